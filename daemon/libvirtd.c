@@ -123,6 +123,8 @@ struct daemonConfig {
     int tls_no_verify_certificate;
     int tls_no_sanity_certificate;
     char **tls_allowed_dn_list;
+    int tls_session_cache_size;
+    int tls_session_cache_timeout;
     char **sasl_allowed_username_list;
 
     char *key_file;
@@ -138,6 +140,7 @@ struct daemonConfig {
 
     int max_requests;
     int max_client_requests;
+    int max_client_events;
 
     int log_level;
     char *log_filters;
@@ -539,6 +542,10 @@ static int daemonSetupNetworking(virNetServerPtr srv,
                     goto error;
             }
 
+            virNetTLSContextSetSessionCache(ctxt,
+                                            config->tls_session_cache_size,
+                                            config->tls_session_cache_timeout);
+
             if (!(svcTLS =
                   virNetServerServiceNewTCP(config->listen_addr,
                                             config->tls_port,
@@ -910,6 +917,9 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->mdns_adv = 1;
 
+    data->tls_session_cache_size = VIR_NET_TLS_SESSION_CACHE_SIZE;
+    data->tls_session_cache_timeout = VIR_NET_TLS_SESSION_CACHE_TIMEOUT;
+
     data->min_workers = 5;
     data->max_workers = 20;
     data->max_clients = 20;
@@ -918,6 +928,7 @@ daemonConfigNew(bool privileged ATTRIBUTE_UNUSED)
 
     data->max_requests = 20;
     data->max_client_requests = 5;
+    data->max_client_events = 200;
 
     data->log_buffer_size = 64;
 
@@ -1066,6 +1077,15 @@ daemonConfigLoad(struct daemonConfig *data,
                                   &data->tls_allowed_dn_list, filename) < 0)
         goto error;
 
+    GET_CONF_INT (conf, filename, tls_session_cache_size);
+    GET_CONF_INT (conf, filename, tls_session_cache_timeout);
+    if (data->tls_session_cache_size < 0 ||
+        data->tls_session_cache_timeout < 0) {
+        VIR_ERROR(_("remoteReadConfigFile: %s: tls_session_cache_size and "
+                    "tls_session_cache_timeout must not be negative"), filename);
+        goto error;
+    }
+
 
     if (remoteConfigGetStringList(conf, "sasl_allowed_username_list",
                                   &data->sasl_allowed_username_list, filename) < 0)
@@ -1080,6 +1100,7 @@ daemonConfigLoad(struct daemonConfig *data,
 
     GET_CONF_INT (conf, filename, max_requests);
     GET_CONF_INT (conf, filename, max_client_requests);
+    GET_CONF_INT (conf, filename, max_client_events);
 
     GET_CONF_INT (conf, filename, audit_level);
     GET_CONF_INT (conf, filename, audit_logging);
@@ -1485,6 +1506,7 @@ int main(int argc, char **argv) {
                                 config->max_workers,
                                 config->prio_workers,
                                 config->max_clients,
+                                config->max_client_events,
                                 config->keepalive_interval,
                                 config->keepalive_count,
                                 !!config->keepalive_required,
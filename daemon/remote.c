@@ -115,6 +115,9 @@ remoteDispatchDomainEventSend(virNetServerClientPtr client,
                               int procnr,
                               xdrproc_t proc,
                               void *data);
+static virNetMessagePtr
+remoteClientEventsLostFunc(virNetServerClientPtr client,
+                           unsigned long long count);
 
 static int remoteRelayDomainEventLifecycle(virConnectPtr conn ATTRIBUTE_UNUSED,
                                            virDomainPtr dom,
@@ -582,6 +585,7 @@ int remoteClientInitHook(virNetServerPtr srv ATTRIBUTE_UNUSED,
     virNetServerClientSetPrivateData(client, priv,
                                      remoteClientFreeFunc);
     virNetServerClientSetCloseHook(client, remoteClientCloseFunc);
+    virNetServerClientSetEventsLostHook(client, remoteClientEventsLostFunc);
     return 0;
 }
 
@@ -2870,17 +2874,16 @@ cleanup:
     return rv;
 }
 
-static void
-remoteDispatchDomainEventSend(virNetServerClientPtr client,
-                              virNetServerProgramPtr program,
-                              int procnr,
-                              xdrproc_t proc,
-                              void *data)
+static virNetMessagePtr
+remoteDomainEventMessageNew(virNetServerProgramPtr program,
+                            int procnr,
+                            xdrproc_t proc,
+                            void *data)
 {
     virNetMessagePtr msg;
 
     if (!(msg = virNetMessageNew(false)))
-        goto cleanup;
+        return NULL;
 
     msg->header.prog = virNetServerProgramGetID(program);
     msg->header.vers = virNetServerProgramGetVersion(program);
@@ -2889,23 +2892,50 @@ remoteDispatchDomainEventSend(virNetServerClientPtr client,
     msg->header.serial = 1;
     msg->header.status = VIR_NET_OK;
 
-    if (virNetMessageEncodeHeader(msg) < 0)
-        goto cleanup;
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg, proc, data) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
 
-    if (virNetMessageEncodePayload(msg, proc, data) < 0)
+static void
+remoteDispatchDomainEventSend(virNetServerClientPtr client,
+                              virNetServerProgramPtr program,
+                              int procnr,
+                              xdrproc_t proc,
+                              void *data)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = remoteDomainEventMessageNew(program, procnr, proc, data)))
         goto cleanup;
 
     VIR_DEBUG("Queue event %d %zu", procnr, msg->bufferLength);
-    virNetServerClientSendMessage(client, msg);
-
-    xdr_free(proc, data);
-    return;
+    if (virNetServerClientSendEvent(client, msg) < 0)
+        virNetMessageFree(msg);
 
 cleanup:
-    virNetMessageFree(msg);
     xdr_free(proc, data);
 }
 
+/* Tells a client that fell behind how many events it missed */
+static virNetMessagePtr
+remoteClientEventsLostFunc(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                           unsigned long long count)
+{
+    remote_domain_events_lost_msg data;
+
+    data.count = count;
+
+    return remoteDomainEventMessageNew(remoteProgram,
+                                       REMOTE_PROC_DOMAIN_EVENTS_LOST,
+                                       (xdrproc_t)xdr_remote_domain_events_lost_msg,
+                                       &data);
+}
+
 static int
 remoteDispatchSecretGetValue(virNetServerPtr server ATTRIBUTE_UNUSED,
                              virNetServerClientPtr client ATTRIBUTE_UNUSED,
@@ -28,6 +28,7 @@
 #include "memory.h"
 #include "logging.h"
 #include "virnetserverclient.h"
+#include "fdstream.h"
 #include "virterror_internal.h"
 
 #define VIR_FROM_THIS VIR_FROM_STREAMS
@@ -285,7 +286,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -555,6 +557,46 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Process a hole in a sparse stream from the client.
+ *
+ * Returns 0 if the hole was skipped, or an RPC error sent back,
+ * -1 upon fatal error
+ */
+static int
+daemonStreamHandleHole(virNetServerClientPtr client,
+                       daemonClientStream *stream,
+                       virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    virNetMessageError rerr;
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d",
+              client, stream, msg->header.proc, msg->header.serial);
+
+    memset(&data, 0, sizeof(data));
+    memset(&rerr, 0, sizeof(rerr));
+
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    if (virStreamSendHole(stream->st, data.length, data.flags) < 0)
+        goto error;
+
+    return 0;
+
+error:
+    VIR_INFO("Stream hole failed");
+    stream->closed = 1;
+    return virNetServerProgramSendReplyError(stream->prog,
+                                             client,
+                                             msg,
+                                             &rerr,
+                                             &msg->header);
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -659,7 +701,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -706,6 +751,11 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
  * worth of data, and then queues that for transmission
  * to the client.
  *
+ * On sockets without TLS or SASL encoding, data waiting
+ * in a pipe is not read at all, but spliced straight into
+ * the socket when the message is transmitted. Otherwise
+ * it is read directly into the message buffer.
+ *
  * Returns 0 if data was queued for TX, or a error RPC
  * was sent, or -1 on fatal error, indicating client should
  * be killed
@@ -714,8 +764,12 @@ static int
 daemonStreamHandleRead(virNetServerClientPtr client,
                        daemonClientStream *stream)
 {
+    virNetMessagePtr msg = NULL;
     char *buffer;
     size_t bufferLen = VIR_NET_MESSAGE_PAYLOAD_MAX;
+    long long holeLen = 0;
+    int spliceFD = -1;
+    size_t spliceLen = 0;
     int ret;
 
     VIR_DEBUG("client=%p, stream=%p tx=%d closed=%d",
@@ -733,50 +787,73 @@ daemonStreamHandleRead(virNetServerClientPtr client,
     if (!stream->tx)
         return 0;
 
-    if (VIR_ALLOC_N(buffer, bufferLen) < 0)
+    if (!(msg = virNetMessageNew(false)))
         return -1;
+    buffer = msg->buffer + VIR_NET_MESSAGE_STREAM_PAYLOAD_OFFSET;
+
+    ret = 0;
+    if (virNetServerClientCanSplice(client))
+        ret = virFDStreamSpliceSource(stream->st, bufferLen,
+                                      &spliceFD, &spliceLen);
+
+    /* Holes are only ever reported by streams opened in sparse
+     * mode, which is what the client asked for */
+    if (ret == 0) {
+        ret = virStreamRecvFlags(stream->st, buffer, bufferLen,
+                                 VIR_STREAM_RECV_STOP_AT_HOLE);
+        if (ret == -3 &&
+            virStreamRecvHole(stream->st, &holeLen, 0) < 0)
+            ret = -1;
+    } else if (ret > 0) {
+        ret = spliceLen;
+    }
 
-    ret = virStreamRecv(stream->st, buffer, bufferLen);
     if (ret == -2) {
         /* Should never get this, since we're only called when we know
          * we're readable, but hey things change... */
+        virNetMessageFree(msg);
         ret = 0;
-    } else if (ret < 0) {
-        virNetMessagePtr msg;
+    } else if (ret == -1) {
         virNetMessageError rerr;
 
         memset(&rerr, 0, sizeof(rerr));
 
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
-        else
-            ret = virNetServerProgramSendStreamError(remoteProgram,
-                                                     client,
-                                                     msg,
-                                                     &rerr,
-                                                     stream->procedure,
-                                                     stream->serial);
+        ret = virNetServerProgramSendStreamError(remoteProgram,
+                                                 client,
+                                                 msg,
+                                                 &rerr,
+                                                 stream->procedure,
+                                                 stream->serial);
     } else {
-        virNetMessagePtr msg;
         stream->tx = 0;
         if (ret == 0)
             stream->recvEOF = 1;
-        if (!(msg = virNetMessageNew(false)))
-            ret = -1;
 
-        if (msg) {
-            msg->cb = daemonStreamMessageFinished;
-            msg->opaque = stream;
-            stream->refs++;
+        msg->cb = daemonStreamMessageFinished;
+        msg->opaque = stream;
+        stream->refs++;
+        if (spliceFD != -1)
+            ret = virNetServerProgramSendStreamSplice(remoteProgram,
+                                                      client,
+                                                      msg,
+                                                      stream->procedure,
+                                                      stream->serial,
+                                                      spliceFD, spliceLen);
+        else if (ret == -3)
+            ret = virNetServerProgramSendStreamHole(remoteProgram,
+                                                    client,
+                                                    msg,
+                                                    stream->procedure,
+                                                    stream->serial,
+                                                    holeLen, 0);
+        else
             ret = virNetServerProgramSendStreamData(remoteProgram,
                                                     client,
                                                     msg,
                                                     stream->procedure,
                                                     stream->serial,
                                                     buffer, ret);
-        }
     }
 
-    VIR_FREE(buffer);
     return ret;
 }
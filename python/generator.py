@@ -458,6 +458,8 @@ skip_function = (
     'virStreamSendAll', # Pure python libvirt-override-virStream.py
     'virStreamRecv', # overridden in libvirt-override-virStream.py
     'virStreamSend', # overridden in libvirt-override-virStream.py
+    'virStreamRecvFlags', # overridden in libvirt-override-virStream.py
+    'virStreamRecvHole', # overridden in libvirt-override-virStream.py
 
     # 'Ref' functions have no use for bindings users.
     "virConnectRef",
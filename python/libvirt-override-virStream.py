@@ -106,6 +106,22 @@
         if ret == None: raise libvirtError ('virStreamRecv() failed')
         return ret
 
+    def recvFlags(self, nbytes, flags = 0):
+        """Like recv, but with VIR_STREAM_RECV_STOP_AT_HOLE in @flags
+        the integer -3 is returned when the stream is positioned at
+        a hole, which recvHole then skips. Otherwise holes are
+        received as zeros."""
+        ret = libvirtmod.virStreamRecvFlags(self._o, nbytes, flags)
+        if ret == None: raise libvirtError ('virStreamRecvFlags() failed')
+        return ret
+
+    def recvHole(self, flags = 0):
+        """Skip the hole the stream is positioned at, returning its
+        length, which is 0 if the stream is not at a hole."""
+        ret = libvirtmod.virStreamRecvHole(self._o, flags)
+        if ret == None: raise libvirtError ('virStreamRecvHole() failed')
+        return ret
+
     def send(self, data):
         """Write a series of bytes to the stream. This method may
         block the calling application for an arbitrary amount
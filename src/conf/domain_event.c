@@ -51,9 +51,21 @@ struct _virDomainEventCallbackList {
 
 struct _virDomainEventQueue {
     unsigned int count;
+    size_t alloc;
     virDomainEventPtr *events;
 };
 
+/* Per-flush index of callbacks by event ID, so that
+ * dispatching an event only visits the callbacks that
+ * are registered for its event ID */
+struct _virDomainEventCallbackIndex {
+    unsigned int count;
+    size_t ncallbacks[VIR_DOMAIN_EVENT_ID_LAST];
+    virDomainEventCallbackPtr *callbacks[VIR_DOMAIN_EVENT_ID_LAST];
+};
+typedef struct _virDomainEventCallbackIndex virDomainEventCallbackIndex;
+typedef virDomainEventCallbackIndex *virDomainEventCallbackIndexPtr;
+
 struct _virDomainEventState {
     /* The list of domain event callbacks */
     virDomainEventCallbackListPtr callbacks;
@@ -334,6 +346,19 @@ virDomainEventCallbackListMarkDeleteID(virConnectPtr conn,
 }
 
 
+static int
+virDomainEventCallbackListMarkDeleteConn(virConnectPtr conn,
+                                         virDomainEventCallbackListPtr cbList)
+{
+    int i;
+    for (i = 0 ; i < cbList->count ; i++) {
+        if (cbList->callbacks[i]->conn == conn)
+            cbList->callbacks[i]->deleted = 1;
+    }
+    return 0;
+}
+
+
 static int
 virDomainEventCallbackListPurgeMarked(virDomainEventCallbackListPtr cbList)
 {
@@ -1062,8 +1087,8 @@ virDomainEventQueuePush(virDomainEventQueuePtr evtQueue,
     }
 
     /* Make space on queue */
-    if (VIR_REALLOC_N(evtQueue->events,
-                      evtQueue->count + 1) < 0) {
+    if (VIR_RESIZE_N(evtQueue->events, evtQueue->alloc,
+                     evtQueue->count, 1) < 0) {
         virReportOOMError();
         return -1;
     }
@@ -1203,26 +1228,89 @@ static int virDomainEventDispatchMatchCallback(virDomainEventPtr event,
 }
 
 
+/**
+ * virDomainEventCallbackIndexBuild:
+ * @idx: the index to fill
+ * @callbacks: the callback list to index
+ *
+ * Group the live callbacks in @callbacks by event ID, releasing
+ * any previous contents of @idx.
+ *
+ * Returns 0 on success, -1 on OOM
+ */
+static int
+virDomainEventCallbackIndexBuild(virDomainEventCallbackIndexPtr idx,
+                                 virDomainEventCallbackListPtr callbacks)
+{
+    size_t alloc[VIR_DOMAIN_EVENT_ID_LAST];
+    int i;
+
+    for (i = 0 ; i < VIR_DOMAIN_EVENT_ID_LAST ; i++) {
+        VIR_FREE(idx->callbacks[i]);
+        idx->ncallbacks[i] = 0;
+        alloc[i] = 0;
+    }
+    idx->count = callbacks->count;
+
+    for (i = 0 ; i < callbacks->count ; i++) {
+        virDomainEventCallbackPtr cb = callbacks->callbacks[i];
+
+        if (cb->deleted ||
+            cb->eventID < 0 || cb->eventID >= VIR_DOMAIN_EVENT_ID_LAST)
+            continue;
+
+        if (VIR_RESIZE_N(idx->callbacks[cb->eventID], alloc[cb->eventID],
+                         idx->ncallbacks[cb->eventID], 1) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        idx->callbacks[cb->eventID][idx->ncallbacks[cb->eventID]++] = cb;
+    }
+
+    return 0;
+}
+
+
+static void
+virDomainEventCallbackIndexClear(virDomainEventCallbackIndexPtr idx)
+{
+    int i;
+
+    for (i = 0 ; i < VIR_DOMAIN_EVENT_ID_LAST ; i++) {
+        VIR_FREE(idx->callbacks[i]);
+        idx->ncallbacks[i] = 0;
+    }
+    idx->count = 0;
+}
+
+
 static void
 virDomainEventDispatch(virDomainEventPtr event,
-                       virDomainEventCallbackListPtr callbacks,
+                       virDomainEventCallbackIndexPtr idx,
                        virDomainEventDispatchFunc dispatch,
                        void *opaque)
 {
     int i;
+    virDomainEventCallbackPtr *callbacks;
+    size_t ncallbacks;
+
+    if (event->eventID < 0 || event->eventID >= VIR_DOMAIN_EVENT_ID_LAST)
+        return;
+
     /* Cache this now, since we may be dropping the lock,
        and have more callbacks added. We're guaranteed not
-       to have any removed */
-    int cbCount = callbacks->count;
+       to have any removed, only marked as deleted */
+    callbacks = idx->callbacks[event->eventID];
+    ncallbacks = idx->ncallbacks[event->eventID];
 
-    for (i = 0 ; i < cbCount ; i++) {
-        if (!virDomainEventDispatchMatchCallback(event, callbacks->callbacks[i]))
+    for (i = 0 ; i < ncallbacks ; i++) {
+        if (!virDomainEventDispatchMatchCallback(event, callbacks[i]))
             continue;
 
-        (*dispatch)(callbacks->callbacks[i]->conn,
+        (*dispatch)(callbacks[i]->conn,
                     event,
-                    callbacks->callbacks[i]->cb,
-                    callbacks->callbacks[i]->opaque,
+                    callbacks[i]->cb,
+                    callbacks[i]->opaque,
                     opaque);
     }
 }
@@ -1234,14 +1322,30 @@ virDomainEventQueueDispatch(virDomainEventQueuePtr queue,
                             virDomainEventDispatchFunc dispatch,
                             void *opaque)
 {
+    virDomainEventCallbackIndex idx;
     int i;
 
+    memset(&idx, 0, sizeof(idx));
+
     for (i = 0 ; i < queue->count ; i++) {
-        virDomainEventDispatch(queue->events[i], callbacks, dispatch, opaque);
+        /* (Re)build the index whenever callbacks were added
+         * while the lock was dropped during dispatch */
+        if ((i == 0 || idx.count != callbacks->count) &&
+            virDomainEventCallbackIndexBuild(&idx, callbacks) < 0) {
+            VIR_WARN("Dropping %u domain events, unable to index callbacks",
+                     queue->count - i);
+            for (; i < queue->count ; i++)
+                virDomainEventFree(queue->events[i]);
+            break;
+        }
+
+        virDomainEventDispatch(queue->events[i], &idx, dispatch, opaque);
         virDomainEventFree(queue->events[i]);
     }
+    virDomainEventCallbackIndexClear(&idx);
     VIR_FREE(queue->events);
     queue->count = 0;
+    queue->alloc = 0;
 }
 
 void
@@ -1293,8 +1397,10 @@ virDomainEventStateFlush(virDomainEventStatePtr state)
     /* Copy the queue, so we're reentrant safe when dispatchFunc drops the
      * driver lock */
     tempQueue.count = state->queue->count;
+    tempQueue.alloc = state->queue->alloc;
     tempQueue.events = state->queue->events;
     state->queue->count = 0;
+    state->queue->alloc = 0;
     state->queue->events = NULL;
     virEventUpdateTimeout(state->timer, -1);
 
@@ -1508,7 +1614,10 @@ virDomainEventStateDeregisterConn(virConnectPtr conn,
 {
     int ret;
     virDomainEventStateLock(state);
-    ret = virDomainEventCallbackListRemoveConn(conn, state->callbacks);
+    if (state->isDispatching)
+        ret = virDomainEventCallbackListMarkDeleteConn(conn, state->callbacks);
+    else
+        ret = virDomainEventCallbackListRemoveConn(conn, state->callbacks);
     virDomainEventStateUnlock(state);
     return ret;
 }
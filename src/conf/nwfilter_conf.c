@@ -2785,6 +2785,9 @@ virNWFilterTriggerVMFilterRebuild(virConnectPtr conn)
             callbackDrvArray[i]->vmFilterRebuild(conn,
                                                  virNWFilterDomainFWUpdateCB,
                                                  &cb);
+
+        /* rules edited in place during the switch over may have failed */
+        err = cb.err;
     }
 
     virHashFree(cb.skipInterfaces);
@@ -612,6 +612,21 @@ typedef int (*virNWFilterRuleRemoveRules)(const char *ifname,
                                           int nruleInstances,
                                           void **_inst);
 
+typedef int (*virNWFilterRuleInsertRules)(const char *ifname,
+                                          int nruleInstances,
+                                          void **_inst,
+                                          int *positions);
+
+typedef int (*virNWFilterRuleDiffRules)(int nOldInst,
+                                        void **_oldInst,
+                                        int nNewInst,
+                                        void **_newInst,
+                                        void ***removed,
+                                        int *nremoved,
+                                        void ***inserted,
+                                        int **positions,
+                                        int *ninserted);
+
 typedef int (*virNWFilterRuleAllTeardown)(const char *ifname);
 
 typedef int (*virNWFilterRuleFreeInstanceData)(void * _inst);
@@ -648,6 +663,8 @@ struct _virNWFilterTechDriver {
     virNWFilterRuleTeardownNewRules tearNewRules;
     virNWFilterRuleTeardownOldRules tearOldRules;
     virNWFilterRuleRemoveRules removeRules;
+    virNWFilterRuleInsertRules insertRules;
+    virNWFilterRuleDiffRules diffRules;
     virNWFilterRuleAllTeardown allTeardown;
     virNWFilterRuleFreeInstanceData freeRuleInstance;
     virNWFilterRuleDisplayInstanceData displayRuleInstance;
@@ -323,6 +323,7 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj) {
         return;
 
     virStoragePoolObjClearVols(obj);
+    virHashFree(obj->probed);
 
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
@@ -1345,6 +1346,7 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+    pool->seqno = 0;
 }
 
 virStorageVolDefPtr
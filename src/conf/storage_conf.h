@@ -28,6 +28,8 @@
 # include "util.h"
 # include "storage_encryption_conf.h"
 # include "threads.h"
+# include "virhash.h"
+# include "threadpool.h"
 
 # include <libxml/tree.h>
 
@@ -91,6 +93,9 @@ struct _virStorageVolDef {
     int type; /* virStorageVolType enum */
 
     unsigned int building;
+    /* still listed while a refresh probes the pool unlocked, to be
+     * replaced with what it finds */
+    bool stale;
 
     unsigned long long allocation;
     unsigned long long capacity;
@@ -286,6 +291,15 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    int watch; /* inotify watch on the target directory, 0 if none */
+    bool watchStale; /* events were missed, volumes need a rescan */
+
+    unsigned long long seqno; /* backend metadata generation the volume
+                               * list was built from, 0 if unknown */
+
+    virHashTablePtr probed; /* directory backends: probe results of the
+                             * last refresh, by volume name */
 };
 
 typedef struct _virStoragePoolObjList virStoragePoolObjList;
@@ -308,6 +322,14 @@ struct _virStorageDriverState {
 
     char *configDir;
     char *autostartDir;
+
+    int inotifyFD;
+    int inotifyWatch;
+    virThreadPoolPtr inotifyWorker; /* updates volumes on watch events */
+
+    /* Volumes of active pools by path, see storage_driver.c */
+    virMutex volPathsLock;
+    virHashTablePtr volPaths;
 };
 
 typedef struct _virStoragePoolSourceList virStoragePoolSourceList;
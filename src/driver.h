@@ -1525,6 +1525,16 @@ typedef int (*virDrvStreamSend)(virStreamPtr st,
 typedef int (*virDrvStreamRecv)(virStreamPtr st,
                                 char *data,
                                 size_t nbytes);
+typedef int (*virDrvStreamRecvFlags)(virStreamPtr st,
+                                     char *data,
+                                     size_t nbytes,
+                                     unsigned int flags);
+typedef int (*virDrvStreamSendHole)(virStreamPtr st,
+                                    long long length,
+                                    unsigned int flags);
+typedef int (*virDrvStreamRecvHole)(virStreamPtr st,
+                                    long long *length,
+                                    unsigned int flags);
 
 typedef int (*virDrvStreamEventAddCallback)(virStreamPtr stream,
                                             int events,
@@ -1547,6 +1557,9 @@ struct _virStreamDriver {
     virDrvStreamEventRemoveCallback streamRemoveCallback;
     virDrvStreamFinish streamFinish;
     virDrvStreamAbort streamAbort;
+    virDrvStreamRecvFlags streamRecvFlags;
+    virDrvStreamSendHole streamSendHole;
+    virDrvStreamRecvHole streamRecvHole;
 };
 
 
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #if HAVE_SYS_UN_H
 # include <sys/un.h>
 #endif
@@ -46,6 +47,8 @@
     virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,              \
                          __FUNCTION__, __LINE__, __VA_ARGS__)
 
+static const char *iohelperPath = LIBEXECDIR "/libvirt_iohelper";
+
 /* Tunnelled migration stream support */
 struct virFDStreamData {
     int fd;
@@ -53,6 +56,17 @@ struct virFDStreamData {
     virCommandPtr cmd;
     unsigned long long offset;
     unsigned long long length;
+    bool sparse;
+    bool pipe;
+
+    /* Sparse streams going through the I/O helper pipe exchange
+     * records, see virFileSparseHeaderEncode */
+    bool records;
+    char header[VIR_FILE_SPARSE_HEADER_LEN];
+    size_t headerLen; /* Bytes of @header read so far */
+    int section; /* Type of the current record, if @sectionLen */
+    unsigned long long sectionLen; /* Bytes left of the current record */
+    unsigned long long holeLen; /* Hole yet to be sent to the helper */
 
     int watch;
     bool cbRemoved;
@@ -224,10 +238,108 @@ cleanup:
 }
 
 
+/*
+ * Make sure a record from the I/O helper is being read, reading
+ * its header if the previous one is used up.
+ *
+ * Returns 1 if there is a record, 0 at end of stream, -2 if the
+ * header is not all there yet, -1 on error
+ */
+static int virFDStreamReadRecord(struct virFDStreamData *fdst)
+{
+    while (fdst->sectionLen == 0) {
+        ssize_t got = read(fdst->fd, fdst->header + fdst->headerLen,
+                           sizeof(fdst->header) - fdst->headerLen);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -2;
+            virReportSystemError(errno, "%s",
+                                 _("cannot read from stream"));
+            return -1;
+        }
+        if (got == 0) {
+            if (fdst->headerLen == 0)
+                return 0;
+            streamsReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                               _("truncated record from I/O helper"));
+            return -1;
+        }
+
+        fdst->headerLen += got;
+        if (fdst->headerLen < sizeof(fdst->header))
+            continue;
+
+        fdst->headerLen = 0;
+        if (virFileSparseHeaderDecode(fdst->header, &fdst->section,
+                                      &fdst->sectionLen) < 0)
+            return -1;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Send a record header to the I/O helper. Headers are shorter than
+ * PIPE_BUF, so they are written entirely or not at all.
+ *
+ * Returns 0 on success, -2 if the pipe is full, -1 on error
+ */
+static int virFDStreamWriteRecord(struct virFDStreamData *fdst,
+                                  int type,
+                                  unsigned long long len)
+{
+    char header[VIR_FILE_SPARSE_HEADER_LEN];
+    ssize_t done;
+
+    virFileSparseHeaderEncode(header, type, len);
+
+retry:
+    done = write(fdst->fd, header, sizeof(header));
+    if (done < 0) {
+        if (errno == EINTR)
+            goto retry;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return -2;
+    }
+    if (done != sizeof(header)) {
+        virReportSystemError(done < 0 ? errno : EIO, "%s",
+                             _("cannot write to stream"));
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Send the hole the I/O helper is owed, if any, before anything
+ * else goes down the pipe.
+ *
+ * Returns 0 on success, -2 if the pipe is full, -1 on error
+ */
+static int virFDStreamFlushHole(struct virFDStreamData *fdst)
+{
+    int rc;
+
+    if (!fdst->holeLen)
+        return 0;
+
+    if ((rc = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_HOLE,
+                                     fdst->holeLen)) < 0)
+        return rc;
+
+    fdst->holeLen = 0;
+    return 0;
+}
+
+
 static int
 virFDStreamClose(virStreamPtr st)
 {
     struct virFDStreamData *fdst = st->privateData;
+    bool holeFailed = false;
     int ret;
 
     VIR_DEBUG("st=%p", st);
@@ -237,7 +349,20 @@ virFDStreamClose(virStreamPtr st)
 
     virMutexLock(&fdst->lock);
 
+    /* A trailing hole may still be owed to the I/O helper */
+    if (fdst->records && fdst->holeLen) {
+        if (virSetBlocking(fdst->fd, true) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to set stream blocking"));
+            holeFailed = true;
+        } else if (virFDStreamFlushHole(fdst) < 0) {
+            holeFailed = true;
+        }
+    }
+
     ret = VIR_CLOSE(fdst->fd);
+    if (holeFailed)
+        ret = -1;
     if (fdst->cmd) {
         char buf[1024];
         ssize_t len;
@@ -317,6 +442,22 @@ static int virFDStreamWrite(virStreamPtr st, const char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->records && nbytes) {
+        /* Start a data record for this buffer, which the following
+         * writes complete if this one falls short */
+        if (fdst->sectionLen == 0) {
+            if ((ret = virFDStreamFlushHole(fdst)) < 0 ||
+                (ret = virFDStreamWriteRecord(fdst, VIR_FILE_SPARSE_DATA,
+                                              nbytes)) < 0) {
+                virMutexUnlock(&fdst->lock);
+                return ret;
+            }
+            fdst->sectionLen = nbytes;
+        }
+        if (fdst->sectionLen < nbytes)
+            nbytes = fdst->sectionLen;
+    }
+
 retry:
     ret = write(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -329,8 +470,11 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot write to stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->records)
+            fdst->sectionLen -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
     virMutexUnlock(&fdst->lock);
@@ -338,11 +482,54 @@ retry:
 }
 
 
-static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+/*
+ * Find out whether the file position of a sparse stream is in a data
+ * or in a hole section, and how many bytes are left of that section,
+ * within the length of the stream.
+ *
+ * Returns 0 on success, -1 on error
+ */
+static int
+virFDStreamSparseSection(struct virFDStreamData *fdst,
+                         bool *inData,
+                         unsigned long long *len)
+{
+    if (virFileInData(fdst->fd, inData, len) < 0)
+        return -1;
+
+    if (fdst->length &&
+        *len > fdst->length - fdst->offset)
+        *len = fdst->length - fdst->offset;
+    return 0;
+}
+
+
+static int virFDStreamSkipHole(struct virFDStreamData *fdst,
+                               unsigned long long len)
+{
+    if (fdst->records) {
+        fdst->sectionLen -= len;
+    } else if (lseek(fdst->fd, len, SEEK_CUR) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to seek in stream"));
+        return -1;
+    }
+    if (fdst->length)
+        fdst->offset += len;
+    return 0;
+}
+
+
+static int virFDStreamReadFlags(virStreamPtr st,
+                                char *bytes,
+                                size_t nbytes,
+                                unsigned int flags)
 {
     struct virFDStreamData *fdst = st->privateData;
     int ret;
 
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     if (nbytes > INT_MAX) {
         virReportSystemError(ERANGE, "%s",
                              _("Too many bytes to read from stream"));
@@ -367,6 +554,40 @@ static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
             nbytes = fdst->length - fdst->offset;
     }
 
+    if (fdst->sparse) {
+        bool inData;
+        unsigned long long len;
+
+        if (fdst->records) {
+            if ((ret = virFDStreamReadRecord(fdst)) <= 0) {
+                virMutexUnlock(&fdst->lock);
+                return ret;
+            }
+            inData = fdst->section == VIR_FILE_SPARSE_DATA;
+            len = fdst->sectionLen;
+        } else if (virFDStreamSparseSection(fdst, &inData, &len) < 0) {
+            virMutexUnlock(&fdst->lock);
+            return -1;
+        }
+
+        if (!inData) {
+            /* Without STOP_AT_HOLE the reader wants the zeros */
+            if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+                ret = -3;
+            } else {
+                if (len < nbytes)
+                    nbytes = len;
+                memset(bytes, 0, nbytes);
+                ret = virFDStreamSkipHole(fdst, nbytes) < 0 ? -1 : nbytes;
+            }
+            virMutexUnlock(&fdst->lock);
+            return ret;
+        }
+
+        if (len < nbytes)
+            nbytes = len;
+    }
+
 retry:
     ret = read(fdst->fd, bytes, nbytes);
     if (ret < 0) {
@@ -379,8 +600,11 @@ retry:
             virReportSystemError(errno, "%s",
                                  _("cannot read from stream"));
         }
-    } else if (fdst->length) {
-        fdst->offset += ret;
+    } else {
+        if (fdst->records)
+            fdst->sectionLen -= ret;
+        if (fdst->length)
+            fdst->offset += ret;
     }
 
     virMutexUnlock(&fdst->lock);
@@ -388,9 +612,121 @@ retry:
 }
 
 
+static int virFDStreamRead(virStreamPtr st, char *bytes, size_t nbytes)
+{
+    return virFDStreamReadFlags(st, bytes, nbytes, 0);
+}
+
+
+static int virFDStreamRecvHole(virStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    bool inData = true;
+    unsigned long long len = 0;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        streamsReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    *length = 0;
+    if (fdst->records) {
+        int rc = virFDStreamReadRecord(fdst);
+
+        if (rc == -1)
+            goto cleanup;
+        if (rc == 1 && fdst->section == VIR_FILE_SPARSE_HOLE) {
+            inData = false;
+            len = fdst->sectionLen;
+        }
+    } else if (fdst->sparse &&
+               virFDStreamSparseSection(fdst, &inData, &len) < 0) {
+        goto cleanup;
+    }
+
+    if (!inData) {
+        if (len > LLONG_MAX)
+            len = LLONG_MAX;
+        if (virFDStreamSkipHole(fdst, len) < 0)
+            goto cleanup;
+        *length = len;
+    }
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
+static int virFDStreamSendHole(virStreamPtr st,
+                               long long length,
+                               unsigned int flags)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    if (!fdst) {
+        streamsReportError(VIR_ERR_INTERNAL_ERROR,
+                           "%s", _("stream is not open"));
+        return -1;
+    }
+
+    virMutexLock(&fdst->lock);
+
+    if (!fdst->sparse) {
+        streamsReportError(VIR_ERR_OPERATION_INVALID,
+                           "%s", _("stream is not sparse"));
+        goto cleanup;
+    }
+
+    if (fdst->length &&
+        length > fdst->length - fdst->offset) {
+        virReportSystemError(ENOSPC, "%s",
+                             _("cannot write to stream"));
+        goto cleanup;
+    }
+
+    if (fdst->records) {
+        /* The hole is sent before the next data record, or when the
+         * stream is closed if the pipe is full now */
+        if (fdst->sectionLen) {
+            streamsReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                               _("cannot send a hole in the middle of data"));
+            goto cleanup;
+        }
+        fdst->holeLen += length;
+        if ((ret = virFDStreamFlushHole(fdst)) == -2)
+            ret = 0;
+    } else {
+        ret = virFileWriteHole(fdst->fd, length);
+    }
+
+    if (ret == 0 && fdst->length)
+        fdst->offset += length;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
 static virStreamDriver virFDStreamDrv = {
     .streamSend = virFDStreamWrite,
     .streamRecv = virFDStreamRead,
+    .streamRecvFlags = virFDStreamReadFlags,
+    .streamSendHole = virFDStreamSendHole,
+    .streamRecvHole = virFDStreamRecvHole,
     .streamFinish = virFDStreamClose,
     .streamAbort = virFDStreamClose,
     .streamAddCallback = virFDStreamAddCallback,
@@ -405,6 +741,7 @@ static int virFDStreamOpenInternal(virStreamPtr st,
                                    unsigned long long length)
 {
     struct virFDStreamData *fdst;
+    struct stat sb;
 
     VIR_DEBUG("st=%p fd=%d cmd=%p errfd=%d length=%llu",
               st, fd, cmd, errfd, length);
@@ -422,6 +759,8 @@ static int virFDStreamOpenInternal(virStreamPtr st,
     fdst->cmd = cmd;
     fdst->errfd = errfd;
     fdst->length = length;
+    if (fstat(fd, &sb) == 0 && S_ISFIFO(sb.st_mode))
+        fdst->pipe = true;
     if (virMutexInit(&fdst->lock) < 0) {
         VIR_FREE(fdst);
         streamsReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -443,6 +782,82 @@ int virFDStreamOpen(virStreamPtr st,
 }
 
 
+/*
+ * Run the I/O helper from @path rather than from where it is
+ * installed, so tests can use the one just built. NULL reverts
+ * to the installed one.
+ */
+void virFDStreamSetIOHelper(const char *path)
+{
+    if (path)
+        iohelperPath = path;
+    else
+        iohelperPath = LIBEXECDIR "/libvirt_iohelper";
+}
+
+
+/*
+ * If @st reads from a pipe, find out how many bytes, at most @max,
+ * are sitting in it so they can be spliced straight out of it rather
+ * than read through virStreamRecv. Those bytes are accounted as read
+ * from the stream; @fd receives a duplicate of the pipe which the
+ * caller must close once the bytes have been moved.
+ *
+ * Returns 1 if @fd and @len were filled in, 0 if the data has to be
+ * read normally, -1 on error
+ */
+int virFDStreamSpliceSource(virStreamPtr st,
+                            size_t max,
+                            int *fd,
+                            size_t *len)
+{
+    struct virFDStreamData *fdst = st->privateData;
+    int avail = 0;
+    int ret = 0;
+
+    *fd = -1;
+    *len = 0;
+
+    if (st->driver != &virFDStreamDrv || !fdst)
+        return 0;
+
+    virMutexLock(&fdst->lock);
+
+    /* Records from the I/O helper must be parsed, not moved whole */
+    if (!fdst->pipe || fdst->records)
+        goto cleanup;
+
+    /* An empty pipe may mean EOF, which virStreamRecv reports */
+    if (ioctl(fdst->fd, FIONREAD, &avail) < 0 || avail <= 0)
+        goto cleanup;
+
+    if ((size_t)avail < max)
+        max = avail;
+    if (fdst->length) {
+        if (fdst->length == fdst->offset)
+            goto cleanup;
+        if ((fdst->length - fdst->offset) < max)
+            max = fdst->length - fdst->offset;
+    }
+
+    if ((*fd = dup(fdst->fd)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to duplicate stream descriptor"));
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (fdst->length)
+        fdst->offset += max;
+    *len = max;
+    ret = 1;
+
+cleanup:
+    virMutexUnlock(&fdst->lock);
+    return ret;
+}
+
+
 #if HAVE_SYS_UN_H
 int virFDStreamConnectUNIX(virStreamPtr st,
                            const char *path,
@@ -509,7 +924,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
                             unsigned long long offset,
                             unsigned long long length,
                             int oflags,
-                            int mode)
+                            int mode,
+                            bool sparse)
 {
     int fd = -1;
     int fds[2] = { -1, -1 };
@@ -517,8 +933,8 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     virCommandPtr cmd = NULL;
     int errfd = -1;
 
-    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o",
-              st, path, oflags, offset, length, mode);
+    VIR_DEBUG("st=%p path=%s oflags=%x offset=%llu length=%llu mode=%o sparse=%d",
+              st, path, oflags, offset, length, mode, sparse);
 
     if (oflags & O_CREAT)
         fd = open(path, oflags, mode);
@@ -550,6 +966,10 @@ virFDStreamOpenFileInternal(virStreamPtr st,
      * non-blocking I/O on block devs/regular files. To
      * support those we need to fork a helper process to do
      * the I/O so we just have a fifo. Or use AIO :-(
+     *
+     * A fifo cannot hold holes, so for sparse streams the
+     * helper finds or creates them and the data travels as
+     * records saying what is data and what is a hole.
      */
     if ((st->flags & VIR_STREAM_NONBLOCK) &&
         (!S_ISCHR(sb.st_mode) &&
@@ -569,9 +989,10 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
         }
 
-        cmd = virCommandNewArgList(LIBEXECDIR "/libvirt_iohelper",
-                                   path,
-                                   NULL);
+        cmd = virCommandNew(iohelperPath);
+        if (sparse)
+            virCommandAddArg(cmd, "--sparse");
+        virCommandAddArg(cmd, path);
         virCommandAddArgFormat(cmd, "%llu", length);
         virCommandTransferFD(cmd, fd);
         virCommandAddArgFormat(cmd, "%d", fd);
@@ -596,6 +1017,12 @@ virFDStreamOpenFileInternal(virStreamPtr st,
     if (virFDStreamOpenInternal(st, fd, cmd, errfd, length) < 0)
         goto error;
 
+    if (sparse && !S_ISCHR(sb.st_mode) && !S_ISFIFO(sb.st_mode)) {
+        struct virFDStreamData *fdst = st->privateData;
+        fdst->sparse = true;
+        fdst->records = cmd != NULL;
+    }
+
     return 0;
 
 error:
@@ -622,7 +1049,24 @@ int virFDStreamOpenFile(virStreamPtr st,
     }
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags, 0);
+                                       oflags, 0, false);
+}
+
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags)
+{
+    if (oflags & O_CREAT) {
+        streamsReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("Attempt to create %s without specifying mode"),
+                           path);
+        return -1;
+    }
+    return virFDStreamOpenFileInternal(st, path,
+                                       offset, length,
+                                       oflags, 0, true);
 }
 
 int virFDStreamCreateFile(virStreamPtr st,
@@ -634,5 +1078,5 @@ int virFDStreamCreateFile(virStreamPtr st,
 {
     return virFDStreamOpenFileInternal(st, path,
                                        offset, length,
-                                       oflags | O_CREAT, mode);
+                                       oflags | O_CREAT, mode, false);
 }
@@ -29,6 +29,13 @@
 int virFDStreamOpen(virStreamPtr st,
                     int fd);
 
+void virFDStreamSetIOHelper(const char *path);
+
+int virFDStreamSpliceSource(virStreamPtr st,
+                            size_t max,
+                            int *fd,
+                            size_t *len);
+
 int virFDStreamConnectUNIX(virStreamPtr st,
                            const char *path,
                            bool abstract);
@@ -38,6 +45,11 @@ int virFDStreamOpenFile(virStreamPtr st,
                         unsigned long long offset,
                         unsigned long long length,
                         int oflags);
+int virFDStreamOpenFileSparse(virStreamPtr st,
+                              const char *path,
+                              unsigned long long offset,
+                              unsigned long long length,
+                              int oflags);
 int virFDStreamCreateFile(virStreamPtr st,
                           const char *path,
                           unsigned long long offset,
@@ -12714,12 +12714,19 @@ error:
  * @stream: stream to use as output
  * @offset: position in @vol to start reading from
  * @length: limit on amount of data to download
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolDownloadFlags
  *
  * Download the content of the volume as a stream. If @length
  * is zero, then the remaining contents of the volume after
  * @offset will be downloaded.
  *
+ * If @flags contains VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM,
+ * holes in the volume are sent as hole descriptors rather than
+ * as runs of zero bytes. A plain virStreamRecv() still sees the
+ * holes as zeros; use virStreamRecvFlags() with
+ * VIR_STREAM_RECV_STOP_AT_HOLE and virStreamRecvHole() to find
+ * out where they are.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -12783,7 +12790,7 @@ error:
  * @stream: stream to use as input
  * @offset: position to start writing to
  * @length: limit on amount of data to upload
- * @flags: extra flags; not used yet, so callers should always pass 0
+ * @flags: bitwise-OR of virStorageVolUploadFlags
  *
  * Upload new content to the volume from a stream. This call
  * will fail if @offset + @length exceeds the size of the
@@ -12791,6 +12798,11 @@ error:
  * will be raised if an attempt is made to upload greater
  * than @length bytes of data.
  *
+ * If @flags contains VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM,
+ * the caller may use virStreamSendHole() to skip over ranges
+ * of the volume, which are then left as holes rather than
+ * written out with zeros.
+ *
  * This call sets up an asynchronous stream; subsequent use of
  * stream APIs is necessary to transfer the actual data,
  * determine how much data is successfully transferred, and
@@ -14938,6 +14950,182 @@ error:
 }
 
 
+/**
+ * virStreamRecvFlags:
+ * @stream: pointer to the stream object
+ * @data: buffer to read into from stream
+ * @nbytes: size of @data buffer
+ * @flags: bitwise-OR of virStreamRecvFlagsValues
+ *
+ * Reads a series of bytes from the stream, just like
+ * virStreamRecv().
+ *
+ * If @flags contains VIR_STREAM_RECV_STOP_AT_HOLE, the read
+ * stops short of any hole in a sparse stream instead of filling
+ * @data with zeros, and if the stream is positioned at a hole
+ * nothing is read at all and -3 is returned. The caller should
+ * then use virStreamRecvHole() to learn the size of the hole.
+ * Streams which were not opened in sparse mode never have holes,
+ * so for them this behaves exactly like virStreamRecv().
+ *
+ * Returns the number of bytes read, 0 at end of stream, -1 upon
+ * error, -2 if the stream is non-blocking and no data is pending,
+ * or -3 if VIR_STREAM_RECV_STOP_AT_HOLE was given and the stream
+ * is positioned at a hole.
+ */
+int virStreamRecvFlags(virStreamPtr stream,
+                       char *data,
+                       size_t nbytes,
+                       unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, data=%p, nbytes=%zi, flags=%x",
+              stream, data, nbytes, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (data == NULL) {
+        virLibConnError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamRecvFlags) {
+        int ret;
+        ret = (stream->driver->streamRecvFlags)(stream, data, nbytes, flags);
+        if (ret == -2 || ret == -3)
+            return ret;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    /* A driver without hole support never produces holes, so a
+     * plain read honours VIR_STREAM_RECV_STOP_AT_HOLE trivially */
+    if (stream->driver &&
+        stream->driver->streamRecv &&
+        (flags & ~VIR_STREAM_RECV_STOP_AT_HOLE) == 0) {
+        int ret;
+        ret = (stream->driver->streamRecv)(stream, data, nbytes);
+        if (ret == -2)
+            return -2;
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamSendHole:
+ * @stream: pointer to the stream object
+ * @length: number of bytes to skip
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Skips @length bytes of a sparse stream, which the receiving
+ * end turns into a hole rather than writing out zeros. This is
+ * only valid on streams opened in sparse mode, for example by
+ * virStorageVolUpload() with VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM.
+ *
+ * Returns 0 on success, -1 upon error, at which time the stream
+ * will be marked as aborted.
+ */
+int virStreamSendHole(virStreamPtr stream,
+                      long long length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%lld, flags=%x", stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (length < 0) {
+        virLibConnError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamSendHole) {
+        int ret;
+        ret = (stream->driver->streamSendHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
+/**
+ * virStreamRecvHole:
+ * @stream: pointer to the stream object
+ * @length: filled with the size of the hole
+ * @flags: extra flags; not used yet, so callers should always pass 0
+ *
+ * Consumes the hole the stream is currently positioned at, as
+ * reported by virStreamRecvFlags() returning -3, and stores its
+ * size in @length. If the stream is not at a hole, @length is
+ * set to zero.
+ *
+ * Returns 0 on success, -1 upon error.
+ */
+int virStreamRecvHole(virStreamPtr stream,
+                      long long *length,
+                      unsigned int flags)
+{
+    VIR_DEBUG("stream=%p, length=%p, flags=%x", stream, length, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STREAM(stream)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (length == NULL) {
+        virLibConnError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        goto error;
+    }
+
+    if (stream->driver &&
+        stream->driver->streamRecvHole) {
+        int ret;
+        ret = (stream->driver->streamRecvHole)(stream, length, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(stream->conn);
+    return -1;
+}
+
+
 /**
  * virStreamSendAll:
  * @stream: pointer to the stream object
@@ -118,6 +118,8 @@ static int networkShutdownNetworkExternal(struct network_driver *driver,
                                         virNetworkObjPtr network);
 
 static void networkReloadIptablesRules(struct network_driver *driver);
+static void networkRemoveIptablesRules(struct network_driver *driver,
+                                       virNetworkObjPtr network);
 
 static struct network_driver *driverState = NULL;
 
@@ -1461,9 +1463,15 @@ networkAddIptablesRules(struct network_driver *driver,
     int ii;
     virNetworkIpDefPtr ipdef;
 
+    /* Apply all rules with a few iptables-restore invocations rather
+     * than running iptables for each of them */
+    iptablesTransactionBegin(driver->iptables);
+
     /* Add "once per network" rules */
-    if (networkAddGeneralIptablesRules(driver, network) < 0)
+    if (networkAddGeneralIptablesRules(driver, network) < 0) {
+        ignore_value(iptablesTransactionCommit(driver->iptables));
         return -1;
+    }
 
     for (ii = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, ii));
@@ -1473,6 +1481,11 @@ networkAddIptablesRules(struct network_driver *driver,
             goto err;
         }
     }
+
+    if (iptablesTransactionCommit(driver->iptables) < 0) {
+        networkRemoveIptablesRules(driver, network);
+        return -1;
+    }
     return 0;
 
 err:
@@ -1485,6 +1498,7 @@ err:
         networkRemoveIpSpecificIptablesRules(driver, network, ipdef);
     }
     networkRemoveGeneralIptablesRules(driver, network);
+    ignore_value(iptablesTransactionCommit(driver->iptables));
     return -1;
 }
 
@@ -1496,12 +1510,16 @@ networkRemoveIptablesRules(struct network_driver *driver,
     int ii;
     virNetworkIpDefPtr ipdef;
 
+    iptablesTransactionBegin(driver->iptables);
+
     for (ii = 0;
          (ipdef = virNetworkDefGetIpByIndex(network->def, AF_UNSPEC, ii));
          ii++) {
         networkRemoveIpSpecificIptablesRules(driver, network, ipdef);
     }
     networkRemoveGeneralIptablesRules(driver, network);
+
+    ignore_value(iptablesTransactionCommit(driver->iptables));
 }
 
 static void
@@ -1511,6 +1529,9 @@ networkReloadIptablesRules(struct network_driver *driver)
 
     VIR_INFO("Reloading iptables rules");
 
+    /* The rules of all networks are applied together at the end */
+    iptablesTransactionBegin(driver->iptables);
+
     for (i = 0 ; i < driver->networks.count ; i++) {
         virNetworkObjPtr network = driver->networks.objs[i];
 
@@ -1529,6 +1550,10 @@ networkReloadIptablesRules(struct network_driver *driver)
         }
         virNetworkObjUnlock(network);
     }
+
+    if (iptablesTransactionCommit(driver->iptables) < 0) {
+        /* failed to add but already logged */
+    }
 }
 
 /* Enable IP Forwarding. Return 0 for success, -1 for failure. */
@@ -1766,7 +1791,7 @@ networkStartNetworkVirtual(struct network_driver *driver,
         }
         if (virNetDevTapCreateInBridgePort(network->def->bridge,
                            &macTapIfName, network->def->mac, 0,
-                           false, NULL, NULL) < 0) {
+                           false, NULL, 0, NULL) < 0) {
             VIR_FREE(macTapIfName);
             goto err0;
         }
@@ -42,6 +42,7 @@
 #include "command.h"
 #include "configmake.h"
 #include "intprops.h"
+#include "c-ctype.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
@@ -83,9 +84,30 @@
 static char *ebtables_cmd_path;
 static char *iptables_cmd_path;
 static char *ip6tables_cmd_path;
+static char *ebtables_restore_cmd_path;
+static char *iptables_restore_cmd_path;
+static char *ip6tables_restore_cmd_path;
+static char *ipset_cmd_path;
 static char *grep_cmd_path;
 static char *gawk_cmd_path;
 
+/* list variables used as IP address of an iptables rule are loaded into
+   an ipset once they have this many entries */
+#define NWFILTER_IPSET_MIN_ENTRIES 2
+
+/* the ipsets of nwfilter: the name of the set holding each list of
+   values, all names that are or may be in use, how many interfaces
+   use each set, and the sets used by the live and by the new chains
+   of each interface */
+static virOnceControl ebiptablesIpsetOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static virMutex ebiptablesIpsetLock;
+static virHashTablePtr ebiptablesIpsetByValues;
+static virHashTablePtr ebiptablesIpsetNames;
+static virHashTablePtr ebiptablesIpsetRefs;
+static virHashTablePtr ebiptablesIpsetsLive;
+static virHashTablePtr ebiptablesIpsetsNew;
+static unsigned int ebiptablesIpsetNextId;
+
 #define PRINT_ROOT_CHAIN(buf, prefix, ifname) \
     snprintf(buf, sizeof(buf), "libvirt-%c-%s", prefix, ifname)
 #define PRINT_CHAIN(buf, prefix, ifname, suffix) \
@@ -176,6 +198,7 @@ static const char *m_physdev_out_str = "-m physdev " PHYSDEV_OUT;
 #define COMMENT_VARNAME "comment"
 
 static int ebtablesRemoveBasicRules(const char *ifname);
+static int ebiptablesExecCLI(virBufferPtr buf, int *status, char **outbuf);
 static int ebiptablesDriverInit(bool privileged);
 static void ebiptablesDriverShutdown(void);
 static int ebtablesCleanAll(const char *ifname);
@@ -402,6 +425,7 @@ ebiptablesRuleInstFree(ebiptablesRuleInstPtr inst)
         return;
 
     VIR_FREE(inst->commandTemplate);
+    VIR_FREE(inst->ipsets);
     VIR_FREE(inst);
 }
 
@@ -865,20 +889,6 @@ iptablesRenameTmpRootChains(virBufferPtr buf,
 }
 
 
-static void
-iptablesInstCommand(virBufferPtr buf,
-                    const char *templ, char cmd, int pos,
-                    int stopOnError)
-{
-    char position[10] = { 0 };
-    if (pos >= 0)
-        snprintf(position, sizeof(position), "%d", pos);
-    virBufferAsprintf(buf, templ, cmd, position);
-    virBufferAsprintf(buf, CMD_SEPARATOR "%s",
-                      CMD_STOPONERR(stopOnError));
-}
-
-
 static int
 iptablesHandleSrcMacAddr(virBufferPtr buf,
                          virNWFilterVarCombIterPtr vars,
@@ -915,6 +925,394 @@ err_exit:
 }
 
 
+static void
+ebiptablesIpsetNameFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    VIR_FREE(payload);
+}
+
+
+static void
+ebiptablesIpsetsFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virHashFree(payload);
+}
+
+
+static void
+ebiptablesIpsetOnceInit(void)
+{
+    if (virMutexInit(&ebiptablesIpsetLock) < 0)
+        return;
+
+    if (!(ebiptablesIpsetByValues = virHashCreate(10,
+                                                  ebiptablesIpsetNameFree)) ||
+        !(ebiptablesIpsetRefs = virHashCreate(10, NULL)) ||
+        !(ebiptablesIpsetsLive = virHashCreate(10, ebiptablesIpsetsFree)) ||
+        !(ebiptablesIpsetsNew = virHashCreate(10, ebiptablesIpsetsFree)) ||
+        !(ebiptablesIpsetNames = virHashCreate(10, NULL))) {
+        virHashFree(ebiptablesIpsetByValues);
+        virHashFree(ebiptablesIpsetRefs);
+        virHashFree(ebiptablesIpsetsLive);
+        virHashFree(ebiptablesIpsetsNew);
+        ebiptablesIpsetByValues = NULL;
+        virMutexDestroy(&ebiptablesIpsetLock);
+    }
+}
+
+
+static bool
+ebiptablesIpsetReady(void)
+{
+    return virOnce(&ebiptablesIpsetOnce, ebiptablesIpsetOnceInit) == 0 &&
+           ebiptablesIpsetNames != NULL;
+}
+
+
+/**
+ * ebiptablesIpsetName:
+ * @val: the values of a list variable
+ * @name: buffer to store the name of the set in
+ * @namelen: the size of the buffer
+ *
+ * Determine the name of the ipset holding the given values. Rules of
+ * all interfaces using the same values share the set, while a set
+ * holding other values never gets the same name, since the set is
+ * created with -exist and would otherwise silently keep its members.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+ebiptablesIpsetName(virNWFilterVarValuePtr val,
+                    char *name, size_t namelen)
+{
+    unsigned int i, n = virNWFilterVarValueGetCardinality(val);
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *values = NULL;
+    char *setname = NULL;
+    const char *known;
+    int ret = -1;
+
+    if (!ebiptablesIpsetReady()) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < n; i++)
+        virBufferAsprintf(&buf, "%s\n",
+                          virNWFilterVarValueGetNthValue(val, i));
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return -1;
+    }
+    if (!(values = virBufferContentAndReset(&buf)) &&
+        !(values = strdup(""))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virMutexLock(&ebiptablesIpsetLock);
+
+    if (!(known = virHashLookup(ebiptablesIpsetByValues, values))) {
+        /* skip the names of sets found when starting up, which may
+           hold any values */
+        do {
+            VIR_FREE(setname);
+            if (virAsprintf(&setname, NWFILTER_IPSET_PREFIX "%u",
+                            ebiptablesIpsetNextId++) < 0) {
+                virReportOOMError();
+                goto cleanup;
+            }
+        } while (virHashLookup(ebiptablesIpsetNames, setname));
+
+        if (virHashAddEntry(ebiptablesIpsetNames, setname, (void *)1) < 0 ||
+            virHashAddEntry(ebiptablesIpsetByValues, values, setname) < 0)
+            goto cleanup;
+        known = setname;
+        setname = NULL;
+    }
+
+    if (!virStrcpy(name, known, namelen)) {
+        virNWFilterReportError(VIR_ERR_INTERNAL_ERROR,
+                               _("ipset name '%s' exceeds %zu characters"),
+                               known, namelen - 1);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&ebiptablesIpsetLock);
+    VIR_FREE(setname);
+    VIR_FREE(values);
+    return ret;
+}
+
+
+/*
+ * Reserve the names of the ipsets of nwfilter that exist already, e.g.
+ * since an earlier run of the daemon, so that no set holding other
+ * values gets any of these names, and destroy those no rule uses.
+ */
+static void
+ebiptablesIpsetReserveExisting(void)
+{
+    virCommandPtr cmd;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *output = NULL;
+    char *line, *next;
+    int cli_status;
+
+    if (!ebiptablesIpsetReady())
+        return;
+
+    cmd = virCommandNewArgList(ipset_cmd_path, "list", "-n", NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+    if (virCommandRun(cmd, NULL) < 0) {
+        VIR_WARN("Cannot list the existing ipsets");
+        virResetLastError();
+        goto cleanup;
+    }
+
+    virMutexLock(&ebiptablesIpsetLock);
+    for (line = output; line && *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+        else
+            next = line + strlen(line);
+
+        if (!STRPREFIX(line, NWFILTER_IPSET_PREFIX) ||
+            virHashLookup(ebiptablesIpsetNames, line))
+            continue;
+        if (virHashAddEntry(ebiptablesIpsetNames, line, (void *)1) < 0) {
+            virResetLastError();
+            break;
+        }
+        virBufferAsprintf(&buf, "%s destroy %s 2>/dev/null" CMD_SEPARATOR,
+                          ipset_cmd_path, line);
+    }
+
+    /* No interface is known to use these sets, so this is the only
+       chance to get rid of those left behind by interfaces that went
+       away; ipset refuses to destroy sets still in use by rules */
+    ebiptablesExecCLI(&buf, &cli_status, NULL);
+
+    virMutexUnlock(&ebiptablesIpsetLock);
+
+cleanup:
+    virCommandFree(cmd);
+    VIR_FREE(output);
+}
+
+
+/**
+ * ebiptablesIpsetAddDef:
+ * @buf: the buffer holding the input for ipset restore
+ * @val: the values of a list variable
+ *
+ * Add the lines for ipset restore creating and filling the set for the
+ * values of a list variable to the buffer.
+ *
+ * Returns 1 if the set was added, 0 if the values cannot be put into a
+ * set of IP addresses, -1 on error.
+ */
+int
+ebiptablesIpsetAddDef(virBufferPtr buf,
+                      virNWFilterVarValuePtr val)
+{
+    unsigned int i, n = virNWFilterVarValueGetCardinality(val);
+    char name[NWFILTER_IPSET_NAME_LEN];
+    virSocketAddr addr;
+    int family = AF_UNSPEC;
+    const char *value;
+
+    for (i = 0; i < n; i++) {
+        value = virNWFilterVarValueGetNthValue(val, i);
+        if (virSocketAddrParse(&addr, value, AF_UNSPEC) < 0) {
+            virResetLastError();
+            return 0;
+        }
+        if (family != AF_UNSPEC &&
+            !VIR_SOCKET_ADDR_IS_FAMILY(&addr, family))
+            return 0;
+        family = VIR_SOCKET_ADDR_FAMILY(&addr);
+    }
+
+    if (ebiptablesIpsetName(val, name, sizeof(name)) < 0)
+        return -1;
+
+    virBufferAsprintf(buf, "create %s hash:ip family %s\n",
+                      name, family == AF_INET6 ? "inet6" : "inet");
+    for (i = 0; i < n; i++)
+        virBufferAsprintf(buf, "add %s %s\n",
+                          name, virNWFilterVarValueGetNthValue(val, i));
+
+    return 1;
+}
+
+
+static ipHdrDataDefPtr
+iptablesRuleGetIpHdr(virNWFilterRuleDefPtr rule)
+{
+    switch (rule->prtclType) {
+    case VIR_NWFILTER_RULE_PROTOCOL_TCP:
+    case VIR_NWFILTER_RULE_PROTOCOL_TCPoIPV6:
+        return &rule->p.tcpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDP:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPoIPV6:
+        return &rule->p.udpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITE:
+    case VIR_NWFILTER_RULE_PROTOCOL_UDPLITEoIPV6:
+        return &rule->p.udpliteHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ESP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ESPoIPV6:
+        return &rule->p.espHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_AH:
+    case VIR_NWFILTER_RULE_PROTOCOL_AHoIPV6:
+        return &rule->p.ahHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTP:
+    case VIR_NWFILTER_RULE_PROTOCOL_SCTPoIPV6:
+        return &rule->p.sctpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMP:
+    case VIR_NWFILTER_RULE_PROTOCOL_ICMPV6:
+        return &rule->p.icmpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_IGMP:
+        return &rule->p.igmpHdrFilter.ipHdr;
+    case VIR_NWFILTER_RULE_PROTOCOL_ALL:
+    case VIR_NWFILTER_RULE_PROTOCOL_ALLoIPV6:
+        return &rule->p.allHdrFilter.ipHdr;
+    default:
+        return NULL;
+    }
+}
+
+
+static bool
+iptablesItemUsesVar(nwItemDescPtr item,
+                    virNWFilterVarAccessPtr varAccess)
+{
+    return (item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) &&
+           item->varAccess == varAccess;
+}
+
+
+/**
+ * iptablesIpsetForVarAccess:
+ * @rule: the rule
+ * @ipHdr: the IP header data of the rule
+ * @vars: the variables of the filter
+ * @varAccess: the variable access to check
+ * @ipsets: buffer to add the definition of the set to
+ *
+ * A list variable that the rule uses as its source or destination IP
+ * address, and for nothing else, is matched through an ipset instead of
+ * instantiating the rule once for every value of the list. Variables
+ * iterated in parallel with other variables keep being expanded.
+ *
+ * Returns 1 if the variable is backed by an ipset, 0 if it is not.
+ */
+static int
+iptablesIpsetForVarAccess(virNWFilterRuleDefPtr rule,
+                          ipHdrDataDefPtr ipHdr,
+                          virNWFilterHashTablePtr vars,
+                          virNWFilterVarAccessPtr varAccess,
+                          virBufferPtr ipsets)
+{
+    int i, nuses = 0;
+    unsigned int iterId;
+    virNWFilterVarValuePtr val;
+    nwItemDescPtr other[] = {
+        &ipHdr->dataSrcIPMask, &ipHdr->dataDstIPMask,
+        &ipHdr->dataProtocolID, &ipHdr->dataSrcIPFrom, &ipHdr->dataSrcIPTo,
+        &ipHdr->dataDstIPFrom, &ipHdr->dataDstIPTo, &ipHdr->dataDSCP,
+        &ipHdr->dataState, &ipHdr->dataConnlimitAbove, &ipHdr->dataComment,
+    };
+
+    if (virNWFilterVarAccessGetType(varAccess) !=
+        VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+        return 0;
+
+    iterId = virNWFilterVarAccessGetIterId(varAccess);
+    for (i = 0; i < rule->nVarAccess; i++) {
+        if (rule->varAccess[i] != varAccess &&
+            virNWFilterVarAccessGetType(rule->varAccess[i]) ==
+                VIR_NWFILTER_VAR_ACCESS_ITERATOR &&
+            virNWFilterVarAccessGetIterId(rule->varAccess[i]) == iterId)
+            return 0;
+    }
+
+    if (iptablesItemUsesVar(&ipHdr->dataSrcIPAddr, varAccess)) {
+        if (HAS_ENTRY_ITEM(&ipHdr->dataSrcIPMask))
+            return 0;
+        nuses++;
+    }
+    if (iptablesItemUsesVar(&ipHdr->dataDstIPAddr, varAccess)) {
+        if (HAS_ENTRY_ITEM(&ipHdr->dataDstIPMask))
+            return 0;
+        nuses++;
+    }
+    if (nuses != 1)
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(other); i++) {
+        if (iptablesItemUsesVar(other[i], varAccess))
+            return 0;
+    }
+
+    val = virHashLookup(vars->hashTable,
+                        virNWFilterVarAccessGetVarName(varAccess));
+    if (!val ||
+        virNWFilterVarValueGetCardinality(val) < NWFILTER_IPSET_MIN_ENTRIES)
+        return 0;
+
+    return ebiptablesIpsetAddDef(ipsets, val);
+}
+
+
+/*
+ * Whether the IP address item is backed by an ipset, which is the case
+ * for a list variable that is not iterated over. Store the set's name.
+ *
+ * Returns 1 if it is, 0 if it is not, -1 on error.
+ */
+static int
+iptablesItemIpset(virNWFilterVarCombIterPtr vars,
+                  nwItemDescPtr item,
+                  char *name, size_t namelen)
+{
+    unsigned int i, j, iterId;
+    const char *varName;
+    virNWFilterVarValuePtr val;
+
+    if (!(item->flags & NWFILTER_ENTRY_ITEM_FLAG_HAS_VAR) ||
+        virNWFilterVarAccessGetType(item->varAccess) !=
+            VIR_NWFILTER_VAR_ACCESS_ITERATOR)
+        return 0;
+
+    iterId = virNWFilterVarAccessGetIterId(item->varAccess);
+    varName = virNWFilterVarAccessGetVarName(item->varAccess);
+
+    for (i = 0; i < vars->nIter; i++) {
+        if (vars->iter[i].iterId != iterId)
+            continue;
+        for (j = 0; j < vars->iter[i].nVarNames; j++) {
+            if (STREQ(vars->iter[i].varNames[j], varName))
+                return 0;
+        }
+    }
+
+    if (!(val = virHashLookup(vars->hashTable->hashTable, varName)))
+        return 0;
+
+    if (ebiptablesIpsetName(val, name, namelen) < 0)
+        return -1;
+
+    return 1;
+}
+
+
 static int
 iptablesHandleIpHdr(virBufferPtr buf,
                     virBufferPtr afterStateMatch,
@@ -931,14 +1329,35 @@ iptablesHandleIpHdr(virBufferPtr buf,
     const char *dst = "--destination";
     const char *srcrange = "--src-range";
     const char *dstrange = "--dst-range";
+    const char *srcset = "src";
+    const char *dstset = "dst";
+    char ipset[NWFILTER_IPSET_NAME_LEN];
+    int useIpset;
+
     if (directionIn) {
         src = "--destination";
         dst = "--source";
         srcrange = "--dst-range";
         dstrange = "--src-range";
+        srcset = "dst";
+        dstset = "src";
     }
 
-    if (HAS_ENTRY_ITEM(&ipHdr->dataSrcIPAddr)) {
+    useIpset = HAS_ENTRY_ITEM(&ipHdr->dataSrcIPAddr)
+               ? iptablesItemIpset(vars, &ipHdr->dataSrcIPAddr,
+                                   ipset, sizeof(ipset))
+               : 0;
+    if (useIpset < 0)
+        goto err_exit;
+
+    if (useIpset) {
+
+        virBufferAsprintf(buf,
+                          " -m set %s --match-set %s %s",
+                          ENTRY_GET_NEG_SIGN(&ipHdr->dataSrcIPAddr),
+                          ipset,
+                          srcset);
+    } else if (HAS_ENTRY_ITEM(&ipHdr->dataSrcIPAddr)) {
 
         if (printDataType(vars,
                           ipaddr, sizeof(ipaddr),
@@ -988,7 +1407,21 @@ iptablesHandleIpHdr(virBufferPtr buf,
         }
     }
 
-    if (HAS_ENTRY_ITEM(&ipHdr->dataDstIPAddr)) {
+    useIpset = HAS_ENTRY_ITEM(&ipHdr->dataDstIPAddr)
+               ? iptablesItemIpset(vars, &ipHdr->dataDstIPAddr,
+                                   ipset, sizeof(ipset))
+               : 0;
+    if (useIpset < 0)
+        goto err_exit;
+
+    if (useIpset) {
+
+        virBufferAsprintf(buf,
+                          " -m set %s --match-set %s %s",
+                          ENTRY_GET_NEG_SIGN(&ipHdr->dataDstIPAddr),
+                          ipset,
+                          dstset);
+    } else if (HAS_ENTRY_ITEM(&ipHdr->dataDstIPAddr)) {
 
         if (printDataType(vars,
                           ipaddr, sizeof(ipaddr),
@@ -2627,16 +3060,51 @@ ebiptablesCreateRuleInstanceIterate(
                              virNWFilterRuleInstPtr res)
 {
     int rc = 0;
+    int i, first = res->ndata;
     virNWFilterVarCombIterPtr vciter;
+    virNWFilterVarAccessPtr *varAccess = rule->varAccess;
+    size_t nVarAccess = rule->nVarAccess;
+    ipHdrDataDefPtr ipHdr;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *ipsets = NULL;
+
+    /* list variables matched through ipsets are not iterated over */
+    if (ipset_cmd_path && rule->nVarAccess > 0 &&
+        (ipHdr = iptablesRuleGetIpHdr(rule)) != NULL) {
+        if (VIR_ALLOC_N(varAccess, rule->nVarAccess) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        nVarAccess = 0;
+        for (i = 0; i < rule->nVarAccess; i++) {
+            rc = iptablesIpsetForVarAccess(rule, ipHdr, vars,
+                                           rule->varAccess[i], &buf);
+            if (rc < 0) {
+                virBufferFreeAndReset(&buf);
+                goto cleanup;
+            }
+            if (rc == 0)
+                varAccess[nVarAccess++] = rule->varAccess[i];
+        }
+        rc = 0;
+        if (virBufferError(&buf)) {
+            virReportOOMError();
+            rc = -1;
+            goto cleanup;
+        }
+        ipsets = virBufferContentAndReset(&buf);
+    }
 
     /* rule->vars holds all the variables names that this rule will access.
      * iterate over all combinations of the variables' values and instantiate
      * the filtering rule with each combination.
      */
     vciter = virNWFilterVarCombIterCreate(vars,
-                                          rule->varAccess, rule->nVarAccess);
-    if (!vciter)
-        return -1;
+                                          varAccess, nVarAccess);
+    if (!vciter) {
+        rc = -1;
+        goto cleanup;
+    }
 
     do {
         rc = ebiptablesCreateRuleInstance(nettype,
@@ -2652,9 +3120,24 @@ ebiptablesCreateRuleInstanceIterate(
 
     virNWFilterVarCombIterFree(vciter);
 
+    /* the rules need the sets to be loaded before they are applied */
+    for (i = first; rc == 0 && ipsets && i < res->ndata; i++) {
+        ebiptablesRuleInstPtr inst = res->data[i];
+        if (!(inst->ipsets = strdup(ipsets))) {
+            virReportOOMError();
+            rc = -1;
+        }
+    }
+
+cleanup:
+    if (varAccess != rule->varAccess)
+        VIR_FREE(varAccess);
+    VIR_FREE(ipsets);
+
     return rc;
 }
 
+
 static int
 ebiptablesFreeRuleInstance(void *_inst)
 {
@@ -2726,32 +3209,339 @@ ebiptablesExecCLI(virBufferPtr buf,
 }
 
 
+/*
+ * Parse the shell word at *p the way /bin/sh would. Rule templates
+ * quote with single and double quotes and only ever reference the
+ * comment variable, whose value is passed in @comment.
+ *
+ * Returns 0 on success, -1 on shell syntax the templates don't use.
+ */
 static int
-ebtablesCreateTmpRootChain(virBufferPtr buf,
-                           int incoming, const char *ifname,
-                           int stopOnError)
+ebiptablesParseShellWord(const char **p,
+                         const char *comment,
+                         virBufferPtr word)
 {
-    char chain[MAX_CHAINNAME_LENGTH];
-    char chainPrefix = (incoming) ? CHAINPREFIX_HOST_IN_TEMP
-                                  : CHAINPREFIX_HOST_OUT_TEMP;
+    const char *s = *p;
+    size_t len = strlen(COMMENT_VARNAME);
+    bool dquote = false;
+
+    while (*s && (dquote || !c_isspace(*s))) {
+        switch (*s) {
+        case '\'':
+            if (dquote) {
+                virBufferAddChar(word, *s++);
+                break;
+            }
+            for (s++; *s && *s != '\''; s++)
+                virBufferAddChar(word, *s);
+            if (*s++ != '\'')
+                return -1;
+            break;
 
-    PRINT_ROOT_CHAIN(chain, chainPrefix, ifname);
+        case '"':
+            dquote = !dquote;
+            s++;
+            break;
 
-    virBufferAsprintf(buf,
-                      CMD_DEF("$EBT -t nat -N %s") CMD_SEPARATOR
-                      CMD_EXEC
-                      "%s",
-                      chain,
-                      CMD_STOPONERR(stopOnError));
+        case '\\':
+            s++;
+            if (!*s)
+                return -1;
+            if (dquote && !strchr("$`\"\\", *s))
+                virBufferAddChar(word, '\\');
+            virBufferAddChar(word, *s++);
+            break;
+
+        case '$':
+            s++;
+            if (*s == '{' && STREQLEN(s + 1, COMMENT_VARNAME, len) &&
+                s[len + 1] == '}') {
+                s += len + 2;
+            } else if (STREQLEN(s, COMMENT_VARNAME, len) &&
+                       !c_isalnum(s[len]) && s[len] != '_') {
+                s += len;
+            } else {
+                return -1;
+            }
+            if (!comment)
+                return -1;
+            virBufferAdd(word, comment, -1);
+            break;
+
+        case '`':
+            return -1;
+
+        default:
+            virBufferAddChar(word, *s++);
+        }
+    }
+
+    if (dquote)
+        return -1;
 
+    *p = s;
     return 0;
 }
 
 
-static int
-ebtablesLinkTmpRootChain(virBufferPtr buf,
-                         int incoming, const char *ifname,
-                         int stopOnError)
+/*
+ * Add an argument to a line of *tables-restore input, quoting it if
+ * it is empty or contains characters other than those of options,
+ * chain names, addresses etc.
+ */
+static void
+ebiptablesRestoreAddArg(virBufferPtr buf, const char *arg)
+{
+    const char *plain = "abcdefghijklmnopqrstuvwxyz"
+                        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                        "0123456789_.:/,!=+-";
+
+    if (*arg && arg[strspn(arg, plain)] == '\0') {
+        virBufferAdd(buf, arg, -1);
+        return;
+    }
+
+    virBufferAddChar(buf, '"');
+    for (; *arg; arg++) {
+        if (*arg == '"' || *arg == '\\')
+            virBufferAddChar(buf, '\\');
+        virBufferAddChar(buf, *arg);
+    }
+    virBufferAddChar(buf, '"');
+}
+
+
+/**
+ * ebiptablesTemplateToRestoreLine:
+ * @buf: the buffer holding the input for the *tables-restore tool
+ * @templ: the command template of the rule
+ * @cmd: the command, i.e., 'A' or 'I'
+ * @pos: the position for 'I', or -1
+ *
+ * Rule templates are shell code that assigns the rule's command line
+ * and possibly its comment to shell variables. Add the arguments of
+ * the command, less the tool and the table, as a line in the format of
+ * the *tables-restore tools to @buf.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+ebiptablesTemplateToRestoreLine(virBufferPtr buf,
+                                const char *templ,
+                                char cmd, int pos)
+{
+    char position[10] = { 0 };
+    virBuffer word = VIR_BUFFER_INITIALIZER;
+    char *script = NULL;
+    char *comment = NULL;
+    char *cmdline = NULL;
+    char *arg;
+    const char *p;
+    int nargs = 0;
+    int ret = -1;
+
+    if (pos >= 0)
+        snprintf(position, sizeof(position), "%d", pos);
+    if (virAsprintf(&script, templ, cmd, position) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    /* pick the assignments of the comment and the command */
+    for (p = script; *p; p++) {
+        if (STRPREFIX(p, COMMENT_VARNAME "=") && !comment) {
+            p += strlen(COMMENT_VARNAME "=");
+            if (ebiptablesParseShellWord(&p, NULL, &word) < 0)
+                goto syntax_error;
+            if (virBufferError(&word))
+                goto no_memory;
+            if (!(comment = virBufferContentAndReset(&word)) &&
+                !(comment = strdup("")))
+                goto no_memory;
+        } else if (STRPREFIX(p, CMD_DEF_PRE) && !cmdline) {
+            p += strlen(CMD_DEF_PRE) - 1;
+            if (ebiptablesParseShellWord(&p, NULL, &word) < 0)
+                goto syntax_error;
+            if (virBufferError(&word) ||
+                !(cmdline = virBufferContentAndReset(&word)))
+                goto no_memory;
+        } else if (STRPREFIX(p, CMD_DEF_PRE) ||
+                   STRPREFIX(p, COMMENT_VARNAME "=")) {
+            /* only templates of a single rule can be batched */
+            goto syntax_error;
+        }
+
+        if (!(p = strchr(p, '\n')))
+            break;
+    }
+
+    if (!cmdline)
+        goto syntax_error;
+
+    if (!STRPREFIX(cmdline, "$EBT ") && !STRPREFIX(cmdline, "$IPT "))
+        goto syntax_error;
+    p = cmdline + strlen("$IPT ");
+
+    while (*p) {
+        if (c_isspace(*p)) {
+            p++;
+            continue;
+        }
+        if (ebiptablesParseShellWord(&p, comment, &word) < 0)
+            goto syntax_error;
+        if (virBufferError(&word))
+            goto no_memory;
+        arg = virBufferContentAndReset(&word);
+
+        /* the table is given in the header of the restore input */
+        if (nargs == 0 && STREQ_NULLABLE(arg, "-t")) {
+            VIR_FREE(arg);
+            while (c_isspace(*p))
+                p++;
+            if (ebiptablesParseShellWord(&p, comment, &word) < 0)
+                goto syntax_error;
+            virBufferFreeAndReset(&word);
+            continue;
+        }
+
+        if (nargs++)
+            virBufferAddChar(buf, ' ');
+        ebiptablesRestoreAddArg(buf, arg ? arg : "");
+        VIR_FREE(arg);
+    }
+    virBufferAddChar(buf, '\n');
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&word);
+    VIR_FREE(script);
+    VIR_FREE(comment);
+    VIR_FREE(cmdline);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+
+syntax_error:
+    virNWFilterReportError(VIR_ERR_INTERNAL_ERROR,
+                           _("cannot batch rule '%s'"), templ);
+    goto cleanup;
+}
+
+
+/**
+ * ebiptablesExecRestore:
+ * @restore_path: path of the *tables-restore tool
+ * @restore: the buffer holding the rules in the tool's input format
+ * @ipsets: NULL or the input for ipset restore defining the sets used
+ *          by the rules
+ * @errmsg: pointer to store the tool's error output in
+ *
+ * Apply the rules in @restore in one operation, adding them to the
+ * existing rules of the table. The ipsets are loaded right before,
+ * without letting other commands run in between that could remove
+ * them as unused.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+ebiptablesExecRestore(const char *restore_path,
+                      virBufferPtr restore,
+                      const char *ipsets,
+                      char **errmsg)
+{
+    virCommandPtr cmd = NULL;
+    char *input = NULL;
+    char *errbuf = NULL;
+    int status;
+    int ret = -1;
+
+    if (virBufferError(restore)) {
+        virBufferFreeAndReset(restore);
+        virReportOOMError();
+        return -1;
+    }
+    input = virBufferContentAndReset(restore);
+
+    virMutexLock(&execCLIMutex);
+
+    if (ipsets) {
+        cmd = virCommandNewArgList(ipset_cmd_path, "-exist", "restore", NULL);
+        virCommandSetInputBuffer(cmd, ipsets);
+        virCommandSetErrorBuffer(cmd, &errbuf);
+
+        if (virCommandRun(cmd, &status) < 0)
+            goto cleanup;
+
+        if (status != 0) {
+            VIR_FREE(*errmsg);
+            if (virAsprintf(errmsg,
+                            "Failure to execute command '%s -exist restore'"
+                            " : '%s'.",
+                            ipset_cmd_path, NULLSTR(errbuf)) < 0)
+                virReportOOMError();
+            goto cleanup;
+        }
+
+        virCommandFree(cmd);
+        VIR_FREE(errbuf);
+    }
+
+    cmd = virCommandNewArgList(restore_path, "--noflush", NULL);
+    virCommandSetInputBuffer(cmd, input);
+    virCommandSetErrorBuffer(cmd, &errbuf);
+
+    if (virCommandRun(cmd, &status) < 0)
+        goto cleanup;
+
+    if (status != 0) {
+        VIR_FREE(*errmsg);
+        if (virAsprintf(errmsg,
+                        "Failure to execute command '%s --noflush' : '%s'.",
+                        restore_path, NULLSTR(errbuf)) < 0)
+            virReportOOMError();
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&execCLIMutex);
+    virCommandFree(cmd);
+    VIR_FREE(input);
+    VIR_FREE(errbuf);
+    return ret;
+}
+
+
+static int
+ebtablesCreateTmpRootChain(virBufferPtr buf,
+                           int incoming, const char *ifname,
+                           int stopOnError)
+{
+    char chain[MAX_CHAINNAME_LENGTH];
+    char chainPrefix = (incoming) ? CHAINPREFIX_HOST_IN_TEMP
+                                  : CHAINPREFIX_HOST_OUT_TEMP;
+
+    PRINT_ROOT_CHAIN(chain, chainPrefix, ifname);
+
+    virBufferAsprintf(buf,
+                      CMD_DEF("$EBT -t nat -N %s") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s",
+                      chain,
+                      CMD_STOPONERR(stopOnError));
+
+    return 0;
+}
+
+
+static int
+ebtablesLinkTmpRootChain(virBufferPtr buf,
+                         int incoming, const char *ifname,
+                         int stopOnError)
 {
     char chain[MAX_CHAINNAME_LENGTH];
     char chainPrefix = (incoming) ? CHAINPREFIX_HOST_IN_TEMP
@@ -2862,7 +3652,8 @@ ebtablesUnlinkTmpRootChain(virBufferPtr buf,
 
 
 static int
-ebtablesCreateTmpSubChain(ebiptablesRuleInstPtr *inst,
+ebtablesCreateTmpSubChain(virBufferPtr buf,
+                          ebiptablesRuleInstPtr *inst,
                           int *nRuleInstances,
                           int incoming,
                           const char *ifname,
@@ -2871,7 +3662,7 @@ ebtablesCreateTmpSubChain(ebiptablesRuleInstPtr *inst,
                           int stopOnError,
                           virNWFilterChainPriority priority)
 {
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer jump = VIR_BUFFER_INITIALIZER;
     ebiptablesRuleInstPtr tmp = *inst;
     size_t count = *nRuleInstances;
     char rootchain[MAX_CHAINNAME_LENGTH], chain[MAX_CHAINNAME_LENGTH];
@@ -2900,35 +3691,33 @@ ebtablesCreateTmpSubChain(ebiptablesRuleInstPtr *inst,
         return -1;
     }
 
-    virBufferAsprintf(&buf,
+    /* the chain is created right away, while the rule jumping into it
+       is added to the root chain along with the other rules */
+    virBufferAsprintf(buf,
                       CMD_DEF("$EBT -t nat -F %s") CMD_SEPARATOR
                       CMD_EXEC
                       CMD_DEF("$EBT -t nat -X %s") CMD_SEPARATOR
                       CMD_EXEC
                       CMD_DEF("$EBT -t nat -N %s") CMD_SEPARATOR
                       CMD_EXEC
-                      "%s"
-                      CMD_DEF("$EBT -t nat -%%c %s %%s %s-j %s")
-                          CMD_SEPARATOR
-                      CMD_EXEC
                       "%s",
-
                       chain,
                       chain,
                       chain,
-
-                      CMD_STOPONERR(stopOnError),
-
-                      rootchain, protostr, chain,
-
                       CMD_STOPONERR(stopOnError));
 
+    virBufferAsprintf(&jump,
+                      CMD_DEF("$EBT -t nat -%%c %s %%s %s-j %s")
+                          CMD_SEPARATOR
+                      CMD_EXEC,
+                      rootchain, protostr, chain);
+
     VIR_FREE(protostr);
 
-    if (virBufferError(&buf) ||
+    if (virBufferError(&jump) ||
         VIR_EXPAND_N(tmp, count, 1) < 0) {
         virReportOOMError();
-        virBufferFreeAndReset(&buf);
+        virBufferFreeAndReset(&jump);
         return -1;
     }
 
@@ -2937,7 +3726,7 @@ ebtablesCreateTmpSubChain(ebiptablesRuleInstPtr *inst,
 
     tmp[*nRuleInstances - 1].priority = priority;
     tmp[*nRuleInstances - 1].commandTemplate =
-        virBufferContentAndReset(&buf);
+        virBufferContentAndReset(&jump);
     tmp[*nRuleInstances - 1].neededProtocolChain =
         virNWFilterChainSuffixTypeToString(VIR_NWFILTER_CHAINSUFFIX_ROOT);
 
@@ -3088,6 +3877,341 @@ ebiptablesInstCommand(virBufferPtr buf,
 }
 
 
+/**
+ * ebiptablesCollectIpsets:
+ * @nruleInstances: the number of rules
+ * @inst: array of rule instantiation data
+ * @ruleType: the type of the rules whose sets are to be loaded
+ * @content: pointer to store the input for ipset restore in
+ *
+ * Collect the definitions of the ipsets used by the rules of the given
+ * type; NULL is stored in @content if the rules use none.
+ *
+ * Returns 0 on success, -1 on OOM error.
+ */
+static int
+ebiptablesCollectIpsets(int nruleInstances,
+                        ebiptablesRuleInstPtr *inst,
+                        enum RuleType ruleType,
+                        char **content)
+{
+    int i;
+    virHashTablePtr loaded = NULL;
+    virBuffer sets = VIR_BUFFER_INITIALIZER;
+
+    *content = NULL;
+
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ruleType != ruleType || !inst[i]->ipsets)
+            continue;
+        if (!loaded && !(loaded = virHashCreate(10, NULL)))
+            goto err_exit;
+        if (virHashLookup(loaded, inst[i]->ipsets))
+            continue;
+        if (virHashAddEntry(loaded, inst[i]->ipsets, (void *)1) < 0)
+            goto err_exit;
+        virBufferAdd(&sets, inst[i]->ipsets, -1);
+    }
+
+    virHashFree(loaded);
+
+    if (virBufferError(&sets)) {
+        virReportOOMError();
+        return -1;
+    }
+
+    *content = virBufferContentAndReset(&sets);
+    return 0;
+
+err_exit:
+    virHashFree(loaded);
+    virBufferFreeAndReset(&sets);
+    virReportOOMError();
+    return -1;
+}
+
+
+/**
+ * ebiptablesLoadIpsets:
+ * @buf: the buffer holding the script
+ * @nruleInstances: the number of rules
+ * @inst: array of rule instantiation data
+ * @ruleType: the type of the rules whose sets are to be loaded
+ *
+ * Add the loading of the ipsets used by the rules of the given type to
+ * the script; this must happen in the same script that adds the rules
+ * so that sets cannot be removed as unused in between.
+ *
+ * Returns 0 on success, -1 on OOM error.
+ */
+static int
+ebiptablesLoadIpsets(virBufferPtr buf,
+                     int nruleInstances,
+                     ebiptablesRuleInstPtr *inst,
+                     enum RuleType ruleType)
+{
+    char *content;
+
+    if (ebiptablesCollectIpsets(nruleInstances, inst, ruleType,
+                                &content) < 0)
+        return -1;
+
+    if (!content)
+        return 0;
+
+    virBufferAsprintf(buf,
+                      CMD_DEF("%s -exist restore") CMD_SEPARATOR
+                      "${cmd} <<'EOF'" CMD_SEPARATOR
+                      "%s"
+                      "EOF" CMD_SEPARATOR
+                      "%s",
+                      ipset_cmd_path,
+                      content,
+                      CMD_STOPONERR(1));
+    VIR_FREE(content);
+
+    return 0;
+}
+
+
+/**
+ * ebiptablesIpsetsRef:
+ * @live: whether the rules go into the live or into the new chains
+ * @ifname: the name of the interface
+ * @nruleInstances: the number of rules
+ * @inst: array of rule instantiation data
+ *
+ * Record that the live or the new chains of the interface use the
+ * ipsets of the given rules, on top of those they used already. Each
+ * set is counted once per interface and chains, so that it is only
+ * destroyed once none of them uses it anymore. This must be done
+ * before the sets are loaded, so that they cannot be destroyed as
+ * unused in between.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+ebiptablesIpsetsRef(bool live,
+                    const char *ifname,
+                    int nruleInstances,
+                    ebiptablesRuleInstPtr *inst)
+{
+    virHashTablePtr ifaces;
+    virHashTablePtr sets;
+    const char *line;
+    char *name = NULL;
+    size_t refs;
+    size_t len;
+    int i;
+    int ret = -1;
+
+    for (i = 0; i < nruleInstances; i++) {
+        if (inst[i]->ipsets)
+            break;
+    }
+    if (i == nruleInstances)
+        return 0;
+
+    if (!ebiptablesIpsetReady()) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virMutexLock(&ebiptablesIpsetLock);
+
+    ifaces = live ? ebiptablesIpsetsLive : ebiptablesIpsetsNew;
+    if (!(sets = virHashLookup(ifaces, ifname))) {
+        if (!(sets = virHashCreate(10, NULL)))
+            goto cleanup;
+        if (virHashAddEntry(ifaces, ifname, sets) < 0) {
+            virHashFree(sets);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < nruleInstances; i++) {
+        for (line = inst[i]->ipsets; line && *line;
+             line += strcspn(line, "\n") + 1) {
+            if (!STRPREFIX(line, "create "))
+                continue;
+            len = strcspn(line + strlen("create "), " \n");
+
+            VIR_FREE(name);
+            if (!(name = strndup(line + strlen("create "), len))) {
+                virReportOOMError();
+                goto cleanup;
+            }
+            if (virHashLookup(sets, name))
+                continue;
+
+            refs = (size_t)virHashLookup(ebiptablesIpsetRefs, name);
+            if (virHashUpdateEntry(ebiptablesIpsetRefs, name,
+                                   (void *)(refs + 1)) < 0 ||
+                virHashAddEntry(sets, name, (void *)1) < 0)
+                goto cleanup;
+            /* the set may have been destroyed and its name released
+               since the rules were created; it is created again */
+            if (!virHashLookup(ebiptablesIpsetNames, name) &&
+                virHashAddEntry(ebiptablesIpsetNames, name, (void *)1) < 0)
+                goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&ebiptablesIpsetLock);
+    VIR_FREE(name);
+    return ret;
+}
+
+
+static int
+ebiptablesIpsetHasName(const void *payload,
+                       const void *name ATTRIBUTE_UNUSED,
+                       const void *data)
+{
+    return STREQ(payload, data);
+}
+
+
+static void
+ebiptablesIpsetUnref(void *payload ATTRIBUTE_UNUSED,
+                     const void *name,
+                     void *data)
+{
+    virBufferPtr unused = data;
+    size_t refs = (size_t)virHashLookup(ebiptablesIpsetRefs, name);
+
+    if (refs > 1) {
+        ignore_value(virHashUpdateEntry(ebiptablesIpsetRefs, name,
+                                        (void *)(refs - 1)));
+        return;
+    }
+
+    /* no interface uses the set anymore; release its name, so that
+       its values get a new set should they be used again */
+    virHashRemoveEntry(ebiptablesIpsetRefs, name);
+    virHashRemoveSet(ebiptablesIpsetByValues, ebiptablesIpsetHasName, name);
+    virHashRemoveEntry(ebiptablesIpsetNames, name);
+
+    virBufferAsprintf(unused, "%s\n", (const char *)name);
+}
+
+
+/*
+ * Destroy the sets listed one per line in @unused; call this with the
+ * ipset lock held so that no one gets their names again in between.
+ */
+static void
+ebiptablesIpsetsDestroy(const char *unused)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int cli_status;
+    size_t len;
+
+    if (!ipset_cmd_path)
+        return;
+
+    for (; unused && *unused; unused += len + 1) {
+        len = strcspn(unused, "\n");
+        virBufferAsprintf(&buf, "%s destroy %.*s 2>/dev/null" CMD_SEPARATOR,
+                          ipset_cmd_path, (int)len, unused);
+    }
+
+    ebiptablesExecCLI(&buf, &cli_status, NULL);
+}
+
+
+/**
+ * ebiptablesIpsetsUnref:
+ * @live: whether the live or the new chains of the interface are gone
+ * @ifname: the name of the interface
+ * @destroyed: NULL or buffer to add the names of destroyed sets to
+ *
+ * Record that the live or the new chains of the interface are gone,
+ * and destroy the ipsets that no interface uses anymore. Call this
+ * once the rules using the sets are removed, since ipset refuses to
+ * destroy sets that are still referenced.
+ */
+void
+ebiptablesIpsetsUnref(bool live,
+                      const char *ifname,
+                      virBufferPtr destroyed)
+{
+    virBuffer unused = VIR_BUFFER_INITIALIZER;
+    virHashTablePtr sets;
+    char *names;
+
+    if (!ebiptablesIpsetReady())
+        return;
+
+    virMutexLock(&ebiptablesIpsetLock);
+
+    if ((sets = virHashSteal(live ? ebiptablesIpsetsLive
+                                  : ebiptablesIpsetsNew, ifname))) {
+        virHashForEach(sets, ebiptablesIpsetUnref, &unused);
+        virHashFree(sets);
+    }
+
+    names = virBufferContentAndReset(&unused);
+    ebiptablesIpsetsDestroy(names);
+
+    virMutexUnlock(&ebiptablesIpsetLock);
+
+    if (destroyed && names)
+        virBufferAdd(destroyed, names, -1);
+    VIR_FREE(names);
+}
+
+
+/**
+ * ebiptablesIpsetsSwitch:
+ * @ifname: the name of the interface
+ * @destroyed: NULL or buffer to add the names of destroyed sets to
+ *
+ * The new chains of the interface became its live ones: release the
+ * sets of the former live chains and hand those of the new chains on.
+ */
+void
+ebiptablesIpsetsSwitch(const char *ifname,
+                       virBufferPtr destroyed)
+{
+    virHashTablePtr sets;
+
+    ebiptablesIpsetsUnref(true, ifname, destroyed);
+
+    if (!ebiptablesIpsetReady())
+        return;
+
+    virMutexLock(&ebiptablesIpsetLock);
+    if ((sets = virHashSteal(ebiptablesIpsetsNew, ifname)) &&
+        virHashAddEntry(ebiptablesIpsetsLive, ifname, sets) < 0) {
+        /* the sets are never destroyed; better than while in use */
+        virResetLastError();
+        virHashFree(sets);
+    }
+    virMutexUnlock(&ebiptablesIpsetLock);
+}
+
+
+/*
+ * Add a rule either to the input of a *tables-restore tool, if the
+ * rules are applied in one batch, or to the script.
+ */
+static int
+ebiptablesInstRule(virBufferPtr buf,
+                   virBufferPtr restore,
+                   const char *templ)
+{
+    if (restore)
+        return ebiptablesTemplateToRestoreLine(restore, templ, 'A', -1);
+
+    ebiptablesInstCommand(buf, templ, 'A', -1, 1);
+    return 0;
+}
+
+
 /**
  * ebiptablesCanApplyBasicRules
  *
@@ -3448,12 +4572,58 @@ normal:
     return (insta->priority - instb->priority);
 }
 
+struct ebiptablesRuleOrder {
+    ebiptablesRuleInstPtr inst;
+    int idx;
+};
+
 static int
-ebiptablesRuleOrderSortPtr(const void *a, const void *b)
+ebiptablesRuleOrderSortStable(const void *a, const void *b)
 {
-    const ebiptablesRuleInstPtr *insta = a;
-    const ebiptablesRuleInstPtr *instb = b;
-    return ebiptablesRuleOrderSort(*insta, *instb);
+    const struct ebiptablesRuleOrder *ordera = a;
+    const struct ebiptablesRuleOrder *orderb = b;
+    int rc = ebiptablesRuleOrderSort(ordera->inst, orderb->inst);
+
+    /* keep rules of the same priority in the order of the filter */
+    if (rc == 0)
+        rc = ordera->idx - orderb->idx;
+    return rc;
+}
+
+/*
+ * Sort the rules into the order they are applied in. The sort is
+ * stable so that the same rules always end up in the same order and
+ * the position of a rule in the live chains can be determined later.
+ *
+ * Returns 0 on success, -1 on OOM error.
+ */
+static int
+ebiptablesSortRules(ebiptablesRuleInstPtr *inst, int nruleInstances)
+{
+    struct ebiptablesRuleOrder *order;
+    int i;
+
+    if (nruleInstances < 2)
+        return 0;
+
+    if (VIR_ALLOC_N(order, nruleInstances) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < nruleInstances; i++) {
+        order[i].inst = inst[i];
+        order[i].idx = i;
+    }
+
+    qsort(order, nruleInstances, sizeof(order[0]),
+          ebiptablesRuleOrderSortStable);
+
+    for (i = 0; i < nruleInstances; i++)
+        inst[i] = order[i].inst;
+
+    VIR_FREE(order);
+    return 0;
 }
 
 static int
@@ -3546,7 +4716,7 @@ ebtablesCreateTmpRootAndSubChains(virBufferPtr buf,
         if ((int)idx < 0)
             continue;
         priority = (const virNWFilterChainPriority *)filter_names[i].value;
-        rc = ebtablesCreateTmpSubChain(inst, nRuleInstances,
+        rc = ebtablesCreateTmpSubChain(buf, inst, nRuleInstances,
                                        direction, ifname, idx,
                                        filter_names[i].key, 1,
                                        *priority);
@@ -3567,6 +4737,9 @@ ebiptablesApplyNewRules(const char *ifname,
     int cli_status;
     ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer restoreBuf = VIR_BUFFER_INITIALIZER;
+    virBufferPtr restore = NULL;
+    char *ipsets = NULL;
     virHashTablePtr chains_in_set  = virHashCreate(10, NULL);
     virHashTablePtr chains_out_set = virHashCreate(10, NULL);
     bool haveIptables = false;
@@ -3580,9 +4753,12 @@ ebiptablesApplyNewRules(const char *ifname,
         goto exit_free_sets;
     }
 
-    if (nruleInstances > 1 && inst)
-        qsort(inst, nruleInstances, sizeof(inst[0]),
-              ebiptablesRuleOrderSortPtr);
+    if (ebiptablesSortRules(inst, nruleInstances) < 0)
+        goto exit_free_sets;
+
+    if (ebiptablesIpsetsRef(false, ifname,
+                            nruleInstances, inst) < 0)
+        goto exit_free_sets;
 
     /* scan the rules to see which chains need to be created */
     for (i = 0; i < nruleInstances; i++) {
@@ -3639,8 +4815,15 @@ ebiptablesApplyNewRules(const char *ifname,
 
     NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
 
+    /* with ebtables-restore, all rules are added in one go */
+    restore = NULL;
+    if (ebtables_restore_cmd_path) {
+        restore = &restoreBuf;
+        virBufferAddLit(restore, "*nat\n");
+    }
+
     /* process ebtables commands; interleave commands from filters with
-       commands for creating and connecting ebtables chains */
+       commands for connecting ebtables chains */
     j = 0;
     for (i = 0; i < nruleInstances; i++) {
         sa_assert (inst);
@@ -3648,13 +4831,13 @@ ebiptablesApplyNewRules(const char *ifname,
         case RT_EBTABLES:
             while (j < nEbtChains &&
                    ebtChains[j].priority <= inst[i]->priority) {
-                ebiptablesInstCommand(&buf,
-                                      ebtChains[j++].commandTemplate,
-                                      'A', -1, 1);
+                if (ebiptablesInstRule(&buf, restore,
+                                       ebtChains[j++].commandTemplate) < 0)
+                    goto tear_down_tmpebchains;
             }
-            ebiptablesInstCommand(&buf,
-                                  inst[i]->commandTemplate,
-                                  'A', -1, 1);
+            if (ebiptablesInstRule(&buf, restore,
+                                   inst[i]->commandTemplate) < 0)
+                goto tear_down_tmpebchains;
         break;
         case RT_IPTABLES:
             haveIptables = true;
@@ -3665,13 +4848,20 @@ ebiptablesApplyNewRules(const char *ifname,
         }
     }
 
-    while (j < nEbtChains)
-        ebiptablesInstCommand(&buf,
-                              ebtChains[j++].commandTemplate,
-                              'A', -1, 1);
+    while (j < nEbtChains) {
+        if (ebiptablesInstRule(&buf, restore,
+                               ebtChains[j++].commandTemplate) < 0)
+            goto tear_down_tmpebchains;
+    }
 
-    if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+    if (restore) {
+        virBufferFreeAndReset(&buf);
+        if (ebiptablesExecRestore(ebtables_restore_cmd_path,
+                                  restore, NULL, &errmsg) < 0)
+            goto tear_down_tmpebchains;
+    } else if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0) {
         goto tear_down_tmpebchains;
+    }
 
     if (haveIptables) {
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
@@ -3700,17 +4890,37 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
+        restore = NULL;
+        if (iptables_restore_cmd_path) {
+            restore = &restoreBuf;
+            virBufferAddLit(restore, "*filter\n");
+            if (ebiptablesCollectIpsets(nruleInstances, inst,
+                                        RT_IPTABLES, &ipsets) < 0)
+                goto tear_down_tmpiptchains;
+        } else if (ebiptablesLoadIpsets(&buf, nruleInstances, inst,
+                                        RT_IPTABLES) < 0) {
+            goto tear_down_tmpiptchains;
+        }
+
         for (i = 0; i < nruleInstances; i++) {
             sa_assert (inst);
-            if (inst[i]->ruleType == RT_IPTABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
+            if (inst[i]->ruleType == RT_IPTABLES &&
+                ebiptablesInstRule(&buf, restore,
+                                   inst[i]->commandTemplate) < 0)
+                goto tear_down_tmpiptchains;
         }
 
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpiptchains;
 
+        if (restore) {
+            virBufferAddLit(restore, "COMMIT\n");
+            if (ebiptablesExecRestore(iptables_restore_cmd_path,
+                                      restore, ipsets, &errmsg) < 0)
+                goto tear_down_tmpiptchains;
+            VIR_FREE(ipsets);
+        }
+
         iptablesCheckBridgeNFCallEnabled(false);
     }
 
@@ -3741,16 +4951,36 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
+        restore = NULL;
+        if (ip6tables_restore_cmd_path) {
+            restore = &restoreBuf;
+            virBufferAddLit(restore, "*filter\n");
+            if (ebiptablesCollectIpsets(nruleInstances, inst,
+                                        RT_IP6TABLES, &ipsets) < 0)
+                goto tear_down_tmpip6tchains;
+        } else if (ebiptablesLoadIpsets(&buf, nruleInstances, inst,
+                                        RT_IP6TABLES) < 0) {
+            goto tear_down_tmpip6tchains;
+        }
+
         for (i = 0; i < nruleInstances; i++) {
-            if (inst[i]->ruleType == RT_IP6TABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
+            if (inst[i]->ruleType == RT_IP6TABLES &&
+                ebiptablesInstRule(&buf, restore,
+                                   inst[i]->commandTemplate) < 0)
+                goto tear_down_tmpip6tchains;
         }
 
         if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
            goto tear_down_tmpip6tchains;
 
+        if (restore) {
+            virBufferAddLit(restore, "COMMIT\n");
+            if (ebiptablesExecRestore(ip6tables_restore_cmd_path,
+                                      restore, ipsets, &errmsg) < 0)
+                goto tear_down_tmpip6tchains;
+            VIR_FREE(ipsets);
+        }
+
         iptablesCheckBridgeNFCallEnabled(true);
     }
 
@@ -3810,6 +5040,8 @@ tear_down_tmpebchains:
 
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
+    ebiptablesIpsetsUnref(false, ifname, NULL);
+
     virNWFilterReportError(VIR_ERR_BUILD_FIREWALL,
                            _("Some rules could not be created for "
                              "interface %s%s%s"),
@@ -3818,6 +5050,8 @@ tear_down_tmpebchains:
                            errmsg ? errmsg : "");
 
 exit_free_sets:
+    virBufferFreeAndReset(&restoreBuf);
+    VIR_FREE(ipsets);
     virHashFree(chains_in_set);
     virHashFree(chains_out_set);
 
@@ -3864,6 +5098,8 @@ ebiptablesTearNewRules(const char *ifname)
 
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
+    ebiptablesIpsetsUnref(false, ifname, NULL);
+
     return 0;
 }
 
@@ -3911,17 +5147,67 @@ ebiptablesTearOldRules(const char *ifname)
         ebiptablesExecCLI(&buf, &cli_status, NULL);
     }
 
+    ebiptablesIpsetsSwitch(ifname, NULL);
+
     return 0;
 }
 
 
+/**
+ * ebiptablesLiveCommandTemplate:
+ * @inst : the rule instance
+ *
+ * Rule instances are created for the temporary chains of an interface.
+ * Return a copy of the command template of the given rule instance
+ * with the name of the chain the rule goes into changed to that of the
+ * live chain the temporary chain was renamed to.
+ *
+ * Returns the template or NULL on OOM error.
+ */
+static char *
+ebiptablesLiveCommandTemplate(ebiptablesRuleInstPtr inst)
+{
+    char *templ, *chain;
+
+    if (!(templ = strdup(inst->commandTemplate))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    /* the chain name follows the command placeholder */
+    if (!(chain = strstr(templ, "-%c ")))
+        return templ;
+    chain += strlen("-%c ");
+
+    if (inst->ruleType == RT_EBTABLES) {
+        if (STRPREFIX(chain, "libvirt-"))
+            chain += strlen("libvirt-");
+    } else {
+        /* skip 'F' or 'H' of the iptables root chain names */
+        chain++;
+    }
+
+    switch (*chain) {
+    case CHAINPREFIX_HOST_IN_TEMP:
+        *chain = CHAINPREFIX_HOST_IN;
+    break;
+    case CHAINPREFIX_HOST_OUT_TEMP:
+        *chain = CHAINPREFIX_HOST_OUT;
+    break;
+    }
+
+    return templ;
+}
+
+
 /**
  * ebiptablesRemoveRules:
  * @ifname : the name of the interface to which the rules apply
  * @nRuleInstance : the number of given rules
  * @_inst : array of rule instantiation data
  *
- * Remove all rules one after the other
+ * Remove the given rules one after the other from the live chains of
+ * the interface.
  *
  * Return 0 on success, -1 if execution of one or more cleanup
  * commands failed.
@@ -3934,17 +5220,37 @@ ebiptablesRemoveRules(const char *ifname ATTRIBUTE_UNUSED,
     int rc = 0;
     int cli_status;
     int i;
+    char *templ;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
 
-    NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+    for (i = 0; i < nruleInstances; i++) {
+        switch (inst[i]->ruleType) {
+        case RT_EBTABLES:
+            NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+        break;
+        case RT_IPTABLES:
+            NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
+        break;
+        case RT_IP6TABLES:
+            NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
+        break;
+        }
+
+        if (!(templ = ebiptablesLiveCommandTemplate(inst[i]))) {
+            virBufferFreeAndReset(&buf);
+            return -1;
+        }
 
-    for (i = 0; i < nruleInstances; i++)
         ebiptablesInstCommand(&buf,
-                              inst[i]->commandTemplate,
+                              templ,
                               'D', -1,
                               0);
+        VIR_FREE(templ);
+    }
 
+    /* other rules may still use the sets of the removed ones; they are
+       released once the chains are rebuilt or torn down */
     if (ebiptablesExecCLI(&buf, &cli_status, NULL) < 0)
         goto err_exit;
 
@@ -3960,6 +5266,359 @@ err_exit:
 }
 
 
+static bool
+ebiptablesRuleInstEqual(ebiptablesRuleInstPtr a,
+                        ebiptablesRuleInstPtr b)
+{
+    return a->ruleType == b->ruleType &&
+           a->chainprefix == b->chainprefix &&
+           a->priority == b->priority &&
+           a->chainPriority == b->chainPriority &&
+           STREQ_NULLABLE(a->neededProtocolChain, b->neededProtocolChain) &&
+           STREQ(a->commandTemplate, b->commandTemplate);
+}
+
+
+/**
+ * ebiptablesInsertRules:
+ * @ifname : the name of the interface to which the rules apply
+ * @nRuleInstance : the number of given rules
+ * @_inst : array of rule instantiation data
+ * @positions : array of the positions to insert the rules at
+ *
+ * Insert the given rules one after the other into the live chains of
+ * the interface, each at its position in its chain.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+ebiptablesInsertRules(const char *ifname,
+                      int nruleInstances,
+                      void **_inst,
+                      int *positions)
+{
+    int i;
+    char *templ;
+    char *errmsg = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    ebiptablesRuleInstPtr *inst = (ebiptablesRuleInstPtr *)_inst;
+
+    if (ebiptablesIpsetsRef(true, ifname,
+                            nruleInstances, inst) < 0 ||
+        ebiptablesLoadIpsets(&buf, nruleInstances, inst, RT_IPTABLES) < 0 ||
+        ebiptablesLoadIpsets(&buf, nruleInstances, inst, RT_IP6TABLES) < 0)
+        goto err_exit;
+
+    for (i = 0; i < nruleInstances; i++) {
+        switch (inst[i]->ruleType) {
+        case RT_EBTABLES:
+            NWFILTER_SET_EBTABLES_SHELLVAR(&buf);
+        break;
+        case RT_IPTABLES:
+            NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
+        break;
+        case RT_IP6TABLES:
+            NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
+        break;
+        }
+
+        if (!(templ = ebiptablesLiveCommandTemplate(inst[i])))
+            goto err_exit;
+
+        ebiptablesInstCommand(&buf,
+                              templ,
+                              'I', positions[i],
+                              1);
+        VIR_FREE(templ);
+    }
+
+    if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0) {
+        virNWFilterReportError(VIR_ERR_BUILD_FIREWALL,
+                               _("Some rules could not be inserted for "
+                                 "interface %s%s%s"),
+                               ifname,
+                               errmsg ? ": " : "",
+                               errmsg ? errmsg : "");
+        VIR_FREE(errmsg);
+        return -1;
+    }
+
+    return 0;
+
+err_exit:
+    virBufferFreeAndReset(&buf);
+    return -1;
+}
+
+
+/*
+ * The chain a rule goes into, which is named after the command
+ * placeholder in its template; NULL if the template has none.
+ */
+static const char *
+ebiptablesRuleChain(ebiptablesRuleInstPtr inst, size_t *len)
+{
+    const char *chain = strstr(inst->commandTemplate, "-%c ");
+
+    if (!chain)
+        return NULL;
+    chain += strlen("-%c ");
+    *len = strcspn(chain, " '");
+    return chain;
+}
+
+
+/* whether both rules end up in the same chain */
+static bool
+ebiptablesRuleInstSameChain(ebiptablesRuleInstPtr a,
+                            ebiptablesRuleInstPtr b)
+{
+    const char *chaina, *chainb;
+    size_t lena = 0, lenb = 0;
+
+    if (a->ruleType != b->ruleType)
+        return false;
+
+    chaina = ebiptablesRuleChain(a, &lena);
+    chainb = ebiptablesRuleChain(b, &lenb);
+
+    return chaina && chainb && lena == lenb &&
+           STREQLEN(chaina, chainb, lena);
+}
+
+
+/* the chains ebiptablesApplyNewRules creates for a set of rules */
+struct ebiptablesChainSet {
+    bool iptables;
+    bool ip6tables;
+    /* the last rule of each ebtables chain, which sets its priority */
+    ebiptablesRuleInstPtr *ebtChains;
+    size_t nebtChains;
+};
+
+
+static int
+ebiptablesChainSetInit(struct ebiptablesChainSet *set,
+                       int nruleInstances,
+                       ebiptablesRuleInstPtr *inst)
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < nruleInstances; i++) {
+        switch (inst[i]->ruleType) {
+        case RT_IPTABLES:
+            set->iptables = true;
+        break;
+        case RT_IP6TABLES:
+            set->ip6tables = true;
+        break;
+        case RT_EBTABLES:
+            for (j = 0; j < set->nebtChains; j++) {
+                if (set->ebtChains[j]->chainprefix == inst[i]->chainprefix &&
+                    STREQ(set->ebtChains[j]->neededProtocolChain,
+                          inst[i]->neededProtocolChain))
+                    break;
+            }
+            if (j == set->nebtChains &&
+                VIR_EXPAND_N(set->ebtChains, set->nebtChains, 1) < 0) {
+                virReportOOMError();
+                return -1;
+            }
+            set->ebtChains[j] = inst[i];
+        break;
+        }
+    }
+
+    return 0;
+}
+
+
+static bool
+ebiptablesChainSetEqual(struct ebiptablesChainSet *a,
+                        struct ebiptablesChainSet *b)
+{
+    size_t i, j;
+
+    if (a->iptables != b->iptables ||
+        a->ip6tables != b->ip6tables ||
+        a->nebtChains != b->nebtChains)
+        return false;
+
+    for (i = 0; i < a->nebtChains; i++) {
+        for (j = 0; j < b->nebtChains; j++) {
+            if (a->ebtChains[i]->chainprefix == b->ebtChains[j]->chainprefix &&
+                STREQ(a->ebtChains[i]->neededProtocolChain,
+                      b->ebtChains[j]->neededProtocolChain))
+                break;
+        }
+        if (j == b->nebtChains ||
+            a->ebtChains[i]->chainPriority != b->ebtChains[j]->chainPriority)
+            return false;
+    }
+
+    return true;
+}
+
+
+/*
+ * The number of rules jumping into sub chains that precede the given
+ * rule of an ebtables root chain; see ebiptablesApplyNewRules.
+ */
+static int
+ebiptablesChainSetCountJumps(struct ebiptablesChainSet *set,
+                             ebiptablesRuleInstPtr inst)
+{
+    size_t i;
+    int njumps = 0;
+
+    for (i = 0; i < set->nebtChains; i++) {
+        if (set->ebtChains[i]->chainprefix == inst->chainprefix &&
+            (int)ebtablesGetProtoIdxByFiltername(
+                         set->ebtChains[i]->neededProtocolChain) >= 0 &&
+            set->ebtChains[i]->chainPriority <= inst->priority)
+            njumps++;
+    }
+
+    return njumps;
+}
+
+
+/**
+ * ebiptablesDiffRules:
+ * @nOldInst : the number of rules currently applied to the interface
+ * @_oldInst : array of rule instantiation data of the current rules
+ * @nNewInst : the number of rules of the updated filter
+ * @_newInst : array of rule instantiation data of the updated filter
+ * @removed : pointer to store an array of the rules to be removed in
+ * @nremoved : pointer to store the number of rules to be removed in
+ * @inserted : pointer to store an array of the rules to be inserted in
+ * @positions : pointer to store an array of the positions to insert
+ *              the rules at in
+ * @ninserted : pointer to store the number of rules to be inserted in
+ *
+ * Determine whether the interface can be moved from the old to the new
+ * set of rules by removing rules from and inserting rules into its live
+ * chains. This is the case if the new rules need the same chains as the
+ * old ones, since a rebuild would create a different set of chains
+ * otherwise. Both arrays are sorted into the order the rules are applied
+ * in, so that the rules to remove and those to insert can be found by
+ * walking both at once.
+ *
+ * The rules to be removed are returned in @removed, which points into
+ * @_oldInst. The rules to be inserted are returned in @inserted, which
+ * points into @_newInst, along with their positions in their chains;
+ * the rules must be removed first and then inserted in the given order.
+ * The caller must free the arrays. Empty lists mean that the rules did
+ * not change.
+ *
+ * Returns 0 if the rules can be updated in place, 1 if the chains of the
+ * interface must be rebuilt and -1 on OOM error.
+ */
+static int
+ebiptablesDiffRules(int nOldInst,
+                    void **_oldInst,
+                    int nNewInst,
+                    void **_newInst,
+                    void ***removed,
+                    int *nremoved,
+                    void ***inserted,
+                    int **positions,
+                    int *ninserted)
+{
+    ebiptablesRuleInstPtr *oldInst = (ebiptablesRuleInstPtr *)_oldInst;
+    ebiptablesRuleInstPtr *newInst = (ebiptablesRuleInstPtr *)_newInst;
+    struct ebiptablesChainSet oldChains = { false, false, NULL, 0 };
+    struct ebiptablesChainSet newChains = { false, false, NULL, 0 };
+    const char *root = virNWFilterChainSuffixTypeToString(
+                                     VIR_NWFILTER_CHAINSUFFIX_ROOT);
+    int i = 0, j = 0, k, pos;
+    size_t len, nrem = 0, nins = 0, npos = 0;
+    int ret = -1;
+
+    *removed = NULL;
+    *nremoved = 0;
+    *inserted = NULL;
+    *positions = NULL;
+    *ninserted = 0;
+
+    if (ebiptablesSortRules(oldInst, nOldInst) < 0 ||
+        ebiptablesSortRules(newInst, nNewInst) < 0 ||
+        ebiptablesChainSetInit(&oldChains, nOldInst, oldInst) < 0 ||
+        ebiptablesChainSetInit(&newChains, nNewInst, newInst) < 0)
+        goto cleanup;
+
+    if (!ebiptablesChainSetEqual(&oldChains, &newChains))
+        goto rebuild;
+
+    while (i < nOldInst || j < nNewInst) {
+        if (i < nOldInst && j < nNewInst &&
+            ebiptablesRuleInstEqual(oldInst[i], newInst[j])) {
+            i++;
+            j++;
+            continue;
+        }
+
+        if (i < nOldInst) {
+            for (k = j; k < nNewInst; k++) {
+                if (ebiptablesRuleInstEqual(oldInst[i], newInst[k]))
+                    break;
+            }
+            /* the old rule is not kept */
+            if (k == nNewInst) {
+                if (VIR_EXPAND_N(*removed, nrem, 1) < 0)
+                    goto no_memory;
+                (*removed)[nrem - 1] = oldInst[i++];
+                continue;
+            }
+        }
+
+        /* the new rule goes after the preceding ones of its chain */
+        if (!ebiptablesRuleChain(newInst[j], &len))
+            goto rebuild;
+        pos = 1;
+        for (k = 0; k < j; k++) {
+            if (ebiptablesRuleInstSameChain(newInst[k], newInst[j]))
+                pos++;
+        }
+        if (newInst[j]->ruleType == RT_EBTABLES &&
+            STREQ(newInst[j]->neededProtocolChain, root))
+            pos += ebiptablesChainSetCountJumps(&newChains, newInst[j]);
+
+        if (VIR_EXPAND_N(*inserted, nins, 1) < 0 ||
+            VIR_EXPAND_N(*positions, npos, 1) < 0)
+            goto no_memory;
+        (*inserted)[nins - 1] = newInst[j++];
+        (*positions)[npos - 1] = pos;
+    }
+
+    *nremoved = nrem;
+    *ninserted = nins;
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        VIR_FREE(*removed);
+        VIR_FREE(*inserted);
+        VIR_FREE(*positions);
+    }
+    VIR_FREE(oldChains.ebtChains);
+    VIR_FREE(newChains.ebtChains);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+
+rebuild:
+    ret = 1;
+    VIR_FREE(*removed);
+    VIR_FREE(*inserted);
+    VIR_FREE(*positions);
+    goto cleanup;
+}
+
+
 /**
  * ebiptablesAllTeardown:
  * @ifname : the name of the interface to which the rules apply
@@ -4002,8 +5661,12 @@ ebiptablesAllTeardown(const char *ifname)
         ebtablesRemoveRootChain(&buf, 1, ifname);
         ebtablesRemoveRootChain(&buf, 0, ifname);
     }
+
     ebiptablesExecCLI(&buf, &cli_status, NULL);
 
+    ebiptablesIpsetsUnref(true, ifname, NULL);
+    ebiptablesIpsetsUnref(false, ifname, NULL);
+
     return 0;
 }
 
@@ -4021,6 +5684,8 @@ virNWFilterTechDriver ebiptables_driver = {
     .tearOldRules        = ebiptablesTearOldRules,
     .allTeardown         = ebiptablesAllTeardown,
     .removeRules         = ebiptablesRemoveRules,
+    .insertRules         = ebiptablesInsertRules,
+    .diffRules           = ebiptablesDiffRules,
     .freeRuleInstance    = ebiptablesFreeRuleInstance,
     .displayRuleInstance = ebiptablesDisplayRuleInstance,
 
@@ -4032,6 +5697,42 @@ virNWFilterTechDriver ebiptables_driver = {
 };
 
 
+/*
+ * ebiptablesProbeRestoreCmd:
+ * @name: name of the *tables-restore tool
+ *
+ * Locate @name and make sure it supports --noflush, which rules
+ * must be applied with so that they are added to the existing
+ * tables rather than replacing them.
+ *
+ * Returns the path of the tool or NULL if rules have to be applied
+ * one at a time instead.
+ */
+static char *
+ebiptablesProbeRestoreCmd(const char *name)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *path = virFindFileInPath(name);
+
+    if (!path)
+        return NULL;
+
+    virBufferAsprintf(&buf,
+                      CMD_DEF("%s --noflush < /dev/null") CMD_SEPARATOR
+                      CMD_EXEC
+                      "%s",
+                      path,
+                      CMD_STOPONERR(1));
+
+    if (ebiptablesExecCLI(&buf, NULL, NULL) < 0) {
+        VIR_INFO("%s does not support --noflush, not batching rules", path);
+        VIR_FREE(path);
+    }
+
+    return path;
+}
+
+
 static int
 ebiptablesDriverInit(bool privileged)
 {
@@ -4088,6 +5789,16 @@ ebiptablesDriverInit(bool privileged)
              VIR_FREE(ip6tables_cmd_path);
     }
 
+    if (ebtables_cmd_path)
+        ebtables_restore_cmd_path =
+            ebiptablesProbeRestoreCmd("ebtables-restore");
+    if (iptables_cmd_path)
+        iptables_restore_cmd_path =
+            ebiptablesProbeRestoreCmd("iptables-restore");
+    if (ip6tables_cmd_path)
+        ip6tables_restore_cmd_path =
+            ebiptablesProbeRestoreCmd("ip6tables-restore");
+
     /* ip(6)tables support needs gawk & grep, ebtables doesn't */
     if ((iptables_cmd_path != NULL || ip6tables_cmd_path != NULL) &&
         (!grep_cmd_path || !gawk_cmd_path)) {
@@ -4098,6 +5809,11 @@ ebiptablesDriverInit(bool privileged)
         VIR_FREE(ip6tables_cmd_path);
     }
 
+    /* ip(6)tables rules match larger lists of addresses through ipsets */
+    if (iptables_cmd_path || ip6tables_cmd_path)
+        ipset_cmd_path = virFindFileInPath("ipset");
+    if (ipset_cmd_path)
+        ebiptablesIpsetReserveExisting();
 
     if (!ebtables_cmd_path && !iptables_cmd_path && !ip6tables_cmd_path) {
         virNWFilterReportError(VIR_ERR_INTERNAL_ERROR, "%s",
@@ -4121,5 +5837,9 @@ ebiptablesDriverShutdown(void)
     VIR_FREE(ebtables_cmd_path);
     VIR_FREE(iptables_cmd_path);
     VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(ebtables_restore_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
+    VIR_FREE(ipset_cmd_path);
     ebiptables_driver.flags = 0;
 }
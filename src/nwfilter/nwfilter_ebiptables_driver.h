@@ -23,6 +23,9 @@
 #ifndef VIR_NWFILTER_EBTABLES_DRIVER_H__
 # define VIR_NWFILTER_EBTABLES_DRIVER_H__
 
+# include "buf.h"
+# include "intprops.h"
+
 # define MAX_CHAINNAME_LENGTH  32 /* see linux/netfilter_bridge/ebtables.h */
 
 enum RuleType {
@@ -40,6 +43,7 @@ struct _ebiptablesRuleInst {
     char chainprefix;    /* I for incoming, O for outgoing */
     virNWFilterRulePriority priority;
     enum RuleType ruleType;
+    char *ipsets;        /* ipset restore lines of the sets used */
 };
 
 extern virNWFilterTechDriver ebiptables_driver;
@@ -48,4 +52,28 @@ extern virNWFilterTechDriver ebiptables_driver;
 
 # define IPTABLES_MAX_COMMENT_LENGTH  256
 
+# define NWFILTER_IPSET_PREFIX      "libvirt-nwf-"
+# define NWFILTER_IPSET_NAME_LEN    (sizeof(NWFILTER_IPSET_PREFIX) + \
+                                     INT_BUFSIZE_BOUND(unsigned int))
+
+int ebiptablesIpsetName(virNWFilterVarValuePtr val,
+                        char *name, size_t namelen);
+
+int ebiptablesIpsetAddDef(virBufferPtr buf,
+                          virNWFilterVarValuePtr val);
+
+int ebiptablesIpsetsRef(bool live,
+                        const char *ifname,
+                        int nruleInstances,
+                        ebiptablesRuleInstPtr *inst);
+void ebiptablesIpsetsUnref(bool live,
+                           const char *ifname,
+                           virBufferPtr destroyed);
+void ebiptablesIpsetsSwitch(const char *ifname,
+                            virBufferPtr destroyed);
+
+int ebiptablesTemplateToRestoreLine(virBufferPtr buf,
+                                    const char *templ,
+                                    char cmd, int pos);
+
 #endif
@@ -42,6 +42,17 @@
 #define NWFILTER_STD_VAR_MAC "MAC"
 #define NWFILTER_STD_VAR_IP  "IP"
 
+/* payloads of domUpdateCBStruct.skipInterfaces */
+#define SKIP_IFACE_UNCHANGED    ((void *)~0)
+#define SKIP_IFACE_EDIT_RULES   ((void *)~1)
+
+/* how the rules of an interface are moved to an updated filter */
+enum instUpdate {
+    INST_UPDATE_REBUILD,  /* build new chains, switch over later */
+    INST_UPDATE_NONE,     /* the rules did not change */
+    INST_UPDATE_EDIT,     /* remove and insert rules in the live chains */
+};
+
 static int _virNWFilterTeardownFilter(const char *ifname);
 
 
@@ -620,6 +631,123 @@ virNWFilterRuleInstancesToArray(int nEntries,
 }
 
 
+/**
+ * virNWFilterUpdateRules:
+ * @techdriver: The driver to use for instantiation
+ * @oldfilter: The currently applied filter
+ * @ifname: The name of the interface the rules are applied to
+ * @vars: A map holding variable names and values
+ * @nptrs: The number of rules of the updated filter
+ * @ptrs: Array of the rules of the updated filter
+ * @update: Pointer to how the update is carried out
+ *
+ * Returns 0 on success, -1 on error.
+ *
+ * Compare the rules of the currently applied filter tree with those of
+ * the updated one and store in @update whether the interface needs to
+ * have its chains rebuilt, whether its rules are unchanged or whether
+ * the update can be done by removing rules from and inserting rules
+ * into the existing chains. If INST_UPDATE_EDIT is passed in @update,
+ * the live chains are also edited that way; should that fail, @update
+ * is set to INST_UPDATE_REBUILD so that the caller builds new chains
+ * to replace the half edited ones.
+ *
+ * Call this function while holding the NWFilter filter update lock
+ * and the lock of the interface.
+ */
+static int
+virNWFilterUpdateRules(virNWFilterTechDriverPtr techdriver,
+                       enum virDomainNetType nettype,
+                       virNWFilterDefPtr oldfilter,
+                       const char *ifname,
+                       virNWFilterHashTablePtr vars,
+                       virNWFilterDriverStatePtr driver,
+                       int nptrs,
+                       void **ptrs,
+                       enum instUpdate *update)
+{
+    int rc;
+    int j, nOldPtrs = 0, nremoved = 0, ninserted = 0;
+    int nOldEntries = 0;
+    virNWFilterRuleInstPtr *oldInsts = NULL;
+    void **oldPtrs = NULL;
+    void **removed = NULL;
+    void **inserted = NULL;
+    int *positions = NULL;
+    bool foundNewFilter = false;
+    bool commit = (*update == INST_UPDATE_EDIT);
+
+    *update = INST_UPDATE_REBUILD;
+
+    if (!techdriver->diffRules ||
+        !techdriver->removeRules ||
+        !techdriver->insertRules)
+        return 0;
+
+    rc = _virNWFilterInstantiateRec(techdriver,
+                                    nettype,
+                                    oldfilter,
+                                    ifname,
+                                    vars,
+                                    &nOldEntries, &oldInsts,
+                                    INSTANTIATE_ALWAYS, &foundNewFilter,
+                                    driver);
+    if (rc < 0)
+        goto cleanup;
+
+    rc = virNWFilterRuleInstancesToArray(nOldEntries, oldInsts,
+                                         &oldPtrs, &nOldPtrs);
+    if (rc < 0)
+        goto cleanup;
+
+    rc = techdriver->diffRules(nOldPtrs, oldPtrs, nptrs, ptrs,
+                               &removed, &nremoved,
+                               &inserted, &positions, &ninserted);
+    if (rc < 0)
+        goto cleanup;
+
+    if (rc == 0) {
+        if (nremoved == 0 && ninserted == 0) {
+            *update = INST_UPDATE_NONE;
+        } else {
+            *update = INST_UPDATE_EDIT;
+            if (commit && nremoved > 0)
+                rc = techdriver->removeRules(ifname, nremoved, removed);
+            if (commit && rc == 0 && ninserted > 0)
+                rc = techdriver->insertRules(ifname, ninserted, inserted,
+                                             positions);
+            if (rc < 0) {
+                /* the live chains may be half edited by now; build
+                   new ones from scratch and switch to them instead */
+                VIR_WARN("Could not edit the rules of interface %s in "
+                         "place, rebuilding them", ifname);
+                virResetLastError();
+                *update = INST_UPDATE_REBUILD;
+                rc = 0;
+            }
+        }
+    } else {
+        rc = 0;
+    }
+
+    VIR_DEBUG("update of rules of %s: %d rules removed, %d inserted, "
+              "rebuild: %d", ifname, nremoved, ninserted,
+              *update == INST_UPDATE_REBUILD);
+
+cleanup:
+    for (j = 0; j < nOldEntries; j++)
+        virNWFilterRuleInstFree(oldInsts[j]);
+
+    VIR_FREE(oldInsts);
+    VIR_FREE(oldPtrs);
+    VIR_FREE(removed);
+    VIR_FREE(inserted);
+    VIR_FREE(positions);
+
+    return rc;
+}
+
+
 /**
  * virNWFilterInstantiate:
  * @vmuuid: The UUID of the VM
@@ -630,6 +758,9 @@ virNWFilterRuleInstancesToArray(int nEntries,
  *  the filter and its subfilters.
  * @forceWithPendingReq: Ignore the check whether a pending learn request
  *  is active; 'true' only when the rules are applied late
+ * @oldfilter: The currently applied filter; only used with @update
+ * @update: NULL or pointer to how an update of the filter is carried
+ *  out; see virNWFilterUpdateRules
  *
  * Returns 0 on success, a value otherwise.
  *
@@ -638,6 +769,10 @@ virNWFilterRuleInstancesToArray(int nEntries,
  * filters. The name of the interface to which the rules belong must be
  * provided. Apply the values of variables as needed.
  *
+ * When updating a filter, new chains are only built for the interface
+ * if the update cannot be done by leaving the rules untouched or by
+ * removing and inserting rules in the existing chains.
+ *
  * Call this function while holding the NWFilter filter update lock
  */
 static int
@@ -653,7 +788,9 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
                        bool teardownOld,
                        const unsigned char *macaddr,
                        virNWFilterDriverStatePtr driver,
-                       bool forceWithPendingReq)
+                       bool forceWithPendingReq,
+                       virNWFilterDefPtr oldfilter,
+                       enum instUpdate *update)
 {
     int rc;
     int j, nptrs;
@@ -732,10 +869,17 @@ virNWFilterInstantiate(const unsigned char *vmuuid ATTRIBUTE_UNUSED,
         if (virNWFilterLockIface(ifname) < 0)
             goto err_exit;
 
-        rc = techdriver->applyNewRules(ifname, nptrs, ptrs);
+        if (update)
+            rc = virNWFilterUpdateRules(techdriver, nettype, oldfilter,
+                                        ifname, vars, driver,
+                                        nptrs, ptrs, update);
 
-        if (teardownOld && rc == 0)
-            techdriver->tearOldRules(ifname);
+        if (rc == 0 && (!update || *update == INST_UPDATE_REBUILD)) {
+            rc = techdriver->applyNewRules(ifname, nptrs, ptrs);
+
+            if (teardownOld && rc == 0)
+                techdriver->tearOldRules(ifname);
+        }
 
         if (rc == 0 && (virNetDevValidateConfig(ifname, NULL, ifindex) <= 0)) {
             virResetLastError();
@@ -790,7 +934,8 @@ __virNWFilterInstantiateFilter(const unsigned char *vmuuid,
                                enum instCase useNewFilter,
                                virNWFilterDriverStatePtr driver,
                                bool forceWithPendingReq,
-                               bool *foundNewFilter)
+                               bool *foundNewFilter,
+                               enum instUpdate *update)
 {
     int rc;
     const char *drvname = EBIPTABLES_DRIVER_ID;
@@ -883,7 +1028,9 @@ __virNWFilterInstantiateFilter(const unsigned char *vmuuid,
                                 teardownOld,
                                 macaddr,
                                 driver,
-                                forceWithPendingReq);
+                                forceWithPendingReq,
+                                obj->def,
+                                update);
 
     virNWFilterHashTableFree(vars);
 
@@ -906,7 +1053,8 @@ _virNWFilterInstantiateFilter(virConnectPtr conn,
                               const virDomainNetDefPtr net,
                               bool teardownOld,
                               enum instCase useNewFilter,
-                              bool *foundNewFilter)
+                              bool *foundNewFilter,
+                              enum instUpdate *update)
 {
     const char *linkdev = (net->type == VIR_DOMAIN_NET_TYPE_DIRECT)
                           ? net->data.direct.linkdev
@@ -940,7 +1088,8 @@ _virNWFilterInstantiateFilter(virConnectPtr conn,
                                         useNewFilter,
                                         conn->nwfilterPrivateData,
                                         false,
-                                        foundNewFilter);
+                                        foundNewFilter,
+                                        update);
 
 cleanup:
     virNWFilterUnlockFilterUpdates();
@@ -977,7 +1126,8 @@ virNWFilterInstantiateFilterLate(const unsigned char *vmuuid,
                                         INSTANTIATE_ALWAYS,
                                         driver,
                                         true,
-                                        &foundNewFilter);
+                                        &foundNewFilter,
+                                        NULL);
     if (rc < 0) {
         /* something went wrong... 'DOWN' the interface */
         if ((virNetDevValidateConfig(ifname, NULL, ifindex) <= 0) ||
@@ -1004,7 +1154,8 @@ virNWFilterInstantiateFilter(virConnectPtr conn,
     return _virNWFilterInstantiateFilter(conn, vmuuid, net,
                                          1,
                                          INSTANTIATE_ALWAYS,
-                                         &foundNewFilter);
+                                         &foundNewFilter,
+                                         NULL);
 }
 
 
@@ -1012,19 +1163,24 @@ int
 virNWFilterUpdateInstantiateFilter(virConnectPtr conn,
                                    const unsigned char *vmuuid,
                                    const virDomainNetDefPtr net,
-                                   bool *skipIface)
+                                   bool *skipIface,
+                                   bool *editRules)
 {
     bool foundNewFilter = false;
+    enum instUpdate update = INST_UPDATE_REBUILD;
 
     int rc = _virNWFilterInstantiateFilter(conn, vmuuid, net,
                                            0,
                                            INSTANTIATE_FOLLOW_NEWFILTER,
-                                           &foundNewFilter);
+                                           &foundNewFilter,
+                                           &update);
 
-    *skipIface = !foundNewFilter;
+    *skipIface = !foundNewFilter || update != INST_UPDATE_REBUILD;
+    *editRules = foundNewFilter && update == INST_UPDATE_EDIT;
     return rc;
 }
 
+
 static int
 virNWFilterRollbackUpdateFilter(const virDomainNetDefPtr net)
 {
@@ -1051,6 +1207,43 @@ virNWFilterRollbackUpdateFilter(const virDomainNetDefPtr net)
 }
 
 
+/*
+ * Remove the rules that an update of the filter dropped from the live
+ * chains of the interface and insert the ones it added. Fall back to
+ * building and switching to new chains should the rules have to be
+ * rebuilt after all, or should editing them fail. If even that fails,
+ * the interface is taken down rather than left with part of its rules.
+ */
+static int
+virNWFilterUpdateEditRules(virConnectPtr conn,
+                           const unsigned char *vmuuid,
+                           const virDomainNetDefPtr net)
+{
+    bool foundNewFilter = false;
+    enum instUpdate update = INST_UPDATE_EDIT;
+    virErrorPtr orig_err;
+    int rc;
+
+    rc = _virNWFilterInstantiateFilter(conn, vmuuid, net,
+                                       1,
+                                       INSTANTIATE_FOLLOW_NEWFILTER,
+                                       &foundNewFilter,
+                                       &update);
+    if (rc < 0) {
+        orig_err = virSaveLastError();
+        virNWFilterRollbackUpdateFilter(net);
+        if (virNetDevSetOnline(net->ifname, false) < 0)
+            VIR_WARN("Could not take down interface %s", net->ifname);
+        if (orig_err) {
+            virSetError(orig_err);
+            virFreeError(orig_err);
+        }
+    }
+
+    return rc;
+}
+
+
 static int
 virNWFilterTearOldFilter(virDomainNetDefPtr net)
 {
@@ -1123,7 +1316,8 @@ virNWFilterDomainFWUpdateCB(void *payload,
     virDomainDefPtr vm = obj->def;
     struct domUpdateCBStruct *cb = data;
     int i, err;
-    bool skipIface;
+    bool skipIface, editRules;
+    void *skip;
 
     virDomainObjLock(obj);
 
@@ -1136,12 +1330,16 @@ virNWFilterDomainFWUpdateCB(void *payload,
                     cb->err = virNWFilterUpdateInstantiateFilter(cb->conn,
                                                                  vm->uuid,
                                                                  net,
-                                                                 &skipIface);
+                                                                 &skipIface,
+                                                                 &editRules);
                     if (cb->err == 0 && skipIface) {
-                        /* filter tree unchanged -- no update needed */
+                        /* no new chains built; rules unchanged or to be
+                           edited in the live chains when committing */
                         cb->err = virHashAddEntry(cb->skipInterfaces,
                                                   net->ifname,
-                                                  (void *)~0);
+                                                  editRules
+                                                  ? SKIP_IFACE_EDIT_RULES
+                                                  : SKIP_IFACE_UNCHANGED);
                     }
                     break;
 
@@ -1152,10 +1350,20 @@ virNWFilterDomainFWUpdateCB(void *payload,
                     break;
 
                 case STEP_TEAR_OLD:
-                    if ( !virHashLookup(cb->skipInterfaces, net->ifname)) {
-                        cb->err = virNWFilterTearOldFilter(net);
-                    }
-                    break;
+                    /* switch over every interface whatever fails, but
+                       keep the first error for the caller */
+                    skip = virHashLookup(cb->skipInterfaces, net->ifname);
+                    if (!skip)
+                        err = virNWFilterTearOldFilter(net);
+                    else if (skip == SKIP_IFACE_EDIT_RULES)
+                        err = virNWFilterUpdateEditRules(cb->conn,
+                                                         vm->uuid,
+                                                         net);
+                    else
+                        err = 0;
+                    if (err && !cb->err)
+                        cb->err = err;
+                    continue;
 
                 case STEP_APPLY_CURRENT:
                     err = virNWFilterInstantiateFilter(cb->conn,
@@ -43,7 +43,8 @@ int virNWFilterInstantiateFilter(virConnectPtr conn,
 int virNWFilterUpdateInstantiateFilter(virConnectPtr conn,
                                        const unsigned char *vmuuid,
                                        const virDomainNetDefPtr net,
-                                       bool *skipIface);
+                                       bool *skipIface,
+                                       bool *editRules);
 
 int virNWFilterInstantiateFilterLate(const unsigned char *vmuuid,
                                      const char *ifname,
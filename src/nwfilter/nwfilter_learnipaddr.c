@@ -25,12 +25,11 @@
 
 #include <config.h>
 
-#ifdef HAVE_LIBPCAP
-# include <pcap.h>
-#endif
-
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -38,6 +37,11 @@
 #include <netinet/udp.h>
 #include <net/if_arp.h>
 
+#ifdef __linux__
+# include <linux/if_packet.h>
+# include <linux/filter.h>
+#endif
+
 #include "internal.h"
 
 #include "intprops.h"
@@ -48,6 +52,8 @@
 #include "virnetdev.h"
 #include "virterror_internal.h"
 #include "threads.h"
+#include "virfile.h"
+#include "virtime.h"
 #include "conf/nwfilter_params.h"
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
@@ -62,6 +68,13 @@
 
 #define PKT_TIMEOUT_MS 500 /* ms */
 
+/* frames are captured through a TPACKET_V3 ring of this geometry */
+#define LEARN_RING_BLOCK_SIZE   (1 << 16)
+#define LEARN_RING_BLOCK_NR     16
+#define LEARN_RING_FRAME_SIZE   2048
+#define LEARN_RING_BLOCK_TOV_MS 10
+#define LEARN_SNAPLEN           1600
+
 /* structure of an ARP request/reply message */
 struct f_arphdr {
     struct arphdr arphdr;
@@ -135,6 +148,26 @@ struct _virNWFilterIfaceLock {
 
 static bool threadsTerminate = false;
 
+/* the capture thread serving all requests */
+static virMutex learnLock;
+static bool learnInitialized;
+static bool learnRunning;
+static volatile bool learnQuit;
+static virThread learnThread;
+static int learnSock = -1;
+static int learnWakeupFds[2] = { -1, -1 };
+static unsigned char *learnRing;
+static size_t learnRingSize;
+
+/* requests handed to the capture thread; protected by learnLock */
+static virNWFilterIPAddrLearnReqPtr *learnQueue;
+static size_t nlearnQueue;
+
+/* requests being served; only accessed by the capture thread */
+static virNWFilterIPAddrLearnReqPtr *learnActive;
+static size_t nlearnActive;
+static bool learnFilterDirty;
+
 
 int
 virNWFilterLockIface(const char *ifname) {
@@ -226,7 +259,7 @@ virNWFilterIPAddrLearnReqFree(virNWFilterIPAddrLearnReqPtr req) {
 }
 
 
-#if HAVE_LIBPCAP
+#ifdef __linux__
 
 static int
 virNWFilterRegisterLearnReq(virNWFilterIPAddrLearnReqPtr req) {
@@ -294,7 +327,7 @@ freeLearnReqEntry(void *payload, const void *name ATTRIBUTE_UNUSED) {
 }
 
 
-#ifdef HAVE_LIBPCAP
+#ifdef __linux__
 
 static virNWFilterIPAddrLearnReqPtr
 virNWFilterDeregisterLearnReq(int ifindex) {
@@ -417,7 +450,7 @@ virNWFilterGetIpAddrForIfname(const char *ifname)
 }
 
 
-#ifdef HAVE_LIBPCAP
+#ifdef __linux__
 
 static void
 procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
@@ -455,44 +488,272 @@ procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
 
 
 /**
- * learnIPAddressThread
- * arg: pointer to virNWFilterIPAddrLearnReq structure
+ * learnProcessFrame
+ * @req: the request the frame was captured for
+ * @packet: the frame
+ * @len: the length of the frame
+ * @howDetected: pointer to store how the IP address was detected
+ *
+ * Use ARP Request and Reply messages, DHCP offers and the first IP packet
+ * being sent from the VM to detect the IP address it is using. Detects
+ * only one IP address per interface (IP aliasing not supported).
  *
- * Learn the IP address being used on an interface. Use ARP Request and
- * Reply messages, DHCP offers and the first IP packet being sent from
- * the VM to detect the IP address it is using. Detects only one IP address
- * per interface (IP aliasing not supported). The method on how the
- * IP address is detected can be chosen through flags. DETECT_DHCP will
- * require that the IP address is detected from a DHCP OFFER, DETECT_STATIC
- * will require that the IP address was taken from an ARP packet or an IPv4
- * packet. Both flags can be set at the same time.
+ * Returns the IP address of the VM or 0 if the frame does not reveal it.
  */
-static void *
-learnIPAddressThread(void *arg)
+static uint32_t
+learnProcessFrame(virNWFilterIPAddrLearnReqPtr req,
+                  const unsigned char *packet, unsigned int len,
+                  enum howDetect *howDetected)
 {
-    char errbuf[PCAP_ERRBUF_SIZE] = {0};
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    struct pcap_pkthdr header;
-    const u_char *packet;
     struct ether_header *ether_hdr;
     struct ether_vlan_header *vlan_hdr;
-    virNWFilterIPAddrLearnReqPtr req = arg;
     uint32_t vmaddr = 0, bcastaddr = 0;
     unsigned int ethHdrSize;
-    char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
-                                                  : req->ifname;
     int dhcp_opts_len;
-    char macaddr[VIR_MAC_STRING_BUFLEN];
-    virBuffer buf = VIR_BUFFER_INITIALIZER;
-    char *filter = NULL;
     uint16_t etherType;
-    bool showError = true;
-    enum howDetect howDetected = 0;
+
+    if (len < sizeof(struct ether_header))
+        return 0;
+
+    ether_hdr = (struct ether_header*)packet;
+
+    switch (ntohs(ether_hdr->ether_type)) {
+
+    case ETHERTYPE_IP:
+    case ETHERTYPE_ARP:
+        ethHdrSize = sizeof(struct ether_header);
+        etherType = ntohs(ether_hdr->ether_type);
+        break;
+
+    case ETHERTYPE_VLAN:
+        ethHdrSize = sizeof(struct ether_vlan_header);
+        vlan_hdr = (struct ether_vlan_header *)packet;
+        if (len < ethHdrSize ||
+            (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP &&
+             ntohs(vlan_hdr->ether_type) != ETHERTYPE_ARP))
+            return 0;
+        etherType = ntohs(vlan_hdr->ether_type);
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (memcmp(ether_hdr->ether_shost,
+               req->macaddr,
+               VIR_MAC_BUFLEN) == 0) {
+        /* packets from the VM */
+
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            vmaddr = iphdr->saddr;
+            /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
+             * class E (240.0.0.0 - 255.255.255.255, includes eth.
+             * bcast) and zero address in DHCP Requests */
+            if ( (ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
+                 vmaddr == 0)
+                return 0;
+
+            *howDetected = DETECT_STATIC;
+        } else if (etherType == ETHERTYPE_ARP &&
+                   (len >= ethHdrSize +
+                           sizeof(struct f_arphdr))) {
+            struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
+                                                         ethHdrSize);
+            switch (ntohs(arphdr->arphdr.ar_op)) {
+            case ARPOP_REPLY:
+                vmaddr = arphdr->ar_sip;
+                *howDetected = DETECT_STATIC;
+            break;
+            case ARPOP_REQUEST:
+                vmaddr = arphdr->ar_tip;
+                *howDetected = DETECT_STATIC;
+            break;
+            }
+        }
+    } else if (memcmp(ether_hdr->ether_dhost,
+                      req->macaddr,
+                      VIR_MAC_BUFLEN) == 0) {
+        /* packets to the VM */
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            if ((iphdr->protocol == IPPROTO_UDP) &&
+                (len >= ethHdrSize +
+                        iphdr->ihl * 4 +
+                        sizeof(struct udphdr))) {
+                struct udphdr *udphdr= (struct udphdr *)
+                                  ((char *)iphdr + iphdr->ihl * 4);
+                if (ntohs(udphdr->source) == 67 &&
+                    ntohs(udphdr->dest)   == 68 &&
+                    len >= ethHdrSize +
+                           iphdr->ihl * 4 +
+                           sizeof(struct udphdr) +
+                           sizeof(struct dhcp)) {
+                    struct dhcp *dhcp = (struct dhcp *)
+                                ((char *)udphdr + sizeof(struct udphdr));
+                    if (dhcp->op == 2 /* BOOTREPLY */ &&
+                        !memcmp(&dhcp->chaddr[0],
+                                req->macaddr,
+                                6)) {
+                        dhcp_opts_len = len -
+                            (ethHdrSize + iphdr->ihl * 4 +
+                             sizeof(struct udphdr) +
+                             sizeof(struct dhcp));
+                        procDHCPOpts(dhcp, dhcp_opts_len,
+                                     &vmaddr,
+                                     &bcastaddr,
+                                     howDetected);
+                    }
+                }
+            }
+        }
+    }
+
+    return vmaddr;
+}
+
+
+/**
+ * learnReqApply
+ * @opaque: the request
+ *
+ * Instantiate the filter of the interface with the learned IP address or
+ * block all its traffic if learning failed, then release the request.
+ * Runs in a thread of its own so that the capture thread does not wait
+ * for the firewall tools.
+ */
+static void
+learnReqApply(void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
     virNWFilterTechDriverPtr techdriver = req->techdriver;
 
     if (virNWFilterLockIface(req->ifname) < 0)
-       goto err_no_lock;
+        goto cleanup;
+
+    /* the interface is being torn down; do not leave rules behind */
+    if (req->terminate)
+        goto unlock;
+
+    if (req->status == 0) {
+        int ret;
+        virSocketAddr sa;
+        sa.len = sizeof(sa.data.inet4);
+        sa.data.inet4.sin_family = AF_INET;
+        sa.data.inet4.sin_addr.s_addr = req->vmaddr;
+        char *inetaddr;
+
+        if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
+            if (virNWFilterAddIpAddrForIfname(req->ifname, inetaddr) < 0) {
+                VIR_ERROR(_("Failed to add IP address %s to IP address "
+                          "cache for interface %s"), inetaddr, req->ifname);
+            }
+
+            ret = virNWFilterInstantiateFilterLate(NULL,
+                                                   req->ifname,
+                                                   req->ifindex,
+                                                   req->linkdev,
+                                                   req->nettype,
+                                                   req->macaddr,
+                                                   req->filtername,
+                                                   req->filterparams,
+                                                   req->driver);
+            VIR_DEBUG("Result from applying firewall rules on "
+                      "%s with IP addr %s : %d\n", req->ifname, inetaddr, ret);
+        }
+    } else {
+        if (req->showError)
+            virReportSystemError(req->status,
+                                 _("encountered an error on interface %s "
+                                   "index %d"),
+                                 req->ifname, req->ifindex);
+
+        techdriver->applyDropAllRules(req->ifname);
+    }
+
+unlock:
+    virNWFilterUnlockIface(req->ifname);
+
+cleanup:
+    VIR_DEBUG("IP address learning terminating for interface %s\n",
+              req->ifname);
+
+    virNWFilterDeregisterLearnReq(req->ifindex);
+
+    virNWFilterIPAddrLearnReqFree(req);
+}
+
+
+/**
+ * learnReqFinish
+ * @req: the request
+ * @vmaddr: the learned IP address if the request's status is 0
+ * @showError: whether to report a failure of the request
+ *
+ * Hand a request the capture thread is done with to a worker thread
+ * that applies the resulting rules.
+ */
+static void
+learnReqFinish(virNWFilterIPAddrLearnReqPtr req,
+               uint32_t vmaddr,
+               bool showError)
+{
+    virThread thread;
+
+    req->vmaddr = vmaddr;
+    req->showError = showError;
+
+    if (virThreadCreate(&thread, false, learnReqApply, req) < 0) {
+        VIR_WARN("Failed to create thread applying rules of interface %s",
+                 req->ifname);
+        learnReqApply(req);
+    }
+}
+
+
+/**
+ * learnReqStart
+ * @req: the request
+ *
+ * Have the capture thread listen on the interface (or link device) of
+ * a request whose restricting rules are installed.
+ */
+static void
+learnReqStart(virNWFilterIPAddrLearnReqPtr req)
+{
+    if (VIR_EXPAND_N(learnActive, nlearnActive, 1) < 0) {
+        req->status = ENOMEM;
+        learnReqFinish(req, 0, true);
+        return;
+    }
+    learnActive[nlearnActive - 1] = req;
+    learnFilterDirty = true;
+}
+
+
+/**
+ * learnReqPrepare
+ * @opaque: the request
+ *
+ * Install the rules restricting the traffic of the interface while its
+ * IP address is learned, then hand the request to the capture thread.
+ * Runs in a thread of its own so that the capture thread does not wait
+ * for the firewall tools while serving the other interfaces.
+ */
+static void
+learnReqPrepare(void *opaque)
+{
+    virNWFilterIPAddrLearnReqPtr req = opaque;
+    const char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
+                                                        : req->ifname;
+    virNWFilterTechDriverPtr techdriver = req->techdriver;
+    int rc;
 
     req->status = 0;
 
@@ -500,244 +761,522 @@ learnIPAddressThread(void *arg)
     if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
         virResetLastError();
         req->status = ENODEV;
-        goto done;
+        goto error;
     }
 
-    handle = pcap_open_live(listen_if, BUFSIZ, 0, PKT_TIMEOUT_MS, errbuf);
-
-    if (handle == NULL) {
-        VIR_DEBUG("Couldn't open device %s: %s\n", listen_if, errbuf);
+    if (virNetDevGetIndex(listen_if, &req->listenIndex) < 0) {
+        VIR_DEBUG("Couldn't get index of device %s", listen_if);
+        virResetLastError();
         req->status = ENODEV;
-        goto done;
+        goto error;
     }
 
-    virMacAddrFormat(req->macaddr, macaddr);
+    if (virNWFilterLockIface(req->ifname) < 0) {
+        virResetLastError();
+        req->status = ENOMEM;
+        goto error;
+    }
 
     switch (req->howDetect) {
     case DETECT_DHCP:
-        if (techdriver->applyDHCPOnlyRules(req->ifname,
-                                           req->macaddr,
-                                           NULL, false) < 0) {
-            req->status = EINVAL;
-            goto done;
-        }
-        virBufferAsprintf(&buf, " ether dst %s"
-                                " and src port 67 and dst port 68",
-                          macaddr);
+        rc = techdriver->applyDHCPOnlyRules(req->ifname,
+                                            req->macaddr,
+                                            NULL, false);
         break;
     default:
-        if (techdriver->applyBasicRules(req->ifname,
-                                        req->macaddr) < 0) {
-            req->status = EINVAL;
-            goto done;
-        }
-        virBufferAsprintf(&buf, "ether host %s", macaddr);
+        rc = techdriver->applyBasicRules(req->ifname,
+                                         req->macaddr);
     }
 
-    if (virBufferError(&buf)) {
-        req->status = ENOMEM;
-        goto done;
+    virNWFilterUnlockIface(req->ifname);
+
+    if (rc < 0) {
+        req->status = EINVAL;
+        goto error;
     }
 
-    filter = virBufferContentAndReset(&buf);
+    virMutexLock(&learnLock);
 
-    if (pcap_compile(handle, &fp, filter, 1, 0) != 0) {
-        VIR_DEBUG("Couldn't compile filter '%s'.\n", filter);
-        req->status = EINVAL;
-        goto done;
+    if (!learnRunning) {
+        virMutexUnlock(&learnLock);
+        req->status = ECANCELED;
+        goto error;
     }
 
-    if (pcap_setfilter(handle, &fp) != 0) {
-        VIR_DEBUG("Couldn't set filter '%s'.\n", filter);
-        req->status = EINVAL;
-        pcap_freecode(&fp);
-        goto done;
+    if (VIR_EXPAND_N(learnQueue, nlearnQueue, 1) < 0) {
+        virMutexUnlock(&learnLock);
+        req->status = ENOMEM;
+        goto error;
     }
+    learnQueue[nlearnQueue - 1] = req;
 
-    pcap_freecode(&fp);
+    ignore_value(safewrite(learnWakeupFds[1], "", 1));
 
-    while (req->status == 0 && vmaddr == 0) {
-        packet = pcap_next(handle, &header);
+    virMutexUnlock(&learnLock);
 
-        if (!packet) {
+    return;
 
-            if (threadsTerminate || req->terminate) {
-                req->status = ECANCELED;
-                showError = false;
-                break;
-            }
+error:
+    req->vmaddr = 0;
+    req->showError = true;
+    learnReqApply(req);
+}
 
-            /* check whether VM's dev is still there */
-            if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
-                virResetLastError();
-                req->status = ENODEV;
-                showError = false;
+
+/* Remove a request from the ones the capture thread serves */
+static virNWFilterIPAddrLearnReqPtr
+learnActiveRemove(size_t i)
+{
+    virNWFilterIPAddrLearnReqPtr req = learnActive[i];
+
+    if (i < nlearnActive - 1)
+        memmove(learnActive + i, learnActive + i + 1,
+                sizeof(*learnActive) * (nlearnActive - i - 1));
+    VIR_SHRINK_N(learnActive, nlearnActive, 1);
+    learnFilterDirty = true;
+
+    return req;
+}
+
+
+/**
+ * learnSetFilter
+ *
+ * Attach a BPF program to the capture socket that only lets IPv4 and ARP
+ * frames (plain or VLAN tagged) of the interfaces being listened on pass.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+learnSetFilter(void)
+{
+    struct sock_filter *code;
+    struct sock_fprog prog;
+    size_t i, j, n = 0, proto;
+    int ret = -1;
+
+    /* load, 2 per interface, drop and 6 for the ethertype check */
+    if (VIR_ALLOC_N(code, 2 * nlearnActive + 8) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    code[n++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX);
+
+    for (i = 0; i < nlearnActive; i++) {
+        /* macvtap devices may share their link device */
+        for (j = 0; j < i; j++) {
+            if (learnActive[j]->listenIndex == learnActive[i]->listenIndex)
                 break;
-            }
+        }
+        if (j < i)
+            continue;
+        code[n++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                     learnActive[i]->listenIndex, 0, 1);
+        /* offset to the ethertype check is filled in below */
+        code[n++] = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0);
+    }
+
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+    proto = n;
+    for (i = 0; i < proto; i++) {
+        if (code[i].code == (BPF_JMP | BPF_JA))
+            code[i].k = proto - (i + 1);
+    }
+
+    code[n++] = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS,
+                 offsetof(struct ether_header, ether_type));
+    code[n++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 3, 0);
+    code[n++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_ARP, 2, 0);
+    code[n++] = (struct sock_filter)
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_VLAN, 1, 0);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, LEARN_SNAPLEN);
+
+    prog.len = n;
+    prog.filter = code;
+
+    if (setsockopt(learnSock, SOL_SOCKET, SO_ATTACH_FILTER,
+                   &prog, sizeof(prog)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot attach filter to packet socket"));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(code);
+    return ret;
+}
+
+
+/*
+ * Receive frames through a TPACKET_V3 ring if the kernel supports it;
+ * otherwise frames are read from the socket one by one.
+ */
+static void
+learnSetupRing(void)
+{
+# ifdef TPACKET_V3
+    int version = TPACKET_V3;
+    struct tpacket_req3 treq;
+
+    memset(&treq, 0, sizeof(treq));
+    treq.tp_block_size = LEARN_RING_BLOCK_SIZE;
+    treq.tp_block_nr = LEARN_RING_BLOCK_NR;
+    treq.tp_frame_size = LEARN_RING_FRAME_SIZE;
+    treq.tp_frame_nr = (LEARN_RING_BLOCK_SIZE / LEARN_RING_FRAME_SIZE) *
+                       LEARN_RING_BLOCK_NR;
+    treq.tp_retire_blk_tov = LEARN_RING_BLOCK_TOV_MS;
+
+    if (setsockopt(learnSock, SOL_PACKET, PACKET_VERSION,
+                   &version, sizeof(version)) < 0 ||
+        setsockopt(learnSock, SOL_PACKET, PACKET_RX_RING,
+                   &treq, sizeof(treq)) < 0) {
+        VIR_DEBUG("Cannot set up TPACKET_V3 ring: %s", strerror(errno));
+        return;
+    }
+
+    learnRingSize = LEARN_RING_BLOCK_SIZE * LEARN_RING_BLOCK_NR;
+    learnRing = mmap(NULL, learnRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, learnSock, 0);
+    if (learnRing == MAP_FAILED) {
+        VIR_DEBUG("Cannot map TPACKET_V3 ring: %s", strerror(errno));
+        learnRing = NULL;
+        /* remove the ring so frames are queued on the socket again */
+        memset(&treq, 0, sizeof(treq));
+        ignore_value(setsockopt(learnSock, SOL_PACKET, PACKET_RX_RING,
+                                &treq, sizeof(treq)));
+    }
+# endif
+}
+
+
+/* Hand a frame captured on the given interface to the requests
+ * listening on it */
+static void
+learnDispatchFrame(int ifindex, const unsigned char *packet,
+                   unsigned int len)
+{
+    size_t i;
+    uint32_t vmaddr;
+    enum howDetect howDetected;
+
+    for (i = 0; i < nlearnActive; i++) {
+        virNWFilterIPAddrLearnReqPtr req = learnActive[i];
+
+        if (req->listenIndex != ifindex)
             continue;
+
+        howDetected = 0;
+        vmaddr = learnProcessFrame(req, packet, len, &howDetected);
+        if (vmaddr && (req->howDetect & howDetected) != 0) {
+            learnReqFinish(learnActiveRemove(i), vmaddr, true);
+            return;
         }
+    }
+}
 
-        if (header.len >= sizeof(struct ether_header)) {
-            ether_hdr = (struct ether_header*)packet;
 
-            switch (ntohs(ether_hdr->ether_type)) {
+static void
+learnReadRing(unsigned int *block)
+{
+# ifdef TPACKET_V3
+    struct tpacket_block_desc *pbd;
+    struct tpacket3_hdr *ppd;
+    struct sockaddr_ll *sll;
+    unsigned int i;
+
+    for (;;) {
+        pbd = (struct tpacket_block_desc *)
+              (learnRing + *block * LEARN_RING_BLOCK_SIZE);
+        if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER))
+            break;
+
+        ppd = (struct tpacket3_hdr *)
+              ((unsigned char *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < pbd->hdr.bh1.num_pkts; i++) {
+            sll = (struct sockaddr_ll *)
+                  ((unsigned char *)ppd +
+                   TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            learnDispatchFrame(sll->sll_ifindex,
+                               (unsigned char *)ppd + ppd->tp_mac,
+                               ppd->tp_snaplen);
+            ppd = (struct tpacket3_hdr *)
+                  ((unsigned char *)ppd + ppd->tp_next_offset);
+        }
 
-            case ETHERTYPE_IP:
-                ethHdrSize = sizeof(struct ether_header);
-                etherType = ntohs(ether_hdr->ether_type);
-                break;
+        /* return the block to the kernel */
+        __sync_synchronize();
+        pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        *block = (*block + 1) % LEARN_RING_BLOCK_NR;
+    }
+# else
+    (void)block;
+# endif
+}
 
-            case ETHERTYPE_VLAN:
-                ethHdrSize = sizeof(struct ether_vlan_header);
-                vlan_hdr = (struct ether_vlan_header *)packet;
-                if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
-                    header.len < ethHdrSize)
-                    continue;
-                etherType = ntohs(vlan_hdr->ether_type);
-                break;
 
-            default:
-                continue;
-            }
+static void
+learnReadSocket(void)
+{
+    unsigned char packet[LEARN_SNAPLEN];
+    struct sockaddr_ll sll;
+    socklen_t slen;
+    ssize_t len;
+
+    for (;;) {
+        slen = sizeof(sll);
+        len = recvfrom(learnSock, packet, sizeof(packet), 0,
+                       (struct sockaddr *)&sll, &slen);
+        if (len < 0)
+            break;
+        learnDispatchFrame(sll.sll_ifindex, packet, len);
+    }
+}
 
-            if (memcmp(ether_hdr->ether_shost,
-                       req->macaddr,
-                       VIR_MAC_BUFLEN) == 0) {
-                /* packets from the VM */
-
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    vmaddr = iphdr->saddr;
-                    /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
-                     * class E (240.0.0.0 - 255.255.255.255, includes eth.
-                     * bcast) and zero address in DHCP Requests */
-                    if ( (ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
-                         vmaddr == 0) {
-                        vmaddr = 0;
-                        continue;
-                    }
 
-                    howDetected = DETECT_STATIC;
-                } else if (etherType == ETHERTYPE_ARP &&
-                           (header.len >= ethHdrSize +
-                                          sizeof(struct f_arphdr))) {
-                    struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
-                                                         ethHdrSize);
-                    switch (ntohs(arphdr->arphdr.ar_op)) {
-                    case ARPOP_REPLY:
-                        vmaddr = arphdr->ar_sip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    case ARPOP_REQUEST:
-                        vmaddr = arphdr->ar_tip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    }
-                }
-            } else if (memcmp(ether_hdr->ether_dhost,
-                              req->macaddr,
-                              VIR_MAC_BUFLEN) == 0) {
-                /* packets to the VM */
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    if ((iphdr->protocol == IPPROTO_UDP) &&
-                        (header.len >= ethHdrSize +
-                                       iphdr->ihl * 4 +
-                                       sizeof(struct udphdr))) {
-                        struct udphdr *udphdr= (struct udphdr *)
-                                          ((char *)iphdr + iphdr->ihl * 4);
-                        if (ntohs(udphdr->source) == 67 &&
-                            ntohs(udphdr->dest)   == 68 &&
-                            header.len >= ethHdrSize +
-                                          iphdr->ihl * 4 +
-                                          sizeof(struct udphdr) +
-                                          sizeof(struct dhcp)) {
-                            struct dhcp *dhcp = (struct dhcp *)
-                                        ((char *)udphdr + sizeof(udphdr));
-                            if (dhcp->op == 2 /* BOOTREPLY */ &&
-                                !memcmp(&dhcp->chaddr[0],
-                                        req->macaddr,
-                                        6)) {
-                                dhcp_opts_len = header.len -
-                                    (ethHdrSize + iphdr->ihl * 4 +
-                                     sizeof(struct udphdr) +
-                                     sizeof(struct dhcp));
-                                procDHCPOpts(dhcp, dhcp_opts_len,
-                                             &vmaddr,
-                                             &bcastaddr,
-                                             &howDetected);
-                            }
-                        }
-                    }
-                }
-            }
+/* Start new requests and finish the ones that were terminated or whose
+ * interface disappeared */
+static void
+learnCheckReqs(bool validate)
+{
+    virNWFilterIPAddrLearnReqPtr *queue;
+    size_t i, nqueue;
+
+    virMutexLock(&learnLock);
+    queue = learnQueue;
+    nqueue = nlearnQueue;
+    learnQueue = NULL;
+    nlearnQueue = 0;
+    virMutexUnlock(&learnLock);
+
+    for (i = 0; i < nqueue; i++)
+        learnReqStart(queue[i]);
+    VIR_FREE(queue);
+
+    i = 0;
+    while (i < nlearnActive) {
+        virNWFilterIPAddrLearnReqPtr req = learnActive[i];
+
+        if (threadsTerminate || req->terminate || learnQuit) {
+            req->status = ECANCELED;
+            learnReqFinish(learnActiveRemove(i), 0, false);
+            continue;
         }
-        if (vmaddr && (req->howDetect & howDetected) == 0) {
-            vmaddr = 0;
-            howDetected = 0;
+
+        /* check whether VM's dev is still there */
+        if (validate &&
+            virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
+            virResetLastError();
+            req->status = ENODEV;
+            learnReqFinish(learnActiveRemove(i), 0, false);
+            continue;
         }
-    } /* while */
 
- done:
-    VIR_FREE(filter);
+        i++;
+    }
+}
 
-    if (handle)
-        pcap_close(handle);
 
-    if (req->status == 0) {
-        int ret;
-        virSocketAddr sa;
-        sa.len = sizeof(sa.data.inet4);
-        sa.data.inet4.sin_family = AF_INET;
-        sa.data.inet4.sin_addr.s_addr = vmaddr;
-        char *inetaddr;
+/**
+ * learnCaptureThread
+ *
+ * Capture the traffic of all interfaces whose IP address is being learned
+ * on a single packet socket and hand the frames to the requests by the
+ * index of the interface they were captured on.
+ */
+static void
+learnCaptureThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    struct pollfd fds[2];
+    unsigned int block = 0;
+    unsigned long long now, lastCheck = 0;
+    char buf[16];
+
+    while (!learnQuit) {
+        fds[0].fd = learnSock;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = learnWakeupFds[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, ARRAY_CARDINALITY(fds), PKT_TIMEOUT_MS) < 0 &&
+            errno != EINTR)
+            VIR_WARN("poll on packet socket failed: %s", strerror(errno));
+
+        if (fds[1].revents & POLLIN) {
+            while (read(learnWakeupFds[0], buf, sizeof(buf)) > 0)
+                ;
+        }
 
-        if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
-            if (virNWFilterAddIpAddrForIfname(req->ifname, inetaddr) < 0) {
-                VIR_ERROR(_("Failed to add IP address %s to IP address "
-                          "cache for interface %s"), inetaddr, req->ifname);
-            }
+        if (learnRing)
+            learnReadRing(&block);
+        else
+            learnReadSocket();
 
-            ret = virNWFilterInstantiateFilterLate(NULL,
-                                                   req->ifname,
-                                                   req->ifindex,
-                                                   req->linkdev,
-                                                   req->nettype,
-                                                   req->macaddr,
-                                                   req->filtername,
-                                                   req->filterparams,
-                                                   req->driver);
-            VIR_DEBUG("Result from applying firewall rules on "
-                      "%s with IP addr %s : %d\n", req->ifname, inetaddr, ret);
+        if (virTimeMillisNow(&now) < 0) {
+            virResetLastError();
+            now = lastCheck + PKT_TIMEOUT_MS;
         }
-    } else {
-        if (showError)
-            virReportSystemError(req->status,
-                                 _("encountered an error on interface %s "
-                                   "index %d"),
-                                 req->ifname, req->ifindex);
 
-        techdriver->applyDropAllRules(req->ifname);
+        learnCheckReqs(now - lastCheck >= PKT_TIMEOUT_MS);
+        if (now - lastCheck >= PKT_TIMEOUT_MS)
+            lastCheck = now;
+
+        if (learnFilterDirty) {
+            if (learnSetFilter() < 0)
+                virResetLastError();
+            learnFilterDirty = false;
+        }
     }
 
-    memset(&req->thread, 0x0, sizeof(req->thread));
+    learnCheckReqs(false);
 
-    VIR_DEBUG("pcap thread terminating for interface %s\n",req->ifname);
+    VIR_DEBUG("IP address learning thread terminating");
+}
 
-    virNWFilterUnlockIface(req->ifname);
 
- err_no_lock:
-    virNWFilterDeregisterLearnReq(req->ifindex);
+static void
+learnCleanup(void)
+{
+    if (learnRing) {
+        munmap(learnRing, learnRingSize);
+        learnRing = NULL;
+    }
+    VIR_FORCE_CLOSE(learnSock);
+    VIR_FORCE_CLOSE(learnWakeupFds[0]);
+    VIR_FORCE_CLOSE(learnWakeupFds[1]);
+    VIR_FREE(learnActive);
+    nlearnActive = 0;
+}
 
-    virNWFilterIPAddrLearnReqFree(req);
+
+/*
+ * Open the packet socket and start the capture thread unless running.
+ * Call with learnLock held.
+ */
+static int
+learnStart(void)
+{
+    struct sockaddr_ll sll;
+
+    if (learnRunning)
+        return 0;
+
+    /* no frames are received before the socket is bound */
+    learnSock = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+    if (learnSock < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot open packet socket"));
+        return -1;
+    }
+
+    /* drop all frames until an interface is listened on */
+    if (learnSetFilter() < 0)
+        goto error;
+
+    learnSetupRing();
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+
+    if (bind(learnSock, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot bind packet socket"));
+        goto error;
+    }
+
+    if (!learnRing && virSetNonBlock(learnSock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot set packet socket non-blocking"));
+        goto error;
+    }
+
+    if (pipe2(learnWakeupFds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create wakeup pipe"));
+        goto error;
+    }
+
+    learnQuit = false;
+    learnFilterDirty = false;
+
+    if (virThreadCreate(&learnThread, true, learnCaptureThread, NULL) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot create IP address learning thread"));
+        goto error;
+    }
+
+    learnRunning = true;
 
     return 0;
+
+error:
+    learnCleanup();
+    return -1;
+}
+
+
+static void
+learnStop(void)
+{
+    if (!learnInitialized)
+        return;
+
+    virMutexLock(&learnLock);
+
+    if (learnRunning) {
+        learnQuit = true;
+        ignore_value(safewrite(learnWakeupFds[1], "", 1));
+        virMutexUnlock(&learnLock);
+
+        virThreadJoin(&learnThread);
+
+        virMutexLock(&learnLock);
+        learnCleanup();
+        learnRunning = false;
+    }
+
+    virMutexUnlock(&learnLock);
+}
+
+
+/* Start the capture thread and prepare a request for it */
+static int
+learnSubmit(virNWFilterIPAddrLearnReqPtr req)
+{
+    virThread thread;
+    int ret = -1;
+
+    virMutexLock(&learnLock);
+
+    if (learnStart() < 0)
+        goto cleanup;
+
+    if (virThreadCreate(&thread, false, learnReqPrepare, req) < 0) {
+        virReportSystemError(errno,
+                             _("cannot create thread preparing IP address "
+                               "learning on interface %s"), req->ifname);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&learnLock);
+
+    return ret;
 }
 
 
@@ -757,11 +1296,11 @@ learnIPAddressThread(void *arg)
  *              IP address; must choose any of the available flags
  *
  * Instruct to learn the IP address being used on a given interface (ifname).
- * Unless there already is a thread attempting to learn the IP address
- * being used on the interface, a thread is started that will listen on
- * the traffic being sent on the interface (or link device) with the
- * MAC address that is provided. Will then launch the application of the
- * firewall rules on the interface.
+ * Unless the IP address being used on the interface is already being
+ * learned, the capture thread is told to listen on the traffic being sent
+ * on the interface (or link device) with the MAC address that is provided.
+ * It will then launch the application of the firewall rules on the
+ * interface.
  */
 int
 virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -839,10 +1378,7 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
     if (rc < 0)
         goto err_free_req;
 
-    if (pthread_create(&req->thread,
-                       NULL,
-                       learnIPAddressThread,
-                       req) != 0)
+    if (learnSubmit(req) < 0)
         goto err_dereg_req;
 
     return 0;
@@ -876,7 +1412,7 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver ATTRIBUTE_UNUSED,
                              "support"));
     return -1;
 }
-#endif /* HAVE_LIBPCAP */
+#endif /* __linux__ */
 
 
 /**
@@ -924,6 +1460,12 @@ virNWFilterLearnInit(void) {
         return -1;
     }
 
+    if (virMutexInit(&learnLock) < 0) {
+        virNWFilterLearnShutdown();
+        return -1;
+    }
+    learnInitialized = true;
+
     return 0;
 }
 
@@ -951,6 +1493,15 @@ virNWFilterLearnShutdown(void)
 
     virNWFilterLearnThreadsTerminate(false);
 
+#ifdef __linux__
+    learnStop();
+#endif
+
+    if (learnInitialized) {
+        virMutexDestroy(&learnLock);
+        learnInitialized = false;
+    }
+
     virHashFree(pendingLearnReq);
     pendingLearnReq = NULL;
 
@@ -47,8 +47,10 @@ struct _virNWFilterIPAddrLearnReq {
     enum howDetect howDetect;
 
     int status;
-    pthread_t thread;
+    int listenIndex;
     volatile bool terminate;
+    uint32_t vmaddr;
+    bool showError;
 };
 
 int virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
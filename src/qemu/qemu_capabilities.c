@@ -152,6 +152,7 @@ VIR_ENUM_IMPL(qemuCaps, QEMU_CAPS_LAST,
               "fsdev-writeout",
 
               "drive-iotune", /* 85 */
+              "virtio-net-pci.mq",
     );
 
 struct qemu_feature_flags {
@@ -1437,6 +1438,8 @@ qemuCapsParseDeviceStr(const char *str, virBitmapPtr flags)
         qemuCapsSet(flags, QEMU_CAPS_VIRTIO_BLK_EVENT_IDX);
     if (strstr(str, "virtio-net-pci.event_idx"))
         qemuCapsSet(flags, QEMU_CAPS_VIRTIO_NET_EVENT_IDX);
+    if (strstr(str, "virtio-net-pci.mq"))
+        qemuCapsSet(flags, QEMU_CAPS_VIRTIO_NET_MQ);
     if (strstr(str, "virtio-blk-pci.scsi"))
         qemuCapsSet(flags, QEMU_CAPS_VIRTIO_BLK_SCSI);
 
@@ -120,6 +120,7 @@ enum qemuCapsFlags {
     QEMU_CAPS_CPU_HOST           = 83, /* support for -cpu host */
     QEMU_CAPS_FSDEV_WRITEOUT     = 84, /* -fsdev writeout supported */
     QEMU_CAPS_DRIVE_IOTUNE       = 85, /* -drive bps= and friends */
+    QEMU_CAPS_VIRTIO_NET_MQ      = 86, /* virtio-net-pci.mq */
 
     QEMU_CAPS_LAST,                   /* this must always be the last item */
 };
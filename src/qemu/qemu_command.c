@@ -168,21 +168,82 @@ qemuPhysIfaceConnect(virDomainDefPtr def,
 }
 
 
+/**
+ * qemuCheckNetQueues:
+ * @net: pointer to the VM's interface description
+ * @qemuCaps: flags for qemu
+ *
+ * Check whether the number of queues requested for @net can be
+ * provided. Multiple queues are only available for virtio interfaces
+ * backed by a tap device with -netdev.
+ *
+ * Returns 0 if supported, -1 with an error reported otherwise.
+ */
+int
+qemuCheckNetQueues(virDomainNetDefPtr net,
+                   virBitmapPtr qemuCaps)
+{
+    int actualType = virDomainNetGetActualType(net);
+
+    if (net->driver.virtio.queues <= 1)
+        return 0;
+
+    if (actualType != VIR_DOMAIN_NET_TYPE_NETWORK &&
+        actualType != VIR_DOMAIN_NET_TYPE_BRIDGE &&
+        actualType != VIR_DOMAIN_NET_TYPE_ETHERNET) {
+        qemuReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                        _("multiqueue network is not supported for "
+                          "interfaces of type %s"),
+                        virDomainNetTypeToString(actualType));
+        return -1;
+    }
+
+    if (!(qemuCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
+          qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE) &&
+          qemuCapsGet(qemuCaps, QEMU_CAPS_VIRTIO_NET_MQ))) {
+        qemuReportError(VIR_ERR_CONFIG_UNSUPPORTED, "%s",
+                        _("multiqueue network is not supported with "
+                          "this QEMU binary"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * qemuNetworkIfaceConnect:
+ * @def: the definition of the VM
+ * @conn: pointer to virConnect object
+ * @driver: pointer to the qemud_driver
+ * @net: pointer to the VM's interface description
+ * @qemuCaps: flags for qemu
+ * @tapfd: array to store the file descriptors of the tap device
+ * @tapfdSize: number of queues of the tap device to open
+ *
+ * Returns 0 on success or -1 in case of error.
+ */
 int
 qemuNetworkIfaceConnect(virDomainDefPtr def,
                         virConnectPtr conn,
                         struct qemud_driver *driver,
                         virDomainNetDefPtr net,
-                        virBitmapPtr qemuCaps)
+                        virBitmapPtr qemuCaps,
+                        int *tapfd,
+                        int tapfdSize)
 {
     char *brname = NULL;
     int err;
-    int tapfd = -1;
+    int ret = -1;
     int vnet_hdr = 0;
+    int i;
     bool template_ifname = false;
     unsigned char tapmac[VIR_MAC_BUFLEN];
     int actualType = virDomainNetGetActualType(net);
 
+    for (i = 0; i < tapfdSize; i++)
+        tapfd[i] = -1;
+
     if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK) {
         int active, fail = 0;
         virErrorPtr errobj;
@@ -247,13 +308,13 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
     memcpy(tapmac, net->mac, VIR_MAC_BUFLEN);
     tapmac[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     err = virNetDevTapCreateInBridgePort(brname, &net->ifname, tapmac,
-                             vnet_hdr, true, &tapfd,
+                             vnet_hdr, true, tapfd, tapfdSize,
                              virDomainNetGetActualVirtPortProfile(net));
-    virDomainAuditNetDevice(def, net, "/dev/net/tun", tapfd >= 0);
-    if (err < 0) {
+    virDomainAuditNetDevice(def, net, "/dev/net/tun", err == 0);
+    if (err != 0) {
         if (template_ifname)
             VIR_FREE(net->ifname);
-        tapfd = -1;
+        goto cleanup;
     }
 
     if (driver->macFilter) {
@@ -264,41 +325,59 @@ qemuNetworkIfaceConnect(virDomainDefPtr def,
         }
     }
 
-    if (tapfd >= 0 &&
-        virNetDevBandwidthSet(net->ifname,
+    if (virNetDevBandwidthSet(net->ifname,
                               virDomainNetGetActualBandwidth(net)) < 0) {
         qemuReportError(VIR_ERR_INTERNAL_ERROR,
                         _("cannot set bandwidth limits on %s"),
                         net->ifname);
-        VIR_FORCE_CLOSE(tapfd);
         goto cleanup;
     }
 
-    if (tapfd >= 0) {
-        if ((net->filter) && (net->ifname)) {
-            if (virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
-                VIR_FORCE_CLOSE(tapfd);
-        }
+    if ((net->filter) && (net->ifname)) {
+        if (virDomainConfNWFilterInstantiate(conn, def->uuid, net) < 0)
+            goto cleanup;
     }
 
+    ret = 0;
+
 cleanup:
+    if (ret < 0) {
+        for (i = 0; i < tapfdSize; i++)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
     VIR_FREE(brname);
 
-    return tapfd;
+    return ret;
 }
 
 
+/**
+ * qemuOpenVhostNet:
+ * @def: the definition of the VM
+ * @net: pointer to the VM's interface description
+ * @qemuCaps: flags for qemu
+ * @vhostfd: array to store the vhost-net file descriptors
+ * @vhostfdSize: number of file descriptors to open; set to 0 if vhost-net
+ *               is not to be used
+ *
+ * Returns 0 on success or -1 in case of error.
+ */
 int
 qemuOpenVhostNet(virDomainDefPtr def,
                  virDomainNetDefPtr net,
                  virBitmapPtr qemuCaps,
-                 int *vhostfd)
+                 int *vhostfd,
+                 int *vhostfdSize)
 {
-    *vhostfd = -1;   /* assume we won't use vhost */
+    int i;
+
+    for (i = 0; i < *vhostfdSize; i++)
+        vhostfd[i] = -1;
 
     /* If the config says explicitly to not use vhost, return now */
     if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_QEMU) {
-       return 0;
+        *vhostfdSize = 0;
+        return 0;
     }
 
     /* If qemu doesn't support vhost-net mode (including the -netdev command
@@ -313,6 +392,7 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                     "this QEMU binary"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
@@ -324,22 +404,37 @@ qemuOpenVhostNet(virDomainDefPtr def,
                                     "virtio network interfaces"));
             return -1;
         }
+        *vhostfdSize = 0;
         return 0;
     }
 
-    *vhostfd = open("/dev/vhost-net", O_RDWR);
-    virDomainAuditNetDevice(def, net, "/dev/vhost-net", *vhostfd >= 0);
+    /* One vhost-net device (and kernel thread) per queue */
+    for (i = 0; i < *vhostfdSize; i++) {
+        vhostfd[i] = open("/dev/vhost-net", O_RDWR);
+        if (vhostfd[i] < 0)
+            break;
+    }
+    virDomainAuditNetDevice(def, net, "/dev/vhost-net", i == *vhostfdSize);
+
+    if (i < *vhostfdSize) {
+        /* If the config says explicitly to use vhost and we couldn't open
+         * it, report an error.
+         */
+        if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST) {
+            qemuReportError(VIR_ERR_CONFIG_UNSUPPORTED,
+                            "%s", _("vhost-net was requested for an interface, "
+                                    "but is unavailable"));
+        }
+
+        /* QEMU needs a vhost-net device for each queue or none at all */
+        while (i--)
+            VIR_FORCE_CLOSE(vhostfd[i]);
+        *vhostfdSize = 0;
 
-    /* If the config says explicitly to use vhost and we couldn't open it,
-     * report an error.
-     */
-    if ((*vhostfd < 0) &&
-        (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST)) {
-        qemuReportError(VIR_ERR_CONFIG_UNSUPPORTED,
-                        "%s", _("vhost-net was requested for an interface, "
-                                "but is unavailable"));
-        return -1;
+        if (net->driver.virtio.name == VIR_DOMAIN_NET_BACKEND_TYPE_VHOST)
+            return -1;
     }
+
     return 0;
 }
 
@@ -2524,6 +2619,11 @@ qemuBuildNicDevStr(virDomainNetDefPtr net,
             virBufferAsprintf(&buf, ",event_idx=%s",
                               virDomainVirtioEventIdxTypeToString(net->driver.virtio.event_idx));
         }
+        if (net->driver.virtio.queues > 1) {
+            /* one MSI-X vector per rx and tx queue plus config and control */
+            virBufferAsprintf(&buf, ",mq=on,vectors=%u",
+                              2 * net->driver.virtio.queues + 2);
+        }
     }
     if (vlan == -1)
         virBufferAsprintf(&buf, ",netdev=host%s", net->info.alias);
@@ -2558,10 +2658,13 @@ char *
 qemuBuildHostNetStr(virDomainNetDefPtr net,
                     char type_sep,
                     int vlan,
-                    const char *tapfd,
-                    const char *vhostfd)
+                    char **tapfd,
+                    int tapfdSize,
+                    char **vhostfd,
+                    int vhostfdSize)
 {
     bool is_tap = false;
+    int i;
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     enum virDomainNetType netType = virDomainNetGetActualType(net);
 
@@ -2577,7 +2680,13 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
     case VIR_DOMAIN_NET_TYPE_BRIDGE:
     case VIR_DOMAIN_NET_TYPE_DIRECT:
         virBufferAddLit(&buf, "tap");
-        virBufferAsprintf(&buf, "%cfd=%s", type_sep, tapfd);
+        if (tapfdSize > 1) {
+            virBufferAsprintf(&buf, "%cfds=", type_sep);
+            for (i = 0; i < tapfdSize; i++)
+                virBufferAsprintf(&buf, "%s%s", i ? ":" : "", tapfd[i]);
+        } else {
+            virBufferAsprintf(&buf, "%cfd=%s", type_sep, tapfd[0]);
+        }
         type_sep = ',';
         is_tap = true;
         break;
@@ -2648,8 +2757,17 @@ qemuBuildHostNetStr(virDomainNetDefPtr net,
     }
 
     if (is_tap) {
-        if (vhostfd && *vhostfd)
-            virBufferAsprintf(&buf, ",vhost=on,vhostfd=%s", vhostfd);
+        /* QEMU opens the queues itself for a tap it creates */
+        if (netType == VIR_DOMAIN_NET_TYPE_ETHERNET &&
+            net->driver.virtio.queues > 1)
+            virBufferAsprintf(&buf, ",queues=%u", net->driver.virtio.queues);
+        if (vhostfdSize > 1) {
+            virBufferAddLit(&buf, ",vhost=on,vhostfds=");
+            for (i = 0; i < vhostfdSize; i++)
+                virBufferAsprintf(&buf, "%s%s", i ? ":" : "", vhostfd[i]);
+        } else if (vhostfdSize == 1) {
+            virBufferAsprintf(&buf, ",vhost=on,vhostfd=%s", vhostfd[0]);
+        }
         if (net->tune.sndbuf_specified)
             virBufferAsprintf(&buf, ",sndbuf=%lu", net->tune.sndbuf);
     }
@@ -3787,6 +3905,166 @@ error:
     return -1;
 }
 
+/**
+ * qemuBuildInterfaceCommandLine:
+ *
+ * Connect the host side of @net and add the arguments for it to @cmd.
+ * For interfaces backed by a tap device one tap (and vhost-net) file
+ * descriptor is passed to QEMU per queue. If an error occurs after the
+ * interface was connected, its filter is torn down again.
+ *
+ * Returns 0 on success or -1 in case of error.
+ */
+static int
+qemuBuildInterfaceCommandLine(virCommandPtr cmd,
+                              struct qemud_driver *driver,
+                              virConnectPtr conn,
+                              virDomainDefPtr def,
+                              virDomainNetDefPtr net,
+                              virBitmapPtr qemuCaps,
+                              int vlan,
+                              int bootindex,
+                              enum virNetDevVPortProfileOp vmop)
+{
+    int ret = -1;
+    char *nic = NULL, *host = NULL;
+    int *tapfd = NULL;
+    char **tapfdName = NULL;
+    int tapfdSize = 0;
+    int *vhostfd = NULL;
+    char **vhostfdName = NULL;
+    int vhostfdSize = 0;
+    int nqueues = net->driver.virtio.queues > 1 ?
+                  net->driver.virtio.queues : 1;
+    bool connected = false;
+    int actualType;
+    int i;
+
+    /* If appropriate, grab a physical device from the configured
+     * network's pool of devices, or resolve bridge device name
+     * to the one defined in the network definition.
+     */
+    if (networkAllocateActualDevice(net) < 0)
+        return -1;
+
+    if (qemuCheckNetQueues(net, qemuCaps) < 0)
+        return -1;
+
+    actualType = virDomainNetGetActualType(net);
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
+        actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        if (VIR_ALLOC_N(tapfd, nqueues) < 0 ||
+            VIR_ALLOC_N(tapfdName, nqueues) < 0 ||
+            VIR_ALLOC_N(vhostfd, nqueues) < 0 ||
+            VIR_ALLOC_N(vhostfdName, nqueues) < 0)
+            goto no_memory;
+    }
+
+    if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
+        actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
+        if (qemuNetworkIfaceConnect(def, conn, driver, net, qemuCaps,
+                                    tapfd, nqueues) < 0)
+            goto cleanup;
+        tapfdSize = nqueues;
+    } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
+        if ((tapfd[0] = qemuPhysIfaceConnect(def, driver, net,
+                                             qemuCaps, vmop)) < 0)
+            goto cleanup;
+        tapfdSize = 1;
+    }
+
+    if (tapfdSize) {
+        connected = true;
+
+        /* Attempt to use vhost-net mode for these types of
+           network device */
+        vhostfdSize = tapfdSize;
+        if (qemuOpenVhostNet(def, net, qemuCaps, vhostfd, &vhostfdSize) < 0)
+            goto cleanup;
+
+        for (i = 0; i < tapfdSize; i++) {
+            if (virAsprintf(&tapfdName[i], "%d", tapfd[i]) < 0)
+                goto no_memory;
+        }
+        for (i = 0; i < vhostfdSize; i++) {
+            if (virAsprintf(&vhostfdName[i], "%d", vhostfd[i]) < 0)
+                goto no_memory;
+        }
+    }
+
+    /* Possible combinations:
+     *
+     *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
+     *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
+     *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
+     *
+     * NB, no support for -netdev without use of -device
+     */
+    if (qemuCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
+        qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
+        if (!(host = qemuBuildHostNetStr(net, ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-netdev", host, NULL);
+        VIR_FREE(host);
+    }
+    if (qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
+        if (!(nic = qemuBuildNicDevStr(net, vlan, bootindex, qemuCaps)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-device", nic, NULL);
+    } else {
+        if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-net", nic, NULL);
+    }
+    if (!(qemuCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
+          qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE))) {
+        if (!(host = qemuBuildHostNetStr(net, ',', vlan,
+                                         tapfdName, tapfdSize,
+                                         vhostfdName, vhostfdSize)))
+            goto cleanup;
+        virCommandAddArgList(cmd, "-net", host, NULL);
+    }
+
+    /* QEMU inherits the descriptors, the command closes them for us */
+    for (i = 0; i < tapfdSize; i++) {
+        virCommandTransferFD(cmd, tapfd[i]);
+        tapfd[i] = -1;
+    }
+    for (i = 0; i < vhostfdSize; i++) {
+        virCommandTransferFD(cmd, vhostfd[i]);
+        vhostfd[i] = -1;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0 && connected)
+        virDomainConfNWFilterTeardown(net);
+    for (i = 0; i < tapfdSize; i++)
+        VIR_FORCE_CLOSE(tapfd[i]);
+    for (i = 0; i < vhostfdSize; i++)
+        VIR_FORCE_CLOSE(vhostfd[i]);
+    for (i = 0; tapfdName && i < nqueues; i++)
+        VIR_FREE(tapfdName[i]);
+    for (i = 0; vhostfdName && i < nqueues; i++)
+        VIR_FREE(vhostfdName[i]);
+    VIR_FREE(tapfd);
+    VIR_FREE(tapfdName);
+    VIR_FREE(vhostfd);
+    VIR_FREE(vhostfdName);
+    VIR_FREE(nic);
+    VIR_FREE(host);
+    return ret;
+
+no_memory:
+    virReportOOMError();
+    goto cleanup;
+}
+
+
 /*
  * Constructs a argv suitable for launching qemu with config defined
  * for a given virtual machine.
@@ -4653,12 +4931,8 @@ qemuBuildCommandLine(virConnectPtr conn,
 
         for (i = 0 ; i < def->nnets ; i++) {
             virDomainNetDefPtr net = def->nets[i];
-            char *nic, *host;
-            char tapfd_name[50];
-            char vhostfd_name[50] = "";
             int vlan;
             int bootindex = bootNet;
-            int actualType;
 
             bootNet = 0;
             if (!bootindex)
@@ -4671,98 +4945,12 @@ qemuBuildCommandLine(virConnectPtr conn,
             else
                 vlan = i;
 
-            /* If appropriate, grab a physical device from the configured
-             * network's pool of devices, or resolve bridge device name
-             * to the one defined in the network definition.
-             */
-            if (networkAllocateActualDevice(net) < 0)
-               goto error;
-
-            actualType = virDomainNetGetActualType(net);
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE) {
-                int tapfd = qemuNetworkIfaceConnect(def, conn, driver, net,
-                                                    qemuCaps);
-                if (tapfd < 0)
-                    goto error;
-
-                last_good_net = i;
-                virCommandTransferFD(cmd, tapfd);
-
-                if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                             tapfd) >= sizeof(tapfd_name))
-                    goto no_memory;
-            } else if (actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                int tapfd = qemuPhysIfaceConnect(def, driver, net,
-                                                 qemuCaps, vmop);
-                if (tapfd < 0)
-                    goto error;
-
-                last_good_net = i;
-                virCommandTransferFD(cmd, tapfd);
-
-                if (snprintf(tapfd_name, sizeof(tapfd_name), "%d",
-                             tapfd) >= sizeof(tapfd_name))
-                    goto no_memory;
-            }
-
-            if (actualType == VIR_DOMAIN_NET_TYPE_NETWORK ||
-                actualType == VIR_DOMAIN_NET_TYPE_BRIDGE ||
-                actualType == VIR_DOMAIN_NET_TYPE_DIRECT) {
-                /* Attempt to use vhost-net mode for these types of
-                   network device */
-                int vhostfd;
-
-                if (qemuOpenVhostNet(def, net, qemuCaps, &vhostfd) < 0)
-                    goto error;
-                if (vhostfd >= 0) {
-                    virCommandTransferFD(cmd, vhostfd);
+            if (qemuBuildInterfaceCommandLine(cmd, driver, conn, def, net,
+                                              qemuCaps, vlan, bootindex,
+                                              vmop) < 0)
+                goto error;
 
-                    if (snprintf(vhostfd_name, sizeof(vhostfd_name), "%d",
-                                 vhostfd) >= sizeof(vhostfd_name))
-                        goto no_memory;
-                }
-            }
-            /* Possible combinations:
-             *
-             *  1. Old way:   -net nic,model=e1000,vlan=1 -net tap,vlan=1
-             *  2. Semi-new:  -device e1000,vlan=1        -net tap,vlan=1
-             *  3. Best way:  -netdev type=tap,id=netdev1 -device e1000,id=netdev1
-             *
-             * NB, no support for -netdev without use of -device
-             */
-            if (qemuCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
-                qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-netdev");
-                if (!(host = qemuBuildHostNetStr(net, ',', vlan,
-                                                 tapfd_name, vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
-            if (qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE)) {
-                virCommandAddArg(cmd, "-device");
-                nic = qemuBuildNicDevStr(net, vlan, bootindex, qemuCaps);
-                if (!nic)
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            } else {
-                virCommandAddArg(cmd, "-net");
-                if (!(nic = qemuBuildNicStr(net, "nic,", vlan)))
-                    goto error;
-                virCommandAddArg(cmd, nic);
-                VIR_FREE(nic);
-            }
-            if (!(qemuCapsGet(qemuCaps, QEMU_CAPS_NETDEV) &&
-                  qemuCapsGet(qemuCaps, QEMU_CAPS_DEVICE))) {
-                virCommandAddArg(cmd, "-net");
-                if (!(host = qemuBuildHostNetStr(net, ',', vlan,
-                                                 tapfd_name, vhostfd_name)))
-                    goto error;
-                virCommandAddArg(cmd, host);
-                VIR_FREE(host);
-            }
+            last_good_net = i;
         }
     }
 
@@ -64,8 +64,10 @@ qemuBuildChrDeviceStr (virDomainChrDefPtr serial,
 char * qemuBuildHostNetStr(virDomainNetDefPtr net,
                            char type_sep,
                            int vlan,
-                           const char *tapfd,
-                           const char *vhostfd);
+                           char **tapfd,
+                           int tapfdSize,
+                           char **vhostfd,
+                           int vhostfdSize);
 
 /* Legacy, pre device support */
 char * qemuBuildNicStr(virDomainNetDefPtr net,
@@ -132,12 +134,17 @@ char * qemuBuildHubDevStr(virDomainHubDefPtr dev, virBitmapPtr qemuCaps);
 char * qemuBuildRedirdevDevStr(virDomainRedirdevDefPtr dev, virBitmapPtr qemuCaps);
 
 
+int qemuCheckNetQueues(virDomainNetDefPtr net,
+                       virBitmapPtr qemuCaps);
+
 int qemuNetworkIfaceConnect(virDomainDefPtr def,
                             virConnectPtr conn,
                             struct qemud_driver *driver,
                             virDomainNetDefPtr net,
-                            virBitmapPtr qemuCaps)
-    ATTRIBUTE_NONNULL(2);
+                            virBitmapPtr qemuCaps,
+                            int *tapfd,
+                            int tapfdSize)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(6);
 
 int qemuPhysIfaceConnect(virDomainDefPtr def,
                          struct qemud_driver *driver,
@@ -148,7 +155,8 @@ int qemuPhysIfaceConnect(virDomainDefPtr def,
 int qemuOpenVhostNet(virDomainDefPtr def,
                      virDomainNetDefPtr net,
                      virBitmapPtr qemuCaps,
-                     int *vhostfd);
+                     int *vhostfd,
+                     int *vhostfdSize);
 
 int qemudCanonicalizeMachine(struct qemud_driver *driver,
                              virDomainDefPtr def);
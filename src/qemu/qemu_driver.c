@@ -92,6 +92,7 @@
 #include "virnodesuspend.h"
 #include "virtime.h"
 #include "virtypedparam.h"
+#include "virnetdevopenvswitch.h"
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
@@ -7688,6 +7689,7 @@ qemudDomainInterfaceStats (virDomainPtr dom,
 {
     struct qemud_driver *driver = dom->conn->privateData;
     virDomainObjPtr vm;
+    virDomainNetDefPtr net = NULL;
     int i;
     int ret = -1;
 
@@ -7713,13 +7715,22 @@ qemudDomainInterfaceStats (virDomainPtr dom,
     for (i = 0 ; i < vm->def->nnets ; i++) {
         if (vm->def->nets[i]->ifname &&
             STREQ (vm->def->nets[i]->ifname, path)) {
+            net = vm->def->nets[i];
             ret = 0;
             break;
         }
     }
 
-    if (ret == 0)
-        ret = linuxDomainInterfaceStats(path, stats);
+    if (ret == 0) {
+        virNetDevVPortProfilePtr vport = virDomainNetGetActualVirtPortProfile(net);
+
+        /* Ports of an Open vSwitch bridge have datapath statistics */
+        if (vport &&
+            vport->virtPortType == VIR_NETDEV_VPORT_PROFILE_OPENVSWITCH)
+            ret = virNetDevOpenvswitchInterfaceStats(path, stats);
+        else
+            ret = linuxDomainInterfaceStats(path, stats);
+    }
     else
         qemuReportError(VIR_ERR_INVALID_ARG,
                         _("invalid path, '%s' is not a known interface"), path);
@@ -9789,6 +9800,9 @@ qemuDomainSnapshotCreateSingleDiskActive(struct qemud_driver *driver,
     if (ret < 0)
         goto cleanup;
 
+    /* qemu has just written a new header into the stub */
+    virStorageFileInvalidateMetadata(source);
+
     /* Update vm in place to match changes.  */
     need_unlink = false;
     VIR_FREE(disk->src);
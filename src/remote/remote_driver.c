@@ -239,6 +239,11 @@ remoteDomainBuildEventDiskChange(virNetClientProgramPtr prog,
                                  virNetClientPtr client,
                                  void *evdata, void *opaque);
 
+static void
+remoteDomainBuildEventsLost(virNetClientProgramPtr prog,
+                            virNetClientPtr client,
+                            void *evdata, void *opaque);
+
 static virNetClientProgramEvent remoteDomainEvents[] = {
     { REMOTE_PROC_DOMAIN_EVENT_RTC_CHANGE,
       remoteDomainBuildEventRTCChange,
@@ -280,6 +285,10 @@ static virNetClientProgramEvent remoteDomainEvents[] = {
       remoteDomainBuildEventDiskChange,
       sizeof(remote_domain_event_disk_change_msg),
       (xdrproc_t)xdr_remote_domain_event_disk_change_msg },
+    { REMOTE_PROC_DOMAIN_EVENTS_LOST,
+      remoteDomainBuildEventsLost,
+      sizeof(remote_domain_events_lost_msg),
+      (xdrproc_t)xdr_remote_domain_events_lost_msg },
 };
 
 enum virDrvOpenRemoteFlags {
@@ -3642,6 +3651,24 @@ remoteDomainBuildEventDiskChange(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
 }
 
 
+/*
+ * The daemon dropped events because we did not read them as fast
+ * as they were raised. There is no event to queue for this: the
+ * best we can do is tell the user that the state they track from
+ * events may be stale.
+ */
+static void
+remoteDomainBuildEventsLost(virNetClientProgramPtr prog ATTRIBUTE_UNUSED,
+                            virNetClientPtr client ATTRIBUTE_UNUSED,
+                            void *evdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    remote_domain_events_lost_msg *msg = evdata;
+
+    VIR_WARN("The daemon dropped %llu domain events that were not "
+             "read in time", (unsigned long long)msg->count);
+}
+
+
 static virDrvOpenStatus ATTRIBUTE_NONNULL (1)
 remoteSecretOpen(virConnectPtr conn, virConnectAuthPtr auth,
                  unsigned int flags)
@@ -3719,11 +3746,12 @@ cleanup:
 
 
 static int
-remoteStreamRecv(virStreamPtr st,
-                 char *data,
-                 size_t nbytes)
+remoteStreamRecvFlags(virStreamPtr st,
+                      char *data,
+                      size_t nbytes,
+                      unsigned int flags)
 {
-    VIR_DEBUG("st=%p data=%p nbytes=%zu", st, data, nbytes);
+    VIR_DEBUG("st=%p data=%p nbytes=%zu flags=%x", st, data, nbytes, flags);
     struct private_data *priv = st->conn->privateData;
     virNetClientStreamPtr privst = st->privateData;
     int rv = -1;
@@ -3737,7 +3765,8 @@ remoteStreamRecv(virStreamPtr st,
                                       priv->client,
                                       data,
                                       nbytes,
-                                      (st->flags & VIR_STREAM_NONBLOCK));
+                                      (st->flags & VIR_STREAM_NONBLOCK),
+                                      flags);
 
     VIR_DEBUG("Done %d", rv);
 
@@ -3747,6 +3776,66 @@ cleanup:
     return rv;
 }
 
+
+static int
+remoteStreamRecv(virStreamPtr st,
+                 char *data,
+                 size_t nbytes)
+{
+    return remoteStreamRecvFlags(st, data, nbytes, 0);
+}
+
+
+static int
+remoteStreamSendHole(virStreamPtr st,
+                     long long length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv = -1;
+
+    remoteDriverLock(priv);
+
+    if (virNetClientStreamRaiseError(privst))
+        goto cleanup;
+
+    rv = virNetClientStreamSendHole(privst,
+                                    priv->client,
+                                    length,
+                                    flags);
+
+cleanup:
+    remoteDriverUnlock(priv);
+
+    return rv;
+}
+
+
+static int
+remoteStreamRecvHole(virStreamPtr st,
+                     long long *length,
+                     unsigned int flags)
+{
+    VIR_DEBUG("st=%p length=%p flags=%x", st, length, flags);
+    struct private_data *priv = st->conn->privateData;
+    virNetClientStreamPtr privst = st->privateData;
+    int rv = -1;
+
+    remoteDriverLock(priv);
+
+    if (virNetClientStreamRaiseError(privst))
+        goto cleanup;
+
+    rv = virNetClientStreamRecvHole(privst, length, flags);
+
+cleanup:
+    remoteDriverUnlock(priv);
+
+    return rv;
+}
+
 struct remoteStreamCallbackData {
     virStreamPtr st;
     virStreamEventCallback cb;
@@ -3914,6 +4003,9 @@ static virStreamDriver remoteStreamDrv = {
     .streamAddCallback = remoteStreamEventAddCallback,
     .streamUpdateCallback = remoteStreamEventUpdateCallback,
     .streamRemoveCallback = remoteStreamEventRemoveCallback,
+    .streamRecvFlags = remoteStreamRecvFlags,
+    .streamSendHole = remoteStreamSendHole,
+    .streamRecvHole = remoteStreamRecvHole,
 };
 
 
@@ -2444,6 +2444,10 @@ struct remote_domain_get_disk_errors_ret {
     int nerrors;
 };
 
+struct remote_domain_events_lost_msg {
+    unsigned hyper count;
+};
+
 
 /*----- Protocol. -----*/
 
@@ -2759,7 +2763,8 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_GET_DISK_ERRORS = 263, /* skipgen skipgen */
     REMOTE_PROC_DOMAIN_SET_METADATA = 264, /* autogen autogen */
     REMOTE_PROC_DOMAIN_GET_METADATA = 265, /* autogen autogen */
-    REMOTE_PROC_DOMAIN_BLOCK_REBASE = 266 /* autogen autogen */
+    REMOTE_PROC_DOMAIN_BLOCK_REBASE = 266, /* autogen autogen */
+    REMOTE_PROC_DOMAIN_EVENTS_LOST = 267 /* skipgen skipgen */
 
     /*
      * Notice how the entries are grouped in sets of 10 ?
@@ -652,6 +652,13 @@ int virNetClientSetTLSSession(virNetClientPtr client,
         goto error;
     }
 
+    /* Both ends are happy with each other, so the next connection
+     * to this server can skip most of the handshake */
+    if (virNetTLSSessionIsResumed(client->tls))
+        VIR_DEBUG("Resumed TLS session with %s", NULLSTR(client->hostname));
+    else
+        virNetTLSSessionSaveResumeData(client->tls);
+
     virNetClientUnlock(client);
     return 0;
 
@@ -873,12 +880,17 @@ static int virNetClientCallDispatchStream(virNetClientPtr client)
     /* Status is either
      *   - REMOTE_OK - no payload for streams
      *   - REMOTE_ERROR - followed by a remote_error struct
-     *   - REMOTE_CONTINUE - followed by a raw data packet
+     *   - REMOTE_CONTINUE - followed by a raw data packet, or by a
+     *                       virNetStreamHole for hole packets
      */
     switch (client->msg.header.status) {
     case VIR_NET_CONTINUE: {
-        if (virNetClientStreamQueuePacket(st, &client->msg) < 0)
+        if (client->msg.header.type == VIR_NET_STREAM_HOLE) {
+            if (virNetClientStreamQueueHole(st, &client->msg) < 0)
+                return -1;
+        } else if (virNetClientStreamQueuePacket(st, &client->msg) < 0) {
             return -1;
+        }
 
         if (thecall && thecall->expectReply) {
             if (thecall->msg->header.status == VIR_NET_CONTINUE) {
@@ -947,6 +959,7 @@ virNetClientCallDispatch(virNetClientPtr client)
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Sparse stream protocol */
         return virNetClientCallDispatchStream(client);
 
     default:
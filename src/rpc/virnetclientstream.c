@@ -35,6 +35,14 @@
     virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,           \
                          __FUNCTION__, __LINE__, __VA_ARGS__)
 
+/* A hole received on a sparse stream, which sits before the
+ * byte at @offset in the incoming buffer */
+typedef struct _virNetClientStreamHole virNetClientStreamHole;
+struct _virNetClientStreamHole {
+    size_t offset;
+    unsigned long long length;
+};
+
 struct _virNetClientStream {
     virMutex lock;
 
@@ -57,6 +65,9 @@ struct _virNetClientStream {
     size_t incomingLength;
     bool incomingEOF;
 
+    virNetClientStreamHole *holes;
+    size_t nholes;
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -74,7 +85,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingOffset || st->incomingEOF || st->nholes) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -97,7 +108,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingOffset || st->incomingEOF || st->nholes))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -179,6 +190,7 @@ void virNetClientStreamFree(virNetClientStreamPtr st)
 
     virResetError(&st->err);
     VIR_FREE(st->incoming);
+    VIR_FREE(st->holes);
     virMutexDestroy(&st->lock);
     virNetClientProgramFree(st->prog);
     VIR_FREE(st);
@@ -321,6 +333,51 @@ cleanup:
 }
 
 
+int virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                                virNetMessagePtr msg)
+{
+    virNetStreamHole data;
+    int ret = -1;
+
+    memset(&data, 0, sizeof(data));
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        return -1;
+
+    if (data.length < 0) {
+        virNetError(VIR_ERR_RPC,
+                    _("invalid stream hole length %lld"),
+                    (long long)data.length);
+        return -1;
+    }
+
+    virMutexLock(&st->lock);
+
+    /* Consecutive holes with no data between them are merged */
+    if (st->nholes &&
+        st->holes[st->nholes - 1].offset == st->incomingOffset) {
+        st->holes[st->nholes - 1].length += data.length;
+    } else {
+        if (VIR_EXPAND_N(st->holes, st->nholes, 1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        st->holes[st->nholes - 1].offset = st->incomingOffset;
+        st->holes[st->nholes - 1].length = data.length;
+    }
+
+    VIR_DEBUG("Stream hole length %lld at offset %zu, %zu holes queued",
+              (long long)data.length, st->incomingOffset, st->nholes);
+    virNetClientStreamEventTimerUpdate(st);
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&st->lock);
+    return ret;
+}
+
+
 int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  int status,
@@ -374,17 +431,78 @@ error:
     return -1;
 }
 
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags)
+{
+    virNetMessagePtr msg;
+    virNetStreamHole data;
+
+    VIR_DEBUG("st=%p length=%lld flags=%x", st, length, flags);
+
+    data.length = length;
+    data.flags = flags;
+
+    if (!(msg = virNetMessageNew(false)))
+        return -1;
+
+    virMutexLock(&st->lock);
+
+    msg->header.prog = virNetClientProgramGetProgram(st->prog);
+    msg->header.vers = virNetClientProgramGetVersion(st->prog);
+    msg->header.status = VIR_NET_CONTINUE;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = st->serial;
+    msg->header.proc = st->proc;
+
+    virMutexUnlock(&st->lock);
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &data) < 0)
+        goto error;
+
+    /* Like data packets, holes are async fire&forget */
+    if (virNetClientSendNoReply(client, msg) < 0)
+        goto error;
+
+    virNetMessageFree(msg);
+    return 0;
+
+error:
+    virNetMessageFree(msg);
+    return -1;
+}
+
+
+static void
+virNetClientStreamPopHole(virNetClientStreamPtr st)
+{
+    memmove(st->holes, st->holes + 1,
+            sizeof(*st->holes) * (st->nholes - 1));
+    VIR_SHRINK_N(st->holes, st->nholes, 1);
+}
+
+
 int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock)
+                                 bool nonblock,
+                                 unsigned int flags)
 {
     int rv = -1;
-    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
-              st, client, data, nbytes, nonblock);
+    size_t avail;
+    VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d flags=%x",
+              st, client, data, nbytes, nonblock, flags);
+
+    virCheckFlags(VIR_STREAM_RECV_STOP_AT_HOLE, -1);
+
     virMutexLock(&st->lock);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingOffset && !st->incomingEOF && !st->nholes) {
         virNetMessagePtr msg;
         int ret;
 
@@ -416,9 +534,29 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
-        int want = st->incomingOffset;
+    VIR_DEBUG("After IO %zu holes %zu", st->incomingOffset, st->nholes);
+    if (st->nholes && st->holes[0].offset == 0) {
+        /* Callers not interested in holes get them as zeros */
+        if (flags & VIR_STREAM_RECV_STOP_AT_HOLE) {
+            rv = -3;
+        } else {
+            int want = nbytes;
+            if (want > st->holes[0].length)
+                want = st->holes[0].length;
+            memset(data, 0, want);
+            st->holes[0].length -= want;
+            if (st->holes[0].length == 0)
+                virNetClientStreamPopHole(st);
+            rv = want;
+        }
+    } else if (st->incomingOffset) {
+        int want;
+        size_t i;
+
+        avail = st->incomingOffset;
+        if (st->nholes)
+            avail = st->holes[0].offset;
+        want = avail;
         if (want > nbytes)
             want = nbytes;
         memcpy(data, st->incoming, want);
@@ -429,6 +567,8 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             VIR_FREE(st->incoming);
             st->incomingOffset = st->incomingLength = 0;
         }
+        for (i = 0 ; i < st->nholes ; i++)
+            st->holes[i].offset -= want;
         rv = want;
     } else {
         rv = 0;
@@ -442,6 +582,28 @@ cleanup:
 }
 
 
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags)
+{
+    virCheckFlags(0, -1);
+
+    virMutexLock(&st->lock);
+
+    *length = 0;
+    if (st->nholes && st->holes[0].offset == 0) {
+        *length = st->holes[0].length;
+        virNetClientStreamPopHole(st);
+    }
+
+    VIR_DEBUG("st=%p length=%lld", st, *length);
+    virNetClientStreamEventTimerUpdate(st);
+
+    virMutexUnlock(&st->lock);
+    return 0;
+}
+
+
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
                                        virNetClientStreamEventCallback cb,
@@ -50,6 +50,9 @@ bool virNetClientStreamMatches(virNetClientStreamPtr st,
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg);
 
+int virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                                virNetMessagePtr msg);
+
 int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  int status,
@@ -60,7 +63,17 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
                                  virNetClientPtr client,
                                  char *data,
                                  size_t nbytes,
-                                 bool nonblock);
+                                 bool nonblock,
+                                 unsigned int flags);
+
+int virNetClientStreamSendHole(virNetClientStreamPtr st,
+                               virNetClientPtr client,
+                               long long length,
+                               unsigned int flags);
+
+int virNetClientStreamRecvHole(virNetClientStreamPtr st,
+                               long long *length,
+                               unsigned int flags);
 
 int virNetClientStreamEventAddCallback(virNetClientStreamPtr st,
                                        int events,
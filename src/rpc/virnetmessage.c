@@ -61,6 +61,8 @@ void virNetMessageClear(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
+    if (msg->spliceLength)
+        VIR_FORCE_CLOSE(msg->spliceFD);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
 }
@@ -80,6 +82,8 @@ void virNetMessageFree(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
+    if (msg->spliceLength)
+        VIR_FORCE_CLOSE(msg->spliceFD);
     VIR_FREE(msg);
 }
 
@@ -409,7 +413,9 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
         return -1;
     }
 
-    memcpy(msg->buffer + msg->bufferOffset, data, len);
+    /* The data may have been read straight into place */
+    if (data != msg->buffer + msg->bufferOffset)
+        memcpy(msg->buffer + msg->bufferOffset, data, len);
     msg->bufferOffset += len;
 
     /* Re-encode the length word. */
@@ -457,6 +463,48 @@ error:
 }
 
 
+/*
+ * Completes a stream packet whose @len bytes of payload are waiting
+ * in the pipe @fd rather than in the buffer. The message takes over
+ * @fd, and the payload is spliced out of it when the message is sent.
+ */
+int virNetMessageEncodePayloadSplice(virNetMessagePtr msg,
+                                     int fd,
+                                     size_t len)
+{
+    XDR xdr;
+    unsigned int msglen;
+
+    if ((msg->bufferLength - msg->bufferOffset) < len) {
+        virNetError(VIR_ERR_RPC,
+                    _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
+                    len, (msg->bufferLength - msg->bufferOffset));
+        return -1;
+    }
+
+    /* Re-encode the length word. */
+    VIR_DEBUG("Encode length as %zu", msg->bufferOffset + len);
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferOffset + len;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virNetError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    msg->bufferLength = msg->bufferOffset;
+    msg->bufferOffset = 0;
+    msg->spliceFD = fd;
+    msg->spliceLength = len;
+    msg->spliceOffset = 0;
+    return 0;
+
+error:
+    xdr_destroy(&xdr);
+    return -1;
+}
+
+
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
 {
     /* This func may be called several times & the first
@@ -36,6 +36,8 @@ typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
  */
 struct _virNetMessage {
     bool tracked;
+    /* Async event, counted against the client's event queue limit */
+    bool event;
 
     char buffer[VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX];
     size_t bufferLength;
@@ -50,9 +52,20 @@ struct _virNetMessage {
     int *fds;
     size_t donefds;
 
+    /* Stream payload left in a pipe, to be spliced into the
+     * socket once the buffer has been written */
+    int spliceFD;
+    size_t spliceLength;
+    size_t spliceOffset;
+
     virNetMessagePtr next;
 };
 
+/* Where the raw payload of a stream packet sits in the buffer, so
+ * that stream data can be read straight into place */
+# define VIR_NET_MESSAGE_STREAM_PAYLOAD_OFFSET \
+    (VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX)
+
 
 virNetMessagePtr virNetMessageNew(bool tracked);
 
@@ -91,6 +104,10 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageEncodePayloadEmpty(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadSplice(virNetMessagePtr msg,
+                                     int fd,
+                                     size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
 void virNetMessageSaveError(virNetMessageErrorPtr rerr)
     ATTRIBUTE_NONNULL(1);
@@ -156,7 +156,9 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* either direction. stream hole packet, followed by virNetStreamHole */
+    VIR_NET_STREAM_HOLE = 6
 };
 
 enum virNetMessageStatus {
@@ -236,3 +238,11 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* Payload of a VIR_NET_STREAM_HOLE packet: the sender skipped over
+ * @length bytes of the stream which the receiver must treat as zeros.
+ */
+struct virNetStreamHole {
+    hyper length;
+    unsigned int flags;
+};
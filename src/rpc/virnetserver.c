@@ -101,6 +101,7 @@ struct _virNetServer {
     size_t nclients;
     size_t nclients_max;
     virNetServerClientPtr *clients;
+    size_t nevents_client_max;
 
     int keepaliveInterval;
     unsigned int keepaliveCount;
@@ -265,6 +266,8 @@ static int virNetServerDispatchNewClient(virNetServerServicePtr svc ATTRIBUTE_UN
                                     virNetServerDispatchNewMessage,
                                     srv);
 
+    virNetServerClientSetMaxEvents(client, srv->nevents_client_max);
+
     virNetServerClientInitKeepAlive(client, srv->keepaliveInterval,
                                     srv->keepaliveCount);
 
@@ -307,6 +310,7 @@ virNetServerPtr virNetServerNew(size_t min_workers,
                                 size_t max_workers,
                                 size_t priority_workers,
                                 size_t max_clients,
+                                size_t max_client_events,
                                 int keepaliveInterval,
                                 unsigned int keepaliveCount,
                                 bool keepaliveRequired,
@@ -331,6 +335,7 @@ virNetServerPtr virNetServerNew(size_t min_workers,
         goto error;
 
     srv->nclients_max = max_clients;
+    srv->nevents_client_max = max_client_events;
     srv->keepaliveInterval = keepaliveInterval;
     srv->keepaliveCount = keepaliveCount;
     srv->keepaliveRequired = keepaliveRequired;
@@ -83,6 +83,15 @@ struct _virNetServerClient
      * throttling calculations */
     size_t nrequests;
     size_t nrequests_max;
+    /* Count of async events in the 'tx' queue, which
+     * is bounded by nevents_max to stop a client that
+     * doesn't read its socket from exhausting memory */
+    size_t nevents;
+    size_t nevents_max;
+    /* Count of events dropped since the queue last
+     * overflowed, not yet reported to the client */
+    unsigned long long neventsLost;
+    virNetServerClientEventsLostFunc eventsLostFunc;
     /* Zero or one messages being received. Zero if
      * nrequests >= max_clients and throttling */
     virNetMessagePtr rx;
@@ -110,6 +119,7 @@ struct _virNetServerClient
 static void virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque);
 static void virNetServerClientUpdateEvent(virNetServerClientPtr client);
 static void virNetServerClientDispatchRead(virNetServerClientPtr client);
+static void virNetServerClientSendEventsLostLocked(virNetServerClientPtr client);
 
 static void virNetServerClientLock(virNetServerClientPtr client)
 {
@@ -458,6 +468,17 @@ int virNetServerClientGetUNIXIdentity(virNetServerClientPtr client,
     return ret;
 }
 
+bool virNetServerClientCanSplice(virNetServerClientPtr client)
+{
+    bool canSplice;
+    virNetServerClientLock(client);
+    canSplice = client->sock && !client->tls &&
+        virNetSocketCanSplice(client->sock);
+    virNetServerClientUnlock(client);
+    return canSplice;
+}
+
+
 bool virNetServerClientIsSecure(virNetServerClientPtr client)
 {
     bool secure = false;
@@ -553,6 +574,15 @@ void virNetServerClientSetCloseHook(virNetServerClientPtr client,
 }
 
 
+void virNetServerClientSetEventsLostHook(virNetServerClientPtr client,
+                                         virNetServerClientEventsLostFunc lf)
+{
+    virNetServerClientLock(client);
+    client->eventsLostFunc = lf;
+    virNetServerClientUnlock(client);
+}
+
+
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque)
@@ -950,8 +980,21 @@ static ssize_t virNetServerClientWrite(virNetServerClientPtr client)
         return -1;
     }
 
-    if (client->tx->bufferLength == client->tx->bufferOffset)
-        return 1;
+    if (client->tx->bufferLength == client->tx->bufferOffset) {
+        if (client->tx->spliceOffset == client->tx->spliceLength)
+            return 1;
+
+        /* The rest of the payload is moved straight out of a pipe */
+        ret = virNetSocketSpliceFrom(client->sock,
+                                     client->tx->spliceFD,
+                                     client->tx->spliceLength -
+                                     client->tx->spliceOffset);
+        if (ret <= 0)
+            return ret; /* -1 error, 0 = egain */
+
+        client->tx->spliceOffset += ret;
+        return ret;
+    }
 
     ret = virNetSocketWrite(client->sock,
                             client->tx->buffer + client->tx->bufferOffset,
@@ -972,7 +1015,8 @@ static void
 virNetServerClientDispatchWrite(virNetServerClientPtr client)
 {
     while (client->tx) {
-        if (client->tx->bufferOffset < client->tx->bufferLength) {
+        if (client->tx->bufferOffset < client->tx->bufferLength ||
+            client->tx->spliceOffset < client->tx->spliceLength) {
             ssize_t ret;
             ret = virNetServerClientWrite(client);
             if (ret < 0) {
@@ -983,7 +1027,8 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
                 return; /* Would block on write EAGAIN */
         }
 
-        if (client->tx->bufferOffset == client->tx->bufferLength) {
+        if (client->tx->bufferOffset == client->tx->bufferLength &&
+            client->tx->spliceOffset == client->tx->spliceLength) {
             virNetMessagePtr msg;
             size_t i;
 
@@ -1012,6 +1057,11 @@ virNetServerClientDispatchWrite(virNetServerClientPtr client)
             /* Get finished msg from head of tx queue */
             msg = virNetMessageQueueServe(&client->tx);
 
+            if (msg->event) {
+                client->nevents--;
+                virNetServerClientSendEventsLostLocked(client);
+            }
+
             if (msg->tracked) {
                 client->nrequests--;
                 /* See if the recv queue is currently throttled */
@@ -1097,16 +1147,18 @@ virNetServerClientDispatchEvent(virNetSocketPtr sock, int events, void *opaque)
 }
 
 
-int virNetServerClientSendMessage(virNetServerClientPtr client,
-                                  virNetMessagePtr msg)
+/*
+ * @client: a locked client object
+ */
+static int
+virNetServerClientSendMessageLocked(virNetServerClientPtr client,
+                                    virNetMessagePtr msg)
 {
     int ret = -1;
     VIR_DEBUG("msg=%p proc=%d len=%zu offset=%zu",
               msg, msg->header.proc,
               msg->bufferLength, msg->bufferOffset);
 
-    virNetServerClientLock(client);
-
     msg->donefds = 0;
     if (client->sock && !client->wantClose) {
         PROBE(RPC_SERVER_CLIENT_MSG_TX_QUEUE,
@@ -1120,12 +1172,114 @@ int virNetServerClientSendMessage(virNetServerClientPtr client,
         ret = 0;
     }
 
+    return ret;
+}
+
+
+int virNetServerClientSendMessage(virNetServerClientPtr client,
+                                  virNetMessagePtr msg)
+{
+    int ret;
+
+    virNetServerClientLock(client);
+    ret = virNetServerClientSendMessageLocked(client, msg);
     virNetServerClientUnlock(client);
 
     return ret;
 }
 
 
+/*
+ * @client: a locked client object
+ *
+ * Once there is room in the event queue again, tell the client
+ * how many events were dropped while it was full. The notice is
+ * not counted against nevents_max, since there is at most one
+ * per overflow.
+ */
+static void
+virNetServerClientSendEventsLostLocked(virNetServerClientPtr client)
+{
+    virNetMessagePtr msg;
+
+    if (!client->neventsLost ||
+        (client->nevents_max &&
+         client->nevents >= client->nevents_max))
+        return;
+
+    VIR_DEBUG("client=%p lost=%llu", client, client->neventsLost);
+
+    if (client->eventsLostFunc) {
+        /* On failure keep the count, to retry on the next event */
+        if (!(msg = client->eventsLostFunc(client, client->neventsLost)))
+            return;
+
+        if (virNetServerClientSendMessageLocked(client, msg) < 0) {
+            virNetMessageFree(msg);
+            return;
+        }
+    }
+
+    client->neventsLost = 0;
+}
+
+
+/**
+ * virNetServerClientSendEvent:
+ * @client: the client
+ * @msg: the async event message to send
+ *
+ * Queue an async event for transmission to @client, unless
+ * the client already has the maximum number of events pending.
+ * Events that do not fit are dropped, and counted so that the
+ * client is told how many it lost once it catches up, and can
+ * resync its view of domain state.
+ *
+ * Returns 0 if @msg was queued, -1 if the caller still owns it
+ */
+int virNetServerClientSendEvent(virNetServerClientPtr client,
+                                virNetMessagePtr msg)
+{
+    int ret = -1;
+
+    virNetServerClientLock(client);
+
+    virNetServerClientSendEventsLostLocked(client);
+
+    if (client->nevents_max &&
+        client->nevents >= client->nevents_max) {
+        if (!client->neventsLost)
+            VIR_WARN("Event queue for client %s is full (%zu events), "
+                     "dropping events",
+                     NULLSTR(virNetServerClientRemoteAddrString(client)),
+                     client->nevents);
+        client->neventsLost++;
+        goto cleanup;
+    }
+
+    msg->event = true;
+    if (virNetServerClientSendMessageLocked(client, msg) < 0) {
+        msg->event = false;
+        goto cleanup;
+    }
+    client->nevents++;
+    ret = 0;
+
+cleanup:
+    virNetServerClientUnlock(client);
+    return ret;
+}
+
+
+void virNetServerClientSetMaxEvents(virNetServerClientPtr client,
+                                    size_t nevents_max)
+{
+    virNetServerClientLock(client);
+    client->nevents_max = nevents_max;
+    virNetServerClientUnlock(client);
+}
+
+
 bool virNetServerClientNeedAuth(virNetServerClientPtr client)
 {
     bool need = false;
@@ -65,6 +65,7 @@ void virNetServerClientSetSASLSession(virNetServerClientPtr client,
 int virNetServerClientGetFD(virNetServerClientPtr client);
 
 bool virNetServerClientIsSecure(virNetServerClientPtr client);
+bool virNetServerClientCanSplice(virNetServerClientPtr client);
 
 int virNetServerClientSetIdentity(virNetServerClientPtr client,
                                   const char *identity);
@@ -87,6 +88,14 @@ typedef void (*virNetServerClientCloseFunc)(virNetServerClientPtr client);
 void virNetServerClientSetCloseHook(virNetServerClientPtr client,
                                     virNetServerClientCloseFunc cf);
 
+/* Called with the client locked, must not call back into it */
+typedef virNetMessagePtr
+(*virNetServerClientEventsLostFunc)(virNetServerClientPtr client,
+                                    unsigned long long count);
+
+void virNetServerClientSetEventsLostHook(virNetServerClientPtr client,
+                                         virNetServerClientEventsLostFunc lf);
+
 void virNetServerClientSetDispatcher(virNetServerClientPtr client,
                                      virNetServerClientDispatchFunc func,
                                      void *opaque);
@@ -111,6 +120,10 @@ const char *virNetServerClientRemoteAddrString(virNetServerClientPtr client);
 
 int virNetServerClientSendMessage(virNetServerClientPtr client,
                                   virNetMessagePtr msg);
+int virNetServerClientSendEvent(virNetServerClientPtr client,
+                                virNetMessagePtr msg);
+void virNetServerClientSetMaxEvents(virNetServerClientPtr client,
+                                    size_t nevents_max);
 
 bool virNetServerClientNeedAuth(virNetServerClientPtr client);
 
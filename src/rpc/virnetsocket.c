@@ -813,6 +813,31 @@ bool virNetSocketHasPassFD(virNetSocketPtr sock)
 }
 
 
+/*
+ * Data can only be spliced straight into the socket when nothing
+ * needs to encrypt or encode it on the way.
+ */
+#ifdef __linux__
+bool virNetSocketCanSplice(virNetSocketPtr sock)
+{
+    bool canSplice;
+    virMutexLock(&sock->lock);
+    canSplice = !sock->tlsSession;
+# if HAVE_SASL
+    if (sock->saslSession)
+        canSplice = false;
+# endif
+    virMutexUnlock(&sock->lock);
+    return canSplice;
+}
+#else
+bool virNetSocketCanSplice(virNetSocketPtr sock ATTRIBUTE_UNUSED)
+{
+    return false;
+}
+#endif
+
+
 int virNetSocketGetPort(virNetSocketPtr sock)
 {
     int port;
@@ -1166,6 +1191,52 @@ ssize_t virNetSocketWrite(virNetSocketPtr sock, const char *buf, size_t len)
 }
 
 
+/*
+ * Moves up to @len bytes out of the pipe @fd into the socket
+ * without copying them through user space. The caller must have
+ * checked virNetSocketCanSplice and know that the bytes are
+ * already waiting in the pipe.
+ *
+ * Returns the number of bytes moved, 0 if it would block, -1 on error
+ */
+#ifdef __linux__
+ssize_t virNetSocketSpliceFrom(virNetSocketPtr sock, int fd, size_t len)
+{
+    ssize_t ret;
+
+    virMutexLock(&sock->lock);
+resplice:
+    ret = splice(fd, NULL, sock->fd, NULL, len,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (ret < 0) {
+        if (errno == EINTR)
+            goto resplice;
+        if (errno == EAGAIN) {
+            ret = 0;
+        } else {
+            virReportSystemError(errno, "%s",
+                                 _("Cannot splice data"));
+        }
+    } else if (ret == 0) {
+        virReportSystemError(EIO, "%s",
+                             _("End of file while splicing data"));
+        ret = -1;
+    }
+    virMutexUnlock(&sock->lock);
+    return ret;
+}
+#else
+ssize_t virNetSocketSpliceFrom(virNetSocketPtr sock ATTRIBUTE_UNUSED,
+                               int fd ATTRIBUTE_UNUSED,
+                               size_t len ATTRIBUTE_UNUSED)
+{
+    virReportSystemError(ENOSYS, "%s",
+                         _("Splicing data is not supported on this platform"));
+    return -1;
+}
+#endif
+
+
 /*
  * Returns 1 if an FD was sent, 0 if it would block, -1 on error
  */
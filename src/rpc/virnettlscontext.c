@@ -36,6 +36,7 @@
 #include "logging.h"
 #include "threads.h"
 #include "configmake.h"
+#include "virhash.h"
 
 #define DH_BITS 1024
 
@@ -62,6 +63,16 @@ struct _virNetTLSContext {
     bool isServer;
     bool requireValidCert;
     const char *const*x509dnWhitelist;
+
+    /* Server: sessions whose peer passed the certificate check, by
+     * hex encoded session ID. Has its own lock, taken last */
+    virMutex cacheLock;
+    virHashTablePtr sessionCache;
+    size_t sessionCacheSize;
+    unsigned int sessionCacheTimeout;
+
+    /* Client: the credentials, as part of the resumption cache key */
+    char *identity;
 };
 
 struct _virNetTLSSession {
@@ -77,8 +88,41 @@ struct _virNetTLSSession {
     virNetTLSSessionWriteFunc writeFunc;
     virNetTLSSessionReadFunc readFunc;
     void *opaque;
+
+    virNetTLSContextPtr ctxt;
+
+    /* Server: what GNUTLS asked us to store for this session, only
+     * added to the cache once the certificate check passed */
+    char *pendingID;
+    unsigned char *pendingData;
+    size_t pendingLen;
+
+    /* Client: key of this session in the resumption cache */
+    char *cacheKey;
+
+    /* When the first of the peer's certificates expires, once they
+     * passed the check. Resuming the session is not allowed past it */
+    time_t certExpires;
+};
+
+/* Data needed to resume a TLS session, on the server side keyed by
+ * session ID, on the client side by credentials and server name.
+ * Only sessions whose peer certificate was accepted are ever stored,
+ * which is what allows skipping the checks when one is resumed. */
+typedef struct _virNetTLSCachedSession virNetTLSCachedSession;
+typedef virNetTLSCachedSession *virNetTLSCachedSessionPtr;
+struct _virNetTLSCachedSession {
+    unsigned char *data;
+    size_t len;
+    time_t expires;
 };
 
+#define VIR_NET_TLS_CLIENT_CACHE_SIZE 256
+
+static virOnceControl virNetTLSClientCacheOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static virMutex virNetTLSClientCacheLock;
+static virHashTablePtr virNetTLSClientCache;
+
 
 static int
 virNetTLSContextCheckCertFile(const char *type, const char *file, bool allowMissing)
@@ -637,6 +681,105 @@ cleanup:
 }
 
 
+static void
+virNetTLSCachedSessionFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virNetTLSCachedSessionPtr entry = payload;
+
+    if (!entry)
+        return;
+    VIR_FREE(entry->data);
+    VIR_FREE(entry);
+}
+
+static int
+virNetTLSCachedSessionExpired(const void *payload,
+                              const void *name ATTRIBUTE_UNUSED,
+                              const void *data)
+{
+    const virNetTLSCachedSession *entry = payload;
+    const time_t *now = data;
+
+    return entry->expires <= *now;
+}
+
+static int
+virNetTLSCachedSessionAny(const void *payload ATTRIBUTE_UNUSED,
+                          const void *name ATTRIBUTE_UNUSED,
+                          const void *data ATTRIBUTE_UNUSED)
+{
+    return 1;
+}
+
+/* Takes ownership of @data. The entry expires after @timeout seconds,
+ * or at @notAfter if that is earlier and not 0. Returns -1 if the entry
+ * was not added, because the cache is full, it would have expired
+ * already or memory ran out. Caller must hold the cache lock */
+static int
+virNetTLSSessionCacheAdd(virHashTablePtr cache,
+                         size_t maxEntries,
+                         const char *name,
+                         unsigned char *data,
+                         size_t len,
+                         unsigned int timeout,
+                         time_t notAfter)
+{
+    virNetTLSCachedSessionPtr entry;
+    time_t now = time(NULL);
+    time_t expires = now + timeout;
+
+    if (notAfter && notAfter < expires)
+        expires = notAfter;
+    if (expires <= now) {
+        VIR_FREE(data);
+        return -1;
+    }
+
+    if ((size_t)virHashSize(cache) >= maxEntries &&
+        !virHashLookup(cache, name)) {
+        virHashRemoveSet(cache, virNetTLSCachedSessionExpired, &now);
+        if ((size_t)virHashSize(cache) >= maxEntries) {
+            VIR_DEBUG("TLS session cache is full, not storing %s", name);
+            VIR_FREE(data);
+            return -1;
+        }
+    }
+
+    if (VIR_ALLOC(entry) < 0) {
+        VIR_FREE(data);
+        return -1;
+    }
+    entry->data = data;
+    entry->len = len;
+    entry->expires = expires;
+
+    if (virHashUpdateEntry(cache, name, entry) < 0) {
+        virNetTLSCachedSessionFree(entry, NULL);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+virNetTLSClientCacheInitialize(void)
+{
+    if (virMutexInit(&virNetTLSClientCacheLock) < 0)
+        return;
+    if (!(virNetTLSClientCache = virHashCreate(VIR_NET_TLS_CLIENT_CACHE_SIZE,
+                                               virNetTLSCachedSessionFree)))
+        virMutexDestroy(&virNetTLSClientCacheLock);
+}
+
+static int
+virNetTLSClientCacheReady(void)
+{
+    return virOnce(&virNetTLSClientCacheOnce,
+                   virNetTLSClientCacheInitialize) == 0 &&
+        virNetTLSClientCache != NULL;
+}
+
+
 static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
                                                const char *cacrl,
                                                const char *cert,
@@ -662,6 +805,14 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
         return NULL;
     }
 
+    if (virMutexInit(&ctxt->cacheLock) < 0) {
+        virNetError(VIR_ERR_INTERNAL_ERROR, "%s",
+                    _("Failed to initialized mutex"));
+        virMutexDestroy(&ctxt->lock);
+        VIR_FREE(ctxt);
+        return NULL;
+    }
+
     ctxt->refs = 1;
 
     if ((gnutlsdebug = getenv("LIBVIRT_GNUTLS_DEBUG")) != NULL) {
@@ -714,6 +865,18 @@ static virNetTLSContextPtr virNetTLSContextNew(const char *cacert,
                                          ctxt->dhParams);
     }
 
+    if (isServer) {
+        ctxt->sessionCacheSize = VIR_NET_TLS_SESSION_CACHE_SIZE;
+        ctxt->sessionCacheTimeout = VIR_NET_TLS_SESSION_CACHE_TIMEOUT;
+        if (!(ctxt->sessionCache = virHashCreate(ctxt->sessionCacheSize,
+                                                 virNetTLSCachedSessionFree)))
+            goto error;
+    } else if (virAsprintf(&ctxt->identity, "%s\n%s",
+                           cacert, NULLSTR(cert)) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
     ctxt->requireValidCert = requireValidCert;
     ctxt->x509dnWhitelist = x509dnWhitelist;
     ctxt->isServer = isServer;
@@ -728,6 +891,10 @@ error:
     if (isServer)
         gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+    virHashFree(ctxt->sessionCache);
+    VIR_FREE(ctxt->identity);
+    virMutexDestroy(&ctxt->cacheLock);
+    virMutexDestroy(&ctxt->lock);
     VIR_FREE(ctxt);
     return NULL;
 }
@@ -941,6 +1108,28 @@ void virNetTLSContextRef(virNetTLSContextPtr ctxt)
 }
 
 
+/*
+ * Configure how many sessions a server context remembers so that
+ * clients can resume them with an abbreviated handshake, and for how
+ * many seconds. A @maxSessions of 0 disables resumption. No effect on
+ * client contexts.
+ */
+void virNetTLSContextSetSessionCache(virNetTLSContextPtr ctxt,
+                                     size_t maxSessions,
+                                     unsigned int timeout)
+{
+    if (!ctxt->isServer)
+        return;
+
+    virMutexLock(&ctxt->cacheLock);
+    ctxt->sessionCacheSize = maxSessions;
+    ctxt->sessionCacheTimeout = timeout;
+    if (maxSessions == 0 || timeout == 0)
+        virHashRemoveSet(ctxt->sessionCache, virNetTLSCachedSessionAny, NULL);
+    virMutexUnlock(&ctxt->cacheLock);
+}
+
+
 static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
                                             virNetTLSSessionPtr sess)
 {
@@ -950,6 +1139,8 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
     unsigned int nCerts, i;
     char dname[256];
     size_t dnamesize = sizeof(dname);
+    time_t expires;
+    time_t certExpires = 0;
 
     memset(dname, 0, dnamesize);
 
@@ -1017,6 +1208,10 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
             goto authdeny;
         }
 
+        expires = gnutls_x509_crt_get_expiration_time(cert);
+        if (i == 0 || expires < certExpires)
+            certExpires = expires;
+
         if (i == 0) {
             ret = gnutls_x509_crt_get_dn(cert, dname, &dnamesize);
             if (ret != 0) {
@@ -1060,6 +1255,8 @@ static int virNetTLSContextValidCertificate(virNetTLSContextPtr ctxt,
         gnutls_x509_crt_deinit(cert);
     }
 
+    sess->certExpires = certExpires;
+
     PROBE(RPC_TLS_CONTEXT_SESSION_ALLOW,
           "ctxt=%p sess=%p dname=%s",
           ctxt, sess, dname);
@@ -1081,6 +1278,31 @@ authfail:
     return -1;
 }
 
+/* Server side, remember a session whose client we accepted */
+static void virNetTLSContextCacheSession(virNetTLSContextPtr ctxt,
+                                         virNetTLSSessionPtr sess)
+{
+    if (!sess->pendingID)
+        return;
+
+    virMutexLock(&ctxt->cacheLock);
+    if (ctxt->sessionCacheSize && ctxt->sessionCacheTimeout)
+        virNetTLSSessionCacheAdd(ctxt->sessionCache,
+                                 ctxt->sessionCacheSize,
+                                 sess->pendingID,
+                                 sess->pendingData,
+                                 sess->pendingLen,
+                                 ctxt->sessionCacheTimeout,
+                                 sess->certExpires);
+    else
+        VIR_FREE(sess->pendingData);
+    virMutexUnlock(&ctxt->cacheLock);
+
+    sess->pendingData = NULL;
+    sess->pendingLen = 0;
+    VIR_FREE(sess->pendingID);
+}
+
 int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
                                      virNetTLSSessionPtr sess)
 {
@@ -1088,6 +1310,16 @@ int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
 
     virMutexLock(&ctxt->lock);
     virMutexLock(&sess->lock);
+
+    /* Only sessions whose peer passed this very check get cached, and
+     * only until the first of the certificates expires, so there is
+     * nothing new to learn from them */
+    if (gnutls_session_is_resumed(sess->session)) {
+        VIR_DEBUG("Skipping certificate check of resumed session %p", sess);
+        ret = 0;
+        goto cleanup;
+    }
+
     if (virNetTLSContextValidCertificate(ctxt, sess) < 0) {
         virErrorPtr err = virGetLastError();
         VIR_WARN("Certificate check failed %s", err && err->message ? err->message : "<unknown>");
@@ -1100,6 +1332,9 @@ int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
         VIR_INFO("Ignoring bad certificate at user request");
     }
 
+    if (ctxt->isServer)
+        virNetTLSContextCacheSession(ctxt, sess);
+
     ret = 0;
 
 cleanup:
@@ -1126,7 +1361,10 @@ void virNetTLSContextFree(virNetTLSContextPtr ctxt)
 
     gnutls_dh_params_deinit(ctxt->dhParams);
     gnutls_certificate_free_credentials(ctxt->x509cred);
+    virHashFree(ctxt->sessionCache);
+    VIR_FREE(ctxt->identity);
     virMutexUnlock(&ctxt->lock);
+    virMutexDestroy(&ctxt->cacheLock);
     virMutexDestroy(&ctxt->lock);
     VIR_FREE(ctxt);
 }
@@ -1161,6 +1399,126 @@ virNetTLSSessionPull(void *opaque, void *buf, size_t len)
 }
 
 
+static char *
+virNetTLSSessionFormatID(const gnutls_datum_t *id)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *ret;
+    size_t i;
+
+    if (VIR_ALLOC_N(ret, id->size * 2 + 1) < 0)
+        return NULL;
+
+    for (i = 0; i < id->size; i++) {
+        ret[i * 2] = hex[id->data[i] >> 4];
+        ret[i * 2 + 1] = hex[id->data[i] & 0xf];
+    }
+
+    return ret;
+}
+
+/* GNUTLS session database callbacks, only used by servers. These run
+ * from within the handshake, so they must not report errors */
+static int
+virNetTLSSessionDBStore(void *opaque,
+                        gnutls_datum_t key,
+                        gnutls_datum_t data)
+{
+    virNetTLSSessionPtr sess = opaque;
+    char *id;
+
+    if (!(id = virNetTLSSessionFormatID(&key)))
+        return -1;
+
+    VIR_FREE(sess->pendingID);
+    VIR_FREE(sess->pendingData);
+    sess->pendingLen = 0;
+
+    if (VIR_ALLOC_N(sess->pendingData, data.size) < 0) {
+        VIR_FREE(id);
+        return -1;
+    }
+    memcpy(sess->pendingData, data.data, data.size);
+    sess->pendingLen = data.size;
+    sess->pendingID = id;
+
+    return 0;
+}
+
+static gnutls_datum_t
+virNetTLSSessionDBRetrieve(void *opaque,
+                           gnutls_datum_t key)
+{
+    virNetTLSSessionPtr sess = opaque;
+    virNetTLSContextPtr ctxt = sess->ctxt;
+    virNetTLSCachedSessionPtr entry;
+    gnutls_datum_t ret = { NULL, 0 };
+    char *id;
+
+    if (!(id = virNetTLSSessionFormatID(&key)))
+        return ret;
+
+    virMutexLock(&ctxt->cacheLock);
+    if ((entry = virHashLookup(ctxt->sessionCache, id)) &&
+        entry->expires > time(NULL) &&
+        (ret.data = gnutls_malloc(entry->len))) {
+        memcpy(ret.data, entry->data, entry->len);
+        ret.size = entry->len;
+    }
+    virMutexUnlock(&ctxt->cacheLock);
+
+    VIR_DEBUG("Session %s %s", id, ret.data ? "resumed" : "not cached");
+    VIR_FREE(id);
+    return ret;
+}
+
+static int
+virNetTLSSessionDBRemove(void *opaque,
+                         gnutls_datum_t key)
+{
+    virNetTLSSessionPtr sess = opaque;
+    virNetTLSContextPtr ctxt = sess->ctxt;
+    char *id;
+    int ret;
+
+    if (!(id = virNetTLSSessionFormatID(&key)))
+        return -1;
+
+    virMutexLock(&ctxt->cacheLock);
+    ret = virHashRemoveEntry(ctxt->sessionCache, id);
+    virMutexUnlock(&ctxt->cacheLock);
+
+    VIR_FREE(id);
+    return ret;
+}
+
+/* Client side, offer the server the session we last had with it */
+static void
+virNetTLSSessionLoadResumeData(virNetTLSSessionPtr sess,
+                               virNetTLSContextPtr ctxt)
+{
+    virNetTLSCachedSessionPtr entry;
+
+    if (!sess->hostname ||
+        !virNetTLSClientCacheReady())
+        return;
+
+    if (virAsprintf(&sess->cacheKey, "%s\n%s",
+                    ctxt->identity, sess->hostname) < 0)
+        return;
+
+    virMutexLock(&virNetTLSClientCacheLock);
+    if ((entry = virHashLookup(virNetTLSClientCache, sess->cacheKey)) &&
+        entry->expires > time(NULL)) {
+        if (gnutls_session_set_data(sess->session,
+                                    entry->data, entry->len) == 0)
+            VIR_DEBUG("Trying to resume previous session with %s",
+                      sess->hostname);
+    }
+    virMutexUnlock(&virNetTLSClientCacheLock);
+}
+
+
 virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
                                         const char *hostname)
 {
@@ -1222,6 +1580,22 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
         gnutls_certificate_server_set_request(sess->session, GNUTLS_CERT_REQUEST);
 
         gnutls_dh_set_prime_bits(sess->session, DH_BITS);
+
+        virMutexLock(&ctxt->cacheLock);
+        if (ctxt->sessionCacheSize && ctxt->sessionCacheTimeout) {
+            gnutls_db_set_cache_expiration(sess->session,
+                                           ctxt->sessionCacheTimeout);
+            gnutls_db_set_retrieve_function(sess->session,
+                                            virNetTLSSessionDBRetrieve);
+            gnutls_db_set_store_function(sess->session,
+                                         virNetTLSSessionDBStore);
+            gnutls_db_set_remove_function(sess->session,
+                                          virNetTLSSessionDBRemove);
+            gnutls_db_set_ptr(sess->session, sess);
+        }
+        virMutexUnlock(&ctxt->cacheLock);
+    } else {
+        virNetTLSSessionLoadResumeData(sess, ctxt);
     }
 
     gnutls_transport_set_ptr(sess->session, sess);
@@ -1231,6 +1605,8 @@ virNetTLSSessionPtr virNetTLSSessionNew(virNetTLSContextPtr ctxt,
                                        virNetTLSSessionPull);
 
     sess->isServer = ctxt->isServer;
+    virNetTLSContextRef(ctxt);
+    sess->ctxt = ctxt;
 
     PROBE(RPC_TLS_SESSION_NEW,
           "sess=%p refs=%d ctxt=%p hostname=%s isServer=%d",
@@ -1396,6 +1772,63 @@ cleanup:
 }
 
 
+bool virNetTLSSessionIsResumed(virNetTLSSessionPtr sess)
+{
+    bool ret;
+
+    virMutexLock(&sess->lock);
+    ret = sess->handshakeComplete &&
+        gnutls_session_is_resumed(sess->session);
+    virMutexUnlock(&sess->lock);
+
+    return ret;
+}
+
+
+/*
+ * Client side, remember the session of a connection the server fully
+ * accepted, so that the next connection to the same server with the
+ * same credentials can resume it. Failing to do so is not an error.
+ */
+void virNetTLSSessionSaveResumeData(virNetTLSSessionPtr sess)
+{
+    unsigned char *data = NULL;
+    size_t len = 0;
+    int rc;
+
+    virMutexLock(&sess->lock);
+
+    if (sess->isServer || !sess->cacheKey || !sess->handshakeComplete ||
+        gnutls_session_is_resumed(sess->session))
+        goto cleanup;
+
+    /* Depending on the GNUTLS version, asking for the size alone
+     * either succeeds or reports the buffer as too short */
+    rc = gnutls_session_get_data(sess->session, NULL, &len);
+    if ((rc != 0 && rc != GNUTLS_E_SHORT_MEMORY_BUFFER) ||
+        len == 0 ||
+        VIR_ALLOC_N(data, len) < 0)
+        goto cleanup;
+
+    if (gnutls_session_get_data(sess->session, data, &len) != 0) {
+        VIR_FREE(data);
+        goto cleanup;
+    }
+
+    virMutexLock(&virNetTLSClientCacheLock);
+    if (virNetTLSSessionCacheAdd(virNetTLSClientCache,
+                                 VIR_NET_TLS_CLIENT_CACHE_SIZE,
+                                 sess->cacheKey, data, len,
+                                 VIR_NET_TLS_SESSION_CACHE_TIMEOUT,
+                                 sess->certExpires) == 0)
+        VIR_DEBUG("Saved session with %s for resumption", sess->hostname);
+    virMutexUnlock(&virNetTLSClientCacheLock);
+
+cleanup:
+    virMutexUnlock(&sess->lock);
+}
+
+
 void virNetTLSSessionFree(virNetTLSSessionPtr sess)
 {
     if (!sess)
@@ -1412,7 +1845,11 @@ void virNetTLSSessionFree(virNetTLSSessionPtr sess)
     }
 
     VIR_FREE(sess->hostname);
+    VIR_FREE(sess->pendingID);
+    VIR_FREE(sess->pendingData);
+    VIR_FREE(sess->cacheKey);
     gnutls_deinit(sess->session);
+    virNetTLSContextFree(sess->ctxt);
     virMutexUnlock(&sess->lock);
     virMutexDestroy(&sess->lock);
     VIR_FREE(sess);
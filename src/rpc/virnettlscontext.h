@@ -29,6 +29,10 @@ typedef virNetTLSContext *virNetTLSContextPtr;
 typedef struct _virNetTLSSession virNetTLSSession;
 typedef virNetTLSSession *virNetTLSSessionPtr;
 
+/* Defaults for resuming sessions, see virNetTLSContextSetSessionCache */
+# define VIR_NET_TLS_SESSION_CACHE_SIZE 1024
+# define VIR_NET_TLS_SESSION_CACHE_TIMEOUT 3600
+
 
 void virNetTLSInit(void);
 
@@ -60,6 +64,10 @@ virNetTLSContextPtr virNetTLSContextNewClient(const char *cacert,
 
 void virNetTLSContextRef(virNetTLSContextPtr ctxt);
 
+void virNetTLSContextSetSessionCache(virNetTLSContextPtr ctxt,
+                                     size_t maxSessions,
+                                     unsigned int timeout);
+
 int virNetTLSContextCheckCertificate(virNetTLSContextPtr ctxt,
                                      virNetTLSSessionPtr sess);
 
@@ -99,6 +107,10 @@ virNetTLSSessionGetHandshakeStatus(virNetTLSSessionPtr sess);
 
 int virNetTLSSessionGetKeySize(virNetTLSSessionPtr sess);
 
+bool virNetTLSSessionIsResumed(virNetTLSSessionPtr sess);
+
+void virNetTLSSessionSaveResumeData(virNetTLSSessionPtr sess);
+
 void virNetTLSSessionFree(virNetTLSSessionPtr sess);
 
 
@@ -39,6 +39,7 @@
 #include "dirname.h"
 #ifdef __linux__
 # include <sys/ioctl.h>
+# include <sys/sendfile.h>
 # include <linux/fs.h>
 #endif
 
@@ -116,6 +117,184 @@ enum {
 
 #define READ_BLOCK_SIZE_DEFAULT  (1024 * 1024)
 #define WRITE_BLOCK_SIZE_DEFAULT (4 * 1024)
+#define COPY_CHUNK_SIZE_DEFAULT  (1024 * 1024 * 1024)
+
+#ifdef __linux__
+/*
+ * Copy up to *len bytes from the current offset of @inputfd to the
+ * current offset of @fd without bouncing them through user space,
+ * using copy_file_range() and then sendfile().  On return *len holds
+ * the number of bytes not copied, which is non-zero if neither call
+ * works for this pair of descriptors or the input ended early; the
+ * caller copies the rest itself.  Returns -1 with errno set on error.
+ */
+static int
+virStorageBackendCopyRangeInKernel(int inputfd, int fd,
+                                   unsigned long long *len)
+{
+# if HAVE_COPY_FILE_RANGE
+    bool use_copy_range = true;
+# else
+    bool use_copy_range = false;
+# endif
+    bool use_sendfile = true;
+
+    while (*len > 0) {
+        size_t chunk = COPY_CHUNK_SIZE_DEFAULT;
+        ssize_t done = -1;
+
+        if (chunk > *len)
+            chunk = *len;
+
+# if HAVE_COPY_FILE_RANGE
+        if (use_copy_range) {
+            done = copy_file_range(inputfd, NULL, fd, NULL, chunk, 0);
+            if (done < 0) {
+                if (errno != EXDEV && errno != EINVAL &&
+                    errno != ENOSYS && errno != EOPNOTSUPP)
+                    return -1;
+                use_copy_range = false;
+            }
+        }
+# endif
+        if (!use_copy_range && use_sendfile) {
+            done = sendfile(fd, inputfd, NULL, chunk);
+            if (done < 0) {
+                if (errno != EINVAL && errno != ENOSYS)
+                    return -1;
+                use_sendfile = false;
+            }
+        }
+
+        if (done <= 0)
+            break;
+        *len -= done;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy as much of @inputvol into @fd as the kernel can do for us: a
+ * reflink of the whole file where the file system shares extents,
+ * otherwise an in-kernel copy of the allocated extents of the source,
+ * skipping holes if @fd is a file.  *remain is decreased by the amount
+ * copied and both descriptors are left positioned after it, so the
+ * caller can carry on with a read/write loop if anything is left.
+ */
+static int
+virStorageBackendCopyToFDFast(virStorageVolDefPtr vol,
+                              virStorageVolDefPtr inputvol,
+                              int inputfd,
+                              int fd,
+                              unsigned long long *remain,
+                              int is_dest_file ATTRIBUTE_UNUSED)
+{
+    struct stat st;
+    off_t pos = 0;
+
+    if (fstat(inputfd, &st) < 0 || !S_ISREG(st.st_mode))
+        return 0;
+
+# ifdef FICLONE
+    if (is_dest_file && (unsigned long long) st.st_size <= *remain) {
+        struct stat dst;
+
+        if (fstat(fd, &dst) == 0 &&
+            ioctl(fd, FICLONE, inputfd) == 0) {
+            VIR_DEBUG("cloned '%s' to '%s'",
+                      inputvol->target.path, vol->target.path);
+
+            /* The clone takes the size of the source, restore the
+             * capacity we have already set up */
+            if (dst.st_size > st.st_size &&
+                ftruncate(fd, dst.st_size) < 0) {
+                virReportSystemError(errno,
+                                     _("cannot extend file '%s'"),
+                                     vol->target.path);
+                return -errno;
+            }
+            if (lseek(inputfd, st.st_size, SEEK_SET) < 0 ||
+                lseek(fd, st.st_size, SEEK_SET) < 0) {
+                virReportSystemError(errno,
+                                     _("cannot seek in file '%s'"),
+                                     vol->target.path);
+                return -errno;
+            }
+            *remain -= st.st_size;
+            return 0;
+        }
+    }
+# endif
+
+    while (*remain > 0 && pos < st.st_size) {
+        off_t hole = st.st_size;
+        unsigned long long len;
+        unsigned long long left;
+
+# if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        /* Holes only need skipping when the target is a file, a
+         * block device must get the zeroes written out. Without
+         * SEEK_DATA/SEEK_HOLE the whole source is copied as data */
+        if (is_dest_file) {
+            off_t data;
+
+            if ((data = lseek(inputfd, pos, SEEK_DATA)) < 0) {
+                if (errno != ENXIO)
+                    data = pos;
+                else
+                    data = st.st_size;
+            } else if ((hole = lseek(inputfd, data, SEEK_HOLE)) < 0) {
+                hole = st.st_size;
+            }
+
+            if (data > pos) {
+                len = data - pos;
+                if (len > *remain)
+                    len = *remain;
+                if (lseek(fd, len, SEEK_CUR) < 0) {
+                    virReportSystemError(errno,
+                                         _("cannot extend file '%s'"),
+                                         vol->target.path);
+                    return -errno;
+                }
+                *remain -= len;
+                pos += len;
+            }
+        }
+# endif
+
+        if (lseek(inputfd, pos, SEEK_SET) < 0) {
+            virReportSystemError(errno,
+                                 _("cannot seek in file '%s'"),
+                                 inputvol->target.path);
+            return -errno;
+        }
+
+        if (*remain == 0 || pos >= st.st_size)
+            break;
+
+        len = hole - pos;
+        if (len > *remain)
+            len = *remain;
+        left = len;
+
+        if (virStorageBackendCopyRangeInKernel(inputfd, fd, &left) < 0) {
+            virReportSystemError(errno,
+                                 _("failed copying '%s' to '%s'"),
+                                 inputvol->target.path, vol->target.path);
+            return -errno;
+        }
+        *remain -= len - left;
+        pos += len - left;
+
+        if (left > 0)
+            break;
+    }
+
+    return 0;
+}
+#endif /* __linux__ */
 
 static int ATTRIBUTE_NONNULL (2)
 virStorageBackendCopyToFD(virStorageVolDefPtr vol,
@@ -167,6 +346,12 @@ virStorageBackendCopyToFD(virStorageVolDefPtr vol,
 
     remain = *total;
 
+#ifdef __linux__
+    if ((ret = virStorageBackendCopyToFDFast(vol, inputvol, inputfd, fd,
+                                             &remain, is_dest_file)) < 0)
+        goto cleanup;
+#endif
+
     while (amtread != 0) {
         int amtleft;
 
@@ -350,7 +535,8 @@ createRawFile(int fd, virStorageVolDefPtr vol,
                 remain -= bytes;
             }
         } else { /* No progress bars to be shown */
-            if (safezero(fd, 0, remain) < 0) {
+            /* do not zero what was copied from the input volume */
+            if (safezero(fd, vol->allocation - remain, remain) < 0) {
                 ret = -errno;
                 virReportSystemError(errno, _("cannot fill file '%s'"),
                                      vol->target.path);
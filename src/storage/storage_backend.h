@@ -33,6 +33,7 @@ typedef int (*virStorageBackendCheckPool)(virConnectPtr conn, virStoragePoolObjP
 typedef int (*virStorageBackendStartPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
 typedef int (*virStorageBackendBuildPool)(virConnectPtr conn, virStoragePoolObjPtr pool, unsigned int flags);
 typedef int (*virStorageBackendRefreshPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
+typedef int (*virStorageBackendCheckPoolChanged)(virConnectPtr conn, virStoragePoolObjPtr pool, bool *changed);
 typedef int (*virStorageBackendStopPool)(virConnectPtr conn, virStoragePoolObjPtr pool);
 typedef int (*virStorageBackendDeletePool)(virConnectPtr conn, virStoragePoolObjPtr pool, unsigned int flags);
 
@@ -75,6 +76,7 @@ struct _virStorageBackend {
     virStorageBackendStartPool startPool;
     virStorageBackendBuildPool buildPool;
     virStorageBackendRefreshPool refreshPool;
+    virStorageBackendCheckPoolChanged checkPoolChanged;
     virStorageBackendStopPool stopPool;
     virStorageBackendDeletePool deletePool;
 
@@ -50,6 +50,9 @@
 #include "xml.h"
 #include "virfile.h"
 #include "logging.h"
+#include "threads.h"
+#include "threadpool.h"
+#include "virhash.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -803,18 +806,401 @@ error:
 }
 
 
+/* Reading the headers of thousands of images one after another makes
+ * a refresh take far longer than it needs to, so volumes are probed
+ * by a pool of worker threads.  */
+#define VIR_STORAGE_FS_PROBE_WORKERS 8
+
+/* Result of probing one volume, kept in pool->probed until the next
+ * refresh so that files whose stat data has not changed need not be
+ * opened again.  */
+typedef struct _virStorageBackendFileSystemProbed virStorageBackendFileSystemProbed;
+typedef virStorageBackendFileSystemProbed *virStorageBackendFileSystemProbedPtr;
+struct _virStorageBackendFileSystemProbed {
+    struct stat sb;
+    int ret;
+    virStorageVolDefPtr vol;
+};
+
+typedef struct _virStorageBackendFileSystemProbeJob virStorageBackendFileSystemProbeJob;
+typedef virStorageBackendFileSystemProbeJob *virStorageBackendFileSystemProbeJobPtr;
+struct _virStorageBackendFileSystemProbeJob {
+    virStorageVolDefPtr vol;
+    struct stat sb;
+    bool haveStat;
+    int ret;
+    virErrorPtr err;
+};
+
+typedef struct _virStorageBackendFileSystemProbeState virStorageBackendFileSystemProbeState;
+typedef virStorageBackendFileSystemProbeState *virStorageBackendFileSystemProbeStatePtr;
+struct _virStorageBackendFileSystemProbeState {
+    virMutex lock;
+    virCond cond;
+    size_t pending;
+    /* Results of the previous refresh, read only while probing */
+    virHashTablePtr cache;
+};
+
+static void
+virStorageBackendFileSystemProbedFree(void *payload,
+                                      const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageBackendFileSystemProbedPtr probed = payload;
+
+    if (!probed)
+        return;
+    virStorageVolDefFree(probed->vol);
+    VIR_FREE(probed);
+}
+
+/* Copy what virStorageBackendProbeTarget found out about @src into @dst */
+static int
+virStorageBackendFileSystemCopyProbed(virStorageVolDefPtr dst,
+                                      virStorageVolDefPtr src)
+{
+    dst->type = src->type;
+    dst->allocation = src->allocation;
+    dst->capacity = src->capacity;
+
+    dst->target.format = src->target.format;
+    dst->target.perms.mode = src->target.perms.mode;
+    dst->target.perms.uid = src->target.perms.uid;
+    dst->target.perms.gid = src->target.perms.gid;
+    if (src->target.perms.label &&
+        !(dst->target.perms.label = strdup(src->target.perms.label)))
+        goto no_memory;
+
+    if (src->target.encryption) {
+        if (VIR_ALLOC(dst->target.encryption) < 0)
+            goto no_memory;
+        dst->target.encryption->format = src->target.encryption->format;
+    }
+
+    if (src->backingStore.path) {
+        if (!(dst->backingStore.path = strdup(src->backingStore.path)))
+            goto no_memory;
+        dst->backingStore.format = src->backingStore.format;
+    }
+
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    return -1;
+}
+
+static bool
+virStorageBackendFileSystemStatUnchanged(const struct stat *a,
+                                         const struct stat *b)
+{
+    return a->st_dev == b->st_dev &&
+        a->st_ino == b->st_ino &&
+        a->st_size == b->st_size &&
+        a->st_blocks == b->st_blocks &&
+        a->st_mtime == b->st_mtime &&
+        a->st_ctime == b->st_ctime;
+}
+
+/* Probe @vol, whose name, key and path are already filled in.  If
+ * @cache holds a result for a file with the same stat data, that is
+ * copied instead of opening the file again.  The stat data is stored
+ * in @sb with *haveStat set if the file could be stat'ed.  Returns as
+ * virStorageBackendProbeTarget does.  */
+static int
+virStorageBackendFileSystemProbeVol(virStorageVolDefPtr vol,
+                                    virHashTablePtr cache,
+                                    struct stat *sb,
+                                    bool *haveStat)
+{
+    virStorageBackendFileSystemProbedPtr probed = NULL;
+    int ret;
+
+    *haveStat = false;
+    if (stat(vol->target.path, sb) == 0) {
+        *haveStat = true;
+        if (cache)
+            probed = virHashLookup(cache, vol->name);
+    }
+
+    if (probed &&
+        virStorageBackendFileSystemStatUnchanged(&probed->sb, sb)) {
+        ret = probed->ret;
+        if (virStorageBackendFileSystemCopyProbed(vol, probed->vol) < 0)
+            ret = -1;
+    } else {
+        char *backingStore;
+        int backingStoreFormat;
+
+        ret = virStorageBackendProbeTarget(&vol->target,
+                                           &backingStore,
+                                           &backingStoreFormat,
+                                           &vol->allocation,
+                                           &vol->capacity,
+                                           &vol->target.encryption);
+        if (ret == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. */
+            backingStoreFormat = VIR_STORAGE_FILE_RAW;
+        }
+
+        if (ret == 0 || ret == -3) {
+            /* directory based volume */
+            if (vol->target.format == VIR_STORAGE_FILE_DIR)
+                vol->type = VIR_STORAGE_VOL_DIR;
+
+            if (backingStore != NULL) {
+                vol->backingStore.path = backingStore;
+                vol->backingStore.format = backingStoreFormat;
+            }
+        }
+    }
+
+    if ((ret == 0 || ret == -3) &&
+        vol->backingStore.path &&
+        virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                             NULL, NULL,
+                                             VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
+        /* The backing file is currently unavailable, the capacity,
+         * allocation, owner, group and mode are unknown. Just log the
+         * error and continue.
+         * Unfortunately virStorageBackendProbeTarget() might already
+         * have logged a similar message for the same problem, but only
+         * if AUTO format detection was used. */
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
+                              _("cannot probe backing volume info: %s"),
+                              vol->backingStore.path);
+    }
+
+    return ret;
+}
+
+static void
+virStorageBackendFileSystemProbeWorker(void *jobdata, void *opaque)
+{
+    virStorageBackendFileSystemProbeJobPtr job = jobdata;
+    virStorageBackendFileSystemProbeStatePtr state = opaque;
+
+    job->ret = virStorageBackendFileSystemProbeVol(job->vol, state->cache,
+                                                   &job->sb, &job->haveStat);
+
+    /* Errors are per thread, hand a real failure over to the caller */
+    if (job->ret < 0 && job->ret != -2 && job->ret != -3)
+        job->err = virSaveLastError();
+
+    virMutexLock(&state->lock);
+    if (--state->pending == 0)
+        virCondSignal(&state->cond);
+    virMutexUnlock(&state->lock);
+}
+
+static void
+virStorageBackendFileSystemProbeJobFree(virStorageBackendFileSystemProbeJobPtr job)
+{
+    if (!job)
+        return;
+    virStorageVolDefFree(job->vol);
+    virFreeError(job->err);
+    VIR_FREE(job);
+}
+
+static virStorageVolDefPtr
+virStorageBackendFileSystemNewVol(virStoragePoolObjPtr pool,
+                                  const char *name)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        goto no_memory;
+
+    if ((vol->name = strdup(name)) == NULL)
+        goto no_memory;
+
+    vol->type = VIR_STORAGE_VOL_FILE;
+    vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
+    if (virAsprintf(&vol->target.path, "%s/%s",
+                    pool->def->target.path,
+                    vol->name) == -1)
+        goto no_memory;
+
+    if ((vol->key = strdup(vol->target.path)) == NULL)
+        goto no_memory;
+
+    return vol;
+
+no_memory:
+    virReportOOMError();
+    virStorageVolDefFree(vol);
+    return NULL;
+}
+
+/**
+ * Update the capacity, allocation and available space of the pool
+ * from the file system holding its directory.
+ */
+int
+virStorageBackendFileSystemUpdateCapacity(virStoragePoolObjPtr pool)
+{
+    struct statvfs sb;
+
+    if (statvfs(pool->def->target.path, &sb) < 0) {
+        virReportSystemError(errno,
+                             _("cannot statvfs path '%s'"),
+                             pool->def->target.path);
+        return -1;
+    }
+    pool->def->capacity = ((unsigned long long)sb.f_frsize *
+                           (unsigned long long)sb.f_blocks);
+    pool->def->available = ((unsigned long long)sb.f_bfree *
+                            (unsigned long long)sb.f_bsize);
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+
+    return 0;
+}
+
+/**
+ * Update the allocation of the volumes of @pool, which a watch does
+ * not report for writes to files kept open, and the capacity of the
+ * pool.  Returns -1 if a volume could not be looked at, in which case
+ * the pool needs to be rescanned.
+ */
+int
+virStorageBackendFileSystemUpdateAllocation(virStoragePoolObjPtr pool)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < pool->volumes.count ; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+        if (vol->building)
+            continue;
+
+        if (virStorageBackendUpdateVolTargetInfo(&vol->target,
+                                                 &vol->allocation, NULL,
+                                                 VIR_STORAGE_VOL_FS_OPEN_FLAGS) < 0)
+            return -1;
+    }
+
+    return virStorageBackendFileSystemUpdateCapacity(pool);
+}
+
+/**
+ * Bring the volume @name of @pool in line with the file of that name
+ * in the pool's directory: add it if it is new, probe it again if it
+ * is known, drop it if the file is gone.  Volumes which are being
+ * built are left alone.
+ */
+int
+virStorageBackendFileSystemUpdateVol(virStoragePoolObjPtr pool,
+                                     const char *name)
+{
+    virStorageVolDefPtr vol = NULL;
+    virStorageVolDefPtr old;
+    struct stat sb;
+    bool haveStat;
+    size_t i;
+    int rc;
+    int ret = -1;
+
+    if (STREQ(name, ".") || STREQ(name, ".."))
+        return 0;
+
+    old = virStorageVolDefFindByName(pool, name);
+    if (old && old->building)
+        return 0;
+
+    if (!(vol = virStorageBackendFileSystemNewVol(pool, name)))
+        return -1;
+
+    if (lstat(vol->target.path, &sb) < 0 && errno == ENOENT)
+        rc = -2;
+    else
+        rc = virStorageBackendFileSystemProbeVol(vol, NULL, &sb, &haveStat);
+
+    if (rc < 0 && rc != -2 && rc != -3)
+        goto cleanup;
+
+    for (i = 0 ; old && i < pool->volumes.count ; i++) {
+        if (pool->volumes.objs[i] == old)
+            break;
+    }
+
+    if (rc == -2) {
+        if (old) {
+            VIR_INFO("Volume '%s' removed from storage pool '%s'",
+                     name, pool->def->name);
+            virStorageVolDefFree(old);
+
+            if (i < (pool->volumes.count - 1))
+                memmove(pool->volumes.objs + i, pool->volumes.objs + i + 1,
+                        sizeof(*(pool->volumes.objs)) * (pool->volumes.count - (i + 1)));
+
+            if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count - 1) < 0) {
+                ; /* Failure to reduce memory allocation isn't fatal */
+            }
+            pool->volumes.count--;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (old) {
+        VIR_DEBUG("Volume '%s' of storage pool '%s' changed",
+                  name, pool->def->name);
+        virStorageVolDefFree(old);
+        pool->volumes.objs[i] = vol;
+    } else {
+        if (VIR_REALLOC_N(pool->volumes.objs,
+                          pool->volumes.count+1) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        VIR_INFO("Volume '%s' added to storage pool '%s'",
+                 name, pool->def->name);
+        pool->volumes.objs[pool->volumes.count++] = vol;
+    }
+    vol = NULL;
+    ret = 0;
+
+cleanup:
+    virStorageVolDefFree(vol);
+    return ret;
+}
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * The pool is unlocked while the volumes are being probed, with an
+ * asynchronous job keeping it from being stopped or undefined.  The
+ * volumes listed so far stay in the pool meanwhile, so that they can
+ * still be looked up, and are replaced with what the probe found once
+ * it is done.  Any volume which shows up in the meantime, from a volume
+ * creation or a watch event, is kept in favour of what the probe found.
  */
 static int
 virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
                                    virStoragePoolObjPtr pool)
 {
-    DIR *dir;
+    DIR *dir = NULL;
     struct dirent *ent;
-    struct statvfs sb;
     virStorageVolDefPtr vol = NULL;
+    virStorageBackendFileSystemProbeJobPtr *jobs = NULL;
+    size_t njobs = 0;
+    size_t existing;
+    size_t i, j;
+    virStorageBackendFileSystemProbeState state;
+    bool stateInitialized = false;
+    virThreadPoolPtr workers = NULL;
+    virHashTablePtr cache = NULL;
+    bool unlocked = false;
+    time_t now = time(NULL);
+    int ret = -1;
+
+    memset(&state, 0, sizeof(state));
 
     if (!(dir = opendir(pool->def->target.path))) {
         virReportSystemError(errno,
@@ -824,106 +1210,177 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     while ((ent = readdir(dir)) != NULL) {
-        int ret;
-        char *backingStore;
-        int backingStoreFormat;
+        if (STREQ(ent->d_name, ".") || STREQ(ent->d_name, ".."))
+            continue;
 
-        if (VIR_ALLOC(vol) < 0)
-            goto no_memory;
+        if (!(vol = virStorageBackendFileSystemNewVol(pool, ent->d_name)))
+            goto cleanup;
 
-        if ((vol->name = strdup(ent->d_name)) == NULL)
+        if (VIR_EXPAND_N(jobs, njobs, 1) < 0 ||
+            VIR_ALLOC(jobs[njobs - 1]) < 0)
             goto no_memory;
+        jobs[njobs - 1]->vol = vol;
+        vol = NULL;
+    }
+    closedir(dir);
+    dir = NULL;
 
-        vol->type = VIR_STORAGE_VOL_FILE;
-        vol->target.format = VIR_STORAGE_FILE_RAW; /* Real value is filled in during probe */
-        if (virAsprintf(&vol->target.path, "%s/%s",
-                        pool->def->target.path,
-                        vol->name) == -1)
-            goto no_memory;
+    if (virMutexInit(&state.lock) < 0) {
+        virReportSystemError(errno, "%s", _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    if (virCondInit(&state.cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("cannot initialize condition variable"));
+        virMutexDestroy(&state.lock);
+        goto cleanup;
+    }
+    stateInitialized = true;
 
-        if ((vol->key = strdup(vol->target.path)) == NULL)
-            goto no_memory;
+    state.cache = pool->probed;
+    pool->probed = NULL;
 
-        if ((ret = virStorageBackendProbeTarget(&vol->target,
-                                                &backingStore,
-                                                &backingStoreFormat,
-                                                &vol->allocation,
-                                                &vol->capacity,
-                                                &vol->target.encryption)) < 0) {
-            if (ret == -2) {
-                /* Silently ignore non-regular files,
-                 * eg '.' '..', 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (ret == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-                backingStoreFormat = VIR_STORAGE_FILE_RAW;
-            } else
-                goto cleanup;
+    for (i = 0 ; i < pool->volumes.count ; i++)
+        pool->volumes.objs[i]->stale = true;
+
+    if (njobs &&
+        !(workers = virThreadPoolNew(1, VIR_STORAGE_FS_PROBE_WORKERS, 0,
+                                     virStorageBackendFileSystemProbeWorker,
+                                     &state)))
+        goto cleanup;
+
+    pool->asyncjobs++;
+    virStoragePoolObjUnlock(pool);
+    unlocked = true;
+
+    virMutexLock(&state.lock);
+    for (i = 0 ; i < njobs ; i++) {
+        if (virThreadPoolSendJob(workers, 0, jobs[i]) < 0) {
+            virMutexUnlock(&state.lock);
+            goto cleanup;
+        }
+        state.pending++;
+    }
+    while (state.pending) {
+        if (virCondWait(&state.cond, &state.lock) < 0) {
+            virMutexUnlock(&state.lock);
+            virReportSystemError(errno, "%s",
+                                 _("cannot wait for volume probes"));
+            goto cleanup;
         }
+    }
+    virMutexUnlock(&state.lock);
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (backingStore != NULL) {
-            vol->backingStore.path = backingStore;
-            vol->backingStore.format = backingStoreFormat;
-
-            if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
-                                        NULL, NULL,
-                                        VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
-                /* The backing file is currently unavailable, the capacity,
-                 * allocation, owner, group and mode are unknown. Just log the
-                 * error and continue.
-                 * Unfortunately virStorageBackendProbeTarget() might already
-                 * have logged a similar message for the same problem, but only
-                 * if AUTO format detection was used. */
-                virStorageReportError(VIR_ERR_INTERNAL_ERROR,
-                                      _("cannot probe backing volume info: %s"),
-                                      vol->backingStore.path);
+    virStoragePoolObjLock(pool);
+    pool->asyncjobs--;
+    unlocked = false;
+    existing = pool->volumes.count;
+
+    if (!(cache = virHashCreate(njobs ? njobs : 10,
+                                virStorageBackendFileSystemProbedFree)))
+        goto cleanup;
+
+    for (i = 0 ; i < njobs ; i++) {
+        virStorageBackendFileSystemProbeJobPtr job = jobs[i];
+
+        if (job->ret == -2) {
+            /* Silently ignore non-regular files,
+             * eg 'lost+found', dangling symbolic link */
+            continue;
+        } else if (job->ret < 0 && job->ret != -3) {
+            if (job->err)
+                virSetError(job->err);
+            goto cleanup;
+        }
+
+        /* Only remember files which have not changed within the
+         * granularity of their timestamps, or a modification made
+         * right after this probe would go unnoticed */
+        if (job->haveStat &&
+            job->sb.st_mtime < now &&
+            job->sb.st_ctime < now) {
+            virStorageBackendFileSystemProbedPtr probed;
+
+            if (VIR_ALLOC(probed) < 0)
+                goto no_memory;
+            probed->sb = job->sb;
+            probed->ret = job->ret;
+            if (VIR_ALLOC(probed->vol) < 0 ||
+                virStorageBackendFileSystemCopyProbed(probed->vol,
+                                                      job->vol) < 0 ||
+                virHashAddEntry(cache, job->vol->name, probed) < 0) {
+                virStorageBackendFileSystemProbedFree(probed, NULL);
+                goto cleanup;
             }
         }
 
+        for (j = 0 ; j < existing ; j++) {
+            if (STREQ(pool->volumes.objs[j]->name, job->vol->name))
+                break;
+        }
+        if (j < existing) {
+            if (pool->volumes.objs[j]->stale) {
+                virStorageVolDefFree(pool->volumes.objs[j]);
+                pool->volumes.objs[j] = job->vol;
+                job->vol = NULL;
+            }
+            continue;
+        }
 
         if (VIR_REALLOC_N(pool->volumes.objs,
                           pool->volumes.count+1) < 0)
             goto no_memory;
-        pool->volumes.objs[pool->volumes.count++] = vol;
-        vol = NULL;
+        pool->volumes.objs[pool->volumes.count++] = job->vol;
+        job->vol = NULL;
     }
-    closedir(dir);
-
 
-    if (statvfs(pool->def->target.path, &sb) < 0) {
-        virReportSystemError(errno,
-                             _("cannot statvfs path '%s'"),
-                             pool->def->target.path);
-        return -1;
+    /* whatever the probe did not find again is gone */
+    for (i = 0, j = 0 ; i < pool->volumes.count ; i++) {
+        if (pool->volumes.objs[i]->stale)
+            virStorageVolDefFree(pool->volumes.objs[i]);
+        else
+            pool->volumes.objs[j++] = pool->volumes.objs[i];
+    }
+    if (j < pool->volumes.count) {
+        ignore_value(VIR_REALLOC_N(pool->volumes.objs, j));
+        pool->volumes.count = j;
     }
-    pool->def->capacity = ((unsigned long long)sb.f_frsize *
-                           (unsigned long long)sb.f_blocks);
-    pool->def->available = ((unsigned long long)sb.f_bfree *
-                            (unsigned long long)sb.f_bsize);
-    pool->def->allocation = pool->def->capacity - pool->def->available;
 
-    return 0;
+    pool->probed = cache;
+    cache = NULL;
+
+    if (virStorageBackendFileSystemUpdateCapacity(pool) < 0)
+        goto cleanup;
+
+    ret = 0;
+    goto cleanup;
 
 no_memory:
     virReportOOMError();
     /* fallthrough */
 
- cleanup:
+cleanup:
     if (dir)
         closedir(dir);
+    /* Waits for any probe still running, so the jobs can go too */
+    virThreadPoolFree(workers);
+    if (unlocked) {
+        virStoragePoolObjLock(pool);
+        pool->asyncjobs--;
+    }
+    if (stateInitialized) {
+        virMutexDestroy(&state.lock);
+        ignore_value(virCondDestroy(&state.cond));
+    }
+    virHashFree(state.cache);
+    virHashFree(cache);
+    for (i = 0 ; i < njobs ; i++)
+        virStorageBackendFileSystemProbeJobFree(jobs[i]);
+    VIR_FREE(jobs);
     virStorageVolDefFree(vol);
-    virStoragePoolObjClearVols(pool);
-    return -1;
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
+    return ret;
 }
 
 
@@ -936,18 +1393,21 @@ no_memory:
  *  - If it is a FS based pool, unmounts the unlying source device on the pool
  *  - Releases all cached data about volumes
  */
-#if WITH_STORAGE_FS
 static int
 virStorageBackendFileSystemStop(virConnectPtr conn ATTRIBUTE_UNUSED,
                                 virStoragePoolObjPtr pool)
 {
+    virHashFree(pool->probed);
+    pool->probed = NULL;
+
+#if WITH_STORAGE_FS
     if (pool->def->type != VIR_STORAGE_POOL_DIR &&
         virStorageBackendFileSystemUnmount(pool) < 0)
         return -1;
+#endif /* WITH_STORAGE_FS */
 
     return 0;
 }
-#endif /* WITH_STORAGE_FS */
 
 
 /**
@@ -1211,6 +1671,7 @@ virStorageBackendFilesystemResizeQemuImg(const char *path,
     virCommandAddArgFormat(cmd, "%llu", capacity);
 
     ret = virCommandRun(cmd, NULL);
+    virStorageFileInvalidateMetadata(path);
 
     VIR_FREE(img_tool);
     virCommandFree(cmd);
@@ -1243,6 +1704,7 @@ virStorageBackend virStorageBackendDirectory = {
     .buildPool = virStorageBackendFileSystemBuild,
     .checkPool = virStorageBackendFileSystemCheck,
     .refreshPool = virStorageBackendFileSystemRefresh,
+    .stopPool = virStorageBackendFileSystemStop,
     .deletePool = virStorageBackendFileSystemDelete,
     .buildVol = virStorageBackendFileSystemVolBuild,
     .buildVolFrom = virStorageBackendFileSystemVolBuildFrom,
@@ -38,4 +38,9 @@ typedef enum {
 } virStoragePoolProbeResult;
 extern virStorageBackend virStorageBackendDirectory;
 
+int virStorageBackendFileSystemUpdateCapacity(virStoragePoolObjPtr pool);
+int virStorageBackendFileSystemUpdateAllocation(virStoragePoolObjPtr pool);
+int virStorageBackendFileSystemUpdateVol(virStoragePoolObjPtr pool,
+                                         const char *name);
+
 #endif /* __VIR_STORAGE_BACKEND_FS_H__ */
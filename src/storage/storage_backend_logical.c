@@ -26,7 +26,6 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <stdio.h>
-#include <regex.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -38,6 +37,7 @@
 #include "memory.h"
 #include "logging.h"
 #include "virfile.h"
+#include "c-ctype.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -64,31 +64,199 @@ virStorageBackendLogicalSetActive(virStoragePoolObjPtr pool,
 
 #define VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED "striped"
 
+/*
+ * Fields requested from lvs, in the order they appear on each output
+ * line. The trailing vg_* fields repeat the volume group metadata on
+ * every row, which saves a separate vgs run whenever the group has at
+ * least one volume.
+ */
+enum {
+    VIR_STORAGE_LOGICAL_LV_NAME,
+    VIR_STORAGE_LOGICAL_LV_ORIGIN,
+    VIR_STORAGE_LOGICAL_LV_UUID,
+    VIR_STORAGE_LOGICAL_LV_DEVICES,
+    VIR_STORAGE_LOGICAL_LV_SEGTYPE,
+    VIR_STORAGE_LOGICAL_LV_STRIPES,
+    VIR_STORAGE_LOGICAL_LV_SEG_SIZE,
+    VIR_STORAGE_LOGICAL_LV_EXTENT_SIZE,
+    VIR_STORAGE_LOGICAL_LV_SIZE,
+    VIR_STORAGE_LOGICAL_LV_VG_SEQNO,
+    VIR_STORAGE_LOGICAL_LV_VG_SIZE,
+    VIR_STORAGE_LOGICAL_LV_VG_FREE,
+
+    VIR_STORAGE_LOGICAL_LV_LAST
+};
+
+#define VIR_STORAGE_LOGICAL_LV_FIELDS                                   \
+    "lv_name,origin,uuid,devices,segtype,stripes,seg_size,"             \
+    "vg_extent_size,lv_size,vg_seq_no,vg_size,vg_free"
+
+/* Same for vgs, used when there are no volumes to piggy-back on */
+enum {
+    VIR_STORAGE_LOGICAL_VG_SEQNO,
+    VIR_STORAGE_LOGICAL_VG_SIZE,
+    VIR_STORAGE_LOGICAL_VG_FREE,
+
+    VIR_STORAGE_LOGICAL_VG_LAST
+};
+
+#define VIR_STORAGE_LOGICAL_VG_FIELDS "vg_seq_no,vg_size,vg_free"
+
+
+/*
+ * Split one line of "--separator # --noheadings" report output in place.
+ * Leading blanks, an optional command name prefix (older lvm tools put
+ * one on some lines) and the trailing separator printed by some distros
+ * (e.g. SLES10 SP2) are ignored.
+ *
+ * Returns 0 on success, -1 if the line does not have exactly @nfields
+ * fields. No error is reported in that case.
+ */
+int
+virStorageBackendLogicalSplitLine(char *line,
+                                  const char *prefix,
+                                  char **fields,
+                                  size_t nfields)
+{
+    char *p = line;
+    char *end;
+    char *tmp;
+    size_t i;
+
+    if ((tmp = STRSKIP(p, prefix)))
+        p = tmp;
+    virSkipSpaces((const char **)&p);
+
+    end = p + strlen(p);
+    while (end > p && c_isspace(end[-1]))
+        end--;
+    if (end > p && end[-1] == '#')
+        end--;
+    *end = '\0';
+
+    if (!*p)
+        return -1;
+
+    for (i = 0; i < nfields; i++) {
+        fields[i] = p;
+        if (!(p = strchr(p, '#')))
+            break;
+        *p++ = '\0';
+    }
+
+    if (i != nfields - 1)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+virStorageBackendLogicalParseVGInfo(virStoragePoolObjPtr pool,
+                                    const char *seqno,
+                                    const char *size,
+                                    const char *avail,
+                                    unsigned long long *seqnoRet)
+{
+    if (virStrToLong_ull(seqno, NULL, 10, seqnoRet) < 0 ||
+        virStrToLong_ull(size, NULL, 10, &pool->def->capacity) < 0 ||
+        virStrToLong_ull(avail, NULL, 10, &pool->def->available) < 0) {
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
+                              _("malformed metadata for volume group '%s'"),
+                              pool->def->source.name);
+        return -1;
+    }
+    pool->def->allocation = pool->def->capacity - pool->def->available;
+
+    return 0;
+}
+
+
+/*
+ * Parse the "devices" field of an lvs row into @vol's extent list.
+ * The field is a comma separated list of "path(extent)" pairs, one
+ * per stripe.
+ */
+int
+virStorageBackendLogicalParseExtents(virStorageVolDefPtr vol,
+                                     char *devices,
+                                     int nextents,
+                                     unsigned long long length,
+                                     unsigned long long size)
+{
+    virStorageVolSourceExtentPtr extent;
+    unsigned long long offset;
+    char *p = devices;
+    char *lparen, *rparen;
+    int i;
+
+    if (VIR_REALLOC_N(vol->source.extents,
+                      vol->source.nextent + nextents) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (i = 0; i < nextents; i++) {
+        if (!(lparen = strchr(p, '(')) ||
+            !(rparen = strchr(lparen, ')')) ||
+            lparen == p ||
+            (rparen[1] != '\0' && rparen[1] != ',') ||
+            (i == nextents - 1) != (rparen[1] == '\0')) {
+            virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                  _("malformed volume extent devices value"));
+            return -1;
+        }
+        *lparen = *rparen = '\0';
+
+        if (virStrToLong_ull(lparen + 1, NULL, 10, &offset) < 0) {
+            virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                  _("malformed volume extent offset value"));
+            return -1;
+        }
+
+        extent = &vol->source.extents[vol->source.nextent];
+        if (!(extent->path = strdup(p))) {
+            virReportOOMError();
+            return -1;
+        }
+        extent->start = offset * size;
+        extent->end = (offset * size) + length;
+        vol->source.nextent++;
+
+        p = rparen + 2;
+    }
+
+    return 0;
+}
+
+
 static int
 virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
-                                char **const groups,
-                                void *data)
+                                char **const fields,
+                                virStorageVolDefPtr match)
 {
     virStorageVolDefPtr vol = NULL;
     bool is_new_vol = false;
-    unsigned long long offset, size, length;
-    const char *regex_unit = "(\\S+)\\((\\S+)\\)";
-    char *regex = NULL;
-    regex_t *reg = NULL;
-    regmatch_t *vars = NULL;
-    char *p = NULL;
-    int i, err, nextents, nvars, ret = -1;
+    unsigned long long size, length;
+    int nextents, ret = -1;
+    const char *name = fields[VIR_STORAGE_LOGICAL_LV_NAME];
+    const char *origin = fields[VIR_STORAGE_LOGICAL_LV_ORIGIN];
 
     /* See if we're only looking for a specific volume */
-    if (data != NULL) {
-        vol = data;
-        if (STRNEQ(vol->name, groups[0]))
+    if (match != NULL) {
+        if (STRNEQ(match->name, name))
             return 0;
+        vol = match;
     }
 
-    /* Or filling in more data on an existing volume */
+    /* Or filling in more data on an existing volume. lvs prints all
+     * segments of a volume on consecutive rows, so the last volume
+     * added is the likely hit */
+    if (vol == NULL && pool->volumes.count > 0 &&
+        STREQ(pool->volumes.objs[pool->volumes.count - 1]->name, name))
+        vol = pool->volumes.objs[pool->volumes.count - 1];
     if (vol == NULL)
-        vol = virStorageVolDefFindByName(pool, groups[0]);
+        vol = virStorageVolDefFindByName(pool, name);
 
     /* Or a completely new volume */
     if (vol == NULL) {
@@ -100,7 +268,7 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
         is_new_vol = true;
         vol->type = VIR_STORAGE_VOL_BLOCK;
 
-        if ((vol->name = strdup(groups[0])) == NULL) {
+        if ((vol->name = strdup(name)) == NULL) {
             virReportOOMError();
             goto cleanup;
         }
@@ -127,9 +295,10 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
      * (lvs outputs "[$lvname_vorigin] for field "origin" if the
      *  lv is created with "--virtualsize").
      */
-    if (groups[1] && !STREQ(groups[1], "") && (groups[1][0] != '[')) {
+    if (vol->backingStore.path == NULL &&
+        !STREQ(origin, "") && origin[0] != '[') {
         if (virAsprintf(&vol->backingStore.path, "%s/%s",
-                        pool->def->target.path, groups[1]) < 0) {
+                        pool->def->target.path, origin) < 0) {
             virReportOOMError();
             goto cleanup;
         }
@@ -138,199 +307,205 @@ virStorageBackendLogicalMakeVol(virStoragePoolObjPtr pool,
     }
 
     if (vol->key == NULL &&
-        (vol->key = strdup(groups[2])) == NULL) {
+        (vol->key = strdup(fields[VIR_STORAGE_LOGICAL_LV_UUID])) == NULL) {
         virReportOOMError();
         goto cleanup;
     }
 
-    if (virStorageBackendUpdateVolInfo(vol, 1) < 0)
-        goto cleanup;
-
-    nextents = 1;
-    if (STREQ(groups[4], VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
-        if (virStrToLong_i(groups[5], NULL, 10, &nextents) < 0) {
+    /* The sizes come straight from the LVM metadata; the device node
+     * is only looked at for ownership and label, and only once per
+     * volume rather than once per segment */
+    if (vol->source.nextent == 0) {
+        if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_SIZE], NULL, 10,
+                             &vol->capacity) < 0) {
             virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                                  _("malformed volume extent stripes value"));
+                                  _("malformed volume size value"));
             goto cleanup;
         }
-    }
+        vol->allocation = vol->capacity;
 
-    /* Finally fill in extents information */
-    if (VIR_REALLOC_N(vol->source.extents,
-                      vol->source.nextent + nextents) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
+        if (virStorageBackendUpdateVolTargetInfo(&vol->target, NULL, NULL,
+                                                 VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)
+            goto cleanup;
 
-    if (virStrToLong_ull(groups[6], NULL, 10, &length) < 0) {
-        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
-                              "%s", _("malformed volume extent length value"));
-        goto cleanup;
-    }
-    if (virStrToLong_ull(groups[7], NULL, 10, &size) < 0) {
-        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
-                              "%s", _("malformed volume extent size value"));
-        goto cleanup;
+        if (vol->backingStore.path &&
+            virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                                 NULL, NULL,
+                                                 VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)
+            goto cleanup;
     }
 
-    /* Now parse the "devices" field separately */
-    regex = strdup(regex_unit);
-
-    for (i = 1; i < nextents; i++) {
-        if (VIR_REALLOC_N(regex, strlen(regex) + strlen(regex_unit) + 2) < 0) {
-            virReportOOMError();
+    nextents = 1;
+    if (STREQ(fields[VIR_STORAGE_LOGICAL_LV_SEGTYPE],
+              VIR_STORAGE_VOL_LOGICAL_SEGTYPE_STRIPED)) {
+        if (virStrToLong_i(fields[VIR_STORAGE_LOGICAL_LV_STRIPES],
+                           NULL, 10, &nextents) < 0 ||
+            nextents <= 0) {
+            virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                  _("malformed volume extent stripes value"));
             goto cleanup;
         }
-        /* "," is the separator of "devices" field */
-        strcat(regex, ",");
-        strncat(regex, regex_unit, strlen(regex_unit));
-    }
-
-    if (VIR_ALLOC(reg) < 0) {
-        virReportOOMError();
-        goto cleanup;
     }
 
-    /* Each extent has a "path:offset" pair, and vars[0] will
-     * be the whole matched string.
-     */
-    nvars = (nextents * 2) + 1;
-    if (VIR_ALLOC_N(vars, nvars) < 0) {
-        virReportOOMError();
+    if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_SEG_SIZE],
+                         NULL, 10, &length) < 0) {
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
+                              "%s", _("malformed volume extent length value"));
         goto cleanup;
     }
-
-    err = regcomp(reg, regex, REG_EXTENDED);
-    if (err != 0) {
-        char error[100];
-        regerror(err, reg, error, sizeof(error));
+    if (virStrToLong_ull(fields[VIR_STORAGE_LOGICAL_LV_EXTENT_SIZE],
+                         NULL, 10, &size) < 0) {
         virStorageReportError(VIR_ERR_INTERNAL_ERROR,
-                              _("Failed to compile regex %s"),
-                              error);
+                              "%s", _("malformed volume extent size value"));
         goto cleanup;
     }
 
-    if (regexec(reg, groups[3], nvars, vars, 0) != 0) {
-        virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                              _("malformed volume extent devices value"));
+    /* Finally fill in extents information */
+    if (virStorageBackendLogicalParseExtents(vol,
+                                             fields[VIR_STORAGE_LOGICAL_LV_DEVICES],
+                                             nextents, length, size) < 0)
         goto cleanup;
-    }
 
-    p = groups[3];
+    if (is_new_vol)
+        pool->volumes.objs[pool->volumes.count++] = vol;
 
-    /* vars[0] is skipped */
-    for (i = 0; i < nextents; i++) {
-        int j, len;
-        const char *offset_str = NULL;
+    ret = 0;
 
-        j = (i * 2) + 1;
-        len = vars[j].rm_eo - vars[j].rm_so;
-        p[vars[j].rm_eo] = '\0';
+cleanup:
+    if (is_new_vol && (ret == -1))
+        virStorageVolDefFree(vol);
+    return ret;
+}
 
-        if ((vol->source.extents[vol->source.nextent].path =
-            strndup(p + vars[j].rm_so, len)) == NULL) {
-            virReportOOMError();
-            goto cleanup;
-        }
 
-        len = vars[j + 1].rm_eo - vars[j + 1].rm_so;
-        if (!(offset_str = strndup(p + vars[j + 1].rm_so, len))) {
-            virReportOOMError();
-            goto cleanup;
-        }
+/*
+ * Read the metadata sequence number, size and free space of the
+ * volume group with a single vgs run.
+ */
+static int
+virStorageBackendLogicalGetVGInfo(virStoragePoolObjPtr pool,
+                                  unsigned long long *seqno)
+{
+    /*
+     *  # vgs --separator # --noheadings --units b --unbuffered --nosuffix --options "vg_seq_no,vg_size,vg_free" VGNAME
+     *    47#10603200512#4328521728
+     */
+    char *output = NULL;
+    char *fields[VIR_STORAGE_LOGICAL_VG_LAST];
+    virCommandPtr cmd;
+    int ret = -1;
 
-        if (virStrToLong_ull(offset_str, NULL, 10, &offset) < 0) {
-            virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                                  _("malformed volume extent offset value"));
-            VIR_FREE(offset_str);
-            goto cleanup;
-        }
+    cmd = virCommandNewArgList(VGS, "--separator", "#", "--noheadings",
+                               "--units", "b", "--unbuffered", "--nosuffix",
+                               "--options", VIR_STORAGE_LOGICAL_VG_FIELDS,
+                               pool->def->source.name, NULL);
+    virCommandSetOutputBuffer(cmd, &output);
 
-        VIR_FREE(offset_str);
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
 
-        vol->source.extents[vol->source.nextent].start = offset * size;
-        vol->source.extents[vol->source.nextent].end = (offset * size) + length;
-        vol->source.nextent++;
+    if (virStorageBackendLogicalSplitLine(output, "vgs", fields,
+                                          VIR_STORAGE_LOGICAL_VG_LAST) < 0) {
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
+                              _("unexpected vgs output for volume group '%s'"),
+                              pool->def->source.name);
+        goto cleanup;
     }
 
-    if (is_new_vol)
-        pool->volumes.objs[pool->volumes.count++] = vol;
-
-    ret = 0;
+    ret = virStorageBackendLogicalParseVGInfo(pool,
+                                              fields[VIR_STORAGE_LOGICAL_VG_SEQNO],
+                                              fields[VIR_STORAGE_LOGICAL_VG_SIZE],
+                                              fields[VIR_STORAGE_LOGICAL_VG_FREE],
+                                              seqno);
 
 cleanup:
-    VIR_FREE(regex);
-    VIR_FREE(reg);
-    VIR_FREE(vars);
-    if (is_new_vol && (ret == -1))
-        virStorageVolDefFree(vol);
+    VIR_FREE(output);
+    virCommandFree(cmd);
     return ret;
 }
 
+
+/*
+ * Fill in the volumes of @pool, or only @vol if it is non-NULL, from a
+ * single lvs run. A full scan also refreshes the pool's capacity and
+ * records the metadata sequence number the volume list was built from.
+ */
 static int
 virStorageBackendLogicalFindLVs(virStoragePoolObjPtr pool,
                                 virStorageVolDefPtr vol)
 {
     /*
-     *  # lvs --separator , --noheadings --units b --unbuffered --nosuffix --options "lv_name,origin,uuid,devices,seg_size,vg_extent_size" VGNAME
-     *  RootLV,,06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky,/dev/hda2(0),5234491392,33554432
-     *  SwapLV,,oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M,/dev/hda2(156),1040187392,33554432
-     *  Test2,,3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR,/dev/hda2(219),1073741824,33554432
-     *  Test3,,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(251),2181038080,33554432
-     *  Test3,Test2,UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht,/dev/hda2(187),1040187392,33554432
-     *
-     * Pull out name, origin, & uuid, device, device extent start #, segment size, extent size.
+     *  # lvs --separator # --noheadings --units b --unbuffered --nosuffix --options "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size,lv_size,vg_seq_no,vg_size,vg_free" VGNAME
+     *  RootLV##06UgP5-2rhb-w3Bo-3mdR-WeoL-pytO-SAa2ky#/dev/hda2(0)#linear#1#5234491392#33554432#5234491392#47#10603200512#4328521728
+     *  SwapLV##oHviCK-8Ik0-paqS-V20c-nkhY-Bm1e-zgzU0M#/dev/hda2(156)#linear#1#1040187392#33554432#1040187392#47#10603200512#4328521728
+     *  Test2##3pg3he-mQsA-5Sui-h0i6-HNmc-Cz7W-QSndcR#/dev/hda2(219)#linear#1#1073741824#33554432#1073741824#47#10603200512#4328521728
+     *  Test3##UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(251)#linear#1#2181038080#33554432#3221225472#47#10603200512#4328521728
+     *  Test3#Test2#UB5hFw-kmlm-LSoX-EI1t-ioVd-h7GL-M0W8Ht#/dev/hda2(187)#linear#1#1040187392#33554432#3221225472#47#10603200512#4328521728
      *
      * NB can be multiple rows per volume if they have many extents
      *
-     * NB lvs from some distros (e.g. SLES10 SP2) outputs trailing "," on each line
+     * NB lvs from some distros (e.g. SLES10 SP2) outputs trailing "#" on each line
      *
      * NB Encrypted logical volumes can print ':' in their name, so it is
      *    not a suitable separator (rhbz 470693).
      * NB "devices" field has multiple device paths and "," if the volume is
      *    striped, so "," is not a suitable separator either (rhbz 727474).
      */
-    const char *regexes[] = {
-       "^\\s*(\\S+)#(\\S*)#(\\S+)#(\\S+)#(\\S+)#([0-9]+)#(\\S+)#([0-9]+)#?\\s*$"
-    };
-    int vars[] = {
-        8
-    };
-    const char *prog[] = {
-        LVS, "--separator", "#", "--noheadings", "--units", "b",
-        "--unbuffered", "--nosuffix", "--options",
-        "lv_name,origin,uuid,devices,segtype,stripes,seg_size,vg_extent_size",
-        pool->def->source.name, NULL
-    };
+    char *fields[VIR_STORAGE_LOGICAL_LV_LAST];
+    char *output = NULL;
+    char *line, *next;
+    unsigned long long seqno = 0;
+    bool haveVG = false;
+    virCommandPtr cmd;
+    int ret = -1;
 
-    if (virStorageBackendRunProgRegex(pool,
-                                      prog,
-                                      1,
-                                      regexes,
-                                      vars,
-                                      virStorageBackendLogicalMakeVol,
-                                      vol, "lvs") < 0) {
-        return -1;
+    cmd = virCommandNewArgList(LVS, "--separator", "#", "--noheadings",
+                               "--units", "b", "--unbuffered", "--nosuffix",
+                               "--options", VIR_STORAGE_LOGICAL_LV_FIELDS,
+                               pool->def->source.name, NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    for (line = output; line && *line; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
+        if (virStorageBackendLogicalSplitLine(line, "lvs", fields,
+                                              VIR_STORAGE_LOGICAL_LV_LAST) < 0)
+            continue;
+
+        if (virStorageBackendLogicalMakeVol(pool, fields, vol) < 0)
+            goto cleanup;
+
+        if (!vol && !haveVG) {
+            if (virStorageBackendLogicalParseVGInfo(pool,
+                                                    fields[VIR_STORAGE_LOGICAL_LV_VG_SEQNO],
+                                                    fields[VIR_STORAGE_LOGICAL_LV_VG_SIZE],
+                                                    fields[VIR_STORAGE_LOGICAL_LV_VG_FREE],
+                                                    &seqno) < 0)
+                goto cleanup;
+            haveVG = true;
+        }
     }
 
-    return 0;
-}
+    if (!vol) {
+        /* An empty volume group prints no rows at all */
+        if (!haveVG &&
+            virStorageBackendLogicalGetVGInfo(pool, &seqno) < 0)
+            goto cleanup;
+        pool->seqno = seqno;
+    }
 
-static int
-virStorageBackendLogicalRefreshPoolFunc(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
-                                        char **const groups,
-                                        void *data ATTRIBUTE_UNUSED)
-{
-    if (virStrToLong_ull(groups[0], NULL, 10, &pool->def->capacity) < 0)
-        return -1;
-    if (virStrToLong_ull(groups[1], NULL, 10, &pool->def->available) < 0)
-        return -1;
-    pool->def->allocation = pool->def->capacity - pool->def->available;
+    ret = 0;
 
-    return 0;
+cleanup:
+    VIR_FREE(output);
+    virCommandFree(cmd);
+    return ret;
 }
 
-
 static int
 virStorageBackendLogicalFindPoolSourcesFunc(virStoragePoolObjPtr pool ATTRIBUTE_UNUSED,
                                             char **const groups,
@@ -561,50 +736,57 @@ virStorageBackendLogicalBuildPool(virConnectPtr conn ATTRIBUTE_UNUSED,
 }
 
 
+static int
+virStorageBackendLogicalCheckPoolChanged(virConnectPtr conn ATTRIBUTE_UNUSED,
+                                         virStoragePoolObjPtr pool,
+                                         bool *changed)
+{
+    unsigned long long seqno;
+    unsigned int i;
+
+    /* Any LVM command touching the group, including our own, bumps
+     * its metadata sequence number */
+    if (virStorageBackendLogicalGetVGInfo(pool, &seqno) < 0)
+        return -1;
+
+    *changed = pool->seqno == 0 || pool->seqno != seqno;
+    if (*changed)
+        return 0;
+
+    /* The volume list is current, but ownership and labels of the
+     * device nodes are not tracked by LVM, so look at those again */
+    for (i = 0 ; i < pool->volumes.count ; i++) {
+        virStorageVolDefPtr vol = pool->volumes.objs[i];
+
+        if (virStorageBackendUpdateVolTargetInfo(&vol->target, NULL, NULL,
+                                                 VIR_STORAGE_VOL_OPEN_DEFAULT) < 0 ||
+            (vol->backingStore.path &&
+             virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                                  NULL, NULL,
+                                                  VIR_STORAGE_VOL_OPEN_DEFAULT) < 0)) {
+            /* A node that went away is worth a full rescan */
+            virResetLastError();
+            *changed = true;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+
 static int
 virStorageBackendLogicalRefreshPool(virConnectPtr conn ATTRIBUTE_UNUSED,
                                     virStoragePoolObjPtr pool)
 {
-    /*
-     *  # vgs --separator : --noheadings --units b --unbuffered --nosuffix --options "vg_size,vg_free" VGNAME
-     *    10603200512:4328521728
-     *
-     * Pull out size & free
-     *
-     * NB vgs from some distros (e.g. SLES10 SP2) outputs trailing ":" on each line
-     */
-    const char *regexes[] = {
-        "^\\s*(\\S+):([0-9]+):?\\s*$"
-    };
-    int vars[] = {
-        2
-    };
-    const char *prog[] = {
-        VGS, "--separator", ":", "--noheadings", "--units", "b", "--unbuffered",
-        "--nosuffix", "--options", "vg_size,vg_free",
-        pool->def->source.name, NULL
-    };
-
     virFileWaitForDevices();
 
-    /* Get list of all logical volumes */
+    /* Get list of all logical volumes and the volgrp metadata */
     if (virStorageBackendLogicalFindLVs(pool, NULL) < 0) {
         virStoragePoolObjClearVols(pool);
         return -1;
     }
 
-    /* Now get basic volgrp metadata */
-    if (virStorageBackendRunProgRegex(pool,
-                                      prog,
-                                      1,
-                                      regexes,
-                                      vars,
-                                      virStorageBackendLogicalRefreshPoolFunc,
-                                      NULL, "vgs") < 0) {
-        virStoragePoolObjClearVols(pool);
-        return -1;
-    }
-
     return 0;
 }
 
@@ -820,6 +1002,7 @@ virStorageBackend virStorageBackendLogical = {
     .startPool = virStorageBackendLogicalStartPool,
     .buildPool = virStorageBackendLogicalBuildPool,
     .refreshPool = virStorageBackendLogicalRefreshPool,
+    .checkPoolChanged = virStorageBackendLogicalCheckPoolChanged,
     .stopPool = virStorageBackendLogicalStopPool,
     .deletePool = virStorageBackendLogicalDeletePool,
     .buildVol = NULL,
@@ -28,4 +28,14 @@
 
 extern virStorageBackend virStorageBackendLogical;
 
+int virStorageBackendLogicalSplitLine(char *line,
+                                      const char *prefix,
+                                      char **fields,
+                                      size_t nfields);
+int virStorageBackendLogicalParseExtents(virStorageVolDefPtr vol,
+                                         char *devices,
+                                         int nextents,
+                                         unsigned long long length,
+                                         unsigned long long size);
+
 #endif /* __VIR_STORAGE_BACKEND_LOGICAL_H__ */
@@ -35,6 +35,11 @@
 #endif
 #include <errno.h>
 #include <string.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/inotify.h>
+# include <linux/fs.h>
+#endif
 
 #include "virterror_internal.h"
 #include "datatypes.h"
@@ -44,10 +49,14 @@
 #include "storage_conf.h"
 #include "memory.h"
 #include "storage_backend.h"
+#include "storage_backend_fs.h"
+#include "storage_file.h"
 #include "logging.h"
 #include "virfile.h"
 #include "fdstream.h"
 #include "configmake.h"
+#include "virtime.h"
+#include "threadpool.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -64,6 +73,579 @@ static void storageDriverUnlock(virStorageDriverStatePtr driver)
     virMutexUnlock(&driver->lock);
 }
 
+/* Volumes of active pools indexed by path, so that looking a volume up
+ * by path does not have to walk every pool and volume.  Volumes of pools
+ * made of stable /dev/disk/by-* links are also indexed by the device node
+ * the link points to.  The index has its own lock, which is always taken
+ * last, so it can be updated with just a pool locked.  */
+typedef struct _storageVolOwner storageVolOwner;
+typedef storageVolOwner *storageVolOwnerPtr;
+struct _storageVolOwner {
+    char *pool;
+    char *name;
+    char *key;
+};
+
+/* Pools sharing a directory each own the path of a volume in it.  The
+ * one that indexed it first answers lookups until it goes away. */
+typedef struct _storageVolPath storageVolPath;
+typedef storageVolPath *storageVolPathPtr;
+struct _storageVolPath {
+    size_t nowners;
+    storageVolOwnerPtr owners;
+};
+
+/* Pool and, unless NULL, volume name of the owners to drop */
+struct storageVolPathMatch {
+    const char *pool;
+    const char *name;
+};
+
+static void
+storageVolOwnerClear(storageVolOwnerPtr owner)
+{
+    VIR_FREE(owner->pool);
+    VIR_FREE(owner->name);
+    VIR_FREE(owner->key);
+}
+
+static void
+storageVolPathFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    storageVolPathPtr entry = payload;
+    size_t i;
+
+    if (!entry)
+        return;
+
+    for (i = 0 ; i < entry->nowners ; i++)
+        storageVolOwnerClear(&entry->owners[i]);
+    VIR_FREE(entry->owners);
+    VIR_FREE(entry);
+}
+
+static void
+storageVolPathDropOwners(void *payload,
+                         const void *name ATTRIBUTE_UNUSED,
+                         void *data)
+{
+    storageVolPathPtr entry = payload;
+    const struct storageVolPathMatch *match = data;
+    size_t i = 0;
+
+    while (i < entry->nowners) {
+        storageVolOwnerPtr owner = &entry->owners[i];
+
+        if (STRNEQ(owner->pool, match->pool) ||
+            (match->name && STRNEQ(owner->name, match->name))) {
+            i++;
+            continue;
+        }
+
+        storageVolOwnerClear(owner);
+        memmove(owner, owner + 1,
+                sizeof(*owner) * (entry->nowners - i - 1));
+        entry->nowners--;
+    }
+}
+
+static int
+storageVolPathIsUnowned(const void *payload,
+                        const void *name ATTRIBUTE_UNUSED,
+                        const void *data ATTRIBUTE_UNUSED)
+{
+    const storageVolPath *entry = payload;
+
+    return entry->nowners == 0;
+}
+
+/* Drop the index entries of volume @name of @pool, or of all its
+ * volumes if @name is NULL.  Paths another pool also owns stay
+ * indexed by that pool. */
+static void
+storageVolPathForget(virStorageDriverStatePtr driver,
+                     const char *pool,
+                     const char *name)
+{
+    struct storageVolPathMatch match = { pool, name };
+
+    virHashForEach(driver->volPaths, storageVolPathDropOwners, &match);
+    virHashRemoveSet(driver->volPaths, storageVolPathIsUnowned, NULL);
+}
+
+/* Same test virStorageBackendStablePath uses to decide whether the
+ * volume paths of @pool are links to differently named device nodes */
+static bool
+storagePoolHasStableLinks(virStoragePoolObjPtr pool)
+{
+    const char *target = pool->def->target.path;
+
+    return target &&
+        STRPREFIX(target, "/dev") &&
+        STRNEQ(target, "/dev") &&
+        STRNEQ(target, "/dev/") &&
+        pool->def->type != VIR_STORAGE_POOL_LOGICAL;
+}
+
+static int
+storageVolPathAdd(virStorageDriverStatePtr driver,
+                  virStoragePoolObjPtr pool,
+                  virStorageVolDefPtr vol,
+                  const char *path)
+{
+    storageVolPathPtr entry;
+    storageVolOwnerPtr owner;
+    bool added = false;
+    size_t i;
+
+    if ((entry = virHashLookup(driver->volPaths, path))) {
+        for (i = 0 ; i < entry->nowners ; i++) {
+            if (STREQ(entry->owners[i].pool, pool->def->name) &&
+                STREQ(entry->owners[i].name, vol->name))
+                return 0;
+        }
+        VIR_DEBUG("Path '%s' of volume '%s' in pool '%s' is also in pool '%s'",
+                  path, vol->name, pool->def->name, entry->owners[0].pool);
+    } else {
+        if (VIR_ALLOC(entry) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        if (virHashAddEntry(driver->volPaths, path, entry) < 0) {
+            VIR_FREE(entry);
+            return -1;
+        }
+        added = true;
+    }
+
+    if (VIR_EXPAND_N(entry->owners, entry->nowners, 1) < 0)
+        goto no_memory;
+
+    owner = &entry->owners[entry->nowners - 1];
+    if (!(owner->pool = strdup(pool->def->name)) ||
+        !(owner->name = strdup(vol->name)) ||
+        (vol->key && !(owner->key = strdup(vol->key)))) {
+        storageVolOwnerClear(owner);
+        VIR_SHRINK_N(entry->owners, entry->nowners, 1);
+        goto no_memory;
+    }
+
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    if (added)
+        virHashRemoveEntry(driver->volPaths, path);
+    return -1;
+}
+
+int
+storageVolIndexAdd(virStorageDriverStatePtr driver,
+                   virStoragePoolObjPtr pool,
+                   virStorageVolDefPtr vol)
+{
+    char *devpath = NULL;
+    int ret = -1;
+
+    if (!vol->target.path)
+        return 0;
+
+    /* Resolving walks the file system, keep it out of the lock.  A link
+     * whose device node is gone is simply not indexed by it. */
+    if (storagePoolHasStableLinks(pool) &&
+        virFileResolveLink(vol->target.path, &devpath) == 0 &&
+        STREQ(devpath, vol->target.path))
+        VIR_FREE(devpath);
+
+    virMutexLock(&driver->volPathsLock);
+
+    if (storageVolPathAdd(driver, pool, vol, vol->target.path) < 0)
+        goto cleanup;
+
+    if (devpath &&
+        storageVolPathAdd(driver, pool, vol, devpath) < 0) {
+        storageVolPathForget(driver, pool->def->name, vol->name);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&driver->volPathsLock);
+    VIR_FREE(devpath);
+    return ret;
+}
+
+void
+storageVolIndexRemove(virStorageDriverStatePtr driver,
+                      virStoragePoolObjPtr pool,
+                      virStorageVolDefPtr vol)
+{
+    storageVolPathPtr entry;
+
+    if (!vol->target.path)
+        return;
+
+    virMutexLock(&driver->volPathsLock);
+
+    /* The device node cannot be resolved any more once the link
+     * is gone, so find its entry the slow way */
+    if (storagePoolHasStableLinks(pool)) {
+        storageVolPathForget(driver, pool->def->name, vol->name);
+    } else if ((entry = virHashLookup(driver->volPaths, vol->target.path))) {
+        struct storageVolPathMatch match = { pool->def->name, vol->name };
+
+        storageVolPathDropOwners(entry, vol->target.path, &match);
+        if (entry->nowners == 0)
+            virHashRemoveEntry(driver->volPaths, vol->target.path);
+    }
+
+    virMutexUnlock(&driver->volPathsLock);
+}
+
+void
+storagePoolIndexRemove(virStorageDriverStatePtr driver,
+                       virStoragePoolObjPtr pool)
+{
+    virMutexLock(&driver->volPathsLock);
+    storageVolPathForget(driver, pool->def->name, NULL);
+    virMutexUnlock(&driver->volPathsLock);
+}
+
+/* (Re)build the index entries of @pool from its current volume list */
+int
+storagePoolIndexVolumes(virStorageDriverStatePtr driver,
+                        virStoragePoolObjPtr pool)
+{
+    unsigned int i;
+
+    storagePoolIndexRemove(driver, pool);
+
+    for (i = 0 ; i < pool->volumes.count ; i++) {
+        if (storageVolIndexAdd(driver, pool, pool->volumes.objs[i]) < 0) {
+            storagePoolIndexRemove(driver, pool);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+#ifdef __linux__
+# define STORAGE_POOL_WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                                    IN_MOVED_TO | IN_CLOSE_WRITE | IN_ATTRIB | \
+                                    IN_DELETE_SELF | IN_MOVE_SELF)
+
+/* Pools whose volumes are the files of a local directory keep an
+ * inotify watch on it, so that files added, removed or changed behind
+ * our back show up without rescanning the whole directory.  */
+void
+storagePoolWatchStart(virStorageDriverStatePtr driver,
+                      virStoragePoolObjPtr pool)
+{
+    int wd;
+
+    pool->watch = 0;
+    pool->watchStale = false;
+
+    if (driver->inotifyFD < 0 ||
+        (pool->def->type != VIR_STORAGE_POOL_DIR &&
+         pool->def->type != VIR_STORAGE_POOL_FS))
+        return;
+
+    if ((wd = inotify_add_watch(driver->inotifyFD, pool->def->target.path,
+                                STORAGE_POOL_WATCH_EVENTS)) < 0) {
+        char ebuf[1024];
+        VIR_WARN("Cannot watch directory '%s' of storage pool '%s': %s",
+                 pool->def->target.path, pool->def->name,
+                 virStrerror(errno, ebuf, sizeof(ebuf)));
+        return;
+    }
+
+    VIR_DEBUG("Watching directory '%s' of storage pool '%s'",
+              pool->def->target.path, pool->def->name);
+    pool->watch = wd;
+}
+
+void
+storagePoolWatchStop(virStorageDriverStatePtr driver,
+                     virStoragePoolObjPtr pool)
+{
+    /* Another pool on the same directory shares the watch, it gets
+     * IN_IGNORED and falls back to rescanning on its next refresh */
+    if (pool->watch > 0 && driver->inotifyFD >= 0)
+        inotify_rm_watch(driver->inotifyFD, pool->watch);
+    pool->watch = 0;
+    pool->watchStale = false;
+}
+
+/* Update the volume a watch event was about and its index entries */
+static int
+storagePoolWatchUpdateVol(virStorageDriverStatePtr driver,
+                          virStoragePoolObjPtr pool,
+                          const char *name)
+{
+    virStorageVolDefPtr vol;
+
+    if ((vol = virStorageVolDefFindByName(pool, name)))
+        storageVolIndexRemove(driver, pool, vol);
+
+    if (virStorageBackendFileSystemUpdateVol(pool, name) < 0)
+        return -1;
+
+    if ((vol = virStorageVolDefFindByName(pool, name)) &&
+        storageVolIndexAdd(driver, pool, vol) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Mark the pools on watch @wd, or all watched pools if the event
+ * queue overflowed, as needing a rescan on their next refresh */
+static void
+storagePoolWatchLost(virStorageDriverStatePtr driver,
+                     int wd,
+                     uint32_t mask)
+{
+    unsigned int i;
+
+    for (i = 0 ; i < driver->pools.count ; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        if (virStoragePoolObjIsActive(pool) &&
+            pool->watch > 0 &&
+            (pool->watch == wd || (mask & IN_Q_OVERFLOW))) {
+            VIR_DEBUG("Lost track of storage pool '%s' (mask 0x%x)",
+                      pool->def->name, mask);
+            pool->watchStale = true;
+            if (mask & IN_IGNORED)
+                pool->watch = 0;
+        }
+        virStoragePoolObjUnlock(pool);
+    }
+}
+
+typedef struct _storageWatchJob storageWatchJob;
+typedef storageWatchJob *storageWatchJobPtr;
+struct _storageWatchJob {
+    int wd;
+    char *name;
+};
+
+/* Probing a file can take a while, so that is left to a worker
+ * instead of holding up the event loop */
+static void
+storageWatchWorker(void *jobdata, void *opaque)
+{
+    storageWatchJobPtr job = jobdata;
+    virStorageDriverStatePtr driver = opaque;
+    unsigned int i;
+
+    storageDriverLock(driver);
+    for (i = 0 ; i < driver->pools.count ; i++) {
+        virStoragePoolObjPtr pool = driver->pools.objs[i];
+
+        virStoragePoolObjLock(pool);
+        if (virStoragePoolObjIsActive(pool) &&
+            pool->watch > 0 &&
+            pool->watch == job->wd &&
+            storagePoolWatchUpdateVol(driver, pool, job->name) < 0) {
+            virErrorPtr err = virGetLastError();
+            VIR_WARN("Failed to update volume '%s' of storage pool '%s': %s",
+                     job->name, pool->def->name,
+                     err ? err->message : _("no error message found"));
+            pool->watchStale = true;
+        }
+        virStoragePoolObjUnlock(pool);
+    }
+    storageDriverUnlock(driver);
+
+    VIR_FREE(job->name);
+    VIR_FREE(job);
+}
+
+static void
+storageInotifyEvent(int watch,
+                    int fd,
+                    int events ATTRIBUTE_UNUSED,
+                    void *data)
+{
+    char buf[4096];
+    struct inotify_event *e;
+    int got;
+    char *tmp;
+    virStorageDriverStatePtr driver = data;
+
+    storageDriverLock(driver);
+    if (watch != driver->inotifyWatch)
+        goto cleanup;
+
+reread:
+    got = read(fd, buf, sizeof(buf));
+    if (got == -1) {
+        if (errno == EINTR)
+            goto reread;
+        goto cleanup;
+    }
+
+    tmp = buf;
+    while (got) {
+        storageWatchJobPtr job = NULL;
+
+        if (got < sizeof(struct inotify_event))
+            goto cleanup; /* bad */
+
+        e = (struct inotify_event *)tmp;
+        tmp += sizeof(struct inotify_event);
+        got -= sizeof(struct inotify_event);
+
+        if (got < e->len)
+            goto cleanup;
+
+        tmp += e->len;
+        got -= e->len;
+
+        if (e->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_UNMOUNT |
+                       IN_DELETE_SELF | IN_MOVE_SELF)) {
+            storagePoolWatchLost(driver, e->wd, e->mask);
+            continue;
+        }
+
+        if (!e->len)
+            continue;
+
+        if (VIR_ALLOC(job) < 0 ||
+            !(job->name = strdup(e->name))) {
+            virReportOOMError();
+            goto lost;
+        }
+        job->wd = e->wd;
+
+        if (virThreadPoolSendJob(driver->inotifyWorker, 0, job) < 0)
+            goto lost;
+        continue;
+
+    lost:
+        if (job)
+            VIR_FREE(job->name);
+        VIR_FREE(job);
+        storagePoolWatchLost(driver, e->wd, e->mask);
+    }
+
+cleanup:
+    storageDriverUnlock(driver);
+}
+
+/* Set up the inotify instance the pool directories are watched with.
+ * Without it, refreshing a pool rescans its directory. */
+void
+storageDriverWatchInit(virStorageDriverStatePtr driver)
+{
+    if (!(driver->inotifyWorker = virThreadPoolNew(1, 1, 0,
+                                                   storageWatchWorker,
+                                                   driver)) ||
+        (driver->inotifyFD = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0 ||
+        (driver->inotifyWatch =
+         virEventAddHandle(driver->inotifyFD, VIR_EVENT_HANDLE_READABLE,
+                           storageInotifyEvent, driver, NULL)) < 0) {
+        VIR_WARN("Cannot watch storage pool directories, "
+                 "refreshing them will rescan them");
+        VIR_FORCE_CLOSE(driver->inotifyFD);
+        virThreadPoolFree(driver->inotifyWorker);
+        driver->inotifyWorker = NULL;
+    }
+}
+#else /* !__linux__ */
+void
+storagePoolWatchStart(virStorageDriverStatePtr driver ATTRIBUTE_UNUSED,
+                      virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+void
+storagePoolWatchStop(virStorageDriverStatePtr driver ATTRIBUTE_UNUSED,
+                     virStoragePoolObjPtr pool ATTRIBUTE_UNUSED)
+{
+}
+
+void
+storageDriverWatchInit(virStorageDriverStatePtr driver ATTRIBUTE_UNUSED)
+{
+}
+#endif /* !__linux__ */
+
+/* Undo storageDriverWatchInit, with the driver locked */
+static void
+storageDriverWatchClose(virStorageDriverStatePtr driver)
+{
+    if (driver->inotifyWatch != -1)
+        virEventRemoveHandle(driver->inotifyWatch);
+    driver->inotifyWatch = -1;
+    VIR_FORCE_CLOSE(driver->inotifyFD);
+
+    /* The worker takes the driver lock for each event it handles */
+    storageDriverUnlock(driver);
+    virThreadPoolFree(driver->inotifyWorker);
+    driver->inotifyWorker = NULL;
+    storageDriverLock(driver);
+}
+
+/* State of a driver with no pools, no configuration directories and
+ * no inotify instance yet */
+virStorageDriverStatePtr
+storageDriverStateNew(void)
+{
+    virStorageDriverStatePtr driver;
+
+    if (VIR_ALLOC(driver) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&driver->lock) < 0) {
+        VIR_FREE(driver);
+        return NULL;
+    }
+    if (virMutexInit(&driver->volPathsLock) < 0) {
+        virMutexDestroy(&driver->lock);
+        VIR_FREE(driver);
+        return NULL;
+    }
+    driver->inotifyFD = -1;
+    driver->inotifyWatch = -1;
+
+    if (!(driver->volPaths = virHashCreate(256, storageVolPathFree))) {
+        storageDriverStateFree(driver);
+        return NULL;
+    }
+
+    return driver;
+}
+
+void
+storageDriverStateFree(virStorageDriverStatePtr driver)
+{
+    if (!driver)
+        return;
+
+    storageDriverLock(driver);
+
+    storageDriverWatchClose(driver);
+
+    /* free inactive pools */
+    virStoragePoolObjListFree(&driver->pools);
+
+    virHashFree(driver->volPaths);
+
+    VIR_FREE(driver->configDir);
+    VIR_FREE(driver->autostartDir);
+    storageDriverUnlock(driver);
+    virMutexDestroy(&driver->volPathsLock);
+    virMutexDestroy(&driver->lock);
+    VIR_FREE(driver);
+}
+
 static void
 storageDriverAutostart(virStorageDriverStatePtr driver) {
     unsigned int i;
@@ -106,8 +688,11 @@ storageDriverAutostart(virStorageDriverStatePtr driver) {
         }
 
         if (started) {
-            if (backend->refreshPool(NULL, pool) < 0) {
+            storagePoolWatchStart(driver, pool);
+            if (backend->refreshPool(NULL, pool) < 0 ||
+                storagePoolIndexVolumes(driver, pool) < 0) {
                 virErrorPtr err = virGetLastError();
+                storagePoolWatchStop(driver, pool);
                 if (backend->stopPool)
                     backend->stopPool(NULL, pool);
                 VIR_ERROR(_("Failed to autostart storage pool '%s': %s"),
@@ -132,13 +717,8 @@ storageDriverStartup(int privileged)
 {
     char *base = NULL;
 
-    if (VIR_ALLOC(driverState) < 0)
-        return -1;
-
-    if (virMutexInit(&driverState->lock) < 0) {
-        VIR_FREE(driverState);
+    if (!(driverState = storageDriverStateNew()))
         return -1;
-    }
     storageDriverLock(driverState);
 
     if (privileged) {
@@ -171,6 +751,8 @@ storageDriverStartup(int privileged)
 
     VIR_FREE(base);
 
+    storageDriverWatchInit(driverState);
+
     if (virStoragePoolLoadAllConfigs(&driverState->pools,
                                      driverState->configDir,
                                      driverState->autostartDir) < 0)
@@ -248,16 +830,8 @@ storageDriverShutdown(void) {
     if (!driverState)
         return -1;
 
-    storageDriverLock(driverState);
-
-    /* free inactive pools */
-    virStoragePoolObjListFree(&driverState->pools);
-
-    VIR_FREE(driverState->configDir);
-    VIR_FREE(driverState->autostartDir);
-    storageDriverUnlock(driverState);
-    virMutexDestroy(&driverState->lock);
-    VIR_FREE(driverState);
+    storageDriverStateFree(driverState);
+    driverState = NULL;
 
     return 0;
 }
@@ -553,7 +1127,10 @@ storagePoolCreate(virConnectPtr conn,
         goto cleanup;
     }
 
-    if (backend->refreshPool(conn, pool) < 0) {
+    storagePoolWatchStart(driver, pool);
+    if (backend->refreshPool(conn, pool) < 0 ||
+        storagePoolIndexVolumes(driver, pool) < 0) {
+        storagePoolWatchStop(driver, pool);
         if (backend->stopPool)
             backend->stopPool(conn, pool);
         virStoragePoolObjRemove(&driver->pools, pool);
@@ -703,7 +1280,10 @@ storagePoolStart(virStoragePoolPtr obj,
         backend->startPool(obj->conn, pool) < 0)
         goto cleanup;
 
-    if (backend->refreshPool(obj->conn, pool) < 0) {
+    storagePoolWatchStart(driver, pool);
+    if (backend->refreshPool(obj->conn, pool) < 0 ||
+        storagePoolIndexVolumes(driver, pool) < 0) {
+        storagePoolWatchStop(driver, pool);
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
         goto cleanup;
@@ -790,10 +1370,12 @@ storagePoolDestroy(virStoragePoolPtr obj) {
         goto cleanup;
     }
 
+    storagePoolWatchStop(driver, pool);
     if (backend->stopPool &&
         backend->stopPool(obj->conn, pool) < 0)
         goto cleanup;
 
+    storagePoolIndexRemove(driver, pool);
     virStoragePoolObjClearVols(pool);
 
     pool->active = 0;
@@ -864,6 +1446,49 @@ cleanup:
 }
 
 
+/**
+ * storagePoolRefreshVolumes:
+ *
+ * Bring the volume list of the active @pool and its index entries up
+ * to date, rescanning the pool unless the watch on its directory kept
+ * track of it.  On failure, @pool is left with its watch stopped and
+ * no index entries, to be stopped by the caller.
+ */
+int
+storagePoolRefreshVolumes(virConnectPtr conn,
+                          virStorageDriverStatePtr driver,
+                          virStoragePoolObjPtr pool,
+                          virStorageBackendPtr backend)
+{
+    /* Nothing was added or removed behind our back that the watch did
+     * not already account for, so only the allocation of the volumes
+     * and the free space need looking at */
+    if (pool->watch > 0 && !pool->watchStale) {
+        if (virStorageBackendFileSystemUpdateAllocation(pool) == 0)
+            return 0;
+        VIR_DEBUG("Rescanning storage pool '%s'", pool->def->name);
+        virResetLastError();
+    }
+
+    /* The file system backends probe the volumes with the pool
+     * unlocked, and meanwhile keep the listed volumes around for
+     * lookups; they swap in what they found themselves */
+    if (pool->def->type != VIR_STORAGE_POOL_DIR &&
+        pool->def->type != VIR_STORAGE_POOL_FS &&
+        pool->def->type != VIR_STORAGE_POOL_NETFS)
+        virStoragePoolObjClearVols(pool);
+    storagePoolWatchStart(driver, pool);
+    if (backend->refreshPool(conn, pool) < 0 ||
+        storagePoolIndexVolumes(driver, pool) < 0) {
+        storagePoolIndexRemove(driver, pool);
+        storagePoolWatchStop(driver, pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+
 static int
 storagePoolRefresh(virStoragePoolPtr obj,
                    unsigned int flags)
@@ -877,6 +1502,7 @@ storagePoolRefresh(virStoragePoolPtr obj,
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByUUID(&driver->pools, obj->uuid);
+    storageDriverUnlock(driver);
 
     if (!pool) {
         virStorageReportError(VIR_ERR_NO_STORAGE_POOL,
@@ -900,15 +1526,36 @@ storagePoolRefresh(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    virStoragePoolObjClearVols(pool);
-    if (backend->refreshPool(obj->conn, pool) < 0) {
+    /* The backend may be able to tell cheaply that the volume list it
+     * built last time is still current.  The check still re-reads what
+     * that list does not cover, such as ownership of the volume targets */
+    if (backend->checkPoolChanged) {
+        bool changed;
+
+        if (backend->checkPoolChanged(obj->conn, pool, &changed) < 0)
+            goto cleanup;
+        if (!changed) {
+            ret = 0;
+            goto cleanup;
+        }
+    }
+
+    if (storagePoolRefreshVolumes(obj->conn, driver, pool, backend) < 0) {
         if (backend->stopPool)
             backend->stopPool(obj->conn, pool);
 
         pool->active = 0;
 
         if (pool->configFile == NULL) {
+            /* The job keeps the pool around while it is unlocked to
+             * take the driver lock first */
+            pool->asyncjobs++;
+            virStoragePoolObjUnlock(pool);
+            storageDriverLock(driver);
+            virStoragePoolObjLock(pool);
+            pool->asyncjobs--;
             virStoragePoolObjRemove(&driver->pools, pool);
+            storageDriverUnlock(driver);
             pool = NULL;
         }
         goto cleanup;
@@ -918,7 +1565,6 @@ storagePoolRefresh(virStoragePoolPtr obj,
 cleanup:
     if (pool)
         virStoragePoolObjUnlock(pool);
-    storageDriverUnlock(driver);
     return ret;
 }
 
@@ -1226,56 +1872,87 @@ storageVolumeLookupByKey(virConnectPtr conn,
     return ret;
 }
 
+/**
+ * storageVolIndexLookup:
+ *
+ * Find the volume the sanitized @path belongs to, filling in copies of
+ * the name of its pool, its own name and its key, unless it has none.
+ * Returns 1 if found, 0 if not, -1 on error.
+ */
+int
+storageVolIndexLookup(virStorageDriverStatePtr driver,
+                      const char *path,
+                      char **pool,
+                      char **name,
+                      char **key)
+{
+    storageVolPathPtr entry;
+    char *devpath = NULL;
+    bool resolved;
+    int ret = 0;
+
+    *pool = *name = *key = NULL;
+
+    virMutexLock(&driver->volPathsLock);
+
+    /* Either a path a volume is known by, or another link to a
+     * device node that is, e.g. /dev/disk/by-id/... for a volume
+     * of a /dev/disk/by-path pool.  The link is resolved without
+     * holding the lock. */
+    if (!(entry = virHashLookup(driver->volPaths, path))) {
+        virMutexUnlock(&driver->volPathsLock);
+        resolved = virFileResolveLink(path, &devpath) == 0;
+        virMutexLock(&driver->volPathsLock);
+        if (resolved)
+            entry = virHashLookup(driver->volPaths, devpath);
+    }
+
+    if (entry) {
+        if (!(*pool = strdup(entry->owners[0].pool)) ||
+            !(*name = strdup(entry->owners[0].name)) ||
+            (entry->owners[0].key &&
+             !(*key = strdup(entry->owners[0].key)))) {
+            virReportOOMError();
+            VIR_FREE(*pool);
+            VIR_FREE(*name);
+            ret = -1;
+        } else {
+            ret = 1;
+        }
+    }
+
+    virMutexUnlock(&driver->volPathsLock);
+
+    VIR_FREE(devpath);
+    return ret;
+}
+
 static virStorageVolPtr
 storageVolumeLookupByPath(virConnectPtr conn,
                           const char *path) {
     virStorageDriverStatePtr driver = conn->storagePrivateData;
-    unsigned int i;
     virStorageVolPtr ret = NULL;
     char *cleanpath;
+    char *pool = NULL;
+    char *name = NULL;
+    char *key = NULL;
+    int rc;
 
     cleanpath = virFileSanitizePath(path);
     if (!cleanpath)
         return NULL;
 
-    storageDriverLock(driver);
-    for (i = 0 ; i < driver->pools.count && !ret ; i++) {
-        virStoragePoolObjLock(driver->pools.objs[i]);
-        if (virStoragePoolObjIsActive(driver->pools.objs[i])) {
-            virStorageVolDefPtr vol;
-            const char *stable_path;
-
-            stable_path = virStorageBackendStablePath(driver->pools.objs[i],
-                                                      cleanpath);
-            if (stable_path == NULL) {
-                /* Don't break the whole lookup process if it fails on
-                 * getting the stable path for some of the pools.
-                 */
-                VIR_WARN("Failed to get stable path for pool '%s'",
-                         driver->pools.objs[i]->def->name);
-                virStoragePoolObjUnlock(driver->pools.objs[i]);
-                continue;
-            }
-
-            vol = virStorageVolDefFindByPath(driver->pools.objs[i],
-                                             stable_path);
-            VIR_FREE(stable_path);
-
-            if (vol)
-                ret = virGetStorageVol(conn,
-                                       driver->pools.objs[i]->def->name,
-                                       vol->name,
-                                       vol->key);
-        }
-        virStoragePoolObjUnlock(driver->pools.objs[i]);
-    }
-
-    if (!ret)
+    if ((rc = storageVolIndexLookup(driver, cleanpath,
+                                    &pool, &name, &key)) > 0)
+        ret = virGetStorageVol(conn, pool, name, key);
+    else if (rc == 0)
         virStorageReportError(VIR_ERR_NO_STORAGE_VOL,
                               "%s", _("no storage vol with matching path"));
 
     VIR_FREE(cleanpath);
-    storageDriverUnlock(driver);
+    VIR_FREE(pool);
+    VIR_FREE(name);
+    VIR_FREE(key);
     return ret;
 }
 
@@ -1343,7 +2020,8 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
     pool->volumes.objs[pool->volumes.count++] = voldef;
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key);
-    if (!volobj) {
+    if (!volobj ||
+        storageVolIndexAdd(driver, pool, voldef) < 0) {
         pool->volumes.count--;
         goto cleanup;
     }
@@ -1515,6 +2193,10 @@ storageVolumeCreateXMLFrom(virStoragePoolPtr obj,
     pool->volumes.objs[pool->volumes.count++] = newvol;
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key);
+    if (storageVolIndexAdd(driver, pool, newvol) < 0) {
+        pool->volumes.count--;
+        goto cleanup;
+    }
 
     /* Drop the pool lock during volume allocation */
     pool->asyncjobs++;
@@ -1582,7 +2264,7 @@ storageVolumeDownload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1616,11 +2298,18 @@ storageVolumeDownload(virStorageVolPtr obj,
         goto out;
     }
 
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_RDONLY) < 0)
+    if (flags & VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_RDONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_RDONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1644,7 +2333,7 @@ storageVolumeUpload(virStorageVolPtr obj,
     virStorageVolDefPtr vol = NULL;
     int ret = -1;
 
-    virCheckFlags(0, -1);
+    virCheckFlags(VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM, -1);
 
     storageDriverLock(driver);
     pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
@@ -1680,11 +2369,18 @@ storageVolumeUpload(virStorageVolPtr obj,
 
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
-    if (virFDStreamOpenFile(stream,
-                            vol->target.path,
-                            offset, length,
-                            O_WRONLY) < 0)
+    if (flags & VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM) {
+        if (virFDStreamOpenFileSparse(stream,
+                                      vol->target.path,
+                                      offset, length,
+                                      O_WRONLY) < 0)
+            goto out;
+    } else if (virFDStreamOpenFile(stream,
+                                   vol->target.path,
+                                   offset, length,
+                                   O_WRONLY) < 0) {
         goto out;
+    }
 
     ret = 0;
 
@@ -1827,6 +2523,9 @@ out:
 }
 
 
+/* How often a volume being written out reports its progress */
+#define STORAGE_WIPE_PROGRESS_MS (10 * 1000)
+
 static int
 storageWipeExtent(virStorageVolDefPtr vol,
                   int fd,
@@ -1834,15 +2533,20 @@ storageWipeExtent(virStorageVolDefPtr vol,
                   off_t extent_length,
                   char *writebuf,
                   size_t writebuf_length,
-                  size_t *bytes_wiped)
+                  unsigned long long *bytes_wiped)
 {
     int ret = -1, written = 0;
     off_t remaining = 0;
     size_t write_size = 0;
+    unsigned long long start = 0, last, now;
 
     VIR_DEBUG("extent logical start: %ju len: %ju",
               (uintmax_t)extent_start, (uintmax_t)extent_length);
 
+    if (virTimeMillisNow(&start) < 0)
+        virResetLastError();
+    last = start;
+
     if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
         virReportSystemError(errno,
                              _("Failed to seek to position %ju in volume "
@@ -1867,6 +2571,16 @@ storageWipeExtent(virStorageVolDefPtr vol,
 
         *bytes_wiped += written;
         remaining -= written;
+
+        /* writing out a large volume takes hours */
+        if (start && virTimeMillisNow(&now) == 0 &&
+            now - last >= STORAGE_WIPE_PROGRESS_MS) {
+            VIR_INFO("Wiped %llu of %ju bytes of volume with path '%s' "
+                     "at %llu KiB/s",
+                     *bytes_wiped, (uintmax_t)extent_length, vol->target.path,
+                     *bytes_wiped / (now - start) * 1000 / 1024);
+            last = now;
+        }
     }
 
     if (fdatasync(fd) < 0) {
@@ -1877,7 +2591,7 @@ storageWipeExtent(virStorageVolDefPtr vol,
         goto out;
     }
 
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
+    VIR_DEBUG("Wrote %llu bytes to volume with path '%s'",
               *bytes_wiped, vol->target.path);
 
     ret = 0;
@@ -1887,6 +2601,70 @@ out:
 }
 
 
+/*
+ * Zero @length bytes of a block device without writing them out, if
+ * the device can do so. BLKDISCARD is not used even where the device
+ * claims discarded blocks read back as zeroes, since too many devices
+ * get BLKDISCARDZEROES wrong; BLKZEROOUT is defined to zero the range.
+ *
+ * Returns 1 if the device was zeroed, 0 if it needs to be written out.
+ */
+static int
+storageVolumeZeroBlockDevice(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                             int fd ATTRIBUTE_UNUSED,
+                             unsigned long long length ATTRIBUTE_UNUSED)
+{
+#ifdef BLKZEROOUT
+    uint64_t range[2] = { 0, length };
+
+    /* the range has to be sector aligned */
+    if (length % 512)
+        return 0;
+
+    if (ioctl(fd, BLKZEROOUT, range) == 0) {
+        VIR_DEBUG("Zeroed out %llu bytes of volume with path '%s'",
+                  length, vol->target.path);
+        return 1;
+    }
+    VIR_DEBUG("Volume with path '%s' needs to be written out: %s",
+              vol->target.path, strerror(errno));
+#endif
+    return 0;
+}
+
+
+/*
+ * Zero a fully allocated regular file without writing zeroes. Where
+ * the file system supports it the blocks are kept allocated, otherwise
+ * they are deallocated.
+ *
+ * Returns 1 if the file was zeroed, 0 if it needs to be written out.
+ */
+static int
+storageVolumeZeroFile(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                      int fd ATTRIBUTE_UNUSED,
+                      off_t size ATTRIBUTE_UNUSED)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+# ifdef FALLOC_FL_ZERO_RANGE
+    if (fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+                  0, size) == 0) {
+        VIR_DEBUG("Zeroed range of volume with path '%s'", vol->target.path);
+        return 1;
+    }
+# endif
+# ifdef FALLOC_FL_PUNCH_HOLE
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  0, size) == 0) {
+        VIR_DEBUG("Punched hole in volume with path '%s'", vol->target.path);
+        return 1;
+    }
+# endif
+#endif
+    return 0;
+}
+
+
 static int
 storageVolumeWipeInternal(virStorageVolDefPtr def,
                           unsigned int algorithm)
@@ -1894,8 +2672,9 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
     int ret = -1, fd = -1;
     struct stat st;
     char *writebuf = NULL;
-    size_t bytes_wiped = 0;
+    unsigned long long bytes_wiped = 0;
     virCommandPtr cmd = NULL;
+    unsigned long long start, end;
 
     VIR_DEBUG("Wiping volume with path '%s' and algorithm %u",
               def->target.path, algorithm);
@@ -1915,6 +2694,8 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
         goto out;
     }
 
+    virStorageFileInvalidateMetadata(def->target.path);
+
     if (algorithm != VIR_STORAGE_VOL_WIPE_ALG_ZERO) {
         const char *alg_char ATTRIBUTE_UNUSED = NULL;
         switch (algorithm) {
@@ -1961,8 +2742,20 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
 #endif
         goto out;
     } else {
+        if (virTimeMillisNow(&start) < 0)
+            start = 0;
+
         if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
             ret = storageVolumeZeroSparseFile(def, st.st_size, fd);
+            bytes_wiped = st.st_size;
+        } else if (S_ISREG(st.st_mode) &&
+                   storageVolumeZeroFile(def, fd, st.st_size) == 1) {
+            ret = 0;
+            bytes_wiped = st.st_size;
+        } else if (S_ISBLK(st.st_mode) &&
+                   storageVolumeZeroBlockDevice(def, fd, def->allocation) == 1) {
+            ret = 0;
+            bytes_wiped = def->allocation;
         } else {
 
             if (VIR_ALLOC_N(writebuf, st.st_blksize) != 0) {
@@ -1978,6 +2771,10 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
                                     st.st_blksize,
                                     &bytes_wiped);
         }
+
+        if (ret == 0 && start && virTimeMillisNow(&end) == 0)
+            VIR_INFO("Wiped %llu bytes of volume with path '%s' in %llu ms",
+                     bytes_wiped, def->target.path, end - start);
     }
 
 out:
@@ -2120,6 +2917,7 @@ storageVolumeDelete(virStorageVolPtr obj,
         if (pool->volumes.objs[i] == vol) {
             VIR_INFO("Deleting volume '%s' from storage pool '%s'",
                      vol->name, pool->def->name);
+            storageVolIndexRemove(driver, pool, vol);
             virStorageVolDefFree(vol);
             vol = NULL;
 
@@ -24,8 +24,39 @@
 #ifndef __VIR_STORAGE_DRIVER_H__
 # define __VIR_STORAGE_DRIVER_H__
 
+# include "internal.h"
 # include "storage_conf.h"
+# include "storage_backend.h"
 
 int storageRegister(void);
 
+/* Exposed for the tests */
+virStorageDriverStatePtr storageDriverStateNew(void);
+void storageDriverStateFree(virStorageDriverStatePtr driver);
+void storageDriverWatchInit(virStorageDriverStatePtr driver);
+
+int storageVolIndexAdd(virStorageDriverStatePtr driver,
+                       virStoragePoolObjPtr pool,
+                       virStorageVolDefPtr vol);
+void storageVolIndexRemove(virStorageDriverStatePtr driver,
+                           virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol);
+void storagePoolIndexRemove(virStorageDriverStatePtr driver,
+                            virStoragePoolObjPtr pool);
+int storagePoolIndexVolumes(virStorageDriverStatePtr driver,
+                            virStoragePoolObjPtr pool);
+int storageVolIndexLookup(virStorageDriverStatePtr driver,
+                          const char *path,
+                          char **pool,
+                          char **name,
+                          char **key);
+void storagePoolWatchStart(virStorageDriverStatePtr driver,
+                           virStoragePoolObjPtr pool);
+void storagePoolWatchStop(virStorageDriverStatePtr driver,
+                          virStoragePoolObjPtr pool);
+int storagePoolRefreshVolumes(virConnectPtr conn,
+                              virStorageDriverStatePtr driver,
+                              virStoragePoolObjPtr pool,
+                              virStorageBackendPtr backend);
+
 #endif /* __VIR_STORAGE_DRIVER_H__ */
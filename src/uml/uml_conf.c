@@ -142,7 +142,7 @@ umlConnectTapDevice(virConnectPtr conn,
     memcpy(tapmac, net->mac, VIR_MAC_BUFLEN);
     tapmac[0] = 0xFE; /* Discourage bridge from using TAP dev MAC */
     if (virNetDevTapCreateInBridgePort(bridge, &net->ifname, tapmac,
-                       0, true, NULL,
+                       0, true, NULL, 0,
                        virDomainNetGetActualVirtPortProfile(net)) < 0) {
         if (template_ifname)
             VIR_FREE(net->ifname);
@@ -72,11 +72,199 @@ cleanup:
     return fd;
 }
 
+#ifdef __linux__
+/* Move data from @fdin to @fdout with splice(), without it ever
+ * crossing into user space.  This only works if one of them is a
+ * pipe.  Returns 1 if all data was moved, 0 if splice() can't be used
+ * for these descriptors and nothing was moved, or -1 on error.  */
+static int
+runIOSplice(int fdin, const char *fdinname,
+            int fdout, const char *fdoutname,
+            unsigned long long length, size_t buflen)
+{
+    unsigned long long total = 0;
+
+    while (1) {
+        size_t want = buflen;
+        ssize_t got;
+
+        if (length &&
+            (length - total) < want)
+            want = length - total;
+
+        if (want == 0)
+            break; /* End of requested data from client */
+
+        got = splice(fdin, NULL, fdout, NULL, want,
+                     SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS))
+                return 0;
+            virReportSystemError(errno, _("Unable to copy %s to %s"),
+                                 fdinname, fdoutname);
+            return -1;
+        }
+        if (got == 0)
+            break; /* End of file before end of requested data */
+
+        total += got;
+    }
+
+    return 1;
+}
+#endif
+
+/* Number of buffers in flight between the reader thread and the
+ * writer, so that disk and pipe I/O can overlap.  */
+#define RUNIO_NBUFFERS 4
+
+typedef struct _runIOPipeline runIOPipeline;
+typedef runIOPipeline *runIOPipelinePtr;
+struct _runIOPipeline {
+    virMutex lock;
+    virCond cond;
+
+    int fdin;
+    unsigned long long length;
+
+    void *base; /* Location to be freed */
+    char *bufs[RUNIO_NBUFFERS]; /* Aligned locations within base */
+    size_t buflen;
+    size_t wanted[RUNIO_NBUFFERS]; /* Amount asked of each read */
+    ssize_t got[RUNIO_NBUFFERS]; /* Amount each read returned */
+    size_t head; /* Next buffer to fill */
+    size_t count; /* Buffers filled and not yet written */
+
+    bool eof; /* Reader has finished */
+    int readerr; /* errno of the read that failed, if any */
+    bool quit; /* Writer has failed, reader should stop */
+};
+
+static runIOPipelinePtr
+runIOPipelineNew(int fdin, unsigned long long length,
+                 size_t buflen, intptr_t alignMask)
+{
+    runIOPipelinePtr p;
+    char *buf;
+    size_t i;
+
+    if (VIR_ALLOC(p) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign(&p->base, alignMask + 1, buflen * RUNIO_NBUFFERS)) {
+        virReportOOMError();
+        goto error;
+    }
+    buf = p->base;
+#else
+    if (VIR_ALLOC_N(buf, buflen * RUNIO_NBUFFERS + alignMask) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+    p->base = buf;
+    buf = (char *) (((intptr_t) p->base + alignMask) & ~alignMask);
+#endif
+
+    for (i = 0 ; i < RUNIO_NBUFFERS ; i++)
+        p->bufs[i] = buf + i * buflen;
+    p->buflen = buflen;
+    p->fdin = fdin;
+    p->length = length;
+
+    if (virMutexInit(&p->lock) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to initialize mutex"));
+        goto error;
+    }
+    if (virCondInit(&p->cond) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize condition variable"));
+        virMutexDestroy(&p->lock);
+        goto error;
+    }
+
+    return p;
+
+error:
+    VIR_FREE(p->base);
+    VIR_FREE(p);
+    return NULL;
+}
+
+static void
+runIOPipelineFree(runIOPipelinePtr p)
+{
+    if (!p)
+        return;
+
+    virMutexDestroy(&p->lock);
+    ignore_value(virCondDestroy(&p->cond));
+    VIR_FREE(p->base);
+    VIR_FREE(p);
+}
+
+static void
+runIOReader(void *opaque)
+{
+    runIOPipelinePtr p = opaque;
+    unsigned long long total = 0;
+    size_t buflen = p->buflen;
+
+    while (1) {
+        size_t slot;
+        ssize_t got;
+
+        if (p->length &&
+            (p->length - total) < buflen)
+            buflen = p->length - total;
+
+        virMutexLock(&p->lock);
+        while (p->count == RUNIO_NBUFFERS && !p->quit) {
+            if (virCondWait(&p->cond, &p->lock) < 0) {
+                p->readerr = errno;
+                p->quit = true;
+            }
+        }
+        if (p->quit) {
+            p->eof = true;
+            virCondBroadcast(&p->cond);
+            virMutexUnlock(&p->lock);
+            return;
+        }
+        slot = p->head;
+        virMutexUnlock(&p->lock);
+
+        /* buflen == 0 means end of requested data from client */
+        got = buflen ? saferead(p->fdin, p->bufs[slot], buflen) : 0;
+
+        virMutexLock(&p->lock);
+        if (got < 0)
+            p->readerr = errno;
+        if (got <= 0) {
+            p->eof = true;
+        } else {
+            p->wanted[slot] = buflen;
+            p->got[slot] = got;
+            p->head = (slot + 1) % RUNIO_NBUFFERS;
+            p->count++;
+            total += got;
+        }
+        virCondBroadcast(&p->cond);
+        virMutexUnlock(&p->lock);
+
+        if (got <= 0)
+            return;
+    }
+}
+
 static int
 runIO(const char *path, int fd, int oflags, unsigned long long length)
 {
-    void *base = NULL; /* Location to be freed */
-    char *buf = NULL; /* Aligned location within base */
+    char *buf = NULL;
     size_t buflen = 1024*1024;
     intptr_t alignMask = 64*1024 - 1;
     int ret = -1;
@@ -86,21 +274,9 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
-
-#if HAVE_POSIX_MEMALIGN
-    if (posix_memalign(&base, alignMask + 1, buflen)) {
-        virReportOOMError();
-        goto cleanup;
-    }
-    buf = base;
-#else
-    if (VIR_ALLOC_N(buf, buflen + alignMask) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-    base = buf;
-    buf = (char *) (((intptr_t) base + alignMask) & ~alignMask);
-#endif
+    runIOPipelinePtr p = NULL;
+    virThread reader;
+    bool started = false;
 
     switch (oflags & O_ACCMODE) {
     case O_RDONLY:
@@ -138,22 +314,61 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+#ifdef __linux__
+    /* The other end is normally a pipe, so unless O_DIRECT needs
+     * aligned buffers, let the kernel move the data.  */
+    if (!direct) {
+        int rc = runIOSplice(fdin, fdinname, fdout, fdoutname,
+                             length, buflen);
+        if (rc < 0)
+            goto cleanup;
+        if (rc > 0) {
+            ret = 0;
+            goto cleanup;
+        }
+    }
+#endif
+
+    /* Otherwise read ahead in a separate thread, so the next buffers
+     * fill while the current one is being written out.  */
+    if (!(p = runIOPipelineNew(fdin, length, buflen, alignMask)))
+        goto cleanup;
+
+    if (virThreadCreate(&reader, true, runIOReader, p) < 0) {
+        virReportSystemError(errno, "%s", _("Unable to create reader thread"));
+        goto cleanup;
+    }
+    started = true;
+
     while (1) {
+        size_t slot;
         ssize_t got;
 
-        if (length &&
-            (length - total) < buflen)
-            buflen = length - total;
-
-        if (buflen == 0)
-            break; /* End of requested data from client */
+        virMutexLock(&p->lock);
+        while (p->count == 0 && !p->eof) {
+            if (virCondWait(&p->cond, &p->lock) < 0) {
+                virMutexUnlock(&p->lock);
+                virReportSystemError(errno, "%s",
+                                     _("Unable to wait for reader thread"));
+                goto cleanup;
+            }
+        }
+        if (p->count == 0) {
+            int err = p->readerr;
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
-            virReportSystemError(errno, _("Unable to read %s"), fdinname);
-            goto cleanup;
+            virMutexUnlock(&p->lock);
+            if (err) {
+                virReportSystemError(err, _("Unable to read %s"), fdinname);
+                goto cleanup;
+            }
+            break; /* End of file or of requested data */
         }
-        if (got == 0)
-            break; /* End of file before end of requested data */
+        slot = (p->head + RUNIO_NBUFFERS - p->count) % RUNIO_NBUFFERS;
+        buf = p->bufs[slot];
+        buflen = p->wanted[slot];
+        got = p->got[slot];
+        virMutexUnlock(&p->lock);
+
         if (got < buflen || (buflen & alignMask)) {
             /* O_DIRECT can handle at most one short read, at end of file */
             if (direct && shortRead) {
@@ -177,18 +392,180 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
             virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
             goto cleanup;
         }
+
+        virMutexLock(&p->lock);
+        p->count--;
+        virCondBroadcast(&p->cond);
+        virMutexUnlock(&p->lock);
     }
 
     ret = 0;
 
 cleanup:
+    if (started) {
+        bool eof;
+
+        virMutexLock(&p->lock);
+        p->quit = true;
+        virCondBroadcast(&p->cond);
+        eof = p->eof;
+        virMutexUnlock(&p->lock);
+
+        /* If the reader is still blocked on input that may never
+         * arrive, leave it and its buffers be; our exit reaps it.  */
+        if (eof) {
+            virThreadJoin(&reader);
+            runIOPipelineFree(p);
+        }
+    } else {
+        runIOPipelineFree(p);
+    }
+
     if (VIR_CLOSE(fd) < 0 &&
         ret == 0) {
         virReportSystemError(errno, _("Unable to close %s"), path);
         ret = -1;
     }
 
-    VIR_FREE(base);
+    return ret;
+}
+
+/* Copy a sparse file to or from a pipe as records telling data from
+ * holes, which a pipe cannot hold by itself.  */
+static int
+runIOSparse(const char *path, int fd, int oflags, unsigned long long length)
+{
+    char header[VIR_FILE_SPARSE_HEADER_LEN];
+    char *buf = NULL;
+    size_t buflen = 1024*1024;
+    unsigned long long total = 0;
+    int ret = -1;
+
+    if (O_DIRECT && (oflags & O_DIRECT)) {
+        virReportSystemError(EINVAL, "%s",
+                             _("O_DIRECT cannot be used with sparse data"));
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(buf, buflen) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    switch (oflags & O_ACCMODE) {
+    case O_RDONLY:
+        while (!length || total < length) {
+            bool inData;
+            unsigned long long len;
+            ssize_t got;
+
+            if (virFileInData(fd, &inData, &len) < 0)
+                goto cleanup;
+            if (length && len > length - total)
+                len = length - total;
+            if (len == 0)
+                break; /* End of file */
+
+            if (!inData) {
+                virFileSparseHeaderEncode(header, VIR_FILE_SPARSE_HOLE, len);
+                if (safewrite(STDOUT_FILENO, header, sizeof(header)) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("Unable to write stdout"));
+                    goto cleanup;
+                }
+                if (lseek(fd, len, SEEK_CUR) < 0) {
+                    virReportSystemError(errno, _("Unable to seek %s"), path);
+                    goto cleanup;
+                }
+                total += len;
+                continue;
+            }
+
+            if (len > buflen)
+                len = buflen;
+            if ((got = saferead(fd, buf, len)) < 0) {
+                virReportSystemError(errno, _("Unable to read %s"), path);
+                goto cleanup;
+            }
+            if (got == 0)
+                break; /* End of a file that does not report its size */
+
+            virFileSparseHeaderEncode(header, VIR_FILE_SPARSE_DATA, got);
+            if (safewrite(STDOUT_FILENO, header, sizeof(header)) < 0 ||
+                safewrite(STDOUT_FILENO, buf, got) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("Unable to write stdout"));
+                goto cleanup;
+            }
+            total += got;
+        }
+        break;
+
+    case O_WRONLY:
+        while (1) {
+            int type;
+            unsigned long long len;
+            ssize_t got;
+
+            if ((got = saferead(STDIN_FILENO, header, sizeof(header))) < 0) {
+                virReportSystemError(errno, "%s", _("Unable to read stdin"));
+                goto cleanup;
+            }
+            if (got == 0)
+                break; /* End of requested data from client */
+            if (got != sizeof(header)) {
+                virReportSystemError(EIO, "%s",
+                                     _("Truncated record on stdin"));
+                goto cleanup;
+            }
+            if (virFileSparseHeaderDecode(header, &type, &len) < 0)
+                goto cleanup;
+
+            if (type == VIR_FILE_SPARSE_HOLE) {
+                if (virFileWriteHole(fd, len) < 0)
+                    goto cleanup;
+                continue;
+            }
+
+            while (len) {
+                size_t want = len < buflen ? len : buflen;
+
+                if ((got = saferead(STDIN_FILENO, buf, want)) < 0) {
+                    virReportSystemError(errno, "%s",
+                                         _("Unable to read stdin"));
+                    goto cleanup;
+                }
+                if (got != want) {
+                    virReportSystemError(EIO, "%s",
+                                         _("Truncated record on stdin"));
+                    goto cleanup;
+                }
+                if (safewrite(fd, buf, got) < 0) {
+                    virReportSystemError(errno, _("Unable to write %s"), path);
+                    goto cleanup;
+                }
+                len -= got;
+            }
+        }
+        break;
+
+    case O_RDWR:
+    default:
+        virReportSystemError(EINVAL,
+                             _("Unable to process file with flags %d"),
+                             (oflags & O_ACCMODE));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    if (VIR_CLOSE(fd) < 0 &&
+        ret == 0) {
+        virReportSystemError(errno, _("Unable to close %s"), path);
+        ret = -1;
+    }
     return ret;
 }
 
@@ -201,7 +578,7 @@ usage(int status)
         fprintf(stderr, _("%s: try --help for more details"), program_name);
     } else {
         printf(_("Usage: %s FILENAME OFLAGS MODE OFFSET LENGTH DELETE\n"
-                 "   or: %s FILENAME LENGTH FD\n"),
+                 "   or: %s [--sparse] FILENAME LENGTH FD\n"),
                program_name, program_name);
     }
     exit(status);
@@ -219,6 +596,7 @@ main(int argc, char **argv)
     unsigned int delete = 0;
     int fd = -1;
     int lengthIndex = 0;
+    bool sparse = false;
 
     program_name = argv[0];
 
@@ -236,10 +614,18 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    path = argv[1];
-
     if (argc > 1 && STREQ(argv[1], "--help"))
         usage(EXIT_SUCCESS);
+    if (argc > 1 && STREQ(argv[1], "--sparse")) {
+        /* Data goes through the pipe as records, see runIOSparse */
+        sparse = true;
+        argv++;
+        argc--;
+        if (argc != 4)
+            usage(EXIT_FAILURE);
+    }
+
+    path = argv[1];
     if (argc == 7) { /* FILENAME OFLAGS MODE OFFSET LENGTH DELETE */
         lengthIndex = 5;
         if (virStrToLong_i(argv[2], NULL, 10, &oflags) < 0) {
@@ -294,8 +680,14 @@ main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    if (fd < 0 || runIO(path, fd, oflags, length) < 0)
+    if (fd < 0)
         goto error;
+    if (sparse) {
+        if (runIOSparse(path, fd, oflags, length) < 0)
+            goto error;
+    } else if (runIO(path, fd, oflags, length) < 0) {
+        goto error;
+    }
 
     if (delete)
         unlink(path);
@@ -43,6 +43,8 @@
 #include "memory.h"
 #include "virterror_internal.h"
 #include "logging.h"
+#include "buf.h"
+#include "ignore-value.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 #define iptablesError(code, ...)                                        \
@@ -60,14 +62,29 @@ typedef struct
     char  *chain;
 } iptRules;
 
+typedef struct
+{
+    int       family;
+    iptRules *rules;
+    int       action;
+    char    **args;     /* NULL terminated */
+} iptQueuedRule;
+
 struct _iptablesContext
 {
     iptRules *input_filter;
     iptRules *forward_filter;
     iptRules *nat_postrouting;
     iptRules *mangle_postrouting;
+
+    /* Rules queued by an open transaction */
+    unsigned int   transaction;
+    size_t         nqueued;
+    iptQueuedRule *queued;
 };
 
+static const char *iptTables[] = { "filter", "nat", "mangle" };
+
 static void
 iptRulesFree(iptRules *rules)
 {
@@ -98,11 +115,117 @@ iptRulesNew(const char *table,
     return NULL;
 }
 
-static int ATTRIBUTE_SENTINEL
-iptablesAddRemoveRule(iptRules *rules, int family, int action,
-                      const char *arg, ...)
+static void
+iptQueuedRuleClear(iptQueuedRule *rule)
+{
+    char **arg;
+
+    for (arg = rule->args; arg && *arg; arg++)
+        VIR_FREE(*arg);
+    VIR_FREE(rule->args);
+}
+
+static void
+iptablesClearQueue(iptablesContext *ctx)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->nqueued; i++)
+        iptQueuedRuleClear(&ctx->queued[i]);
+    VIR_FREE(ctx->queued);
+    ctx->nqueued = 0;
+}
+
+static bool
+iptQueuedRuleEqual(iptQueuedRule *a,
+                   iptQueuedRule *b)
+{
+    size_t i;
+
+    if (a->family != b->family || a->rules != b->rules)
+        return false;
+
+    for (i = 0; a->args[i] && b->args[i]; i++) {
+        if (STRNEQ(a->args[i], b->args[i]))
+            return false;
+    }
+
+    return !a->args[i] && !b->args[i];
+}
+
+/*
+ * Instead of queueing the removal of a rule the transaction queued for
+ * addition, do not add it in the first place. Inserting a rule and
+ * deleting it again leaves the chain as it was, and it keeps rules that
+ * are undone because adding others failed from ever being installed.
+ */
+static void
+iptablesCancelQueuedRule(iptablesContext *ctx)
+{
+    iptQueuedRule *last = &ctx->queued[ctx->nqueued - 1];
+    size_t i;
+
+    if (last->action != REMOVE)
+        return;
+
+    for (i = ctx->nqueued - 1; i-- > 0;) {
+        iptQueuedRule *rule = &ctx->queued[i];
+
+        if (rule->action != ADD || !iptQueuedRuleEqual(rule, last))
+            continue;
+
+        iptQueuedRuleClear(last);
+        iptQueuedRuleClear(rule);
+        memmove(rule, rule + 1, sizeof(*rule) * (ctx->nqueued - i - 2));
+        VIR_SHRINK_N(ctx->queued, ctx->nqueued, 2);
+        return;
+    }
+}
+
+static int
+iptablesQueueRule(iptablesContext *ctx,
+                  iptRules *rules,
+                  int family,
+                  int action,
+                  const char *arg,
+                  va_list args)
+{
+    iptQueuedRule *rule;
+    size_t nargs = 0;
+    const char *s;
+
+    if (VIR_EXPAND_N(ctx->queued, ctx->nqueued, 1) < 0)
+        goto no_memory;
+
+    rule = &ctx->queued[ctx->nqueued - 1];
+    rule->family = family;
+    rule->rules = rules;
+    rule->action = action;
+
+    for (s = arg; s; s = va_arg(args, const char *)) {
+        if (VIR_REALLOC_N(rule->args, nargs + 2) < 0 ||
+            !(rule->args[nargs] = strdup(s)))
+            goto no_memory;
+        rule->args[++nargs] = NULL;
+    }
+
+    iptablesCancelQueuedRule(ctx);
+
+    return 0;
+
+no_memory:
+    if (ctx->nqueued) {
+        iptQueuedRuleClear(&ctx->queued[ctx->nqueued - 1]);
+        ctx->nqueued--;
+    }
+    virReportOOMError();
+    return -1;
+}
+
+static int
+iptablesRunRule(iptRules *rules, int family, int action,
+                const char *arg, va_list args)
 {
-    va_list args;
     int ret;
     virCommandPtr cmd;
     const char *s;
@@ -114,16 +237,332 @@ iptablesAddRemoveRule(iptRules *rules, int family, int action,
                          action == ADD ? "--insert" : "--delete",
                          rules->chain, arg, NULL);
 
-    va_start(args, arg);
     while ((s = va_arg(args, const char *)))
         virCommandAddArg(cmd, s);
-    va_end(args);
 
     ret = virCommandRun(cmd, NULL);
     virCommandFree(cmd);
     return ret;
 }
 
+static int ATTRIBUTE_SENTINEL
+iptablesAddRemoveRule(iptablesContext *ctx, iptRules *rules,
+                      int family, int action,
+                      const char *arg, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, arg);
+    if (ctx->transaction)
+        ret = iptablesQueueRule(ctx, rules, family, action, arg, args);
+    else
+        ret = iptablesRunRule(rules, family, action, arg, args);
+    va_end(args);
+
+    return ret;
+}
+
+/* Like iptablesAddRemoveRule, but never queued in a transaction, for
+ * rules whose failure the caller needs to see and may ignore */
+static int ATTRIBUTE_SENTINEL
+iptablesAddRemoveRuleNow(iptRules *rules, int family, int action,
+                         const char *arg, ...)
+{
+    va_list args;
+    int ret;
+
+    va_start(args, arg);
+    ret = iptablesRunRule(rules, family, action, arg, args);
+    va_end(args);
+
+    return ret;
+}
+
+/*
+ * Apply a single queued rule with its own iptables invocation. Failing
+ * to delete a rule is not an error, as it may simply not be present.
+ */
+static int
+iptablesApplyQueuedRule(iptQueuedRule *rule)
+{
+    virCommandPtr cmd;
+    int status;
+    int ret;
+
+    cmd = virCommandNew((rule->family == AF_INET6)
+                        ? IP6TABLES_PATH : IPTABLES_PATH);
+
+    virCommandAddArgList(cmd, "--table", rule->rules->table,
+                         rule->action == ADD ? "--insert" : "--delete",
+                         rule->rules->chain, NULL);
+    virCommandAddArgSet(cmd, (const char *const *)rule->args);
+
+    ret = virCommandRun(cmd, rule->action == ADD ? NULL : &status);
+    virCommandFree(cmd);
+    return rule->action == ADD ? ret : 0;
+}
+
+/*
+ * Whether the iptables-save output @saved may contain @rule. The rules
+ * are saved in a canonical form which differs from the options libvirt
+ * uses, so this only checks that a rule in the same chain mentions all
+ * values of @rule; a false positive just fails the batch.
+ */
+static bool
+iptablesSavedMayContain(const char *saved,
+                        iptQueuedRule *rule)
+{
+    const char *line, *end, *value;
+    size_t chainlen = strlen(rule->rules->chain);
+    size_t len;
+    char **arg;
+
+    for (line = saved; *line; line = *end ? end + 1 : end) {
+        end = line + strcspn(line, "\n");
+
+        if (!STRPREFIX(line, "-A ") ||
+            strncmp(line + 3, rule->rules->chain, chainlen) != 0 ||
+            line[3 + chainlen] != ' ')
+            continue;
+
+        for (arg = rule->args; *arg; arg++) {
+            if (**arg == '-' || STREQ(*arg, "!"))
+                continue;
+
+            /* lists such as connection states may be reordered */
+            for (value = *arg; *value; value += len + !!value[len]) {
+                len = strcspn(value, ",");
+                if (!memmem(line, end - line, value, len))
+                    break;
+            }
+            if (*value)
+                break;
+        }
+
+        if (!*arg)
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * iptablesTransactionRestoreInput:
+ * @ctx: pointer to the IP table context
+ * @family: address family of the rules
+ * @table: the table of the rules
+ * @saved: iptables-save output of @table, or NULL
+ *
+ * Format the rules of @family in @table that the open transaction
+ * queued as input to iptables-restore --noflush, in the order they
+ * were queued. Deleting a rule that is not present fails the whole
+ * batch, so if @saved is given, rules to delete that it does not
+ * contain are left out.
+ *
+ * Returns the input, or NULL on error
+ */
+char *
+iptablesTransactionRestoreInput(iptablesContext *ctx,
+                                int family,
+                                const char *table,
+                                const char *saved)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char **arg;
+    size_t i;
+
+    virBufferAsprintf(&buf, "*%s\n", table);
+    for (i = 0; i < ctx->nqueued; i++) {
+        iptQueuedRule *rule = &ctx->queued[i];
+
+        if (rule->family != family || STRNEQ(rule->rules->table, table))
+            continue;
+
+        if (rule->action == REMOVE && saved &&
+            !iptablesSavedMayContain(saved, rule))
+            continue;
+
+        virBufferAsprintf(&buf, "%s %s",
+                          rule->action == ADD ? "--insert" : "--delete",
+                          rule->rules->chain);
+        for (arg = rule->args; *arg; arg++)
+            virBufferAsprintf(&buf, " %s", *arg);
+        virBufferAddLit(&buf, "\n");
+    }
+    virBufferAddLit(&buf, "COMMIT\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+/* Apply @input with iptables-restore; returns 0 if all of it applied */
+static int
+iptablesRestore(int family,
+                const char *input)
+{
+    virCommandPtr cmd;
+    int status;
+    int ret = -1;
+
+    cmd = virCommandNewArgList((family == AF_INET6)
+                               ? IP6TABLES_RESTORE_PATH : IPTABLES_RESTORE_PATH,
+                               "--noflush", NULL);
+    virCommandSetInputBuffer(cmd, input);
+
+    if (virCommandRun(cmd, &status) == 0 && status == 0)
+        ret = 0;
+
+    virCommandFree(cmd);
+    return ret;
+}
+
+/* The rules of @table as listed by iptables-save, or NULL on error */
+static char *
+iptablesSave(int family,
+             const char *table)
+{
+    virCommandPtr cmd;
+    char *saved = NULL;
+    int status;
+
+    cmd = virCommandNewArgList((family == AF_INET6)
+                               ? IP6TABLES_SAVE_PATH : IPTABLES_SAVE_PATH,
+                               "--table", table, NULL);
+    virCommandSetOutputBuffer(cmd, &saved);
+
+    if (virCommandRun(cmd, &status) < 0 || status != 0)
+        VIR_FREE(saved);
+
+    virCommandFree(cmd);
+    return saved;
+}
+
+/*
+ * Apply all queued rules of @family in @table in the order they were
+ * queued, atomically with one iptables-restore invocation. A rule to
+ * delete may not be present, which fails the whole batch; the batch is
+ * then retried without the rules iptables-save does not list. Should
+ * that fail too, nothing has been applied and the rules are applied one
+ * by one, which gives the same result and errors as if there had been
+ * no transaction.
+ */
+static int
+iptablesCommitTable(iptablesContext *ctx,
+                    int family,
+                    const char *table)
+{
+    char *input = NULL;
+    char *saved = NULL;
+    size_t i, nremove = 0;
+    int ret = 0;
+
+    for (i = 0; i < ctx->nqueued; i++) {
+        iptQueuedRule *rule = &ctx->queued[i];
+
+        if (rule->family == family && rule->action == REMOVE &&
+            STREQ(rule->rules->table, table))
+            nremove++;
+    }
+
+    if (!(input = iptablesTransactionRestoreInput(ctx, family, table, NULL)))
+        return -1;
+
+    if (iptablesRestore(family, input) == 0)
+        goto cleanup;
+
+    if (nremove > 0 && (saved = iptablesSave(family, table))) {
+        VIR_FREE(input);
+        if (!(input = iptablesTransactionRestoreInput(ctx, family, table,
+                                                      saved))) {
+            ret = -1;
+            goto cleanup;
+        }
+
+        if (iptablesRestore(family, input) == 0)
+            goto cleanup;
+    }
+
+    VIR_DEBUG("Batch update of %s table failed, applying rules one by one",
+              table);
+
+    for (i = 0; i < ctx->nqueued; i++) {
+        iptQueuedRule *rule = &ctx->queued[i];
+
+        if (rule->family != family || STRNEQ(rule->rules->table, table))
+            continue;
+
+        if (iptablesApplyQueuedRule(rule) < 0)
+            ret = -1;
+    }
+
+cleanup:
+    VIR_FREE(saved);
+    VIR_FREE(input);
+    return ret;
+}
+
+/**
+ * iptablesTransactionBegin:
+ * @ctx: pointer to the IP table context
+ *
+ * Start queueing rule changes instead of applying each of them with its
+ * own iptables invocation. Transactions can be nested, the rules are
+ * applied in order when the outermost one is committed. Removing a rule
+ * the transaction is to add cancels its addition. While a transaction
+ * is open the add and remove functions only fail if the rule can not
+ * be queued.
+ */
+void
+iptablesTransactionBegin(iptablesContext *ctx)
+{
+    ctx->transaction++;
+}
+
+/**
+ * iptablesTransactionCommit:
+ * @ctx: pointer to the IP table context
+ *
+ * Close a transaction started with iptablesTransactionBegin. When the
+ * outermost transaction is closed, all queued rules are applied with
+ * one iptables-restore invocation per family and table.
+ *
+ * Returns 0 in case of success or -1 if any rule could not be added
+ */
+int
+iptablesTransactionCommit(iptablesContext *ctx)
+{
+    int families[] = { AF_INET, AF_INET6 };
+    size_t i, j, k;
+    int ret = 0;
+
+    if (!ctx->transaction || --ctx->transaction > 0)
+        return 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(families); i++) {
+        for (j = 0; j < ARRAY_CARDINALITY(iptTables); j++) {
+            for (k = 0; k < ctx->nqueued; k++) {
+                if (ctx->queued[k].family == families[i] &&
+                    STREQ(ctx->queued[k].rules->table, iptTables[j]))
+                    break;
+            }
+            if (k == ctx->nqueued)
+                continue;
+
+            if (iptablesCommitTable(ctx, families[i], iptTables[j]) < 0)
+                ret = -1;
+        }
+    }
+
+    iptablesClearQueue(ctx);
+    return ret;
+}
+
 /**
  * iptablesContextNew:
  *
@@ -167,6 +606,7 @@ iptablesContextNew(void)
 void
 iptablesContextFree(iptablesContext *ctx)
 {
+    iptablesClearQueue(ctx);
     if (ctx->input_filter)
         iptRulesFree(ctx->input_filter);
     if (ctx->forward_filter)
@@ -191,7 +631,7 @@ iptablesInput(iptablesContext *ctx,
     snprintf(portstr, sizeof(portstr), "%d", port);
     portstr[sizeof(portstr) - 1] = '\0';
 
-    return iptablesAddRemoveRule(ctx->input_filter,
+    return iptablesAddRemoveRule(ctx, ctx->input_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -335,7 +775,7 @@ iptablesForwardAllowOut(iptablesContext *ctx,
         return -1;
 
     if (physdev && physdev[0]) {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--source", networkstr,
@@ -344,7 +784,7 @@ iptablesForwardAllowOut(iptablesContext *ctx,
                                     "--jump", "ACCEPT",
                                     NULL);
     } else {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--source", networkstr,
@@ -421,7 +861,7 @@ iptablesForwardAllowRelatedIn(iptablesContext *ctx,
         return -1;
 
     if (physdev && physdev[0]) {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -432,7 +872,7 @@ iptablesForwardAllowRelatedIn(iptablesContext *ctx,
                                     "--jump", "ACCEPT",
                                     NULL);
     } else {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -509,7 +949,7 @@ iptablesForwardAllowIn(iptablesContext *ctx,
         return -1;
 
     if (physdev && physdev[0]) {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -518,7 +958,7 @@ iptablesForwardAllowIn(iptablesContext *ctx,
                                     "--jump", "ACCEPT",
                                     NULL);
     } else {
-        ret = iptablesAddRemoveRule(ctx->forward_filter,
+        ret = iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                     VIR_SOCKET_ADDR_FAMILY(netaddr),
                                     action,
                                     "--destination", networkstr,
@@ -586,7 +1026,7 @@ iptablesForwardAllowCross(iptablesContext *ctx,
                           const char *iface,
                           int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -643,7 +1083,7 @@ iptablesForwardRejectOut(iptablesContext *ctx,
                          const char *iface,
                          int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--in-interface", iface,
@@ -699,7 +1139,7 @@ iptablesForwardRejectIn(iptablesContext *ctx,
                         const char *iface,
                         int action)
 {
-    return iptablesAddRemoveRule(ctx->forward_filter,
+    return iptablesAddRemoveRule(ctx, ctx->forward_filter,
                                  family,
                                  action,
                                  "--out-interface", iface,
@@ -772,7 +1212,7 @@ iptablesForwardMasquerade(iptablesContext *ctx,
 
     if (protocol && protocol[0]) {
         if (physdev && physdev[0]) {
-            ret = iptablesAddRemoveRule(ctx->nat_postrouting,
+            ret = iptablesAddRemoveRule(ctx, ctx->nat_postrouting,
                                         AF_INET,
                                         action,
                                         "--source", networkstr,
@@ -783,7 +1223,7 @@ iptablesForwardMasquerade(iptablesContext *ctx,
                                         "--to-ports", "1024-65535",
                                         NULL);
         } else {
-            ret = iptablesAddRemoveRule(ctx->nat_postrouting,
+            ret = iptablesAddRemoveRule(ctx, ctx->nat_postrouting,
                                         AF_INET,
                                         action,
                                         "--source", networkstr,
@@ -795,7 +1235,7 @@ iptablesForwardMasquerade(iptablesContext *ctx,
         }
     } else {
         if (physdev && physdev[0]) {
-            ret = iptablesAddRemoveRule(ctx->nat_postrouting,
+            ret = iptablesAddRemoveRule(ctx, ctx->nat_postrouting,
                                         AF_INET,
                                         action,
                                         "--source", networkstr,
@@ -804,7 +1244,7 @@ iptablesForwardMasquerade(iptablesContext *ctx,
                                         "--jump", "MASQUERADE",
                                         NULL);
         } else {
-            ret = iptablesAddRemoveRule(ctx->nat_postrouting,
+            ret = iptablesAddRemoveRule(ctx, ctx->nat_postrouting,
                                         AF_INET,
                                         action,
                                         "--source", networkstr,
@@ -875,14 +1315,17 @@ iptablesOutputFixUdpChecksum(iptablesContext *ctx,
     snprintf(portstr, sizeof(portstr), "%d", port);
     portstr[sizeof(portstr) - 1] = '\0';
 
-    return iptablesAddRemoveRule(ctx->mangle_postrouting,
-                                 AF_INET,
-                                 action,
-                                 "--out-interface", iface,
-                                 "--protocol", "udp",
-                                 "--destination-port", portstr,
-                                 "--jump", "CHECKSUM", "--checksum-fill",
-                                 NULL);
+    /* Not all iptables implementations support the CHECKSUM target
+     * and callers ignore its failure, so it is never part of a
+     * transaction whose other rules would fail along with it */
+    return iptablesAddRemoveRuleNow(ctx->mangle_postrouting,
+                                    AF_INET,
+                                    action,
+                                    "--out-interface", iface,
+                                    "--protocol", "udp",
+                                    "--destination-port", portstr,
+                                    "--jump", "CHECKSUM", "--checksum-fill",
+                                    NULL);
 }
 
 /**
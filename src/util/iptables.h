@@ -29,6 +29,13 @@ typedef struct _iptablesContext iptablesContext;
 iptablesContext *iptablesContextNew              (void);
 void             iptablesContextFree             (iptablesContext *ctx);
 
+void             iptablesTransactionBegin        (iptablesContext *ctx);
+int              iptablesTransactionCommit       (iptablesContext *ctx);
+char            *iptablesTransactionRestoreInput (iptablesContext *ctx,
+                                                  int family,
+                                                  const char *table,
+                                                  const char *saved);
+
 int              iptablesAddTcpInput             (iptablesContext *ctx,
                                                   int family,
                                                   const char *iface,
@@ -26,6 +26,11 @@
 # include "stats_linux.h"
 # include "memory.h"
 # include "virfile.h"
+# include "virnetlink.h"
+
+# ifdef HAVE_LIBNL
+#  include <linux/if_link.h>
+# endif
 
 # define VIR_FROM_THIS VIR_FROM_STATS_LINUX
 
@@ -40,6 +45,178 @@
  * the interface of a domain they own.  We do no such checking.
  */
 
+# ifdef HAVE_LIBNL
+/* Older kernels lacked 64 bit link statistics.  */
+#  if !HAVE_DECL_IFLA_STATS64
+#   define IFLA_STATS64 23
+struct rtnl_link_stats64 {
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t rx_errors;
+    uint64_t tx_errors;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+};
+#  endif
+
+/*
+ * Fill @stats from the link attributes of a RTM_NEWLINK message,
+ * preferring the 64 bit counters over the ones that wrap at 4GB.
+ *
+ * IMPORTANT NOTE!
+ * The counters see the network from the point of view of the host.
+ * So bytes TRANSMITTED by the host are bytes RECEIVED by the domain.
+ * That's why the TX/RX fields appear to be swapped here.
+ */
+static int
+linuxLinkStatsFromAttrs(struct nlattr **tb,
+                        struct _virDomainInterfaceStats *stats)
+{
+    if (tb[IFLA_STATS64] &&
+        nla_len(tb[IFLA_STATS64]) >= sizeof(struct rtnl_link_stats64)) {
+        struct rtnl_link_stats64 *st = nla_data(tb[IFLA_STATS64]);
+
+        stats->rx_bytes = st->tx_bytes;
+        stats->rx_packets = st->tx_packets;
+        stats->rx_errs = st->tx_errors;
+        stats->rx_drop = st->tx_dropped;
+        stats->tx_bytes = st->rx_bytes;
+        stats->tx_packets = st->rx_packets;
+        stats->tx_errs = st->rx_errors;
+        stats->tx_drop = st->rx_dropped;
+        return 0;
+    }
+
+    if (tb[IFLA_STATS] &&
+        nla_len(tb[IFLA_STATS]) >= sizeof(struct rtnl_link_stats)) {
+        struct rtnl_link_stats *st = nla_data(tb[IFLA_STATS]);
+
+        stats->rx_bytes = st->tx_bytes;
+        stats->rx_packets = st->tx_packets;
+        stats->rx_errs = st->tx_errors;
+        stats->rx_drop = st->tx_dropped;
+        stats->tx_bytes = st->rx_bytes;
+        stats->tx_packets = st->rx_packets;
+        stats->tx_errs = st->rx_errors;
+        stats->tx_drop = st->rx_dropped;
+        return 0;
+    }
+
+    return -1;
+}
+
+
+/**
+ * linuxDomainInterfaceStatsParse:
+ * @path: the name of the interface
+ * @buf: the netlink response to a RTM_GETLINK request for @path
+ * @len: length of @buf
+ * @stats: where to store the statistics
+ *
+ * Fill @stats from the kernel's answer to a request for the link
+ * attributes of @path.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+linuxDomainInterfaceStatsParse(const char *path,
+                               unsigned char *buf,
+                               unsigned int len,
+                               struct _virDomainInterfaceStats *stats)
+{
+    struct nlattr *tb[IFLA_MAX + 1];
+    struct nlmsghdr *resp;
+    struct nlmsgerr *err;
+
+    if (len < NLMSG_LENGTH(0) || buf == NULL)
+        goto malformed_resp;
+
+    resp = (struct nlmsghdr *)buf;
+
+    if (resp->nlmsg_len < NLMSG_LENGTH(0) || resp->nlmsg_len > len)
+        goto malformed_resp;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+
+        if (err->error == -ENODEV) {
+            virStatsError(VIR_ERR_INTERNAL_ERROR,
+                          _("Interface '%s' not found"), path);
+        } else {
+            virReportSystemError(-err->error,
+                                 _("cannot get statistics of interface '%s'"),
+                                 path);
+        }
+        return -1;
+
+    case RTM_NEWLINK:
+        if (nlmsg_parse(resp, sizeof(struct ifinfomsg),
+                        tb, IFLA_MAX, NULL) < 0)
+            goto malformed_resp;
+
+        if (linuxLinkStatsFromAttrs(tb, stats) < 0) {
+            virStatsError(VIR_ERR_INTERNAL_ERROR,
+                          _("no statistics reported for interface '%s'"),
+                          path);
+            return -1;
+        }
+        return 0;
+
+    default:
+        goto malformed_resp;
+    }
+
+malformed_resp:
+    virStatsError(VIR_ERR_INTERNAL_ERROR, "%s",
+                  _("malformed netlink response message"));
+    return -1;
+}
+
+
+int
+linuxDomainInterfaceStats(const char *path,
+                          struct _virDomainInterfaceStats *stats)
+{
+    int ret = -1;
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_index  = 0,
+    };
+    struct nl_msg *nl_msg;
+    unsigned char *recvbuf = NULL;
+    unsigned int recvbuflen;
+
+    nl_msg = nlmsg_alloc_simple(RTM_GETLINK, NLM_F_REQUEST);
+    if (!nl_msg) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (nlmsg_append(nl_msg, &ifinfo, sizeof(ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(path) + 1, path) < 0) {
+        virStatsError(VIR_ERR_INTERNAL_ERROR, "%s",
+                      _("allocated netlink buffer is too small"));
+        goto cleanup;
+    }
+
+    if (virNetlinkCommand(nl_msg, &recvbuf, &recvbuflen, 0) < 0)
+        goto cleanup;
+
+    ret = linuxDomainInterfaceStatsParse(path, recvbuf, recvbuflen, stats);
+
+cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(recvbuf);
+    return ret;
+}
+
+# else /* !HAVE_LIBNL */
+
 int
 linuxDomainInterfaceStats(const char *path,
                           struct _virDomainInterfaceStats *stats)
@@ -111,4 +288,6 @@ linuxDomainInterfaceStats(const char *path,
     return -1;
 }
 
+# endif /* !HAVE_LIBNL */
+
 #endif /* __linux__ */
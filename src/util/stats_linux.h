@@ -18,6 +18,13 @@
 extern int linuxDomainInterfaceStats(const char *path,
                                      struct _virDomainInterfaceStats *stats);
 
+#  ifdef HAVE_LIBNL
+int linuxDomainInterfaceStatsParse(const char *path,
+                                   unsigned char *buf,
+                                   unsigned int len,
+                                   struct _virDomainInterfaceStats *stats);
+#  endif
+
 # endif /* __linux__ */
 
 #endif /* __STATS_LINUX_H__ */
@@ -38,6 +38,8 @@
 #include "virterror_internal.h"
 #include "logging.h"
 #include "virfile.h"
+#include "threads.h"
+#include "virhash.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -804,6 +806,211 @@ virStorageFileProbeFormat(const char *path)
     return ret;
 }
 
+/*
+ * Headers parsed from regular files are kept, so that walking the same
+ * backing chains on every domain start, relabel and pool refresh does
+ * not read them again while the files are unchanged.  Entries are keyed
+ * on the file identity, the requested format and the path relative
+ * backing stores were resolved against; they are only used while the
+ * size and timestamps of the file still match.  Block devices are never
+ * cached as their timestamps do not follow their contents.  Once the
+ * cache is full, the least recently used entry makes way for a new one.
+ *
+ * Whether the backing store is a file is not kept but worked out again
+ * from its name on every lookup.
+ */
+#define VIR_STORAGE_FILE_CACHE_MAX 4096
+
+typedef struct _virStorageFileCacheEntry virStorageFileCacheEntry;
+typedef virStorageFileCacheEntry *virStorageFileCacheEntryPtr;
+struct _virStorageFileCacheEntry {
+    char *key;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    int ret;
+    virStorageFileMetadata meta;
+
+    /* Least recently used order, most recent first */
+    virStorageFileCacheEntryPtr prev;
+    virStorageFileCacheEntryPtr next;
+};
+
+static virMutex virStorageFileCacheLock;
+static virHashTablePtr virStorageFileCache;
+static virStorageFileCacheEntryPtr virStorageFileCacheHead;
+static virStorageFileCacheEntryPtr virStorageFileCacheTail;
+static virOnceControl virStorageFileCacheOnce = VIR_ONCE_CONTROL_INITIALIZER;
+
+static void
+virStorageFileCacheUnlink(virStorageFileCacheEntryPtr entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else if (virStorageFileCacheHead == entry)
+        virStorageFileCacheHead = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else if (virStorageFileCacheTail == entry)
+        virStorageFileCacheTail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void
+virStorageFileCacheLink(virStorageFileCacheEntryPtr entry)
+{
+    entry->prev = NULL;
+    entry->next = virStorageFileCacheHead;
+    if (virStorageFileCacheHead)
+        virStorageFileCacheHead->prev = entry;
+    virStorageFileCacheHead = entry;
+    if (!virStorageFileCacheTail)
+        virStorageFileCacheTail = entry;
+}
+
+/* Called by the hash, with the cache lock held, for every entry it
+ * drops, so the entry leaves the usage list too */
+static void
+virStorageFileCacheEntryFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageFileCacheEntryPtr entry = payload;
+
+    if (!entry)
+        return;
+    virStorageFileCacheUnlink(entry);
+    VIR_FREE(entry->key);
+    VIR_FREE(entry->meta.backingStore);
+    VIR_FREE(entry);
+}
+
+static void
+virStorageFileCacheInitialize(void)
+{
+    if (virMutexInit(&virStorageFileCacheLock) < 0)
+        return;
+    if (!(virStorageFileCache = virHashCreate(256,
+                                              virStorageFileCacheEntryFree)))
+        virMutexDestroy(&virStorageFileCacheLock);
+}
+
+static int
+virStorageFileCacheReady(void)
+{
+    return virOnce(&virStorageFileCacheOnce,
+                   virStorageFileCacheInitialize) == 0 &&
+        virStorageFileCache != NULL;
+}
+
+static int
+virStorageFileCopyMetadata(virStorageFileMetadata *dst,
+                           const virStorageFileMetadata *src)
+{
+    *dst = *src;
+    if (src->backingStore &&
+        !(dst->backingStore = strdup(src->backingStore)))
+        return -1;
+    return 0;
+}
+
+static char *
+virStorageFileCacheKey(const char *path, const struct stat *sb, int format)
+{
+    char *key;
+
+    if (virAsprintf(&key, "%llu:%llu:%d:%s",
+                    (unsigned long long) sb->st_dev,
+                    (unsigned long long) sb->st_ino,
+                    format, path) < 0)
+        return NULL;
+    return key;
+}
+
+/* Returns 1 and fills in @meta and @ret if the cache holds the header
+ * of the file described by @sb, 0 otherwise */
+static int
+virStorageFileCacheLookup(const char *key,
+                          const struct stat *sb,
+                          virStorageFileMetadata *meta,
+                          int *ret)
+{
+    virStorageFileCacheEntryPtr entry;
+    int found = 0;
+
+    virMutexLock(&virStorageFileCacheLock);
+    entry = virHashLookup(virStorageFileCache, key);
+    if (entry &&
+        entry->size == sb->st_size &&
+        entry->mtime == sb->st_mtime &&
+        entry->ctime == sb->st_ctime &&
+        virStorageFileCopyMetadata(meta, &entry->meta) == 0) {
+        virStorageFileCacheUnlink(entry);
+        virStorageFileCacheLink(entry);
+        meta->backingStoreIsFile = meta->backingStore &&
+            virBackingStoreIsFile(meta->backingStore);
+        *ret = entry->ret;
+        found = 1;
+    }
+    virMutexUnlock(&virStorageFileCacheLock);
+
+    return found;
+}
+
+static int
+virStorageFileCacheMatchFile(const void *payload,
+                             const void *name ATTRIBUTE_UNUSED,
+                             const void *data)
+{
+    const virStorageFileCacheEntry *entry = payload;
+    const struct stat *sb = data;
+
+    return entry->dev == sb->st_dev && entry->ino == sb->st_ino;
+}
+
+static void
+virStorageFileCacheStore(const char *key,
+                         const struct stat *sb,
+                         const virStorageFileMetadata *meta,
+                         int ret)
+{
+    virStorageFileCacheEntryPtr entry;
+    time_t now = time(NULL);
+
+    /* A change made within the same second would not show in the
+     * timestamps, so leave recently modified files alone */
+    if (sb->st_mtime >= now || sb->st_ctime >= now)
+        return;
+
+    if (VIR_ALLOC(entry) < 0)
+        return;
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = sb->st_mtime;
+    entry->ctime = sb->st_ctime;
+    entry->ret = ret;
+    if (!(entry->key = strdup(key)) ||
+        virStorageFileCopyMetadata(&entry->meta, meta) < 0) {
+        VIR_FREE(entry->key);
+        VIR_FREE(entry);
+        return;
+    }
+    entry->meta.backingStoreIsFile = false;
+
+    virMutexLock(&virStorageFileCacheLock);
+    /* Drops any older entry for the key, and unlinks it */
+    if (virHashUpdateEntry(virStorageFileCache, key, entry) < 0) {
+        virStorageFileCacheEntryFree(entry, NULL);
+    } else {
+        virStorageFileCacheLink(entry);
+        while (virHashSize(virStorageFileCache) > VIR_STORAGE_FILE_CACHE_MAX)
+            virHashRemoveEntry(virStorageFileCache,
+                               virStorageFileCacheTail->key);
+    }
+    virMutexUnlock(&virStorageFileCacheLock);
+}
+
 /**
  * virStorageFileGetMetadataFromFD:
  *
@@ -832,6 +1039,7 @@ virStorageFileGetMetadataFromFD(const char *path,
     ssize_t len = STORAGE_MAX_HEAD;
     int ret = -1;
     struct stat sb;
+    char *key = NULL;
 
     memset(meta, 0, sizeof (*meta));
 
@@ -847,6 +1055,14 @@ virStorageFileGetMetadataFromFD(const char *path,
         return 0;
     }
 
+    if (S_ISREG(sb.st_mode) &&
+        virStorageFileCacheReady() &&
+        (key = virStorageFileCacheKey(path, &sb, format)) &&
+        virStorageFileCacheLookup(key, &sb, meta, &ret)) {
+        VIR_FREE(key);
+        return ret;
+    }
+
     if (lseek(fd, 0, SEEK_SET) == (off_t)-1) {
         virReportSystemError(errno, _("cannot seek to start of '%s'"), path);
         return -1;
@@ -874,7 +1090,11 @@ virStorageFileGetMetadataFromFD(const char *path,
 
     ret = virStorageFileGetMetadataFromBuf(format, path, head, len, meta);
 
+    if (ret >= 0 && key)
+        virStorageFileCacheStore(key, &sb, meta, ret);
+
 cleanup:
+    VIR_FREE(key);
     VIR_FREE(head);
     return ret;
 }
@@ -931,6 +1151,27 @@ virStorageFileFreeMetadata(virStorageFileMetadata *meta)
     VIR_FREE(meta);
 }
 
+/**
+ * virStorageFileInvalidateMetadata:
+ *
+ * Forget any header cached for the file at 'path'.  To be called
+ * whenever libvirt writes to an image, so the next lookup does not
+ * depend on its timestamps having moved.
+ */
+void
+virStorageFileInvalidateMetadata(const char *path)
+{
+    struct stat sb;
+
+    if (!virStorageFileCacheReady() ||
+        stat(path, &sb) < 0)
+        return;
+
+    virMutexLock(&virStorageFileCacheLock);
+    virHashRemoveSet(virStorageFileCache, virStorageFileCacheMatchFile, &sb);
+    virMutexUnlock(&virStorageFileCacheLock);
+}
+
 /**
  * virStorageFileResize:
  *
@@ -939,6 +1180,8 @@ virStorageFileFreeMetadata(virStorageFileMetadata *meta)
 int
 virStorageFileResize(const char *path, unsigned long long capacity)
 {
+    virStorageFileInvalidateMetadata(path);
+
     if (truncate(path, capacity) < 0) {
         virReportSystemError(errno, _("Failed to truncate file '%s'"), path);
         return -1;
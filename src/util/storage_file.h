@@ -71,6 +71,7 @@ int virStorageFileGetMetadataFromFD(const char *path,
                                     virStorageFileMetadata *meta);
 
 void virStorageFileFreeMetadata(virStorageFileMetadata *meta);
+void virStorageFileInvalidateMetadata(const char *path);
 
 int virStorageFileResize(const char *path, unsigned long long capacity);
 
@@ -134,7 +134,7 @@ safewrite(int fd, const void *buf, size_t count)
 }
 
 #ifdef HAVE_POSIX_FALLOCATE
-int safezero(int fd, off_t offset, off_t len)
+static int safezero_fallback(int fd, off_t offset, off_t len)
 {
     int ret = posix_fallocate(fd, offset, len);
     if (ret == 0)
@@ -145,7 +145,7 @@ int safezero(int fd, off_t offset, off_t len)
 #else
 
 # ifdef HAVE_MMAP
-int safezero(int fd, off_t offset, off_t len)
+static int safezero_fallback(int fd, off_t offset, off_t len)
 {
     int r;
     char *buf;
@@ -169,7 +169,7 @@ int safezero(int fd, off_t offset, off_t len)
 
 # else /* HAVE_MMAP */
 
-int safezero(int fd, off_t offset, off_t len)
+static int safezero_fallback(int fd, off_t offset, off_t len)
 {
     int r;
     char *buf;
@@ -207,6 +207,21 @@ int safezero(int fd, off_t offset, off_t len)
 # endif /* HAVE_MMAP */
 #endif /* HAVE_POSIX_FALLOCATE */
 
+/* Zero the given range of the file, allocating it. Unlike allocating
+ * with posix_fallocate, zeroing the range makes data already there
+ * read back as zeroes too, without writing anything on file systems
+ * which support it. Only on others are zeroes written out. */
+int safezero(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_ZERO_RANGE)
+    if (fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, len) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS)
+        return -1;
+#endif
+    return safezero_fallback(fd, offset, len);
+}
+
 int virFileStripSuffix(char *str,
                        const char *suffix)
 {
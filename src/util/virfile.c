@@ -411,3 +411,209 @@ int virFileTouch(const char *path, mode_t mode)
 
     return 0;
 }
+
+
+/**
+ * virFileInData:
+ * @fd: file to check
+ * @inData: set to true if the current position is in data
+ * @len: set to the number of bytes left of that data or hole
+ *
+ * Find out whether the current position of @fd is in a data or in a
+ * hole section, and how many bytes are left of that section. The
+ * file position is left where it was. At the end of the file
+ * @inData is true and @len zero. Files which cannot report holes,
+ * like block devices, are a single data section.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virFileInData(int fd, bool *inData, unsigned long long *len)
+{
+    off_t cur;
+    struct stat sb;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t data;
+    off_t hole;
+#endif
+
+    *inData = true;
+    *len = 0;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0)
+        goto error;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if ((data = lseek(fd, cur, SEEK_DATA)) < 0) {
+        if (errno == EINVAL)
+            goto whole; /* No hole reporting for this file */
+        if (errno != ENXIO)
+            goto error;
+
+        /* No data past @cur, only a trailing hole, if anything */
+        if (fstat(fd, &sb) < 0)
+            goto error;
+        if (sb.st_size <= cur)
+            goto restore;
+        data = sb.st_size;
+    }
+
+    if (data > cur) {
+        *inData = false;
+        *len = data - cur;
+    } else {
+        if ((hole = lseek(fd, cur, SEEK_HOLE)) < 0)
+            goto error;
+        *len = hole - cur;
+    }
+
+restore:
+    if (lseek(fd, cur, SEEK_SET) < 0)
+        goto error;
+    return 0;
+
+whole:
+#endif
+    if (fstat(fd, &sb) < 0)
+        goto error;
+    if (S_ISREG(sb.st_mode) && sb.st_size > cur)
+        *len = sb.st_size - cur;
+    else if (!S_ISREG(sb.st_mode))
+        *len = ULLONG_MAX;
+    return 0;
+
+error:
+    virReportSystemError(errno, "%s",
+                         _("unable to find holes in file"));
+    return -1;
+}
+
+
+/**
+ * virFileWriteHole:
+ * @fd: file to write to
+ * @len: size of the hole
+ *
+ * Leave @len bytes from the current position of @fd reading back as
+ * zeros without writing them out: past the end of the file this is
+ * just a truncate, within it the range is deallocated if the file
+ * system can do that and written out with zeros otherwise. The file
+ * position ends up past the hole.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int virFileWriteHole(int fd, unsigned long long len)
+{
+    off_t cur;
+    off_t end;
+    struct stat sb;
+    char *zeros = NULL;
+    int ret = -1;
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0 ||
+        fstat(fd, &sb) < 0)
+        goto error;
+    end = cur + len;
+
+    if (S_ISREG(sb.st_mode) && cur >= sb.st_size) {
+        if (ftruncate(fd, end) < 0)
+            goto error;
+    } else {
+        unsigned long long left = len;
+
+        if (S_ISREG(sb.st_mode) && end > sb.st_size) {
+            if (ftruncate(fd, end) < 0)
+                goto error;
+            left = sb.st_size - cur;
+        }
+
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+        if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      cur, left) == 0)
+            left = 0;
+#endif
+
+        if (left) {
+            size_t zlen = 1024 * 1024;
+
+            if (left < zlen)
+                zlen = left;
+            if (VIR_ALLOC_N(zeros, zlen) < 0) {
+                virReportOOMError();
+                return -1;
+            }
+            while (left) {
+                size_t n = left < zlen ? left : zlen;
+                if (safewrite(fd, zeros, n) != n)
+                    goto error;
+                left -= n;
+            }
+        }
+    }
+
+    if (lseek(fd, end, SEEK_SET) < 0)
+        goto error;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(zeros);
+    return ret;
+
+error:
+    virReportSystemError(errno, "%s",
+                         _("unable to write hole to file"));
+    goto cleanup;
+}
+
+
+/**
+ * virFileSparseHeaderEncode:
+ * @buf: VIR_FILE_SPARSE_HEADER_LEN bytes to fill in
+ * @type: VIR_FILE_SPARSE_DATA or VIR_FILE_SPARSE_HOLE
+ * @len: length of the section
+ *
+ * Encode the header of a record of sparse data sent through a pipe.
+ */
+void virFileSparseHeaderEncode(char *buf, int type, unsigned long long len)
+{
+    int i;
+
+    buf[0] = (type >> 24) & 0xff;
+    buf[1] = (type >> 16) & 0xff;
+    buf[2] = (type >> 8) & 0xff;
+    buf[3] = type & 0xff;
+    for (i = 0 ; i < 8 ; i++)
+        buf[4 + i] = (len >> (56 - i * 8)) & 0xff;
+}
+
+
+/**
+ * virFileSparseHeaderDecode:
+ * @buf: VIR_FILE_SPARSE_HEADER_LEN bytes to decode
+ * @type: set to the type of the record
+ * @len: set to the length of the section
+ *
+ * Returns 0 on success, -1 if @buf is not a valid record header
+ */
+int virFileSparseHeaderDecode(const char *buf, int *type,
+                              unsigned long long *len)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    int i;
+
+    *type = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    *len = 0;
+    for (i = 0 ; i < 8 ; i++)
+        *len = (*len << 8) | p[4 + i];
+
+    if ((*type != VIR_FILE_SPARSE_DATA &&
+         *type != VIR_FILE_SPARSE_HOLE) ||
+        *len > LLONG_MAX) {
+        virFileError(VIR_ERR_INTERNAL_ERROR, "%s",
+                     _("malformed sparse data record"));
+        return -1;
+    }
+
+    return 0;
+}
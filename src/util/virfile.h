@@ -76,4 +76,24 @@ int virFileRewrite(const char *path,
 
 int virFileTouch(const char *path, mode_t mode);
 
+int virFileInData(int fd, bool *inData, unsigned long long *len)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+int virFileWriteHole(int fd, unsigned long long len);
+
+/* A pipe cannot carry holes, so sparse data is sent through one as
+ * records: a header giving the type and length of a section, then
+ * that many bytes for data, or nothing for a hole.  */
+enum {
+    VIR_FILE_SPARSE_DATA = 1,
+    VIR_FILE_SPARSE_HOLE = 2,
+};
+
+# define VIR_FILE_SPARSE_HEADER_LEN 12
+
+void virFileSparseHeaderEncode(char *buf, int type, unsigned long long len)
+    ATTRIBUTE_NONNULL(1);
+int virFileSparseHeaderDecode(const char *buf, int *type,
+                              unsigned long long *len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3);
+
 #endif /* __VIR_FILES_H */
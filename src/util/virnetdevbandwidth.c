@@ -28,7 +28,24 @@
 #include "virterror_internal.h"
 #include "ignore-value.h"
 
-#define VIR_FROM_THIS VIR_FROM_NONE
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include <stdio.h>
+# include <linux/if_ether.h>
+# include <linux/pkt_sched.h>
+# include <linux/pkt_cls.h>
+
+# include "virnetlink.h"
+# include "virnetdev.h"
+# include "virfile.h"
+# include "threads.h"
+# include "logging.h"
+#endif
+
+#define VIR_FROM_THIS VIR_FROM_NET
+
+#define virNetDevBandwidthError(code, ...)                              \
+        virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,             \
+                             __FUNCTION__, __LINE__, __VA_ARGS__)
 
 void
 virNetDevBandwidthFree(virNetDevBandwidthPtr def)
@@ -42,6 +59,522 @@ virNetDevBandwidthFree(virNetDevBandwidthPtr def)
 }
 
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+/*
+ * After any previous setting is cleared, traffic control is set up
+ * with rtnetlink messages equivalent to
+ *
+ *   tc qdisc add dev IFNAME root handle 1: htb default 1
+ *   tc class add dev IFNAME parent 1: classid 1:1 htb rate AVERAGE \
+ *      [ceil PEAK] [burst BURST]
+ *   tc filter add dev IFNAME parent 1:0 protocol ip prio 1 handle 1 \
+ *      fw flowid 1
+ *
+ * for incoming traffic and
+ *
+ *   tc qdisc add dev IFNAME ingress
+ *   tc filter add dev IFNAME parent ffff: protocol ip prio 1 \
+ *      handle 800::800 u32 match ip src 0.0.0.0/0 police rate AVERAGE \
+ *      burst BURST mtu BURST drop flowid :1
+ *
+ * for outgoing traffic, the same as the tc based implementation does.
+ */
+
+# define VIR_NETDEV_BANDWIDTH_HTB_HANDLE    0x10000     /* 1: */
+# define VIR_NETDEV_BANDWIDTH_HTB_CLASS     0x10001     /* 1:1 */
+# define VIR_NETDEV_BANDWIDTH_INGRESS       0xffff0000  /* ffff: */
+# define VIR_NETDEV_BANDWIDTH_U32_HANDLE    0x80000800  /* 800::800 */
+# define VIR_NETDEV_BANDWIDTH_FLOWID        1           /* :1 */
+# define VIR_NETDEV_BANDWIDTH_PRIO          1
+# define VIR_NETDEV_BANDWIDTH_MTU           1600
+# define VIR_NETDEV_BANDWIDTH_RTAB_SIZE     256
+
+# define TIME_UNITS_PER_SEC 1000000
+
+static virOnceControl virNetDevBandwidthOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static double virNetDevBandwidthTickInUsec = 1;
+static unsigned int virNetDevBandwidthHz = 100;
+
+/*
+ * Read the scheduler clock parameters of the kernel which are needed to
+ * express times in the units the packet schedulers use.
+ */
+static void
+virNetDevBandwidthOnceInit(void)
+{
+    FILE *fp;
+    unsigned int t2us, us2t, clockRes, hz;
+    int n;
+
+    if (!(fp = fopen("/proc/net/psched", "r"))) {
+        VIR_WARN("Unable to open /proc/net/psched: %s", strerror(errno));
+        return;
+    }
+
+    n = fscanf(fp, "%08x%08x%08x%08x", &t2us, &us2t, &clockRes, &hz);
+    VIR_FORCE_FCLOSE(fp);
+
+    if (n < 3 || us2t == 0) {
+        VIR_WARN("Unable to parse /proc/net/psched");
+        return;
+    }
+
+    /* the kernel advertises a tick multiplier of 1000 in case of
+     * nanosecond resolution, which really is 1 */
+    if (clockRes == 1000000000)
+        t2us = us2t;
+
+    virNetDevBandwidthTickInUsec = (double)t2us / us2t *
+                                   ((double)clockRes / TIME_UNITS_PER_SEC);
+    if (n == 4 && clockRes == 1000000)
+        virNetDevBandwidthHz = hz;
+}
+
+
+/* Time to transmit @size bytes at @rate bytes/s in scheduler ticks,
+ * saturated at what the kernel can be told */
+static uint32_t
+virNetDevBandwidthXmitTime(uint32_t rate, unsigned int size)
+{
+    double ticks = TIME_UNITS_PER_SEC * ((double)size / rate) *
+                   virNetDevBandwidthTickInUsec;
+
+    if (ticks >= UINT32_MAX)
+        return UINT32_MAX;
+    return ticks;
+}
+
+
+static void
+virNetDevBandwidthRateTable(struct tc_ratespec *r,
+                            uint32_t *rtab,
+                            unsigned int mtu)
+{
+    int cellLog = 0;
+    size_t i;
+
+    while ((mtu >> cellLog) > 255)
+        cellLog++;
+
+    for (i = 0; i < VIR_NETDEV_BANDWIDTH_RTAB_SIZE; i++)
+        rtab[i] = virNetDevBandwidthXmitTime(r->rate, (i + 1) << cellLog);
+
+    r->cell_align = -1;
+    r->cell_log = cellLog;
+}
+
+
+/* Convert a rate in kbytes/s to the bytes/s the kernel expects */
+static int
+virNetDevBandwidthToRate(const char *ifname,
+                         unsigned long long kbps,
+                         uint32_t *rate)
+{
+    if (kbps == 0 || kbps > UINT32_MAX / 1000) {
+        virReportSystemError(ERANGE,
+                             _("invalid rate %llu kbytes/s for interface %s"),
+                             kbps, ifname);
+        return -1;
+    }
+    *rate = kbps * 1000;
+    return 0;
+}
+
+
+static struct nl_msg *
+virNetDevBandwidthNewMsg(int type,
+                         int flags,
+                         int ifindex,
+                         uint32_t parent,
+                         uint32_t handle,
+                         uint32_t info,
+                         const char *kind)
+{
+    struct nl_msg *nl_msg;
+    struct tcmsg tcm = {
+        .tcm_family = AF_UNSPEC,
+        .tcm_ifindex = ifindex,
+        .tcm_parent = parent,
+        .tcm_handle = handle,
+        .tcm_info = info,
+    };
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | NLM_F_ACK |
+                                            flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, &tcm, sizeof(tcm), NLMSG_ALIGNTO) < 0 ||
+        (kind && nla_put(nl_msg, TCA_KIND, strlen(kind) + 1, kind) < 0)) {
+        nlmsg_free(nl_msg);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+/**
+ * virNetDevBandwidthCommand:
+ * @nl_msg: the request
+ * @ifname: the interface the request is about
+ * @quiet: whether to report errors the kernel answered with
+ *
+ * Send a traffic control request to the kernel and wait for it to
+ * be acknowledged. @nl_msg is freed.
+ *
+ * Returns 0 on success, the negative errno the kernel rejected the
+ * request with, or -1 on other errors.
+ */
+static int
+virNetDevBandwidthCommand(struct nl_msg *nl_msg,
+                          const char *ifname,
+                          bool quiet)
+{
+    unsigned char *recvbuf = NULL;
+    unsigned int recvbuflen;
+    struct nlmsghdr *resp;
+    struct nlmsgerr *err;
+    int ret = -1;
+
+    if (virNetlinkCommand(nl_msg, &recvbuf, &recvbuflen, 0) < 0)
+        goto cleanup;
+
+    resp = (struct nlmsghdr *)recvbuf;
+    if (recvbuflen < NLMSG_LENGTH(sizeof(*err)) || !recvbuf ||
+        resp->nlmsg_type != NLMSG_ERROR ||
+        resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) {
+        virNetDevBandwidthError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                _("malformed netlink response message"));
+        goto cleanup;
+    }
+
+    err = (struct nlmsgerr *)NLMSG_DATA(resp);
+    if (err->error < 0 && !quiet)
+        virReportSystemError(-err->error,
+                             _("cannot set up traffic control on %s"),
+                             ifname);
+    ret = err->error < 0 ? err->error : 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(recvbuf);
+    return ret;
+}
+
+
+/*
+ * Delete a qdisc of an interface. The kernel refuses to delete its
+ * default qdisc, which @quiet allows for: there is nothing to delete.
+ */
+static int
+virNetDevBandwidthDelQdisc(const char *ifname,
+                           int ifindex,
+                           uint32_t parent,
+                           bool quiet)
+{
+    struct nl_msg *nl_msg;
+    int rc;
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_DELQDISC, 0, ifindex,
+                                            parent, 0, 0, NULL)))
+        return -1;
+
+    if ((rc = virNetDevBandwidthCommand(nl_msg, ifname, true)) == 0)
+        return 0;
+    if (rc == -1)
+        return -1;
+
+    if (quiet && (rc == -ENOENT || rc == -EINVAL))
+        return 0;
+
+    virReportSystemError(-rc,
+                         _("cannot remove traffic control from %s"),
+                         ifname);
+    return -1;
+}
+
+
+/*
+ * Delete the root and ingress qdiscs of an interface, and with them
+ * the classes and filters set up below.
+ */
+static int
+virNetDevBandwidthClearIndex(const char *ifname,
+                             int ifindex,
+                             bool quiet)
+{
+    int ret = 0;
+
+    if (virNetDevBandwidthDelQdisc(ifname, ifindex, TC_H_ROOT, quiet) < 0)
+        ret = -1;
+
+    if (virNetDevBandwidthDelQdisc(ifname, ifindex, TC_H_INGRESS, quiet) < 0)
+        ret = -1;
+
+    return ret;
+}
+
+
+static int
+virNetDevBandwidthSetIn(const char *ifname,
+                        int ifindex,
+                        virNetDevBandwidthRatePtr in)
+{
+    struct nl_msg *nl_msg = NULL;
+    struct nlattr *opts;
+    struct tc_htb_glob glob = {
+        .version = 3,
+        .rate2quantum = 10,
+        .defcls = 1,
+    };
+    struct tc_htb_opt opt;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    uint32_t ctab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    unsigned int buffer, cbuffer;
+    uint32_t classid = VIR_NETDEV_BANDWIDTH_FLOWID;
+
+    memset(&opt, 0, sizeof(opt));
+    if (virNetDevBandwidthToRate(ifname, in->average, &opt.rate.rate) < 0)
+        return -1;
+    if (in->peak) {
+        if (virNetDevBandwidthToRate(ifname, in->peak, &opt.ceil.rate) < 0)
+            return -1;
+    } else {
+        opt.ceil.rate = opt.rate.rate;
+    }
+
+    buffer = in->burst ? in->burst * 1024 :
+        opt.rate.rate / virNetDevBandwidthHz + VIR_NETDEV_BANDWIDTH_MTU;
+    cbuffer = opt.ceil.rate / virNetDevBandwidthHz + VIR_NETDEV_BANDWIDTH_MTU;
+
+    virNetDevBandwidthRateTable(&opt.rate, rtab, VIR_NETDEV_BANDWIDTH_MTU);
+    virNetDevBandwidthRateTable(&opt.ceil, ctab, VIR_NETDEV_BANDWIDTH_MTU);
+    opt.buffer = virNetDevBandwidthXmitTime(opt.rate.rate, buffer);
+    opt.cbuffer = virNetDevBandwidthXmitTime(opt.ceil.rate, cbuffer);
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_NEWQDISC,
+                                            NLM_F_CREATE | NLM_F_REPLACE,
+                                            ifindex, TC_H_ROOT,
+                                            VIR_NETDEV_BANDWIDTH_HTB_HANDLE,
+                                            0, "htb")))
+        return -1;
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_INIT, sizeof(glob), &glob) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    if (virNetDevBandwidthCommand(nl_msg, ifname, false) < 0)
+        return -1;
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_NEWTCLASS,
+                                            NLM_F_CREATE | NLM_F_REPLACE,
+                                            ifindex,
+                                            VIR_NETDEV_BANDWIDTH_HTB_HANDLE,
+                                            VIR_NETDEV_BANDWIDTH_HTB_CLASS,
+                                            0, "htb")))
+        return -1;
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put(nl_msg, TCA_HTB_PARMS, sizeof(opt), &opt) < 0 ||
+        nla_put(nl_msg, TCA_HTB_RTAB, sizeof(rtab), rtab) < 0 ||
+        nla_put(nl_msg, TCA_HTB_CTAB, sizeof(ctab), ctab) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    if (virNetDevBandwidthCommand(nl_msg, ifname, false) < 0)
+        return -1;
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_NEWTFILTER,
+                                            NLM_F_CREATE,
+                                            ifindex,
+                                            VIR_NETDEV_BANDWIDTH_HTB_HANDLE,
+                                            1,
+                                            TC_H_MAKE(VIR_NETDEV_BANDWIDTH_PRIO << 16,
+                                                      htons(ETH_P_IP)),
+                                            "fw")))
+        return -1;
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_FW_CLASSID, classid) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, opts);
+
+    if (virNetDevBandwidthCommand(nl_msg, ifname, false) < 0)
+        return -1;
+
+    return 0;
+
+buffer_too_small:
+    nlmsg_free(nl_msg);
+    virNetDevBandwidthError(VIR_ERR_INTERNAL_ERROR, "%s",
+                            _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+
+static int
+virNetDevBandwidthSetOut(const char *ifname,
+                         int ifindex,
+                         virNetDevBandwidthRatePtr out)
+{
+    struct nl_msg *nl_msg = NULL;
+    struct nlattr *opts, *police;
+    struct tc_police p;
+    uint32_t rtab[VIR_NETDEV_BANDWIDTH_RTAB_SIZE];
+    unsigned int burst;
+    uint32_t classid = VIR_NETDEV_BANDWIDTH_FLOWID;
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key key;
+    } sel;
+
+    memset(&p, 0, sizeof(p));
+    if (virNetDevBandwidthToRate(ifname, out->average, &p.rate.rate) < 0)
+        return -1;
+
+    burst = (out->burst ? out->burst : out->average) * 1024;
+
+    virNetDevBandwidthRateTable(&p.rate, rtab, burst);
+    p.action = TC_POLICE_SHOT;
+    p.burst = virNetDevBandwidthXmitTime(p.rate.rate, burst);
+    p.mtu = burst;
+
+    /* match ip src 0.0.0.0/0 */
+    memset(&sel, 0, sizeof(sel));
+    sel.sel.flags = TC_U32_TERMINAL;
+    sel.sel.nkeys = 1;
+    sel.key.off = 12;
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_NEWQDISC,
+                                            NLM_F_CREATE | NLM_F_REPLACE,
+                                            ifindex, TC_H_INGRESS,
+                                            VIR_NETDEV_BANDWIDTH_INGRESS,
+                                            0, "ingress")))
+        return -1;
+
+    if (virNetDevBandwidthCommand(nl_msg, ifname, false) < 0)
+        return -1;
+
+    if (!(nl_msg = virNetDevBandwidthNewMsg(RTM_NEWTFILTER,
+                                            NLM_F_CREATE,
+                                            ifindex,
+                                            VIR_NETDEV_BANDWIDTH_INGRESS,
+                                            VIR_NETDEV_BANDWIDTH_U32_HANDLE,
+                                            TC_H_MAKE(VIR_NETDEV_BANDWIDTH_PRIO << 16,
+                                                      htons(ETH_P_IP)),
+                                            "u32")))
+        return -1;
+    if (!(opts = nla_nest_start(nl_msg, TCA_OPTIONS)) ||
+        nla_put_u32(nl_msg, TCA_U32_CLASSID, classid) < 0 ||
+        nla_put(nl_msg, TCA_U32_SEL, sizeof(sel), &sel) < 0 ||
+        !(police = nla_nest_start(nl_msg, TCA_U32_POLICE)) ||
+        nla_put(nl_msg, TCA_POLICE_TBF, sizeof(p), &p) < 0 ||
+        nla_put(nl_msg, TCA_POLICE_RATE, sizeof(rtab), rtab) < 0)
+        goto buffer_too_small;
+    nla_nest_end(nl_msg, police);
+    nla_nest_end(nl_msg, opts);
+
+    if (virNetDevBandwidthCommand(nl_msg, ifname, false) < 0)
+        return -1;
+
+    return 0;
+
+buffer_too_small:
+    nlmsg_free(nl_msg);
+    virNetDevBandwidthError(VIR_ERR_INTERNAL_ERROR, "%s",
+                            _("allocated netlink buffer is too small"));
+    return -1;
+}
+
+
+/**
+ * virNetDevBandwidthSet:
+ * @ifname: on which interface
+ * @bandwidth: rates to set (may be NULL)
+ *
+ * This function enables QoS on specified interface
+ * and set given traffic limits for both, incoming
+ * and outgoing traffic. Any previous setting get
+ * overwritten: the qdiscs and classes are replaced
+ * in place, so traffic is never left unlimited in
+ * between. On failure no limits are left behind.
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthSet(const char *ifname,
+                      virNetDevBandwidthPtr bandwidth)
+{
+    virErrorPtr orig_err;
+    int ifindex;
+
+    if (!bandwidth) {
+        /* nothing to be enabled */
+        return 0;
+    }
+
+    if (virOnce(&virNetDevBandwidthOnce, virNetDevBandwidthOnceInit) < 0) {
+        virNetDevBandwidthError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                _("unable to initialize traffic control"));
+        return -1;
+    }
+
+    if (virNetDevGetIndex(ifname, &ifindex) < 0)
+        return -1;
+
+    if (bandwidth->in) {
+        if (virNetDevBandwidthSetIn(ifname, ifindex, bandwidth->in) < 0)
+            goto error;
+    } else if (virNetDevBandwidthDelQdisc(ifname, ifindex,
+                                          TC_H_ROOT, true) < 0) {
+        goto error;
+    }
+
+    if (bandwidth->out) {
+        if (virNetDevBandwidthSetOut(ifname, ifindex, bandwidth->out) < 0)
+            goto error;
+    } else if (virNetDevBandwidthDelQdisc(ifname, ifindex,
+                                          TC_H_INGRESS, true) < 0) {
+        goto error;
+    }
+
+    return 0;
+
+error:
+    /* do not leave half of the limits behind */
+    orig_err = virSaveLastError();
+    if (virNetDevBandwidthClearIndex(ifname, ifindex, true) < 0)
+        VIR_WARN("Unable to remove traffic control from %s", ifname);
+    virSetError(orig_err);
+    virFreeError(orig_err);
+    return -1;
+}
+
+/**
+ * virNetDevBandwidthClear:
+ * @ifname: on which interface
+ *
+ * This function tries to disable QoS on specified interface
+ * by deleting root and ingress qdisc. However, this may fail
+ * if we try to remove the default one.
+ *
+ * Return 0 on success, -1 otherwise.
+ */
+int
+virNetDevBandwidthClear(const char *ifname)
+{
+    int ifindex;
+
+    if (virNetDevGetIndex(ifname, &ifindex) < 0)
+        return -1;
+
+    return virNetDevBandwidthClearIndex(ifname, ifindex, false);
+}
+
+#else /* !(__linux__ && HAVE_LIBNL) */
+
 /**
  * virNetDevBandwidthSet:
  * @ifname: on which interface
@@ -187,6 +720,8 @@ virNetDevBandwidthClear(const char *ifname)
     return ret;
 }
 
+#endif /* !(__linux__ && HAVE_LIBNL) */
+
 /*
  * virNetDevBandwidthCopy:
  * @dest: destination
@@ -23,6 +23,8 @@
 #include <config.h>
 
 #include "virnetdevbridge.h"
+#include "virnetdev.h"
+#include "virmacaddr.h"
 #include "virterror_internal.h"
 #include "util.h"
 #include "virfile.h"
@@ -41,9 +43,17 @@
 # define JIFFIES_TO_MS(j) (((j)*1000)/HZ)
 # define MS_TO_JIFFIES(ms) (((ms)*HZ)/1000)
 #endif
+#if defined(__linux__) && defined(HAVE_LIBNL)
+# include "virnetlink.h"
+# include "logging.h"
+#endif
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+#define virNetDevBridgeError(code, ...)                                 \
+    virReportErrorHelper(VIR_FROM_NET, code, __FILE__,                  \
+                         __FUNCTION__, __LINE__, __VA_ARGS__)
+
 
 #if defined(HAVE_NET_IF_H) && defined(SIOCBRADDBR)
 static int virNetDevSetupControlFull(const char *ifname,
@@ -202,16 +212,8 @@ cleanup:
 #endif /* __linux__ */
 
 
-/**
- * virNetDevBridgeCreate:
- * @brname: the bridge name
- *
- * This function register a new bridge
- *
- * Returns 0 in case of success or -1 on failure
- */
 #ifdef SIOCBRADDBR
-int virNetDevBridgeCreate(const char *brname)
+static int virNetDevBridgeCreateIoctl(const char *brname)
 {
     int fd = -1;
     int ret = -1;
@@ -232,7 +234,7 @@ cleanup:
     return ret;
 }
 #else
-int virNetDevBridgeCreate(const char *brname)
+static int virNetDevBridgeCreateIoctl(const char *brname)
 {
     virReportSystemError(ENOSYS,
                          _("Unable to create bridge %s"), brname);
@@ -240,16 +242,8 @@ int virNetDevBridgeCreate(const char *brname)
 }
 #endif
 
-/**
- * virNetDevBridgeDelete:
- * @brname: the bridge name
- *
- * Remove a bridge from the layer.
- *
- * Returns 0 in case of success or an errno code in case of failure.
- */
 #ifdef SIOCBRDELBR
-int virNetDevBridgeDelete(const char *brname)
+static int virNetDevBridgeDeleteIoctl(const char *brname)
 {
     int fd = -1;
     int ret = -1;
@@ -270,7 +264,7 @@ cleanup:
     return ret;
 }
 #else
-int virNetDevBridgeDelete(const char *brname ATTRIBUTE_UNUSED)
+static int virNetDevBridgeDeleteIoctl(const char *brname ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENOSYS,
                          _("Unable to delete bridge %s"), brname);
@@ -278,18 +272,9 @@ int virNetDevBridgeDelete(const char *brname ATTRIBUTE_UNUSED)
 }
 #endif
 
-/**
- * virNetDevBridgeAddPort:
- * @brname: the bridge name
- * @ifname: the network interface name
- *
- * Adds an interface to a bridge
- *
- * Returns 0 in case of success or an errno code in case of failure.
- */
 #ifdef SIOCBRADDIF
-int virNetDevBridgeAddPort(const char *brname,
-                           const char *ifname)
+static int virNetDevBridgeAddPortIoctl(const char *brname,
+                                       const char *ifname)
 {
     int fd = -1;
     int ret = -1;
@@ -316,8 +301,8 @@ cleanup:
     return ret;
 }
 #else
-int virNetDevBridgeAddPort(const char *brname,
-                           const char *ifname)
+static int virNetDevBridgeAddPortIoctl(const char *brname,
+                                       const char *ifname)
 {
     virReportSystemError(ENOSYS,
                          _("Unable to add bridge %s port %s"), brname, ifname);
@@ -325,18 +310,9 @@ int virNetDevBridgeAddPort(const char *brname,
 }
 #endif
 
-/**
- * virNetDevBridgeRemovePort:
- * @brname: the bridge name
- * @ifname: the network interface name
- *
- * Removes an interface from a bridge
- *
- * Returns 0 in case of success or an errno code in case of failure.
- */
 #ifdef SIOCBRDELIF
-int virNetDevBridgeRemovePort(const char *brname,
-                              const char *ifname)
+static int virNetDevBridgeRemovePortIoctl(const char *brname,
+                                          const char *ifname)
 {
     int fd = -1;
     int ret = -1;
@@ -364,8 +340,8 @@ cleanup:
     return ret;
 }
 #else
-int virNetDevBridgeRemovePort(const char *brname,
-                              const char *ifname)
+static int virNetDevBridgeRemovePortIoctl(const char *brname,
+                                          const char *ifname)
 {
     virReportSystemError(ENOSYS,
                          _("Unable to remove bridge %s port %s"), brname, ifname);
@@ -374,6 +350,500 @@ int virNetDevBridgeRemovePort(const char *brname,
 #endif
 
 
+#if defined(__linux__) && defined(HAVE_LIBNL)
+/*
+ * Whether RTM_SETLINK honours IFLA_MASTER: -1 until probed, 0 if the
+ * kernel silently ignored it (as the ones before 2.6.38 do), 1 if it
+ * worked. Probed by reading back the master of the first interface
+ * that is added to or removed from a bridge.
+ */
+static int virNetDevBridgeSetMasterWorks = -1;
+
+
+/**
+ * virNetDevBridgeLinkCommand:
+ * @nl_msg: the request, freed on return
+ *
+ * Send a link request to the kernel and return the error it was
+ * acknowledged with: 0 on success, the negative errno the kernel
+ * rejected the request with, or -1 if no valid answer was received
+ * (in which case an error is reported).
+ */
+static int
+virNetDevBridgeLinkCommand(struct nl_msg *nl_msg)
+{
+    unsigned char *recvbuf = NULL;
+    unsigned int recvbuflen;
+    struct nlmsghdr *resp;
+    struct nlmsgerr *err;
+    int ret = -1;
+
+    if (virNetlinkCommand(nl_msg, &recvbuf, &recvbuflen, 0) < 0)
+        goto cleanup;
+
+    if (recvbuflen < NLMSG_LENGTH(0) || recvbuf == NULL)
+        goto malformed_resp;
+
+    resp = (struct nlmsghdr *)recvbuf;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+        ret = err->error;
+        break;
+
+    case NLMSG_DONE:
+        ret = 0;
+        break;
+
+    default:
+        goto malformed_resp;
+    }
+
+cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(recvbuf);
+    return ret;
+
+malformed_resp:
+    virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                         _("malformed netlink response message"));
+    ret = -1;
+    goto cleanup;
+}
+
+
+static struct nl_msg *
+virNetDevBridgeNewLinkMsg(int type,
+                          int flags,
+                          struct ifinfomsg *ifinfo,
+                          const char *ifname)
+{
+    struct nl_msg *nl_msg;
+
+    if (!(nl_msg = nlmsg_alloc_simple(type, NLM_F_REQUEST | flags))) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (nlmsg_append(nl_msg, ifinfo, sizeof(*ifinfo), NLMSG_ALIGNTO) < 0 ||
+        nla_put(nl_msg, IFLA_IFNAME, strlen(ifname) + 1, ifname) < 0) {
+        nlmsg_free(nl_msg);
+        virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                             _("allocated netlink buffer is too small"));
+        return NULL;
+    }
+
+    return nl_msg;
+}
+
+
+/*
+ * Look up the index, MTU and master (0 if none) of @ifname with a single
+ * RTM_GETLINK.
+ */
+static int
+virNetDevBridgeGetLink(const char *ifname,
+                       int *ifindex,
+                       int *mtu,
+                       int *master)
+{
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nlattr *tb[IFLA_MAX + 1];
+    unsigned char *recvbuf = NULL;
+    unsigned int recvbuflen;
+    struct nlmsghdr *resp;
+    struct nlmsgerr *err;
+    struct nl_msg *nl_msg;
+    int ret = -1;
+
+    if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_GETLINK, 0,
+                                             &ifinfo, ifname)))
+        return -1;
+
+    if (virNetlinkCommand(nl_msg, &recvbuf, &recvbuflen, 0) < 0)
+        goto cleanup;
+
+    if (recvbuflen < NLMSG_LENGTH(0) || recvbuf == NULL)
+        goto malformed_resp;
+
+    resp = (struct nlmsghdr *)recvbuf;
+
+    switch (resp->nlmsg_type) {
+    case NLMSG_ERROR:
+        err = (struct nlmsgerr *)NLMSG_DATA(resp);
+        if (resp->nlmsg_len < NLMSG_LENGTH(sizeof(*err)))
+            goto malformed_resp;
+        virReportSystemError(-err->error,
+                             _("Unable to get index of interface %s"),
+                             ifname);
+        goto cleanup;
+
+    case RTM_NEWLINK:
+        if (nlmsg_parse(resp, sizeof(struct ifinfomsg),
+                        tb, IFLA_MAX, NULL) < 0 ||
+            !tb[IFLA_MTU])
+            goto malformed_resp;
+        *ifindex = ((struct ifinfomsg *)NLMSG_DATA(resp))->ifi_index;
+        *mtu = *(uint32_t *)nla_data(tb[IFLA_MTU]);
+        *master = tb[IFLA_MASTER] ? *(uint32_t *)nla_data(tb[IFLA_MASTER]) : 0;
+        break;
+
+    default:
+        goto malformed_resp;
+    }
+
+    ret = 0;
+
+cleanup:
+    nlmsg_free(nl_msg);
+    VIR_FREE(recvbuf);
+    return ret;
+
+malformed_resp:
+    virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                         _("malformed netlink response message"));
+    goto cleanup;
+}
+
+
+/**
+ * virNetDevBridgeSetMaster:
+ * @nl_msg: RTM_SETLINK request for @ifname setting IFLA_MASTER, freed
+ * @brname: the bridge name
+ * @ifname: the network interface name
+ * @brindex: index of @brname, or 0 to release @ifname from it
+ *
+ * Send a request enslaving @ifname to the bridge or releasing it.
+ *
+ * Returns 0 on success, 1 if the kernel does not support the request
+ * and the ioctl needs to be used instead, or -1 on error.
+ */
+static int
+virNetDevBridgeSetMaster(struct nl_msg *nl_msg,
+                         const char *brname,
+                         const char *ifname,
+                         int brindex)
+{
+    int rc, ifindex, mtu, master;
+
+    if (virNetDevBridgeSetMasterWorks == 0) {
+        nlmsg_free(nl_msg);
+        return 1;
+    }
+
+    if ((rc = virNetDevBridgeLinkCommand(nl_msg)) == -1)
+        return -1;
+
+    if (rc == -EOPNOTSUPP || rc == -EINVAL) {
+        VIR_DEBUG("Kernel rejected IFLA_MASTER for %s: %d", ifname, rc);
+        return 1;
+    }
+
+    if (rc < 0) {
+        if (brindex)
+            virReportSystemError(-rc,
+                                 _("Unable to add bridge %s port %s"),
+                                 brname, ifname);
+        else
+            virReportSystemError(-rc,
+                                 _("Unable to remove bridge %s port %s"),
+                                 brname, ifname);
+        return -1;
+    }
+
+    if (virNetDevBridgeSetMasterWorks < 0) {
+        if (virNetDevBridgeGetLink(ifname, &ifindex, &mtu, &master) < 0)
+            return -1;
+        virNetDevBridgeSetMasterWorks = master == brindex;
+        if (!virNetDevBridgeSetMasterWorks) {
+            VIR_DEBUG("Kernel ignored IFLA_MASTER for %s", ifname);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Bring @ifname online or offline with a RTM_SETLINK request.
+ */
+static int
+virNetDevBridgeSetOnline(const char *ifname,
+                         bool up)
+{
+    struct ifinfomsg ifinfo = {
+        .ifi_family = AF_UNSPEC,
+        .ifi_flags = up ? IFF_UP : 0,
+        .ifi_change = IFF_UP,
+    };
+    struct nl_msg *nl_msg;
+    int rc;
+
+    if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_SETLINK, 0,
+                                             &ifinfo, ifname)))
+        return -1;
+
+    if ((rc = virNetDevBridgeLinkCommand(nl_msg)) < 0) {
+        if (rc != -1)
+            virReportSystemError(-rc,
+                                 _("Cannot set interface flags on '%s'"),
+                                 ifname);
+        return -1;
+    }
+
+    return 0;
+}
+#endif /* __linux__ && HAVE_LIBNL */
+
+
+/**
+ * virNetDevBridgeCreate:
+ * @brname: the bridge name
+ *
+ * This function register a new bridge
+ *
+ * Returns 0 in case of success or -1 on failure
+ */
+int virNetDevBridgeCreate(const char *brname)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    struct nlattr *linkinfo;
+    int rc;
+
+    if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_NEWLINK,
+                                             NLM_F_CREATE | NLM_F_EXCL,
+                                             &ifinfo, brname)))
+        return -1;
+
+    if (!(linkinfo = nla_nest_start(nl_msg, IFLA_LINKINFO)) ||
+        nla_put(nl_msg, IFLA_INFO_KIND, strlen("bridge"), "bridge") < 0) {
+        nlmsg_free(nl_msg);
+        virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                             _("allocated netlink buffer is too small"));
+        return -1;
+    }
+    nla_nest_end(nl_msg, linkinfo);
+
+    if ((rc = virNetDevBridgeLinkCommand(nl_msg)) == -1)
+        return -1;
+
+    /* kernels without rtnetlink support for bridges need the ioctl */
+    if (rc != -EOPNOTSUPP) {
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to create bridge %s"), brname);
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+    return virNetDevBridgeCreateIoctl(brname);
+}
+
+/**
+ * virNetDevBridgeDelete:
+ * @brname: the bridge name
+ *
+ * Remove a bridge from the layer.
+ *
+ * Returns 0 in case of success or an errno code in case of failure.
+ */
+int virNetDevBridgeDelete(const char *brname)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int rc;
+
+    if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_DELLINK, 0,
+                                             &ifinfo, brname)))
+        return -1;
+
+    if ((rc = virNetDevBridgeLinkCommand(nl_msg)) == -1)
+        return -1;
+
+    if (rc != -EOPNOTSUPP) {
+        if (rc < 0) {
+            virReportSystemError(-rc,
+                                 _("Unable to delete bridge %s"), brname);
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+    return virNetDevBridgeDeleteIoctl(brname);
+}
+
+/**
+ * virNetDevBridgeAddPort:
+ * @brname: the bridge name
+ * @ifname: the network interface name
+ *
+ * Adds an interface to a bridge
+ *
+ * Returns 0 in case of success or an errno code in case of failure.
+ */
+int virNetDevBridgeAddPort(const char *brname,
+                           const char *ifname)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int brindex, mtu, master, rc;
+
+    if (virNetDevBridgeSetMasterWorks != 0) {
+        if (virNetDevBridgeGetLink(brname, &brindex, &mtu, &master) < 0)
+            return -1;
+
+        if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_SETLINK, 0,
+                                                 &ifinfo, ifname)))
+            return -1;
+
+        if (nla_put_u32(nl_msg, IFLA_MASTER, brindex) < 0) {
+            nlmsg_free(nl_msg);
+            virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                 _("allocated netlink buffer is too small"));
+            return -1;
+        }
+
+        if ((rc = virNetDevBridgeSetMaster(nl_msg, brname,
+                                           ifname, brindex)) <= 0)
+            return rc;
+    }
+#endif
+
+    return virNetDevBridgeAddPortIoctl(brname, ifname);
+}
+
+/**
+ * virNetDevBridgeRemovePort:
+ * @brname: the bridge name
+ * @ifname: the network interface name
+ *
+ * Removes an interface from a bridge
+ *
+ * Returns 0 in case of success or an errno code in case of failure.
+ */
+int virNetDevBridgeRemovePort(const char *brname,
+                              const char *ifname)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int brindex, ifindex, mtu, master, rc;
+
+    if (virNetDevBridgeSetMasterWorks != 0) {
+        if (virNetDevBridgeGetLink(brname, &brindex, &mtu, &master) < 0 ||
+            virNetDevBridgeGetLink(ifname, &ifindex, &mtu, &master) < 0)
+            return -1;
+
+        /* the ioctl only removes ports of the given bridge, too */
+        if (master != brindex) {
+            virReportSystemError(EINVAL,
+                                 _("Unable to remove bridge %s port %s"),
+                                 brname, ifname);
+            return -1;
+        }
+
+        if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_SETLINK, 0,
+                                                 &ifinfo, ifname)))
+            return -1;
+
+        if (nla_put_u32(nl_msg, IFLA_MASTER, 0) < 0) {
+            nlmsg_free(nl_msg);
+            virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                 _("allocated netlink buffer is too small"));
+            return -1;
+        }
+
+        if ((rc = virNetDevBridgeSetMaster(nl_msg, brname,
+                                           ifname, 0)) <= 0)
+            return rc;
+    }
+#endif
+
+    return virNetDevBridgeRemovePortIoctl(brname, ifname);
+}
+
+
+/**
+ * virNetDevBridgeSetupPort:
+ * @brname: the bridge name
+ * @ifname: the network interface name
+ * @macaddr: the MAC address to give @ifname (VIR_MAC_BUFLEN long)
+ * @up: whether @ifname should be brought online
+ *
+ * Sets the MAC address of @ifname and its MTU to the one of the bridge,
+ * adds it to the bridge and brings it online (or offline). The MAC
+ * address and MTU are set before the interface is enslaved, so the
+ * bridge neither picks up a random MAC address nor changes its own MTU.
+ *
+ * Where possible the interface is set up and enslaved with one netlink
+ * request, and brought online with a second one once it is a port.
+ *
+ * Returns 0 in case of success or -1 on failure
+ */
+int virNetDevBridgeSetupPort(const char *brname,
+                             const char *ifname,
+                             const unsigned char *macaddr,
+                             bool up)
+{
+#if defined(__linux__) && defined(HAVE_LIBNL)
+    struct ifinfomsg ifinfo = { .ifi_family = AF_UNSPEC };
+    struct nl_msg *nl_msg;
+    int brindex, mtu, master, rc;
+
+    if (virNetDevBridgeSetMasterWorks != 0) {
+        if (virNetDevBridgeGetLink(brname, &brindex, &mtu, &master) < 0)
+            return -1;
+
+        if (!(nl_msg = virNetDevBridgeNewLinkMsg(RTM_SETLINK, 0,
+                                                 &ifinfo, ifname)))
+            return -1;
+
+        /* The kernel applies the address and MTU before the master */
+        if (nla_put(nl_msg, IFLA_ADDRESS, VIR_MAC_BUFLEN, macaddr) < 0 ||
+            nla_put_u32(nl_msg, IFLA_MTU, mtu) < 0 ||
+            nla_put_u32(nl_msg, IFLA_MASTER, brindex) < 0) {
+            nlmsg_free(nl_msg);
+            virNetDevBridgeError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                 _("allocated netlink buffer is too small"));
+            return -1;
+        }
+
+        if ((rc = virNetDevBridgeSetMaster(nl_msg, brname,
+                                           ifname, brindex)) < 0)
+            return -1;
+
+        if (rc == 0)
+            return virNetDevBridgeSetOnline(ifname, up);
+    }
+#endif
+
+    if (virNetDevSetMAC(ifname, macaddr) < 0)
+        return -1;
+
+    if (virNetDevSetMTUFromDevice(ifname, brname) < 0)
+        return -1;
+
+    if (virNetDevBridgeAddPort(brname, ifname) < 0)
+        return -1;
+
+    if (virNetDevSetOnline(ifname, up) < 0)
+        return -1;
+
+    return 0;
+}
+
+
 #ifdef __linux__
 /**
  * virNetDevBridgeSetSTPDelay:
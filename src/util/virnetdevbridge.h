@@ -38,6 +38,13 @@ int virNetDevBridgeRemovePort(const char *brname,
                               const char *ifname)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 
+int virNetDevBridgeSetupPort(const char *brname,
+                             const char *ifname,
+                             const unsigned char *macaddr,
+                             bool up)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_RETURN_CHECK;
+
 int virNetDevBridgeSetSTPDelay(const char *brname,
                                int delay)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
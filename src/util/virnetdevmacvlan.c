@@ -53,6 +53,8 @@ VIR_ENUM_IMPL(virNetDevMacVLanMode, VIR_NETDEV_MACVLAN_MODE_LAST,
 # include <fcntl.h>
 # include <sys/socket.h>
 # include <sys/ioctl.h>
+# include <sys/inotify.h>
+# include <poll.h>
 
 # include <linux/if.h>
 # include <linux/if_tun.h>
@@ -68,6 +70,9 @@ VIR_ENUM_IMPL(virNetDevMacVLanMode, VIR_NETDEV_MACVLAN_MODE_LAST,
 # include "virfile.h"
 # include "virnetlink.h"
 # include "virnetdev.h"
+# include "bitmap.h"
+# include "threads.h"
+# include "virtime.h"
 
 # define MACVTAP_NAME_PREFIX	"macvtap"
 # define MACVTAP_NAME_PATTERN	"macvtap%d"
@@ -75,6 +80,117 @@ VIR_ENUM_IMPL(virNetDevMacVLanMode, VIR_NETDEV_MACVLAN_MODE_LAST,
 # define MACVLAN_NAME_PREFIX	"macvlan"
 # define MACVLAN_NAME_PATTERN	"macvlan%d"
 
+# define MACVLAN_MAX_ID 8191
+
+/* How long to wait for udev to create the tap character device */
+# define MACVTAP_TAP_TIMEOUT_MS 1000
+
+/*
+ * Names handed out to macvtap and macvlan devices. A set bit means the
+ * name is, or recently was, in use; names are only ever probed with the
+ * kernel when their bit is clear.
+ */
+static virMutex virNetDevMacVLanLock;
+static virBitmapPtr virNetDevMacVTapIDs;
+static virBitmapPtr virNetDevMacVLanIDs;
+static virOnceControl virNetDevMacVLanOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static bool virNetDevMacVLanInitialized;
+
+static void
+virNetDevMacVLanOnceInit(void)
+{
+    if (virMutexInit(&virNetDevMacVLanLock) < 0)
+        return;
+
+    if (!(virNetDevMacVTapIDs = virBitmapAlloc(MACVLAN_MAX_ID + 1)) ||
+        !(virNetDevMacVLanIDs = virBitmapAlloc(MACVLAN_MAX_ID + 1))) {
+        virBitmapFree(virNetDevMacVTapIDs);
+        virNetDevMacVTapIDs = NULL;
+        return;
+    }
+
+    virNetDevMacVLanInitialized = true;
+}
+
+
+static int
+virNetDevMacVLanInitialize(void)
+{
+    if (virOnce(&virNetDevMacVLanOnce, virNetDevMacVLanOnceInit) < 0 ||
+        !virNetDevMacVLanInitialized) {
+        virReportOOMError();
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * Return the ID of @ifname if it follows the naming pattern for devices
+ * of type @withTap, or -1 otherwise.
+ */
+static int
+virNetDevMacVLanParseID(const char *ifname,
+                        bool withTap)
+{
+    const char *prefix = withTap ? MACVTAP_NAME_PREFIX : MACVLAN_NAME_PREFIX;
+    unsigned int id;
+    char *end;
+
+    if (!STRPREFIX(ifname, prefix) ||
+        virStrToLong_ui(ifname + strlen(prefix), &end, 10, &id) < 0 ||
+        *end || id > MACVLAN_MAX_ID)
+        return -1;
+
+    return id;
+}
+
+
+/*
+ * Reserve the lowest ID that is not in use yet, or -1 if all are.
+ */
+static int
+virNetDevMacVLanReserveID(bool withTap)
+{
+    virBitmapPtr ids = withTap ? virNetDevMacVTapIDs : virNetDevMacVLanIDs;
+    int id = -1;
+    size_t i;
+    bool used;
+
+    virMutexLock(&virNetDevMacVLanLock);
+    for (i = 0; i <= MACVLAN_MAX_ID; i++) {
+        if (virBitmapGetBit(ids, i, &used) == 0 && !used) {
+            ignore_value(virBitmapSetBit(ids, i));
+            id = i;
+            break;
+        }
+    }
+    virMutexUnlock(&virNetDevMacVLanLock);
+
+    return id;
+}
+
+
+static void
+virNetDevMacVLanSetID(const char *ifname,
+                      bool withTap,
+                      bool used)
+{
+    virBitmapPtr ids = withTap ? virNetDevMacVTapIDs : virNetDevMacVLanIDs;
+    int id;
+
+    if (!virNetDevMacVLanInitialized ||
+        (id = virNetDevMacVLanParseID(ifname, withTap)) < 0)
+        return;
+
+    virMutexLock(&virNetDevMacVLanLock);
+    if (used)
+        ignore_value(virBitmapSetBit(ids, id));
+    else
+        ignore_value(virBitmapClearBit(ids, id));
+    virMutexUnlock(&virNetDevMacVLanLock);
+}
+
 /**
  * virNetDevMacVLanCreate:
  *
@@ -304,17 +420,72 @@ buffer_too_small:
 }
 
 
+/**
+ * virNetDevMacVLanTapWait:
+ * @tapname: path of the tap character device
+ * @timeout: how long to wait, in milliseconds
+ *
+ * Wait for udev to create @tapname and open it. Rather than retrying
+ * after fixed delays, watch /dev for the device node to appear.
+ *
+ * Returns the file descriptor, or -1 with errno set.
+ */
+static int
+virNetDevMacVLanTapWait(const char *tapname,
+                        int timeout)
+{
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+    unsigned long long now, deadline;
+    int watchfd;
+    int tapfd = -1;
+    int saved_errno = ENOENT;
+
+    if ((watchfd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) < 0 ||
+        inotify_add_watch(watchfd, "/dev", IN_CREATE) < 0 ||
+        virTimeMillisNow(&now) < 0) {
+        saved_errno = errno;
+        goto cleanup;
+    }
+    deadline = now + timeout;
+
+    /* the node may have appeared before the watch was set up */
+    while ((tapfd = open(tapname, O_RDWR)) < 0 && errno == ENOENT) {
+        struct pollfd fd = { .fd = watchfd, .events = POLLIN };
+
+        if (virTimeMillisNow(&now) < 0 || now >= deadline)
+            goto cleanup;
+
+        if (poll(&fd, 1, deadline - now) < 0) {
+            if (errno == EINTR)
+                continue;
+            saved_errno = errno;
+            goto cleanup;
+        }
+
+        /* drain the events before trying again */
+        while (read(watchfd, buf, sizeof(buf)) > 0)
+            ;
+    }
+    saved_errno = errno;
+
+cleanup:
+    VIR_FORCE_CLOSE(watchfd);
+    errno = saved_errno;
+    return tapfd;
+}
+
+
 /**
  * virNetDevMacVLanTapOpen:
  * Open the macvtap's tap device.
  * @ifname: Name of the macvtap interface
- * @retries : Number of retries in case udev for example may need to be
- *            waited for to create the tap chardev
+ * @timeout: How long to wait in milliseconds in case udev for example
+ *           needs to be waited for to create the tap chardev
  * Returns negative value in case of error, the file descriptor otherwise.
  */
 static
 int virNetDevMacVLanTapOpen(const char *ifname,
-                            int retries)
+                            int timeout)
 {
     FILE *file;
     char path[64];
@@ -357,16 +528,8 @@ int virNetDevMacVLanTapOpen(const char *ifname,
         return -1;
     }
 
-    while (1) {
-        /* may need to wait for udev to be done */
-        tapfd = open(tapname, O_RDWR);
-        if (tapfd < 0 && retries > 0) {
-            retries--;
-            usleep(20000);
-            continue;
-        }
-        break;
-    }
+    if ((tapfd = open(tapname, O_RDWR)) < 0 && errno == ENOENT)
+        tapfd = virNetDevMacVLanTapWait(tapname, timeout);
 
     if (tapfd < 0)
         virReportSystemError(errno,
@@ -482,7 +645,7 @@ int virNetDevMacVLanCreateWithVPortProfile(const char *tgifname,
     const char *pattern = withTap ? MACVTAP_NAME_PATTERN : MACVLAN_NAME_PATTERN;
     int c, rc;
     char ifname[IFNAMSIZ];
-    int retries, do_retry = 0;
+    int do_retry = 0;
     uint32_t macvtapMode;
     const char *cr_ifname;
     int ret;
@@ -491,6 +654,9 @@ int virNetDevMacVLanCreateWithVPortProfile(const char *tgifname,
 
     *res_ifname = NULL;
 
+    if (virNetDevMacVLanInitialize() < 0)
+        return -1;
+
     VIR_DEBUG("%s: VM OPERATION: %s", __FUNCTION__, virNetDevVPortProfileOpTypeToString(vmOp));
 
     /** Note: When using PASSTHROUGH mode with MACVTAP devices the link
@@ -522,21 +688,27 @@ int virNetDevMacVLanCreateWithVPortProfile(const char *tgifname,
                                     macvtapMode, &do_retry);
         if (rc < 0)
             return -1;
+        virNetDevMacVLanSetID(tgifname, withTap, true);
     } else {
 create_name:
-        retries = 5;
-        for (c = 0; c < 8192; c++) {
-            snprintf(ifname, sizeof(ifname), pattern, c);
-            if ((ret = virNetDevExists(ifname)) < 0)
+        /* Names are taken from the in-memory map, so the kernel only
+         * needs to be asked again if a device was created behind our
+         * back, e.g. by a previous instance of the daemon. */
+        while (1) {
+            if ((c = virNetDevMacVLanReserveID(withTap)) < 0) {
+                virReportSystemError(EBUSY, "%s",
+                                     _("No free name for macvlan device"));
                 return -1;
-            if (!ret) {
-                rc = virNetDevMacVLanCreate(ifname, type, macaddress, linkdev,
-                                            macvtapMode, &do_retry);
-                if (rc == 0)
-                    break;
-
-                if (do_retry && --retries)
-                    continue;
+            }
+            snprintf(ifname, sizeof(ifname), pattern, c);
+            rc = virNetDevMacVLanCreate(ifname, type, macaddress, linkdev,
+                                        macvtapMode, &do_retry);
+            if (rc == 0)
+                break;
+
+            /* a name the kernel has stays marked as used */
+            if (!do_retry) {
+                virNetDevMacVLanSetID(ifname, withTap, false);
                 return -1;
             }
         }
@@ -558,7 +730,8 @@ create_name:
     }
 
     if (withTap) {
-        if ((rc = virNetDevMacVLanTapOpen(cr_ifname, 10)) < 0)
+        if ((rc = virNetDevMacVLanTapOpen(cr_ifname,
+                                          MACVTAP_TAP_TIMEOUT_MS)) < 0)
             goto disassociate_exit;
 
         if (virNetDevMacVLanTapSetup(rc, vnet_hdr) < 0) {
@@ -600,7 +773,8 @@ disassociate_exit:
                                                    vmOp));
 
 link_del_exit:
-    ignore_value(virNetDevMacVLanDelete(cr_ifname));
+    if (virNetDevMacVLanDelete(cr_ifname) == 0)
+        virNetDevMacVLanSetID(cr_ifname, withTap, false);
 
     return rc;
 }
@@ -635,8 +809,13 @@ int virNetDevMacVLanDeleteWithVPortProfile(const char *ifname,
                                               linkdev,
                                               VIR_NETDEV_VPORT_PROFILE_OP_DESTROY) < 0)
             ret = -1;
-        if (virNetDevMacVLanDelete(ifname) < 0)
+        if (virNetDevMacVLanDelete(ifname) < 0) {
             ret = -1;
+        } else {
+            /* the device type is evident from the name */
+            virNetDevMacVLanSetID(ifname, true, false);
+            virNetDevMacVLanSetID(ifname, false, false);
+        }
     }
     return ret;
 }
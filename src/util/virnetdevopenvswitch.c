@@ -29,9 +29,26 @@
 #include "virterror_internal.h"
 #include "ignore-value.h"
 #include "virmacaddr.h"
+#include "threads.h"
+#include "virtime.h"
+#include "logging.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
+#define virNetDevOpenvswitchError(code, ...)                            \
+    virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,                 \
+                         __FUNCTION__, __LINE__, __VA_ARGS__)
+
+/* The statistics of all interfaces are fetched at once and reused for
+ * this long, so polling every port costs one ovs-vsctl run */
+#define VIR_NETDEV_OPENVSWITCH_STATS_MAX_AGE_MS 1000
+
+static virOnceControl virNetDevOpenvswitchOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static bool virNetDevOpenvswitchStatsLockReady;
+static virMutex virNetDevOpenvswitchStatsLock;
+static char *virNetDevOpenvswitchStats;
+static unsigned long long virNetDevOpenvswitchStatsTime;
+
 /**
  * virNetDevOpenvswitchAddPort:
  * @brname: the bridge name
@@ -133,3 +150,210 @@ int virNetDevOpenvswitchRemovePort(const char *brname ATTRIBUTE_UNUSED, const ch
         virCommandFree(cmd);
         return ret;
 }
+
+static void
+virNetDevOpenvswitchOnceInit(void)
+{
+    if (virMutexInit(&virNetDevOpenvswitchStatsLock) == 0)
+        virNetDevOpenvswitchStatsLockReady = true;
+}
+
+/* Refetch the statistics of all interfaces unless recent enough; call
+ * with virNetDevOpenvswitchStatsLock held */
+static int
+virNetDevOpenvswitchUpdateStats(void)
+{
+    virCommandPtr cmd = NULL;
+    char *output = NULL;
+    unsigned long long now;
+    int ret = -1;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (virNetDevOpenvswitchStats &&
+        now - virNetDevOpenvswitchStatsTime <
+        VIR_NETDEV_OPENVSWITCH_STATS_MAX_AGE_MS)
+        return 0;
+
+    cmd = virCommandNew(OVSVSCTL);
+    virCommandAddArgList(cmd, "--columns=name,statistics",
+                         "list", "Interface", NULL);
+    virCommandSetOutputBuffer(cmd, &output);
+
+    if (virCommandRun(cmd, NULL) < 0)
+        goto cleanup;
+
+    VIR_FREE(virNetDevOpenvswitchStats);
+    virNetDevOpenvswitchStats = output;
+    output = NULL;
+    virNetDevOpenvswitchStatsTime = now;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(output);
+    virCommandFree(cmd);
+    return ret;
+}
+
+/* The value of a "column : value" line of ovs-vsctl list output */
+static char *
+virNetDevOpenvswitchColumnValue(char *line, const char *column)
+{
+    char *value;
+
+    if (!STRPREFIX(line, column) ||
+        !(value = strchr(line + strlen(column), ':')))
+        return NULL;
+
+    for (line += strlen(column); line < value; line++) {
+        if (*line != ' ')
+            return NULL;
+    }
+
+    return value + 1 + strspn(value + 1, " ");
+}
+
+/**
+ * virNetDevOpenvswitchParseStats:
+ * @output: the output of ovs-vsctl list Interface with name and statistics
+ * @ifname: the port name
+ * @stats: returns the collected interface statistics
+ *
+ * Find the statistics of the Interface @ifname in @output, which lists
+ * its records as lines like
+ *
+ *   name                : vnet0
+ *   statistics          : {collisions=0, rx_bytes=1234, rx_dropped=0, ...}
+ *
+ * separated by blank lines. Counters which are not listed are set to -1.
+ *
+ * Returns 0 in case of success or -1 if there are no statistics for
+ * @ifname.
+ */
+int virNetDevOpenvswitchParseStats(const char *output,
+                                   const char *ifname,
+                                   struct _virDomainInterfaceStats *stats)
+{
+    char *copy = NULL;
+    char *line, *next, *value;
+    char *entry, *saveptr = NULL;
+    bool matched = false;
+    bool found = false;
+    size_t len;
+
+    stats->rx_bytes = stats->rx_packets = -1;
+    stats->rx_errs = stats->rx_drop = -1;
+    stats->tx_bytes = stats->tx_packets = -1;
+    stats->tx_errs = stats->tx_drop = -1;
+
+    if (!(copy = strdup(output))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (line = copy; line && !found; line = next) {
+        if ((next = strchr(line, '\n')))
+            *next++ = '\0';
+
+        if ((value = virNetDevOpenvswitchColumnValue(line, "name"))) {
+            /* names are quoted unless they are plain identifiers */
+            len = strlen(value);
+            if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+                value[len - 1] = '\0';
+                value++;
+            }
+            matched = STREQ(value, ifname);
+            continue;
+        }
+
+        if (!matched ||
+            !(value = virNetDevOpenvswitchColumnValue(line, "statistics")))
+            continue;
+
+        /* The counters see the network from the point of view of the
+         * host, so bytes TRANSMITTED by the port are bytes RECEIVED by
+         * the domain and the TX/RX fields appear to be swapped here.
+         */
+        for (entry = strtok_r(value, "{}, ", &saveptr);
+             entry;
+             entry = strtok_r(NULL, "{}, ", &saveptr)) {
+            char *counter = strchr(entry, '=');
+            long long *field = NULL;
+
+            if (!counter)
+                continue;
+            *counter++ = '\0';
+
+            if (STREQ(entry, "rx_bytes"))
+                field = &stats->tx_bytes;
+            else if (STREQ(entry, "rx_packets"))
+                field = &stats->tx_packets;
+            else if (STREQ(entry, "rx_errors"))
+                field = &stats->tx_errs;
+            else if (STREQ(entry, "rx_dropped"))
+                field = &stats->tx_drop;
+            else if (STREQ(entry, "tx_bytes"))
+                field = &stats->rx_bytes;
+            else if (STREQ(entry, "tx_packets"))
+                field = &stats->rx_packets;
+            else if (STREQ(entry, "tx_errors"))
+                field = &stats->rx_errs;
+            else if (STREQ(entry, "tx_dropped"))
+                field = &stats->rx_drop;
+
+            if (field && virStrToLong_ll(counter, NULL, 10, field) == 0)
+                found = true;
+        }
+    }
+
+    VIR_FREE(copy);
+
+    if (!found) {
+        virNetDevOpenvswitchError(VIR_ERR_INTERNAL_ERROR,
+                                  _("No statistics available for OVS port %s"),
+                                  ifname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * virNetDevOpenvswitchInterfaceStats:
+ * @ifname: the port name
+ * @stats: returns the collected interface statistics
+ *
+ * Fetch the statistics Open vSwitch keeps for the Interface @ifname.
+ * Unlike the kernel counters of the tap device these include the
+ * packets dropped and the errors seen by the datapath. The statistics
+ * of all interfaces are fetched together and may be up to a second
+ * old. Counters which Open vSwitch does not provide are set to -1.
+ *
+ * Returns 0 in case of success or -1 in case of failure.
+ */
+int virNetDevOpenvswitchInterfaceStats(const char *ifname,
+                                       struct _virDomainInterfaceStats *stats)
+{
+    int ret = -1;
+
+    if (virOnce(&virNetDevOpenvswitchOnce, virNetDevOpenvswitchOnceInit) < 0 ||
+        !virNetDevOpenvswitchStatsLockReady) {
+        virNetDevOpenvswitchError(VIR_ERR_INTERNAL_ERROR, "%s",
+                                  _("Unable to initialize OVS statistics"));
+        return -1;
+    }
+
+    virMutexLock(&virNetDevOpenvswitchStatsLock);
+
+    if (virNetDevOpenvswitchUpdateStats() < 0)
+        goto cleanup;
+
+    ret = virNetDevOpenvswitchParseStats(virNetDevOpenvswitchStats,
+                                         ifname, stats);
+
+cleanup:
+    virMutexUnlock(&virNetDevOpenvswitchStatsLock);
+    return ret;
+}
@@ -109,77 +109,106 @@ virNetDevProbeVnetHdr(int tapfd)
  * brCreateTap:
  * @ifname: the interface name
  * @vnet_hr: whether to try enabling IFF_VNET_HDR
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  *
  * Creates a tap interface.
  * If the @tapfd parameter is supplied, the open tap device file
- * descriptor will be returned, otherwise the TAP device will be made
+ * descriptors will be returned, otherwise the TAP device will be made
  * persistent and closed. The caller must use brDeleteTap to remove
  * a persistent TAP devices when it is no longer needed.
+ * If @tapfdSize is greater than one, the tap device is created with
+ * one queue per file descriptor (IFF_MULTI_QUEUE).
  *
  * Returns 0 in case of success or an errno code in case of failure.
  */
 int virNetDevTapCreate(char **ifname,
                        int vnet_hdr ATTRIBUTE_UNUSED,
-                       int *tapfd)
+                       int *tapfd,
+                       int tapfdSize)
 {
-    int fd;
+    int fd = -1;
     struct ifreq ifr;
     int ret = -1;
+    int nfds = tapfd ? tapfdSize : 1;
+    int i;
 
-    if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
-        virReportSystemError(errno, "%s",
-                             _("Unable to open /dev/net/tun, is tun module loaded?"));
-        return -1;
-    }
+    for (i = 0; i < nfds; i++) {
+        if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to open /dev/net/tun, is tun module loaded?"));
+            goto cleanup;
+        }
 
-    memset(&ifr, 0, sizeof(ifr));
+        memset(&ifr, 0, sizeof(ifr));
 
-    ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
+        ifr.ifr_flags = IFF_TAP|IFF_NO_PI;
 
-# ifdef IFF_VNET_HDR
-    if (vnet_hdr && virNetDevProbeVnetHdr(fd))
-        ifr.ifr_flags |= IFF_VNET_HDR;
+        /* all queues of a multiqueue tap are attached by the same name */
+        if (nfds > 1) {
+# ifdef IFF_MULTI_QUEUE
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+# else
+            virReportSystemError(ENOTSUP,
+                                 _("Unable to create multiqueue tap device %s: "
+                                   "not supported on this platform"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
 # endif
+        }
 
-    if (virStrcpyStatic(ifr.ifr_name, *ifname) == NULL) {
-        virReportSystemError(ERANGE,
-                             _("Network interface name '%s' is too long"),
-                             *ifname);
-        goto cleanup;
-
-    }
-
-    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
-        virReportSystemError(errno,
-                             _("Unable to create tap device %s"),
-                             NULLSTR(*ifname));
-        goto cleanup;
-    }
-
-    if (!tapfd &&
-        (errno = ioctl(fd, TUNSETPERSIST, 1))) {
-        virReportSystemError(errno,
-                             _("Unable to set tap device %s to persistent"),
-                             NULLSTR(*ifname));
-        goto cleanup;
-    }
+# ifdef IFF_VNET_HDR
+        if (vnet_hdr && virNetDevProbeVnetHdr(fd))
+            ifr.ifr_flags |= IFF_VNET_HDR;
+# endif
 
-    VIR_FREE(*ifname);
-    if (!(*ifname = strdup(ifr.ifr_name))) {
-        virReportOOMError();
-        goto cleanup;
+        if (virStrcpyStatic(ifr.ifr_name, *ifname) == NULL) {
+            virReportSystemError(ERANGE,
+                                 _("Network interface name '%s' is too long"),
+                                 *ifname);
+            goto cleanup;
+
+        }
+
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            virReportSystemError(errno,
+                                 _("Unable to create tap device %s"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
+        }
+
+        if (!tapfd &&
+            (errno = ioctl(fd, TUNSETPERSIST, 1))) {
+            virReportSystemError(errno,
+                                 _("Unable to set tap device %s to persistent"),
+                                 NULLSTR(*ifname));
+            goto cleanup;
+        }
+
+        /* the remaining queues are attached to the name of the first */
+        if (i == 0) {
+            VIR_FREE(*ifname);
+            if (!(*ifname = strdup(ifr.ifr_name))) {
+                virReportOOMError();
+                goto cleanup;
+            }
+        }
+
+        if (tapfd)
+            tapfd[i] = fd;
+        else
+            VIR_FORCE_CLOSE(fd);
+        fd = -1;
     }
-    if (tapfd)
-        *tapfd = fd;
-    else
-        VIR_FORCE_CLOSE(fd);
 
     ret = 0;
 
 cleanup:
-    if (ret < 0)
+    if (ret < 0) {
         VIR_FORCE_CLOSE(fd);
+        while (tapfd && i--)
+            VIR_FORCE_CLOSE(tapfd[i]);
+    }
 
     return ret;
 }
@@ -228,7 +257,8 @@ cleanup:
 #else /* ! TUNSETIFF */
 int virNetDevTapCreate(char **ifname ATTRIBUTE_UNUSED,
                        int vnet_hdr ATTRIBUTE_UNUSED,
-                       int *tapfd ATTRIBUTE_UNUSED)
+                       int *tapfd ATTRIBUTE_UNUSED,
+                       int tapfdSize ATTRIBUTE_UNUSED)
 {
     virReportSystemError(ENOSYS, "%s",
                          _("Unable to create TAP devices on this platform"));
@@ -249,16 +279,18 @@ int virNetDevTapDelete(const char *ifname ATTRIBUTE_UNUSED)
  * @ifname: the interface name (or name template)
  * @macaddr: desired MAC address (VIR_MAC_BUFLEN long)
  * @vnet_hdr: whether to try enabling IFF_VNET_HDR
- * @tapfd: file descriptor return value for the new tap device
+ * @tapfd: array of file descriptor return value for the new tap device
+ * @tapfdSize: number of file descriptors in @tapfd
  * @ovsport: Open vSwitch specific configuration
  *
  * This function creates a new tap device on a bridge. @ifname can be either
  * a fixed name or a name template with '%d' for dynamic name allocation.
  * in either case the final name for the bridge will be stored in @ifname.
  * If the @tapfd parameter is supplied, the open tap device file
- * descriptor will be returned, otherwise the TAP device will be made
+ * descriptors will be returned, otherwise the TAP device will be made
  * persistent and closed. The caller must use brDeleteTap to remove
- * a persistent TAP devices when it is no longer needed.
+ * a persistent TAP devices when it is no longer needed. Passing more
+ * than one file descriptor creates a multiqueue tap device.
  *
  * Returns 0 in case of success or -1 on failure
  */
@@ -268,11 +300,22 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                                    int vnet_hdr,
                                    bool up,
                                    int *tapfd,
+                                   int tapfdSize,
                                    virNetDevVPortProfilePtr ovsport)
 {
-    if (virNetDevTapCreate(ifname, vnet_hdr, tapfd) < 0)
+    int i;
+
+    if (virNetDevTapCreate(ifname, vnet_hdr, tapfd, tapfdSize) < 0)
         return -1;
 
+    if (!ovsport) {
+        /* Setting the MAC, MTU, bridge and online state is
+         * done in one go, see virNetDevBridgeSetupPort */
+        if (virNetDevBridgeSetupPort(brname, *ifname, macaddr, up) < 0)
+            goto error;
+        return 0;
+    }
+
     /* We need to set the interface MAC before adding it
      * to the bridge, because the bridge assumes the lowest
      * MAC of all enslaved interfaces & we don't want it
@@ -289,13 +332,8 @@ int virNetDevTapCreateInBridgePort(const char *brname,
     if (virNetDevSetMTUFromDevice(*ifname, brname) < 0)
         goto error;
 
-    if (ovsport) {
-        if (virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, ovsport) < 0)
-            goto error;
-    } else {
-        if (virNetDevBridgeAddPort(brname, *ifname) < 0)
-            goto error;
-    }
+    if (virNetDevOpenvswitchAddPort(brname, *ifname, macaddr, ovsport) < 0)
+        goto error;
 
     if (virNetDevSetOnline(*ifname, up) < 0)
         goto error;
@@ -303,7 +341,8 @@ int virNetDevTapCreateInBridgePort(const char *brname,
     return 0;
 
  error:
-    VIR_FORCE_CLOSE(*tapfd);
+    for (i = 0; tapfd && i < tapfdSize; i++)
+        VIR_FORCE_CLOSE(tapfd[i]);
 
     return errno;
 }
@@ -28,7 +28,8 @@
 
 int virNetDevTapCreate(char **ifname,
                        int vnet_hdr,
-                       int *tapfd)
+                       int *tapfd,
+                       int tapfdSize)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 
 int virNetDevTapDelete(const char *ifname)
@@ -40,6 +41,7 @@ int virNetDevTapCreateInBridgePort(const char *brname,
                                    int vnet_hdr,
                                    bool up,
                                    int *tapfd,
+                                   int tapfdSize,
                                    virNetDevVPortProfilePtr ovsport)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(3)
     ATTRIBUTE_RETURN_CHECK;
@@ -0,0 +1,180 @@
+/*
+ * domaineventtest.c: Test the domain event queue and dispatch
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "datatypes.h"
+#include "domain_event.h"
+#include "logging.h"
+
+#define MAX_EVENTS 16
+
+struct testEventLog {
+    int nevents;
+    int lifecycle[MAX_EVENTS];
+    int nreboots;
+};
+
+static const unsigned char testUUID[VIR_UUID_BUFLEN] = {
+    0xc7, 0xa5, 0xfd, 0xbd, 0xed, 0xaf, 0x96, 0x55,
+    0x02, 0x46, 0x52, 0xc2, 0xe4, 0x11, 0x2b, 0xc3
+};
+
+static int
+testLifecycleCallback(virConnectPtr conn ATTRIBUTE_UNUSED,
+                      virDomainPtr dom ATTRIBUTE_UNUSED,
+                      int event,
+                      int detail ATTRIBUTE_UNUSED,
+                      void *opaque)
+{
+    struct testEventLog *log = opaque;
+
+    if (log->nevents < MAX_EVENTS)
+        log->lifecycle[log->nevents] = event;
+    log->nevents++;
+    return 0;
+}
+
+static void
+testRebootCallback(virConnectPtr conn ATTRIBUTE_UNUSED,
+                   virDomainPtr dom ATTRIBUTE_UNUSED,
+                   void *opaque)
+{
+    struct testEventLog *log = opaque;
+
+    log->nreboots++;
+}
+
+/*
+ * Queue a series of lifecycle events, including repeats, plus
+ * some reboot events, and check that every one of them reaches
+ * the callback registered for it, in the order it was queued.
+ */
+static int
+testDomainEventDispatch(const void *data ATTRIBUTE_UNUSED)
+{
+    static const int sequence[] = {
+        VIR_DOMAIN_EVENT_STARTED,
+        VIR_DOMAIN_EVENT_STOPPED,
+        VIR_DOMAIN_EVENT_STARTED,
+        VIR_DOMAIN_EVENT_STOPPED,
+        VIR_DOMAIN_EVENT_STOPPED,
+    };
+    virConnectPtr conn = NULL;
+    virDomainEventStatePtr state = NULL;
+    struct testEventLog lifecycleLog = { 0, { 0 }, 0 };
+    struct testEventLog rebootLog = { 0, { 0 }, 0 };
+    int callbackID = -1;
+    int ret = -1;
+    int i;
+
+    if (!(conn = virGetConnect()))
+        goto cleanup;
+
+    if (!(state = virDomainEventStateNew()))
+        goto cleanup;
+
+    if (virDomainEventStateRegister(conn, state,
+                                    testLifecycleCallback,
+                                    &lifecycleLog, NULL) < 0)
+        goto cleanup;
+
+    if (virDomainEventStateRegisterID(conn, state, NULL,
+                                      VIR_DOMAIN_EVENT_ID_REBOOT,
+                                      VIR_DOMAIN_EVENT_CALLBACK(testRebootCallback),
+                                      &rebootLog, NULL, &callbackID) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(sequence) ; i++) {
+        virDomainEventPtr event;
+
+        if (!(event = virDomainEventNew(1, "test", testUUID,
+                                        sequence[i], 0)))
+            goto cleanup;
+        virDomainEventStateQueue(state, event);
+
+        if (i % 2 == 0) {
+            if (!(event = virDomainEventRebootNew(1, "test", testUUID)))
+                goto cleanup;
+            virDomainEventStateQueue(state, event);
+        }
+    }
+
+    /* The queue is flushed from a zero timeout in the event loop */
+    if (virEventRunDefaultImpl() < 0)
+        goto cleanup;
+
+    if (lifecycleLog.nevents != ARRAY_CARDINALITY(sequence)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nExpected %zu lifecycle events, got %d\n",
+                    ARRAY_CARDINALITY(sequence), lifecycleLog.nevents);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(sequence) ; i++) {
+        if (lifecycleLog.lifecycle[i] != sequence[i]) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nLifecycle event %d is %d, expected %d\n",
+                        i, lifecycleLog.lifecycle[i], sequence[i]);
+            goto cleanup;
+        }
+    }
+
+    if (lifecycleLog.nreboots != 0 ||
+        rebootLog.nevents != 0 ||
+        rebootLog.nreboots != 3) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nEvents were dispatched to the wrong callback\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (state) {
+        if (callbackID >= 0)
+            virDomainEventStateDeregisterID(conn, state, callbackID);
+        virDomainEventStateDeregister(conn, state, testLifecycleCallback);
+        virDomainEventStateFree(state);
+    }
+    if (conn)
+        virUnrefConnect(conn);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Domain event dispatch", 1,
+                    testDomainEventDispatch, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
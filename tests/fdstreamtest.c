@@ -0,0 +1,328 @@
+/*
+ * fdstreamtest.c: Test sparse file streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "datatypes.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "fdstream.h"
+
+#define TEST_DATA (64 * 1024)
+#define TEST_HOLE (1024 * 1024)
+#define TEST_SIZE (2 * (TEST_DATA + TEST_HOLE))
+
+static char *testDir;
+
+/* Layout of the test file: data, hole, data, trailing hole */
+static void
+testFillExpected(char *buf)
+{
+    memset(buf, 0, TEST_SIZE);
+    memset(buf, 'a', TEST_DATA);
+    memset(buf + TEST_DATA + TEST_HOLE, 'b', TEST_DATA);
+}
+
+static int
+testWriteSource(const char *path, char *expect)
+{
+    int fd;
+    int ret = -1;
+
+    testFillExpected(expect);
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        return -1;
+    if (safewrite(fd, expect, TEST_DATA) != TEST_DATA ||
+        lseek(fd, TEST_DATA + TEST_HOLE, SEEK_SET) < 0 ||
+        safewrite(fd, expect + TEST_DATA + TEST_HOLE,
+                  TEST_DATA) != TEST_DATA ||
+        ftruncate(fd, TEST_SIZE) < 0)
+        goto cleanup;
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+/* Whether the file system of @path reports the holes of a file */
+static bool
+testHasHoles(const char *path)
+{
+    bool ret = false;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return false;
+    ret = lseek(fd, 0, SEEK_HOLE) < TEST_SIZE;
+    VIR_FORCE_CLOSE(fd);
+#endif
+    return ret;
+}
+
+struct testStreamData {
+    bool nonblock; /* Go through the I/O helper */
+    bool holes; /* Ask for holes rather than zeros */
+};
+
+/*
+ * Reading a sparse file must give its content back, with the holes
+ * reported as such if the reader asks for them
+ */
+static int
+testSparseRead(const void *opaque)
+{
+    const struct testStreamData *data = opaque;
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    char *path = NULL;
+    char *expect = NULL;
+    char *got = NULL;
+    char buf[16 * 1024];
+    unsigned long long offset = 0;
+    int nholes = 0;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/read.img", testDir) < 0 ||
+        VIR_ALLOC_N(expect, TEST_SIZE) < 0 ||
+        VIR_ALLOC_N(got, TEST_SIZE) < 0)
+        goto cleanup;
+
+    if (testWriteSource(path, expect) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()) ||
+        !(st = virStreamNew(conn, data->nonblock ? VIR_STREAM_NONBLOCK : 0)))
+        goto cleanup;
+
+    if (virFDStreamOpenFileSparse(st, path, 0, 0, O_RDONLY) < 0)
+        goto cleanup;
+
+    while (1) {
+        int rc = virStreamRecvFlags(st, buf, sizeof(buf),
+                                    data->holes ?
+                                    VIR_STREAM_RECV_STOP_AT_HOLE : 0);
+
+        if (rc == -2) {
+            usleep(1000);
+            continue;
+        }
+        if (rc == -3) {
+            long long len;
+
+            if (virStreamRecvHole(st, &len, 0) < 0)
+                goto cleanup;
+            if (len <= 0 || offset + len > TEST_SIZE) {
+                if (virTestGetDebug())
+                    fprintf(stderr, "\nHole of %lld bytes at %llu\n",
+                            len, offset);
+                goto cleanup;
+            }
+            offset += len;
+            nholes++;
+            continue;
+        }
+        if (rc < 0)
+            goto cleanup;
+        if (rc == 0)
+            break;
+
+        if (offset + rc > TEST_SIZE) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nRead past the end of the file\n");
+            goto cleanup;
+        }
+        memcpy(got + offset, buf, rc);
+        offset += rc;
+    }
+
+    if (virStreamFinish(st) < 0)
+        goto cleanup;
+
+    if (offset != TEST_SIZE ||
+        memcmp(expect, got, TEST_SIZE) != 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nRead %llu bytes, not the file content\n",
+                    offset);
+        goto cleanup;
+    }
+
+    if (data->holes ? (testHasHoles(path) && nholes != 2) : nholes != 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nGot %d holes\n", nholes);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (st) {
+        if (ret < 0)
+            virStreamAbort(st);
+        virStreamFree(st);
+    }
+    if (conn)
+        virUnrefConnect(conn);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(expect);
+    VIR_FREE(got);
+    return ret;
+}
+
+static int
+testSend(virStreamPtr st, const char *buf, size_t len)
+{
+    while (len) {
+        int rc = virStreamSend(st, buf, len);
+
+        if (rc == -2) {
+            usleep(1000);
+            continue;
+        }
+        if (rc < 0)
+            return -1;
+        buf += rc;
+        len -= rc;
+    }
+    return 0;
+}
+
+/*
+ * Holes sent into a sparse file must read back as zeros, including
+ * one at the end which only makes the file longer
+ */
+static int
+testSparseWrite(const void *opaque)
+{
+    const struct testStreamData *data = opaque;
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    char *path = NULL;
+    char *expect = NULL;
+    char *got = NULL;
+    int fd = -1;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/write.img", testDir) < 0 ||
+        VIR_ALLOC_N(expect, TEST_SIZE) < 0 ||
+        VIR_ALLOC_N(got, TEST_SIZE + 1) < 0)
+        goto cleanup;
+
+    testFillExpected(expect);
+
+    /* Holes have to clear what was there before */
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+    memset(got, 'x', TEST_DATA + TEST_HOLE);
+    if (safewrite(fd, got, TEST_DATA + TEST_HOLE) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()) ||
+        !(st = virStreamNew(conn, data->nonblock ? VIR_STREAM_NONBLOCK : 0)))
+        goto cleanup;
+
+    if (virFDStreamOpenFileSparse(st, path, 0, 0, O_WRONLY) < 0)
+        goto cleanup;
+
+    if (testSend(st, expect, TEST_DATA) < 0 ||
+        virStreamSendHole(st, TEST_HOLE, 0) < 0 ||
+        testSend(st, expect + TEST_DATA + TEST_HOLE, TEST_DATA) < 0 ||
+        virStreamSendHole(st, TEST_HOLE / 2, 0) < 0 ||
+        virStreamSendHole(st, TEST_HOLE / 2, 0) < 0)
+        goto cleanup;
+
+    if (virStreamFinish(st) < 0)
+        goto cleanup;
+
+    if ((fd = open(path, O_RDONLY)) < 0 ||
+        saferead(fd, got, TEST_SIZE + 1) != TEST_SIZE ||
+        memcmp(expect, got, TEST_SIZE) != 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nWritten file does not match\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (st) {
+        if (ret < 0)
+            virStreamAbort(st);
+        virStreamFree(st);
+    }
+    if (conn)
+        virUnrefConnect(conn);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    VIR_FREE(expect);
+    VIR_FREE(got);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!(testDir = mkdtemp(template)))
+        return EXIT_FAILURE;
+
+    virFDStreamSetIOHelper(abs_builddir "/../src/libvirt_iohelper");
+
+#define DO_TEST(name, func, nonblock, holes)                            \
+    do {                                                                \
+        struct testStreamData data = { nonblock, holes };               \
+        if (virtTestRun(name, 1, func, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("Sparse read", testSparseRead, false, true);
+    DO_TEST("Sparse read as zeros", testSparseRead, false, false);
+    DO_TEST("Sparse read through helper", testSparseRead, true, true);
+    DO_TEST("Sparse read as zeros through helper",
+            testSparseRead, true, false);
+    DO_TEST("Sparse write", testSparseWrite, false, true);
+    DO_TEST("Sparse write through helper", testSparseWrite, true, true);
+
+    rmdir(testDir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,208 @@
+/*
+ * iptablestest.c: Test batching of iptables rule changes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "memory.h"
+#include "iptables.h"
+
+struct testInfo {
+    int family;
+    const char *table;
+    const char *saved;
+    const char *expect;
+};
+
+static iptablesContext *ctx;
+
+static int
+testRestoreInput(const void *data)
+{
+    const struct testInfo *info = data;
+    char *actual;
+    int ret = -1;
+
+    if (!(actual = iptablesTransactionRestoreInput(ctx, info->family,
+                                                   info->table,
+                                                   info->saved)))
+        return -1;
+
+    if (STRNEQ(info->expect, actual)) {
+        virtTestDifference(stderr, info->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(actual);
+    return ret;
+}
+
+/*
+ * Queue the rules a NATed network on virbr0 adds, plus removals of
+ * other rules and of rules whose addition is undone
+ */
+static int
+testQueueRules(void)
+{
+    virSocketAddr netaddr;
+
+    if (virSocketAddrParse(&netaddr, "192.168.122.1", AF_INET) < 0)
+        return -1;
+
+    iptablesTransactionBegin(ctx);
+
+    if (iptablesRemoveTcpInput(ctx, AF_INET, "virbr1", 53) < 0 ||
+        iptablesAddTcpInput(ctx, AF_INET, "virbr0", 53) < 0 ||
+        iptablesAddUdpInput(ctx, AF_INET, "virbr0", 53) < 0 ||
+        iptablesAddUdpInput(ctx, AF_INET6, "virbr0", 53) < 0 ||
+        iptablesAddForwardAllowCross(ctx, AF_INET, "virbr0") < 0 ||
+        iptablesRemoveForwardMasquerade(ctx, &netaddr, 24,
+                                        "eth1", NULL) < 0 ||
+        iptablesAddForwardMasquerade(ctx, &netaddr, 24, "eth0", "tcp") < 0 ||
+        iptablesAddForwardMasquerade(ctx, &netaddr, 24, "eth0", NULL) < 0)
+        return -1;
+
+    /* a rule added and removed again is never added, while one that
+     * may have been there before is still removed */
+    if (iptablesAddTcpInput(ctx, AF_INET, "virbr2", 67) < 0 ||
+        iptablesRemoveUdpInput(ctx, AF_INET, "virbr3", 68) < 0 ||
+        iptablesAddUdpInput(ctx, AF_INET, "virbr3", 68) < 0 ||
+        iptablesRemoveTcpInput(ctx, AF_INET, "virbr2", 67) < 0 ||
+        iptablesRemoveUdpInput(ctx, AF_INET, "virbr3", 68) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!(ctx = iptablesContextNew()))
+        return EXIT_FAILURE;
+
+    if (testQueueRules() < 0) {
+        iptablesContextFree(ctx);
+        return EXIT_FAILURE;
+    }
+
+#define DO_TEST_FULL(name, family, table, saved, expect)               \
+    do {                                                                \
+        static struct testInfo info = { family, table, saved, expect }; \
+        if (virtTestRun("Restore input " name,                          \
+                        1, testRestoreInput, &info) < 0)                \
+            ret = -1;                                                   \
+    } while (0)
+#define DO_TEST(family, table, expect)                                  \
+    DO_TEST_FULL(#family " " table, family, table, NULL, expect)
+
+    DO_TEST(AF_INET, "filter",
+            "*filter\n"
+            "--delete INPUT --in-interface virbr1 --protocol tcp "
+            "--destination-port 53 --jump ACCEPT\n"
+            "--insert INPUT --in-interface virbr0 --protocol tcp "
+            "--destination-port 53 --jump ACCEPT\n"
+            "--insert INPUT --in-interface virbr0 --protocol udp "
+            "--destination-port 53 --jump ACCEPT\n"
+            "--insert FORWARD --in-interface virbr0 "
+            "--out-interface virbr0 --jump ACCEPT\n"
+            "--delete INPUT --in-interface virbr3 --protocol udp "
+            "--destination-port 68 --jump ACCEPT\n"
+            "COMMIT\n");
+    DO_TEST(AF_INET6, "filter",
+            "*filter\n"
+            "--insert INPUT --in-interface virbr0 --protocol udp "
+            "--destination-port 53 --jump ACCEPT\n"
+            "COMMIT\n");
+    DO_TEST(AF_INET, "nat",
+            "*nat\n"
+            "--delete POSTROUTING --source 192.168.122.0/24 "
+            "! --destination 192.168.122.0/24 --out-interface eth1 "
+            "--jump MASQUERADE\n"
+            "--insert POSTROUTING --source 192.168.122.0/24 -p tcp "
+            "! --destination 192.168.122.0/24 --out-interface eth0 "
+            "--jump MASQUERADE --to-ports 1024-65535\n"
+            "--insert POSTROUTING --source 192.168.122.0/24 "
+            "! --destination 192.168.122.0/24 --out-interface eth0 "
+            "--jump MASQUERADE\n"
+            "COMMIT\n");
+    DO_TEST(AF_INET, "mangle",
+            "*mangle\n"
+            "COMMIT\n");
+
+    /* rules to delete are left out unless iptables-save lists them */
+    DO_TEST_FULL("AF_INET filter saved", AF_INET, "filter",
+                 "*filter\n"
+                 ":INPUT ACCEPT [0:0]\n"
+                 "-A INPUT -i virbr1 -p tcp -m tcp --dport 53 -j ACCEPT\n"
+                 "-A INPUT -i virbr3 -p tcp -m tcp --dport 68 -j ACCEPT\n"
+                 "-A FORWARD -i virbr3 -p udp -m udp --dport 68 -j ACCEPT\n"
+                 "COMMIT\n",
+                 "*filter\n"
+                 "--delete INPUT --in-interface virbr1 --protocol tcp "
+                 "--destination-port 53 --jump ACCEPT\n"
+                 "--insert INPUT --in-interface virbr0 --protocol tcp "
+                 "--destination-port 53 --jump ACCEPT\n"
+                 "--insert INPUT --in-interface virbr0 --protocol udp "
+                 "--destination-port 53 --jump ACCEPT\n"
+                 "--insert FORWARD --in-interface virbr0 "
+                 "--out-interface virbr0 --jump ACCEPT\n"
+                 "COMMIT\n");
+    DO_TEST_FULL("AF_INET nat saved", AF_INET, "nat",
+                 "*nat\n"
+                 "-A POSTROUTING -s 192.168.122.0/24 ! -d 192.168.122.0/24 "
+                 "-o eth1 -j MASQUERADE\n"
+                 "COMMIT\n",
+                 "*nat\n"
+                 "--delete POSTROUTING --source 192.168.122.0/24 "
+                 "! --destination 192.168.122.0/24 --out-interface eth1 "
+                 "--jump MASQUERADE\n"
+                 "--insert POSTROUTING --source 192.168.122.0/24 -p tcp "
+                 "! --destination 192.168.122.0/24 --out-interface eth0 "
+                 "--jump MASQUERADE --to-ports 1024-65535\n"
+                 "--insert POSTROUTING --source 192.168.122.0/24 "
+                 "! --destination 192.168.122.0/24 --out-interface eth0 "
+                 "--jump MASQUERADE\n"
+                 "COMMIT\n");
+    DO_TEST_FULL("AF_INET nat nothing saved", AF_INET, "nat",
+                 "*nat\n"
+                 "COMMIT\n",
+                 "*nat\n"
+                 "--insert POSTROUTING --source 192.168.122.0/24 -p tcp "
+                 "! --destination 192.168.122.0/24 --out-interface eth0 "
+                 "--jump MASQUERADE --to-ports 1024-65535\n"
+                 "--insert POSTROUTING --source 192.168.122.0/24 "
+                 "! --destination 192.168.122.0/24 --out-interface eth0 "
+                 "--jump MASQUERADE\n"
+                 "COMMIT\n");
+
+    /* the queued rules are dropped without being applied */
+    iptablesContextFree(ctx);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
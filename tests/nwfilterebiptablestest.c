@@ -0,0 +1,665 @@
+/*
+ * nwfilterebiptablestest.c: Test the conversion of nwfilter rule
+ *                           templates into *tables-restore input, the
+ *                           update of rules in place and the ipsets
+ *                           matching lists of addresses, and when
+ *                           those are destroyed
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "buf.h"
+#include "memory.h"
+#include "domain_conf.h"
+#include "nwfilter_conf.h"
+#include "nwfilter/nwfilter_ebiptables_driver.h"
+
+struct testRestoreData {
+    const char *templ;
+    char cmd;
+    int pos;
+    const char *expect; /* NULL if the template must be rejected */
+};
+
+static int
+testTemplateToRestoreLine(const void *opaque)
+{
+    const struct testRestoreData *data = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    int rc;
+    int ret = -1;
+
+    rc = ebiptablesTemplateToRestoreLine(&buf, data->templ,
+                                         data->cmd, data->pos);
+
+    if (!data->expect) {
+        if (rc == 0) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nTemplate was not rejected\n");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (rc < 0)
+        goto cleanup;
+
+    if (!(actual = virBufferContentAndReset(&buf)))
+        goto cleanup;
+
+    if (STRNEQ(actual, data->expect)) {
+        virtTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+struct testRuleSpec {
+    enum RuleType ruleType;
+    const char *chain;
+    virNWFilterChainPriority chainPriority;
+    virNWFilterRulePriority priority;
+    const char *templ;
+};
+
+struct testDiffData {
+    const struct testRuleSpec **oldRules;
+    const struct testRuleSpec **newRules;
+    int rc;
+    const char *expect;
+};
+
+/* rules going into the given chain, commented with their own name */
+#define IPT_RULE(name, chain, prio)                                     \
+    static const struct testRuleSpec name = {                           \
+        RT_IPTABLES, "root", 0, prio,                                   \
+        "$IPT -%c " chain " %s -m comment --comment " #name " -j ACCEPT" \
+    }
+#define EBT_RULE(name, chain, chainPriority, prio, ebtchain)            \
+    static const struct testRuleSpec name = {                           \
+        RT_EBTABLES, chain, chainPriority, prio,                        \
+        "$EBT -t nat -%c " ebtchain " %s --comment " #name " -j ACCEPT" \
+    }
+
+IPT_RULE(ipt100, "FI-vnet0", 100);
+IPT_RULE(ipt200, "FI-vnet0", 200);
+IPT_RULE(ipt200b, "FI-vnet0", 200);
+IPT_RULE(ipt300, "FI-vnet0", 300);
+IPT_RULE(iptOut150, "FO-vnet0", 150);
+EBT_RULE(ebtRootM800, "root", 0, -800, "libvirt-J-vnet0");
+EBT_RULE(ebtRoot100, "root", 0, 100, "libvirt-J-vnet0");
+EBT_RULE(ebtRoot200, "root", 0, 200, "libvirt-J-vnet0");
+EBT_RULE(ebtIPv4, "ipv4", -700, 500, "J-vnet0-ipv4");
+EBT_RULE(ebtIPv6, "ipv6", -600, 500, "J-vnet0-ipv6");
+
+static ebiptablesRuleInstPtr *
+testRulesNew(const struct testRuleSpec **spec, int *nrules)
+{
+    ebiptablesRuleInstPtr *rules = NULL;
+    int i;
+
+    for (*nrules = 0; spec[*nrules]; (*nrules)++)
+        ;
+
+    if (VIR_ALLOC_N(rules, *nrules) < 0)
+        return NULL;
+
+    for (i = 0; i < *nrules; i++) {
+        if (VIR_ALLOC(rules[i]) < 0)
+            goto error;
+        rules[i]->ruleType = spec[i]->ruleType;
+        rules[i]->neededProtocolChain = spec[i]->chain;
+        rules[i]->chainPriority = spec[i]->chainPriority;
+        rules[i]->priority = spec[i]->priority;
+        rules[i]->chainprefix = 'J';
+        if (!(rules[i]->commandTemplate = strdup(spec[i]->templ)))
+            goto error;
+    }
+
+    return rules;
+
+error:
+    for (i = 0; i < *nrules; i++) {
+        if (rules[i])
+            VIR_FREE(rules[i]->commandTemplate);
+        VIR_FREE(rules[i]);
+    }
+    VIR_FREE(rules);
+    return NULL;
+}
+
+static void
+testRulesFree(ebiptablesRuleInstPtr *rules, int nrules)
+{
+    int i;
+
+    if (!rules)
+        return;
+    for (i = 0; i < nrules; i++) {
+        VIR_FREE(rules[i]->commandTemplate);
+        VIR_FREE(rules[i]);
+    }
+    VIR_FREE(rules);
+}
+
+static int
+testDiffRules(const void *opaque)
+{
+    const struct testDiffData *data = opaque;
+    ebiptablesRuleInstPtr *oldRules = NULL, *newRules = NULL;
+    ebiptablesRuleInstPtr *removed = NULL, *inserted = NULL;
+    int *positions = NULL;
+    int nold = 0, nnew = 0, nremoved = 0, ninserted = 0;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    int i, rc;
+    int ret = -1;
+
+    if (!(oldRules = testRulesNew(data->oldRules, &nold)) ||
+        !(newRules = testRulesNew(data->newRules, &nnew)))
+        goto cleanup;
+
+    rc = ebiptables_driver.diffRules(nold, (void **)oldRules,
+                                     nnew, (void **)newRules,
+                                     (void ***)&removed, &nremoved,
+                                     (void ***)&inserted, &positions,
+                                     &ninserted);
+    if (rc != data->rc) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nExpected result %d, got %d\n", data->rc, rc);
+        goto cleanup;
+    }
+
+    for (i = 0; i < nremoved; i++)
+        virBufferAsprintf(&buf, "remove %s\n", removed[i]->commandTemplate);
+    for (i = 0; i < ninserted; i++)
+        virBufferAsprintf(&buf, "insert %d %s\n",
+                          positions[i], inserted[i]->commandTemplate);
+
+    if (virBufferError(&buf))
+        goto cleanup;
+
+    if (!(actual = virBufferContentAndReset(&buf)) &&
+        !(actual = strdup("")))
+        goto cleanup;
+
+    if (STRNEQ(actual, data->expect)) {
+        virtTestDifference(stderr, data->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    VIR_FREE(removed);
+    VIR_FREE(inserted);
+    VIR_FREE(positions);
+    testRulesFree(oldRules, nold);
+    testRulesFree(newRules, nnew);
+    return ret;
+}
+
+
+static virNWFilterVarValuePtr
+testVarValueNew(const char *const *values)
+{
+    virNWFilterVarValuePtr val;
+    char *value;
+    int i;
+
+    if (!(val = virNWFilterVarValueCreateSimpleCopyValue(values[0])))
+        return NULL;
+
+    for (i = 1; values[i]; i++) {
+        if (!(value = strdup(values[i])) ||
+            virNWFilterVarValueAddValue(val, value) < 0) {
+            VIR_FREE(value);
+            virNWFilterVarValueFree(val);
+            return NULL;
+        }
+    }
+
+    return val;
+}
+
+
+/*
+ * Sets of the same values share their name, while sets of different
+ * values must never do, since a set is created with -exist and would
+ * keep members that the rules using it do not expect
+ */
+static int
+testIpsetName(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const char *const values1[] = { "10.1.0.1", "10.1.0.2", NULL };
+    static const char *const values2[] = { "10.1.0.1", "10.1.0.3", NULL };
+    static const char *const values3[] = { "10.1.0.1", NULL };
+    virNWFilterVarValuePtr val1 = NULL, val1copy = NULL;
+    virNWFilterVarValuePtr val2 = NULL, val3 = NULL;
+    char name1[NWFILTER_IPSET_NAME_LEN], name1copy[NWFILTER_IPSET_NAME_LEN];
+    char name2[NWFILTER_IPSET_NAME_LEN], name3[NWFILTER_IPSET_NAME_LEN];
+    int ret = -1;
+
+    if (!(val1 = testVarValueNew(values1)) ||
+        !(val1copy = testVarValueNew(values1)) ||
+        !(val2 = testVarValueNew(values2)) ||
+        !(val3 = testVarValueNew(values3)))
+        goto cleanup;
+
+    if (ebiptablesIpsetName(val1, name1, sizeof(name1)) < 0 ||
+        ebiptablesIpsetName(val2, name2, sizeof(name2)) < 0 ||
+        ebiptablesIpsetName(val3, name3, sizeof(name3)) < 0 ||
+        ebiptablesIpsetName(val1copy, name1copy, sizeof(name1copy)) < 0)
+        goto cleanup;
+
+    if (!STRPREFIX(name1, NWFILTER_IPSET_PREFIX)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nUnexpected set name %s\n", name1);
+        goto cleanup;
+    }
+
+    if (STRNEQ(name1, name1copy)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nSets of the same values are named %s and %s\n",
+                    name1, name1copy);
+        goto cleanup;
+    }
+
+    if (STREQ(name1, name2) || STREQ(name1, name3) || STREQ(name2, name3)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nSets of different values share a name\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNWFilterVarValueFree(val1);
+    virNWFilterVarValueFree(val1copy);
+    virNWFilterVarValueFree(val2);
+    virNWFilterVarValueFree(val3);
+    return ret;
+}
+
+
+struct testIpsetData {
+    const char *const *values;
+    const char *family; /* NULL if no set can hold the values */
+};
+
+static int
+testIpsetAddDef(const void *opaque)
+{
+    const struct testIpsetData *data = opaque;
+    virNWFilterVarValuePtr val = NULL;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virBuffer expect = VIR_BUFFER_INITIALIZER;
+    char name[NWFILTER_IPSET_NAME_LEN];
+    char *actual = NULL;
+    char *expected = NULL;
+    int i, rc;
+    int ret = -1;
+
+    if (!(val = testVarValueNew(data->values)))
+        goto cleanup;
+
+    if ((rc = ebiptablesIpsetAddDef(&buf, val)) < 0)
+        goto cleanup;
+
+    if (rc != (data->family != NULL)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nUnexpected result %d\n", rc);
+        goto cleanup;
+    }
+
+    if (!data->family) {
+        if (virBufferUse(&buf) != 0) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nSet was defined anyway\n");
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (ebiptablesIpsetName(val, name, sizeof(name)) < 0)
+        goto cleanup;
+
+    virBufferAsprintf(&expect, "create %s hash:ip family %s\n",
+                      name, data->family);
+    for (i = 0; data->values[i]; i++)
+        virBufferAsprintf(&expect, "add %s %s\n", name, data->values[i]);
+
+    if (virBufferError(&buf) || virBufferError(&expect))
+        goto cleanup;
+
+    actual = virBufferContentAndReset(&buf);
+    expected = virBufferContentAndReset(&expect);
+
+    if (STRNEQ_NULLABLE(actual, expected)) {
+        virtTestDifference(stderr, NULLSTR(expected), NULLSTR(actual));
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    virBufferFreeAndReset(&expect);
+    VIR_FREE(actual);
+    VIR_FREE(expected);
+    virNWFilterVarValueFree(val);
+    return ret;
+}
+
+
+/* whether exactly the sets in the NULL terminated @expect were destroyed */
+static bool
+testIpsetsDestroyed(virBufferPtr buf, const char *const *expect)
+{
+    char *actual = virBufferContentAndReset(buf);
+    size_t nlines = 0;
+    const char *line;
+    bool ret = false;
+    int i;
+
+    for (line = actual; line && *line; line = strchr(line, '\n') + 1)
+        nlines++;
+
+    for (i = 0; expect[i]; i++) {
+        for (line = actual; line && *line; line = strchr(line, '\n') + 1) {
+            if (STRPREFIX(line, expect[i]) &&
+                line[strlen(expect[i])] == '\n')
+                break;
+        }
+        if (!line || !*line)
+            goto cleanup;
+    }
+
+    ret = nlines == i;
+
+cleanup:
+    if (!ret && virTestGetDebug())
+        fprintf(stderr, "\nDestroyed sets:\n%s", NULLSTR(actual));
+    VIR_FREE(actual);
+    return ret;
+}
+
+#define TEST_IPSET_DEF(name) "create " name " hash:ip family inet\n" \
+                             "add " name " 10.1.0.1\n"
+
+/*
+ * A set shared by the rules of several interfaces, or by the live and
+ * the new chains of one interface, is only destroyed once the last of
+ * them is gone, and then only once
+ */
+static int
+testIpsetsRefs(const void *opaque ATTRIBUTE_UNUSED)
+{
+    static const char *const none[] = { NULL };
+    static const char *const setA[] = { "test-a", NULL };
+    static const char *const setsAB[] = { "test-a", "test-b", NULL };
+    ebiptablesRuleInst ruleA = { .ipsets = (char *)TEST_IPSET_DEF("test-a") };
+    ebiptablesRuleInst ruleB = { .ipsets = (char *)TEST_IPSET_DEF("test-b") };
+    ebiptablesRuleInst ruleAB = {
+        .ipsets = (char *)(TEST_IPSET_DEF("test-a") TEST_IPSET_DEF("test-b"))
+    };
+    ebiptablesRuleInst plain = { .ipsets = NULL };
+    ebiptablesRuleInstPtr rulesAB[] = { &plain, &ruleAB, &ruleA };
+    ebiptablesRuleInstPtr rulesA[] = { &ruleA };
+    ebiptablesRuleInstPtr rulesB[] = { &ruleB, &plain };
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int ret = -1;
+
+    /* both interfaces switch to chains using test-a */
+    if (ebiptablesIpsetsRef(false, "vnet0", ARRAY_CARDINALITY(rulesAB),
+                            rulesAB) < 0)
+        goto cleanup;
+    ebiptablesIpsetsSwitch("vnet0", &buf);
+    if (ebiptablesIpsetsRef(false, "vnet1", ARRAY_CARDINALITY(rulesA),
+                            rulesA) < 0)
+        goto cleanup;
+    ebiptablesIpsetsSwitch("vnet1", &buf);
+    if (!testIpsetsDestroyed(&buf, none))
+        goto cleanup;
+
+    /* vnet0 is rebuilt without test-a, which vnet1 still uses */
+    if (ebiptablesIpsetsRef(false, "vnet0", ARRAY_CARDINALITY(rulesB),
+                            rulesB) < 0)
+        goto cleanup;
+    ebiptablesIpsetsSwitch("vnet0", &buf);
+    if (!testIpsetsDestroyed(&buf, none))
+        goto cleanup;
+
+    /* the last user of test-a goes away */
+    ebiptablesIpsetsUnref(true, "vnet1", &buf);
+    if (!testIpsetsDestroyed(&buf, setA))
+        goto cleanup;
+
+    /* new chains of vnet0 using test-a are torn down again, while its
+       live chains keep test-b */
+    if (ebiptablesIpsetsRef(false, "vnet0", ARRAY_CARDINALITY(rulesAB),
+                            rulesAB) < 0)
+        goto cleanup;
+    ebiptablesIpsetsUnref(false, "vnet0", &buf);
+    if (!testIpsetsDestroyed(&buf, setA))
+        goto cleanup;
+
+    /* test-a is inserted into the live chains, which then go away */
+    if (ebiptablesIpsetsRef(true, "vnet0", ARRAY_CARDINALITY(rulesA),
+                            rulesA) < 0)
+        goto cleanup;
+    ebiptablesIpsetsUnref(true, "vnet0", &buf);
+    if (!testIpsetsDestroyed(&buf, setsAB))
+        goto cleanup;
+
+    /* nothing is left to destroy */
+    ebiptablesIpsetsUnref(true, "vnet0", &buf);
+    ebiptablesIpsetsUnref(false, "vnet0", &buf);
+    ebiptablesIpsetsUnref(true, "vnet1", &buf);
+    if (!testIpsetsDestroyed(&buf, none))
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(name, templ, cmd, pos, expect)                          \
+    do {                                                                \
+        static const struct testRestoreData data = {                    \
+            templ, cmd, pos, expect                                     \
+        };                                                              \
+        if (virtTestRun("restore line " name, 1,                        \
+                        testTemplateToRestoreLine, &data) < 0)          \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("iptables",
+            "cmd='$IPT -%c FI-vnet0 %s -p tcp --dport 22 -j RETURN'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1,
+            "-A FI-vnet0 -p tcp --dport 22 -j RETURN\n");
+
+    DO_TEST("ebtables table",
+            "cmd='$EBT -t nat -%c I-vnet0-ipv4 %s -p IPv4 "
+            "--ip-src 10.1.2.3 -j ACCEPT'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1,
+            "-A I-vnet0-ipv4 -p IPv4 --ip-src 10.1.2.3 -j ACCEPT\n");
+
+    DO_TEST("insert position",
+            "cmd='$EBT -t nat -%c libvirt-I-vnet0 %s -p IPv4 "
+            "-j I-vnet0-ipv4'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'I', 3,
+            "-I libvirt-I-vnet0 3 -p IPv4 -j I-vnet0-ipv4\n");
+
+    DO_TEST("comment",
+            "comment='ssh from \"admin\" net'\\''s hosts'\n"
+            "cmd='$IPT -%c FO-vnet0 %s -m comment "
+            "--comment \"$comment\" -j ACCEPT'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1,
+            "-A FO-vnet0 -m comment --comment "
+            "\"ssh from \\\"admin\\\" net's hosts\" -j ACCEPT\n");
+
+    DO_TEST("empty comment",
+            "comment=''\n"
+            "cmd='$IPT -%c FO-vnet0 %s -m comment "
+            "--comment \"${comment}\" -j DROP'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1,
+            "-A FO-vnet0 -m comment --comment \"\" -j DROP\n");
+
+    DO_TEST("two commands",
+            "cmd='$IPT -%c FO-vnet0 %s -j ACCEPT'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n"
+            "cmd='$IPT -A FO-vnet0 -j DROP'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1, NULL);
+
+    DO_TEST("other variable",
+            "cmd='$IPT -%c FO-vnet0 %s -s $ADDR -j ACCEPT'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1, NULL);
+
+    DO_TEST("command substitution",
+            "cmd='$IPT -%c FO-vnet0 %s -s `hostname` -j ACCEPT'\n"
+            "eval res=\\$\\(\"${cmd} 2>&1\"\\)\n",
+            'A', -1, NULL);
+
+#define DO_TEST_DIFF(name, rc, expect, oldRules, newRules)              \
+    do {                                                                \
+        const struct testDiffData data = {                              \
+            oldRules, newRules, rc, expect                              \
+        };                                                              \
+        if (virtTestRun("diff rules " name, 1,                          \
+                        testDiffRules, &data) < 0)                      \
+            ret = -1;                                                   \
+    } while (0)
+#define RULES(...) (const struct testRuleSpec *[]) { __VA_ARGS__, NULL }
+#define NO_RULES (const struct testRuleSpec *[]) { NULL }
+
+    DO_TEST_DIFF("unchanged", 0, "",
+                 RULES(&ipt100, &ipt200, &ebtIPv4),
+                 RULES(&ipt100, &ipt200, &ebtIPv4));
+
+    DO_TEST_DIFF("empty", 0, "",
+                 NO_RULES,
+                 NO_RULES);
+
+    DO_TEST_DIFF("remove", 0,
+                 "remove $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200 -j ACCEPT\n",
+                 RULES(&ipt100, &ipt200, &ipt300),
+                 RULES(&ipt100, &ipt300));
+
+    DO_TEST_DIFF("insert", 0,
+                 "insert 2 $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200 -j ACCEPT\n",
+                 RULES(&ipt300, &ipt100),
+                 RULES(&ipt300, &ipt200, &ipt100));
+
+    DO_TEST_DIFF("insert other chain", 0,
+                 "insert 2 $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200 -j ACCEPT\n",
+                 RULES(&ipt100, &iptOut150, &ipt300),
+                 RULES(&ipt100, &iptOut150, &ipt200, &ipt300));
+
+    DO_TEST_DIFF("replace", 0,
+                 "remove $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200 -j ACCEPT\n"
+                 "insert 2 $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200b -j ACCEPT\n",
+                 RULES(&ipt100, &ipt200, &ipt300),
+                 RULES(&ipt100, &ipt200b, &ipt300));
+
+    DO_TEST_DIFF("same priority", 0,
+                 "insert 2 $IPT -%c FI-vnet0 %s -m comment "
+                 "--comment ipt200b -j ACCEPT\n",
+                 RULES(&ipt200, &ipt300),
+                 RULES(&ipt200, &ipt200b, &ipt300));
+
+    DO_TEST_DIFF("ebtables root chain", 0,
+                 "insert 1 $EBT -t nat -%c libvirt-J-vnet0 %s "
+                 "--comment ebtRootM800 -j ACCEPT\n"
+                 "insert 4 $EBT -t nat -%c libvirt-J-vnet0 %s "
+                 "--comment ebtRoot200 -j ACCEPT\n",
+                 RULES(&ebtIPv4, &ebtRoot100),
+                 RULES(&ebtRoot200, &ebtIPv4, &ebtRootM800, &ebtRoot100));
+
+    DO_TEST_DIFF("new ebtables chain", 1, "",
+                 RULES(&ebtIPv4, &ebtRoot100),
+                 RULES(&ebtIPv4, &ebtIPv6, &ebtRoot100));
+
+    DO_TEST_DIFF("removed ebtables chain", 1, "",
+                 RULES(&ebtIPv4, &ebtIPv6),
+                 RULES(&ebtIPv4));
+
+    DO_TEST_DIFF("new iptables chains", 1, "",
+                 RULES(&ebtRoot100),
+                 RULES(&ebtRoot100, &ipt100));
+
+    if (virtTestRun("ipset name", 1, testIpsetName, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("ipset references", 1, testIpsetsRefs, NULL) < 0)
+        ret = -1;
+
+#define DO_TEST_IPSET(name, family, ...)                                \
+    do {                                                                \
+        static const char *const values[] = { __VA_ARGS__, NULL };      \
+        static const struct testIpsetData data = { values, family };    \
+        if (virtTestRun("ipset definition " name, 1,                    \
+                        testIpsetAddDef, &data) < 0)                    \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_IPSET("IPv4", "inet", "192.168.122.1", "192.168.122.2");
+    DO_TEST_IPSET("IPv6", "inet6", "2001:db8::1", "2001:db8::2");
+    DO_TEST_IPSET("mixed families", NULL, "192.168.122.1", "2001:db8::1");
+    DO_TEST_IPSET("no addresses", NULL, "192.168.122.1", "00:11:22:33:44:55");
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
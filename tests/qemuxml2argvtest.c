@@ -281,6 +281,93 @@ cleanup:
 }
 
 
+/*
+ * Interfaces QEMU gets file descriptors for cannot be set up in the
+ * test, so check the -netdev argument built from the descriptors'
+ * names as hotplug passes them
+ */
+struct testHostNetInfo {
+    const char *name;
+    int tapfdSize;
+    int vhostfdSize;
+    const char *expect;
+};
+
+static int
+testCompareXMLToHostNet(const void *data)
+{
+    const struct testHostNetInfo *info = data;
+    char *xml = NULL;
+    virDomainDefPtr vmdef = NULL;
+    virBitmapPtr qemuCaps = NULL;
+    virDomainNetDefPtr net;
+    char **tapfdName = NULL;
+    char **vhostfdName = NULL;
+    char *actual = NULL;
+    int ret = -1;
+    int i;
+
+    if (virAsprintf(&xml, "%s/qemuxml2argvdata/qemuxml2argv-%s.xml",
+                    abs_srcdir, info->name) < 0)
+        goto cleanup;
+
+    if (!(vmdef = virDomainDefParseFile(driver.caps, xml,
+                                        QEMU_EXPECTED_VIRT_TYPES,
+                                        VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if (!(qemuCaps = qemuCapsNew()))
+        goto cleanup;
+    qemuCapsSetList(qemuCaps, QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV,
+                    QEMU_CAPS_VIRTIO_NET_MQ, QEMU_CAPS_LAST);
+
+    if (qemuAssignDeviceAliases(vmdef, qemuCaps) < 0)
+        goto cleanup;
+
+    if (vmdef->nnets != 1)
+        goto cleanup;
+    net = vmdef->nets[0];
+
+    if (VIR_ALLOC_N(tapfdName, info->tapfdSize) < 0 ||
+        VIR_ALLOC_N(vhostfdName, info->vhostfdSize) < 0)
+        goto cleanup;
+
+    for (i = 0; i < info->tapfdSize; i++) {
+        if (virAsprintf(&tapfdName[i], "fd-%s-%d", net->info.alias, i) < 0)
+            goto cleanup;
+    }
+    for (i = 0; i < info->vhostfdSize; i++) {
+        if (virAsprintf(&vhostfdName[i], "vhostfd-%s-%d",
+                        net->info.alias, i) < 0)
+            goto cleanup;
+    }
+
+    if (!(actual = qemuBuildHostNetStr(net, ',', -1,
+                                       tapfdName, info->tapfdSize,
+                                       vhostfdName, info->vhostfdSize)))
+        goto cleanup;
+
+    if (STRNEQ(info->expect, actual)) {
+        virtTestDifference(stderr, info->expect, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; tapfdName && i < info->tapfdSize; i++)
+        VIR_FREE(tapfdName[i]);
+    for (i = 0; vhostfdName && i < info->vhostfdSize; i++)
+        VIR_FREE(vhostfdName[i]);
+    VIR_FREE(tapfdName);
+    VIR_FREE(vhostfdName);
+    VIR_FREE(actual);
+    qemuCapsFree(qemuCaps);
+    virDomainDefFree(vmdef);
+    VIR_FREE(xml);
+    return ret;
+}
+
 
 static int
 mymain(void)
@@ -335,6 +422,17 @@ mymain(void)
 
 # define NONE QEMU_CAPS_LAST
 
+# define DO_TEST_HOSTNET(name, tapfds, vhostfds, expect)                \
+    do {                                                                \
+        static struct testHostNetInfo info = {                          \
+            name, tapfds, vhostfds, expect                              \
+        };                                                              \
+        if (virtTestRun("QEMU XML-2-ARGV hostnet " name " "             \
+                        #tapfds "/" #vhostfds,                          \
+                        1, testCompareXMLToHostNet, &info) < 0)         \
+            ret = -1;                                                   \
+    } while (0)
+
     /* Unset or set all envvars here that are copied in qemudBuildCommandLine
      * using ADD_ENV_COPY, otherwise these tests may fail due to unexpected
      * values for these envvars */
@@ -536,6 +634,23 @@ mymain(void)
             QEMU_CAPS_DEVICE, QEMU_CAPS_NODEFCONFIG, QEMU_CAPS_VIRTIO_TX_ALG);
     DO_TEST("net-virtio-netdev", false,
             QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG);
+    DO_TEST("net-virtio-netdev-mq", false,
+            QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG,
+            QEMU_CAPS_VIRTIO_NET_MQ);
+    DO_TEST_FAILURE("net-virtio-mq-user",
+                    QEMU_CAPS_DEVICE, QEMU_CAPS_NETDEV, QEMU_CAPS_NODEFCONFIG,
+                    QEMU_CAPS_VIRTIO_NET_MQ);
+    DO_TEST_HOSTNET("net-virtio-bridge-mq", 4, 4,
+                    "tap,fds=fd-net0-0:fd-net0-1:fd-net0-2:fd-net0-3,"
+                    "id=hostnet0,vhost=on,"
+                    "vhostfds=vhostfd-net0-0:vhostfd-net0-1:"
+                    "vhostfd-net0-2:vhostfd-net0-3");
+    DO_TEST_HOSTNET("net-virtio-bridge-mq", 4, 0,
+                    "tap,fds=fd-net0-0:fd-net0-1:fd-net0-2:fd-net0-3,"
+                    "id=hostnet0");
+    DO_TEST_HOSTNET("net-virtio-bridge-mq", 1, 1,
+                    "tap,fd=fd-net0-0,id=hostnet0,vhost=on,"
+                    "vhostfd=vhostfd-net0-0");
     DO_TEST("net-eth", false, NONE);
     DO_TEST("net-eth-ifname", false, NONE);
     DO_TEST("net-eth-names", false, QEMU_CAPS_NET_NAME);
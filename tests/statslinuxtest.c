@@ -0,0 +1,238 @@
+/*
+ * statslinuxtest.c: Test parsing of netlink interface statistics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+
+#if defined(__linux__) && defined(HAVE_LIBNL)
+
+# include <errno.h>
+# include <sys/socket.h>
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+# include <linux/if_link.h>
+
+# include "internal.h"
+# include "virterror_internal.h"
+# include "stats_linux.h"
+
+/*
+ * RTM_NEWLINK messages as the kernel sends them: the link
+ * attributes follow the ifinfomsg, each padded to 4 bytes
+ */
+struct testLinkMsg64 {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifinfo;
+    struct nlattr nameattr;
+    char name[8];
+    struct nlattr statsattr;
+    struct rtnl_link_stats64 stats;
+} ATTRIBUTE_PACKED;
+
+struct testLinkMsg32 {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifinfo;
+    struct nlattr nameattr;
+    char name[8];
+    struct nlattr statsattr;
+    struct rtnl_link_stats stats;
+} ATTRIBUTE_PACKED;
+
+struct testLinkMsgNoStats {
+    struct nlmsghdr hdr;
+    struct ifinfomsg ifinfo;
+    struct nlattr nameattr;
+    char name[8];
+} ATTRIBUTE_PACKED;
+
+struct testErrorMsg {
+    struct nlmsghdr hdr;
+    struct nlmsgerr err;
+} ATTRIBUTE_PACKED;
+
+static struct testLinkMsg64 testMsg64 = {
+    .hdr = {
+        .nlmsg_len = sizeof(struct testLinkMsg64),
+        .nlmsg_type = RTM_NEWLINK,
+    },
+    .ifinfo = { .ifi_family = AF_UNSPEC, .ifi_index = 7 },
+    .nameattr = { .nla_len = NLA_HDRLEN + 6, .nla_type = IFLA_IFNAME },
+    .name = "vnet0",
+    .statsattr = {
+        .nla_len = NLA_HDRLEN + sizeof(struct rtnl_link_stats64),
+        .nla_type = IFLA_STATS64,
+    },
+    .stats = {
+        .rx_packets = 10, .tx_packets = 20,
+        .rx_bytes = 5000000000ULL, .tx_bytes = 6000000000ULL,
+        .rx_errors = 1, .tx_errors = 2,
+        .rx_dropped = 3, .tx_dropped = 4,
+    },
+};
+
+static struct testLinkMsg32 testMsg32 = {
+    .hdr = {
+        .nlmsg_len = sizeof(struct testLinkMsg32),
+        .nlmsg_type = RTM_NEWLINK,
+    },
+    .ifinfo = { .ifi_family = AF_UNSPEC, .ifi_index = 7 },
+    .nameattr = { .nla_len = NLA_HDRLEN + 6, .nla_type = IFLA_IFNAME },
+    .name = "vnet0",
+    .statsattr = {
+        .nla_len = NLA_HDRLEN + sizeof(struct rtnl_link_stats),
+        .nla_type = IFLA_STATS,
+    },
+    .stats = {
+        .rx_packets = 10, .tx_packets = 20,
+        .rx_bytes = 500, .tx_bytes = 600,
+        .rx_errors = 1, .tx_errors = 2,
+        .rx_dropped = 3, .tx_dropped = 4,
+    },
+};
+
+static struct testLinkMsgNoStats testMsgNoStats = {
+    .hdr = {
+        .nlmsg_len = sizeof(struct testLinkMsgNoStats),
+        .nlmsg_type = RTM_NEWLINK,
+    },
+    .ifinfo = { .ifi_family = AF_UNSPEC, .ifi_index = 7 },
+    .nameattr = { .nla_len = NLA_HDRLEN + 6, .nla_type = IFLA_IFNAME },
+    .name = "vnet0",
+};
+
+static struct testErrorMsg testMsgError = {
+    .hdr = {
+        .nlmsg_len = sizeof(struct testErrorMsg),
+        .nlmsg_type = NLMSG_ERROR,
+    },
+    .err = { .error = -ENODEV },
+};
+
+struct testInfo {
+    void *msg;
+    unsigned int len;
+    bool fail;
+    /* counters from the domain's point of view */
+    long long rx_bytes, rx_packets, rx_errs, rx_drop;
+    long long tx_bytes, tx_packets, tx_errs, tx_drop;
+};
+
+static void testQuietError(void *userData ATTRIBUTE_UNUSED,
+                           virErrorPtr error ATTRIBUTE_UNUSED)
+{
+    /* nada */
+}
+
+static int
+testParse(const void *data)
+{
+    const struct testInfo *info = data;
+    struct _virDomainInterfaceStats stats;
+    int rc;
+
+    memset(&stats, 0, sizeof(stats));
+
+    rc = linuxDomainInterfaceStatsParse("vnet0", info->msg, info->len,
+                                        &stats);
+    virResetLastError();
+
+    if (info->fail) {
+        if (rc == 0) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nParsing should have failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    if (stats.rx_bytes != info->rx_bytes ||
+        stats.rx_packets != info->rx_packets ||
+        stats.rx_errs != info->rx_errs ||
+        stats.rx_drop != info->rx_drop ||
+        stats.tx_bytes != info->tx_bytes ||
+        stats.tx_packets != info->tx_packets ||
+        stats.tx_errs != info->tx_errs ||
+        stats.tx_drop != info->tx_drop) {
+        if (virTestGetDebug())
+            fprintf(stderr,
+                    "\nExpected rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld,"
+                    " got rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld\n",
+                    info->rx_bytes, info->rx_packets,
+                    info->rx_errs, info->rx_drop,
+                    info->tx_bytes, info->tx_packets,
+                    info->tx_errs, info->tx_drop,
+                    stats.rx_bytes, stats.rx_packets,
+                    stats.rx_errs, stats.rx_drop,
+                    stats.tx_bytes, stats.tx_packets,
+                    stats.tx_errs, stats.tx_drop);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+# define DO_TEST(name, msg, len, fail, ...)                              \
+    do {                                                                \
+        static struct testInfo info = { msg, len, fail, __VA_ARGS__ };  \
+        if (virtTestRun("Interface stats " name, 1,                     \
+                        testParse, &info) < 0)                          \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* the host's TX is the domain's RX and vice versa */
+    DO_TEST("64 bit counters", &testMsg64, sizeof(testMsg64), false,
+            6000000000LL, 20, 2, 4, 5000000000LL, 10, 1, 3);
+    DO_TEST("32 bit counters", &testMsg32, sizeof(testMsg32), false,
+            600, 20, 2, 4, 500, 10, 1, 3);
+    DO_TEST("no counters", &testMsgNoStats, sizeof(testMsgNoStats), true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    DO_TEST("no device", &testMsgError, sizeof(testMsgError), true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    DO_TEST("truncated", &testMsg64, sizeof(testMsg64) - 8, true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    DO_TEST("short", &testMsg64, 8, true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* __linux__ && HAVE_LIBNL */
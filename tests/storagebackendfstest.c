@@ -0,0 +1,214 @@
+/*
+ * storagebackendfstest.c: Test the refresh of directory storage pools
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "storage_conf.h"
+#include "storage/storage_backend_fs.h"
+
+#define TEST_VOLUMES 32
+
+static char *
+testVolPath(const char *dir, int i)
+{
+    char *path;
+
+    if (virAsprintf(&path, "%s/vol-%02d.img", dir, i) < 0)
+        return NULL;
+    return path;
+}
+
+static int
+testVolCreate(const char *dir, int i, off_t size)
+{
+    char *path;
+    int fd = -1;
+    int ret = -1;
+
+    if (!(path = testVolPath(dir, i)))
+        return -1;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0 ||
+        ftruncate(fd, size) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    return ret;
+}
+
+/* Check that every volume of @pool was found with the size it has */
+static int
+testCheckVolumes(virStoragePoolObjPtr pool, off_t firstSize)
+{
+    int i;
+
+    if (pool->volumes.count != TEST_VOLUMES) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nExpected %d volumes, got %u\n",
+                    TEST_VOLUMES, pool->volumes.count);
+        return -1;
+    }
+
+    for (i = 0 ; i < TEST_VOLUMES ; i++) {
+        char name[32];
+        unsigned long long size = i ? (i + 1) * 1024 : firstSize;
+        virStorageVolDefPtr vol;
+
+        snprintf(name, sizeof(name), "vol-%02d.img", i);
+        if (!(vol = virStorageVolDefFindByName(pool, name))) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nVolume %s is missing\n", name);
+            return -1;
+        }
+        if (vol->capacity != size) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nVolume %s has capacity %llu, expected %llu\n",
+                        name, vol->capacity, size);
+            return -1;
+        }
+    }
+
+    if (pool->asyncjobs != 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nRefresh left %u jobs behind\n", pool->asyncjobs);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Refresh a directory pool twice, changing one of its files in
+ * between: the probe results kept from the first refresh must not
+ * hide the change, and stopping the pool must release them
+ */
+static int
+testDirRefresh(const void *data ATTRIBUTE_UNUSED)
+{
+    char template[] = "/tmp/libvirt_XXXXXX";
+    char *dir = NULL;
+    char *xml = NULL;
+    virStoragePoolObjPtr pool = NULL;
+    time_t created;
+    int i;
+    int ret = -1;
+
+    if (!(dir = mkdtemp(template)))
+        return -1;
+
+    for (i = 0 ; i < TEST_VOLUMES ; i++) {
+        if (testVolCreate(dir, i, (i + 1) * 1024) < 0)
+            goto cleanup;
+    }
+
+    /* Files changed within the current second are not remembered */
+    created = time(NULL);
+    while (time(NULL) <= created)
+        usleep(100 * 1000);
+
+    if (virAsprintf(&xml,
+                    "<pool type='dir'>"
+                    "<name>test</name>"
+                    "<target><path>%s</path></target>"
+                    "</pool>", dir) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC(pool) < 0)
+        goto cleanup;
+    if (virMutexInit(&pool->lock) < 0) {
+        VIR_FREE(pool);
+        goto cleanup;
+    }
+    virStoragePoolObjLock(pool);
+    if (!(pool->def = virStoragePoolDefParseString(xml)))
+        goto cleanup;
+    pool->active = 1;
+
+    if (virStorageBackendDirectory.refreshPool(NULL, pool) < 0 ||
+        testCheckVolumes(pool, 1024) < 0)
+        goto cleanup;
+
+    if (!pool->probed || virHashSize(pool->probed) != TEST_VOLUMES) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nProbe results were not kept\n");
+        goto cleanup;
+    }
+
+    if (testVolCreate(dir, 0, 64 * 1024) < 0)
+        goto cleanup;
+
+    virStoragePoolObjClearVols(pool);
+    if (virStorageBackendDirectory.refreshPool(NULL, pool) < 0 ||
+        testCheckVolumes(pool, 64 * 1024) < 0)
+        goto cleanup;
+
+    if (virStorageBackendDirectory.stopPool(NULL, pool) < 0)
+        goto cleanup;
+    if (pool->probed) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nProbe results outlived the pool\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0 ; i < TEST_VOLUMES ; i++) {
+        char *path = testVolPath(dir, i);
+        if (path)
+            unlink(path);
+        VIR_FREE(path);
+    }
+    rmdir(dir);
+    if (pool) {
+        virStoragePoolObjUnlock(pool);
+        virStoragePoolObjFree(pool);
+    }
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virtTestRun("Directory pool refresh", 1,
+                    testDirRefresh, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,227 @@
+/*
+ * storagebackendlogicaltest.c: Test the parsing of LVM reports
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "memory.h"
+#include "util.h"
+#include "storage_conf.h"
+#include "storage/storage_backend_logical.h"
+
+#define TEST_FIELDS_MAX 12
+
+struct testSplitData {
+    const char *line;
+    const char *prefix;
+    size_t nfields;
+    const char *fields[TEST_FIELDS_MAX]; /* NULL if the line is rejected */
+};
+
+/*
+ * A report line must split into exactly the fields asked for, with
+ * the command prefix, blanks and a trailing separator ignored
+ */
+static int
+testSplitLine(const void *opaque)
+{
+    const struct testSplitData *data = opaque;
+    char *fields[TEST_FIELDS_MAX];
+    char *line;
+    bool reject = data->fields[0] == NULL;
+    size_t i;
+    int ret = -1;
+
+    if (!(line = strdup(data->line)))
+        return -1;
+
+    if (virStorageBackendLogicalSplitLine(line, data->prefix, fields,
+                                          data->nfields) < 0) {
+        if (!reject && virTestGetDebug())
+            fprintf(stderr, "\nLine '%s' was rejected\n", data->line);
+        ret = reject ? 0 : -1;
+        goto cleanup;
+    }
+
+    if (reject) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nLine '%s' was accepted\n", data->line);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < data->nfields ; i++) {
+        if (STRNEQ(fields[i], data->fields[i])) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nField %zu is '%s', expected '%s'\n",
+                        i, fields[i], data->fields[i]);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(line);
+    return ret;
+}
+
+struct testExtentsData {
+    const char *devices;
+    int nextents;
+    const char *paths[4]; /* NULL if the value is rejected */
+    unsigned long long offsets[4];
+};
+
+#define TEST_EXTENT_LENGTH (8 * 1024 * 1024ULL)
+#define TEST_EXTENT_SIZE (4 * 1024 * 1024ULL)
+
+/*
+ * The devices value must give one extent per stripe, appended to
+ * whatever extents earlier segments of the volume gave
+ */
+static int
+testParseExtents(const void *opaque)
+{
+    const struct testExtentsData *data = opaque;
+    virStorageVolDefPtr vol = NULL;
+    char *devices = NULL;
+    bool reject = data->paths[0] == NULL;
+    int rc;
+    int i;
+    int ret = -1;
+
+    if (VIR_ALLOC(vol) < 0 ||
+        !(devices = strdup(data->devices)))
+        goto cleanup;
+
+    /* An extent from an earlier segment */
+    if (VIR_ALLOC_N(vol->source.extents, 1) < 0 ||
+        !(vol->source.extents[0].path = strdup("/dev/sda1")))
+        goto cleanup;
+    vol->source.nextent = 1;
+
+    rc = virStorageBackendLogicalParseExtents(vol, devices, data->nextents,
+                                              TEST_EXTENT_LENGTH,
+                                              TEST_EXTENT_SIZE);
+    if (reject) {
+        if (rc == 0) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nDevices '%s' were accepted\n",
+                        data->devices);
+            goto cleanup;
+        }
+        ret = 0;
+        goto cleanup;
+    }
+    if (rc < 0)
+        goto cleanup;
+
+    if (vol->source.nextent != data->nextents + 1 ||
+        STRNEQ(vol->source.extents[0].path, "/dev/sda1")) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nGot %d extents, expected %d\n",
+                    vol->source.nextent, data->nextents + 1);
+        goto cleanup;
+    }
+
+    for (i = 0 ; i < data->nextents ; i++) {
+        virStorageVolSourceExtentPtr extent = &vol->source.extents[i + 1];
+        unsigned long long start = data->offsets[i] * TEST_EXTENT_SIZE;
+
+        if (STRNEQ(extent->path, data->paths[i]) ||
+            extent->start != start ||
+            extent->end != start + TEST_EXTENT_LENGTH) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nExtent %d is %s %llu-%llu\n",
+                        i, extent->path, extent->start, extent->end);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    virStorageVolDefFree(vol);
+    VIR_FREE(devices);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST_SPLIT(name, line, prefix, nfields, ...)                 \
+    do {                                                                \
+        struct testSplitData data = {                                   \
+            line, prefix, nfields, { __VA_ARGS__ }                      \
+        };                                                              \
+        if (virtTestRun("Split " name, 1, testSplitLine, &data) < 0)    \
+            ret = -1;                                                   \
+    } while (0)
+
+#define DO_TEST_EXTENTS(name, devices, nextents, ...)                   \
+    do {                                                                \
+        struct testExtentsData data = { devices, nextents, __VA_ARGS__ }; \
+        if (virtTestRun("Extents " name, 1, testParseExtents, &data) < 0) \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_SPLIT("linear", "  RootLV##06UgP5#/dev/hda2(0)#linear#1#"
+                  "5234491392#33554432#5234491392#47#10603200512#4328521728",
+                  "lvs", 12,
+                  "RootLV", "", "06UgP5", "/dev/hda2(0)", "linear", "1",
+                  "5234491392", "33554432", "5234491392", "47",
+                  "10603200512", "4328521728");
+    DO_TEST_SPLIT("striped", "  Data##p0Xx2Q#/dev/sdb(0),/dev/sdc(0)#"
+                  "striped#2#1073741824#4194304#1073741824#9#"
+                  "2147483648#0",
+                  "lvs", 12,
+                  "Data", "", "p0Xx2Q", "/dev/sdb(0),/dev/sdc(0)",
+                  "striped", "2", "1073741824", "4194304", "1073741824",
+                  "9", "2147483648", "0");
+    DO_TEST_SPLIT("trailing separator", "  47#10603200512#4328521728#  ",
+                  "vgs", 3, "47", "10603200512", "4328521728");
+    DO_TEST_SPLIT("command prefix", "vgs  47#10603200512#4328521728",
+                  "vgs", 3, "47", "10603200512", "4328521728");
+    DO_TEST_SPLIT("empty volume group", "  3#10603200512#10603200512",
+                  "vgs", 3, "3", "10603200512", "10603200512");
+    DO_TEST_SPLIT("blank line", "   ", "lvs", 12, NULL);
+    DO_TEST_SPLIT("too few fields", "  47#10603200512", "vgs", 3, NULL);
+    DO_TEST_SPLIT("too many fields", "  47#1#2#3", "vgs", 3, NULL);
+
+    DO_TEST_EXTENTS("linear", "/dev/hda2(156)", 1,
+                    { "/dev/hda2" }, { 156 });
+    DO_TEST_EXTENTS("striped", "/dev/sdb(0),/dev/sdc(12),/dev/sdd(7)", 3,
+                    { "/dev/sdb", "/dev/sdc", "/dev/sdd" }, { 0, 12, 7 });
+    DO_TEST_EXTENTS("missing stripe", "/dev/sdb(0)", 2, { NULL });
+    DO_TEST_EXTENTS("extra stripe", "/dev/sdb(0),/dev/sdc(0)", 1, { NULL });
+    DO_TEST_EXTENTS("no offset", "/dev/sdb", 1, { NULL });
+    DO_TEST_EXTENTS("bad offset", "/dev/sdb(x)", 1, { NULL });
+    DO_TEST_EXTENTS("no path", "(0)", 1, { NULL });
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,580 @@
+/*
+ * storagedrivertest.c: Test the storage driver's tracking of pool volumes
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "testutils.h"
+
+#ifdef __linux__
+
+# include <unistd.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <sys/stat.h>
+# include <sys/inotify.h>
+
+# include "internal.h"
+# include "memory.h"
+# include "util.h"
+# include "virfile.h"
+# include "storage_conf.h"
+# include "storage/storage_driver.h"
+# include "storage/storage_backend_fs.h"
+
+# define TEST_VOLUMES 6
+# define TEST_GROWTH (64 * 1024)
+
+static char *
+testVolPath(const char *dir, int i)
+{
+    char *path;
+
+    if (virAsprintf(&path, "%s/vol-%02d.img", dir, i) < 0)
+        return NULL;
+    return path;
+}
+
+static int
+testVolCreate(const char *dir, int i)
+{
+    char *path;
+    int fd = -1;
+    int ret = -1;
+
+    if (!(path = testVolPath(dir, i)))
+        return -1;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0 ||
+        ftruncate(fd, 1024) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    return ret;
+}
+
+/* Append TEST_GROWTH bytes of data to volume @i, returning the file
+ * still open so that the watch does not hear of it */
+static int
+testVolGrow(const char *dir, int i)
+{
+    char buf[TEST_GROWTH];
+    char *path;
+    int fd = -1;
+
+    if (!(path = testVolPath(dir, i)))
+        return -1;
+
+    memset(buf, 'x', sizeof(buf));
+    if ((fd = open(path, O_WRONLY | O_APPEND)) < 0 ||
+        safewrite(fd, buf, sizeof(buf)) < 0 ||
+        fdatasync(fd) < 0)
+        VIR_FORCE_CLOSE(fd);
+
+    VIR_FREE(path);
+    return fd;
+}
+
+static int
+testVolRemove(const char *dir, int i)
+{
+    char *path;
+    int ret;
+
+    if (!(path = testVolPath(dir, i)))
+        return -1;
+
+    ret = unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+/* Hand whatever the watch has queued to the driver */
+static void
+testWatchDispatch(virStorageDriverStatePtr driver)
+{
+    struct pollfd fds = { driver->inotifyFD, POLLIN, 0 };
+
+    while (poll(&fds, 1, 0) == 1 && (fds.revents & POLLIN)) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+/* Whether volume @i of @pool is listed, with @capacity unless 0 */
+static bool
+testVolListed(virStoragePoolObjPtr pool, int i,
+              unsigned long long capacity)
+{
+    char name[32];
+    virStorageVolDefPtr vol;
+
+    snprintf(name, sizeof(name), "vol-%02d.img", i);
+    if (!(vol = virStorageVolDefFindByName(pool, name)))
+        return false;
+    return capacity == 0 || vol->capacity == capacity;
+}
+
+/*
+ * The watch updates the pool from a worker, so give it a few seconds
+ * to get volume @i listed (or not) as expected
+ */
+static int
+testWaitVol(virStoragePoolObjPtr pool, int i, bool listed,
+            unsigned long long capacity)
+{
+    int tries;
+    bool ok = false;
+
+    for (tries = 0 ; tries < 500 && !ok ; tries++) {
+        if (tries)
+            usleep(10 * 1000);
+        virStoragePoolObjLock(pool);
+        ok = testVolListed(pool, i, capacity) == listed;
+        virStoragePoolObjUnlock(pool);
+    }
+
+    if (!ok && virTestGetDebug())
+        fprintf(stderr, "\nVolume vol-%02d.img is %slisted\n",
+                i, listed ? "not " : "");
+    return ok ? 0 : -1;
+}
+
+/* Queue more events for the watch on @dir than inotify keeps, so
+ * that it reports an overflow */
+static int
+testWatchOverflow(const char *dir)
+{
+    FILE *fp;
+    unsigned int max;
+    unsigned int n;
+    char *paths[2];
+    int ret = -1;
+
+    if (!(fp = fopen("/proc/sys/fs/inotify/max_queued_events", "r")))
+        return -1;
+    if (fscanf(fp, "%u", &max) != 1)
+        max = 0;
+    VIR_FORCE_FCLOSE(fp);
+    if (max == 0 || max > 1024 * 1024)
+        return -1;
+
+    paths[0] = testVolPath(dir, 0);
+    paths[1] = testVolPath(dir, 2);
+    if (!paths[0] || !paths[1])
+        goto cleanup;
+
+    /* Alternate the files, as identical events in a row are merged */
+    for (n = 0 ; n <= max ; n++) {
+        if (chmod(paths[n % 2], 0600) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(paths[0]);
+    VIR_FREE(paths[1]);
+    return ret;
+}
+
+/*
+ * Change the files of a watched directory pool behind the driver's
+ * back: files created, removed or written out and closed must show up
+ * without a refresh, which then only updates the allocation of files
+ * written to while open.  Once the watch is lost, to another pool
+ * removing it or to an event queue overflow, a refresh must rescan
+ * the directory and watch it again.
+ */
+static int
+testWatch(const void *data ATTRIBUTE_UNUSED)
+{
+    char template[] = "/tmp/libvirt_XXXXXX";
+    char *dir = NULL;
+    char *xml = NULL;
+    virStorageDriverStatePtr driver = NULL;
+    virStoragePoolDefPtr def = NULL;
+    virStoragePoolObjPtr pool = NULL;
+    virStorageVolDefPtr vol;
+    unsigned long long grown = 1024 + TEST_GROWTH;
+    int fd = -1;
+    int i;
+    int ret = -1;
+
+    if (!(dir = mkdtemp(template)))
+        return -1;
+
+    for (i = 0 ; i < 3 ; i++) {
+        if (testVolCreate(dir, i) < 0)
+            goto cleanup;
+    }
+
+    if (virAsprintf(&xml,
+                    "<pool type='dir'>"
+                    "<name>test</name>"
+                    "<target><path>%s</path></target>"
+                    "</pool>", dir) < 0)
+        goto cleanup;
+
+    if (!(driver = storageDriverStateNew()))
+        goto cleanup;
+    storageDriverWatchInit(driver);
+    if (driver->inotifyFD < 0)
+        goto cleanup;
+
+    if (!(def = virStoragePoolDefParseString(xml)) ||
+        !(pool = virStoragePoolObjAssignDef(&driver->pools, def)))
+        goto cleanup;
+    def = NULL;
+    pool->active = 1;
+
+    if (storagePoolRefreshVolumes(NULL, driver, pool,
+                                  &virStorageBackendDirectory) < 0)
+        goto cleanup;
+    if (pool->watch <= 0 || pool->volumes.count != 3) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nPool is not watched or has %u volumes\n",
+                    pool->volumes.count);
+        goto cleanup;
+    }
+    virStoragePoolObjUnlock(pool);
+
+    /* Created, removed, and written to then closed */
+    if (testVolCreate(dir, 3) < 0 ||
+        testVolRemove(dir, 1) < 0 ||
+        (fd = testVolGrow(dir, 2)) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto relock;
+    testWatchDispatch(driver);
+    if (testWaitVol(pool, 3, true, 1024) < 0 ||
+        testWaitVol(pool, 1, false, 0) < 0 ||
+        testWaitVol(pool, 2, true, grown) < 0)
+        goto relock;
+
+    /* Written to while kept open, which the watch does not report */
+    if ((fd = testVolGrow(dir, 3)) < 0)
+        goto relock;
+    virStoragePoolObjLock(pool);
+    vol = virStorageVolDefFindByName(pool, "vol-03.img");
+    if (storagePoolRefreshVolumes(NULL, driver, pool,
+                                  &virStorageBackendDirectory) < 0)
+        goto cleanup;
+    if (virStorageVolDefFindByName(pool, "vol-03.img") != vol ||
+        vol->allocation < TEST_GROWTH) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nRefresh rescanned the pool or missed "
+                    "the allocation of vol-03.img\n");
+        goto cleanup;
+    }
+    virStoragePoolObjUnlock(pool);
+    if (VIR_CLOSE(fd) < 0)
+        goto relock;
+    testWatchDispatch(driver);
+    if (testWaitVol(pool, 3, true, grown) < 0)
+        goto relock;
+
+    /* Watch removed by another pool on the same directory */
+    virStoragePoolObjLock(pool);
+    if (inotify_rm_watch(driver->inotifyFD, pool->watch) < 0)
+        goto cleanup;
+    virStoragePoolObjUnlock(pool);
+    if (testVolCreate(dir, 4) < 0)
+        goto relock;
+    testWatchDispatch(driver);
+    virStoragePoolObjLock(pool);
+    if (pool->watch != 0 || !pool->watchStale ||
+        testVolListed(pool, 4, 0)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nLoss of the watch went unnoticed\n");
+        goto cleanup;
+    }
+    if (storagePoolRefreshVolumes(NULL, driver, pool,
+                                  &virStorageBackendDirectory) < 0)
+        goto cleanup;
+    if (pool->watch <= 0 || pool->watchStale ||
+        pool->volumes.count != 4 ||
+        !testVolListed(pool, 4, 1024) ||
+        !testVolListed(pool, 3, grown)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nRescan after losing the watch failed\n");
+        goto cleanup;
+    }
+    virStoragePoolObjUnlock(pool);
+
+    /* Events dropped from a full queue */
+    if (testWatchOverflow(dir) < 0 ||
+        testVolCreate(dir, 5) < 0)
+        goto relock;
+    testWatchDispatch(driver);
+    virStoragePoolObjLock(pool);
+    if (!pool->watchStale || pool->watch <= 0 ||
+        testVolListed(pool, 5, 0)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nQueue overflow went unnoticed\n");
+        goto cleanup;
+    }
+    if (storagePoolRefreshVolumes(NULL, driver, pool,
+                                  &virStorageBackendDirectory) < 0)
+        goto cleanup;
+    if (pool->watchStale ||
+        pool->volumes.count != 5 ||
+        !testVolListed(pool, 5, 1024)) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nRescan after the overflow failed\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+    goto cleanup;
+
+relock:
+    virStoragePoolObjLock(pool);
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (pool) {
+        storagePoolWatchStop(driver, pool);
+        virStorageBackendDirectory.stopPool(NULL, pool);
+        virStoragePoolObjUnlock(pool);
+    }
+    storageDriverStateFree(driver);
+    virStoragePoolDefFree(def);
+    for (i = 0 ; i < TEST_VOLUMES ; i++)
+        testVolRemove(dir, i);
+    rmdir(dir);
+    VIR_FREE(xml);
+    return ret;
+}
+
+
+/* Start a directory pool @name on @dir, unlocked on return */
+static virStoragePoolObjPtr
+testPoolStart(virStorageDriverStatePtr driver,
+              const char *name,
+              const char *dir)
+{
+    virStoragePoolDefPtr def = NULL;
+    virStoragePoolObjPtr pool = NULL;
+    char *xml = NULL;
+
+    if (virAsprintf(&xml,
+                    "<pool type='dir'>"
+                    "<name>%s</name>"
+                    "<target><path>%s</path></target>"
+                    "</pool>", name, dir) < 0 ||
+        !(def = virStoragePoolDefParseString(xml)) ||
+        !(pool = virStoragePoolObjAssignDef(&driver->pools, def)))
+        goto cleanup;
+    def = NULL;
+    pool->active = 1;
+
+    if (storagePoolRefreshVolumes(NULL, driver, pool,
+                                  &virStorageBackendDirectory) < 0) {
+        virStoragePoolObjUnlock(pool);
+        pool = NULL;
+        goto cleanup;
+    }
+    virStoragePoolObjUnlock(pool);
+
+cleanup:
+    virStoragePoolDefFree(def);
+    VIR_FREE(xml);
+    return pool;
+}
+
+static int
+testPoolRefresh(virStorageDriverStatePtr driver,
+                virStoragePoolObjPtr pool)
+{
+    int ret;
+
+    virStoragePoolObjLock(pool);
+    ret = storagePoolRefreshVolumes(NULL, driver, pool,
+                                    &virStorageBackendDirectory);
+    virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
+/* What storagePoolDestroy does to the volumes of @pool */
+static void
+testPoolDestroy(virStorageDriverStatePtr driver,
+                virStoragePoolObjPtr pool)
+{
+    virStoragePoolObjLock(pool);
+    virStorageBackendDirectory.stopPool(NULL, pool);
+    storagePoolIndexRemove(driver, pool);
+    virStoragePoolObjClearVols(pool);
+    pool->active = 0;
+    virStoragePoolObjUnlock(pool);
+}
+
+/* Check that the path of volume @i is indexed as part of pool @owner,
+ * or not indexed at all if @owner is NULL */
+static int
+testIndexOwner(virStorageDriverStatePtr driver,
+               const char *dir, int i,
+               const char *owner)
+{
+    char *path;
+    char *pool = NULL;
+    char *name = NULL;
+    char *key = NULL;
+    char expect[32];
+    int rc;
+    int ret = -1;
+
+    if (!(path = testVolPath(dir, i)))
+        return -1;
+    snprintf(expect, sizeof(expect), "vol-%02d.img", i);
+
+    if ((rc = storageVolIndexLookup(driver, path, &pool, &name, &key)) < 0)
+        goto cleanup;
+
+    if (owner ?
+        rc == 0 || STRNEQ(pool, owner) || STRNEQ(name, expect) :
+        rc != 0) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\n%s is indexed as %s/%s, expected %s/%s\n",
+                    path, NULLSTR(pool), NULLSTR(name),
+                    NULLSTR(owner), owner ? expect : "(null)");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(pool);
+    VIR_FREE(name);
+    VIR_FREE(key);
+    return ret;
+}
+
+/*
+ * Index the volumes of two pools on the same directory: the pool that
+ * indexed a path first answers for it, and whatever one pool drops,
+ * from a volume to all of them, leaves the other's ownership intact
+ */
+static int
+testIndexShared(const void *data ATTRIBUTE_UNUSED)
+{
+    char template[] = "/tmp/libvirt_XXXXXX";
+    char *dir = NULL;
+    virStorageDriverStatePtr driver = NULL;
+    virStoragePoolObjPtr a = NULL;
+    virStoragePoolObjPtr b = NULL;
+    virStorageVolDefPtr vol;
+    int i;
+    int ret = -1;
+
+    if (!(dir = mkdtemp(template)))
+        return -1;
+
+    for (i = 0 ; i < 2 ; i++) {
+        if (testVolCreate(dir, i) < 0)
+            goto cleanup;
+    }
+
+    if (!(driver = storageDriverStateNew()) ||
+        !(a = testPoolStart(driver, "a", dir)) ||
+        !(b = testPoolStart(driver, "b", dir)))
+        goto cleanup;
+
+    if (testIndexOwner(driver, dir, 0, "a") < 0 ||
+        testIndexOwner(driver, dir, 1, "a") < 0)
+        goto cleanup;
+
+    /* Volume deleted through one pool */
+    virStoragePoolObjLock(a);
+    if ((vol = virStorageVolDefFindByName(a, "vol-00.img")))
+        storageVolIndexRemove(driver, a, vol);
+    virStoragePoolObjUnlock(a);
+    if (!vol ||
+        testIndexOwner(driver, dir, 0, "b") < 0 ||
+        testIndexOwner(driver, dir, 1, "a") < 0)
+        goto cleanup;
+
+    /* Rebuilding the entries of one pool puts them behind the other's */
+    if (testPoolRefresh(driver, a) < 0 ||
+        testIndexOwner(driver, dir, 0, "b") < 0 ||
+        testIndexOwner(driver, dir, 1, "b") < 0)
+        goto cleanup;
+
+    /* File gone, with only one pool refreshed since */
+    if (testVolRemove(dir, 1) < 0 ||
+        testPoolRefresh(driver, a) < 0 ||
+        testIndexOwner(driver, dir, 1, "b") < 0 ||
+        testPoolRefresh(driver, b) < 0 ||
+        testIndexOwner(driver, dir, 1, NULL) < 0)
+        goto cleanup;
+
+    /* Pools destroyed, the first one twice over after refreshes */
+    if (testPoolRefresh(driver, a) < 0 ||
+        testIndexOwner(driver, dir, 0, "b") < 0)
+        goto cleanup;
+    testPoolDestroy(driver, b);
+    if (testIndexOwner(driver, dir, 0, "a") < 0)
+        goto cleanup;
+    testPoolDestroy(driver, a);
+    if (testIndexOwner(driver, dir, 0, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    storageDriverStateFree(driver);
+    for (i = 0 ; i < 2 ; i++)
+        testVolRemove(dir, i);
+    rmdir(dir);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+    if (virtTestRun("Directory pool watch", 1, testWatch, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Volume shared by pools", 1, testIndexShared, NULL) < 0)
+        ret = -1;
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else /* !__linux__ */
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* !__linux__ */
@@ -0,0 +1,297 @@
+/*
+ * storagefiletest.c: Test the cache of parsed image headers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "storage_file.h"
+
+/* Must match VIR_STORAGE_FILE_CACHE_MAX */
+#define TEST_CACHE_MAX 4096
+
+#define TEST_CAPACITY (1024 * 1024)
+#define TEST_BACKING_OFFSET 72
+
+static char *testDir;
+
+/* Write a qcow2 header for an image backed by @backing, if not NULL */
+static int
+testWriteImage(const char *path, const char *backing)
+{
+    unsigned char buf[512];
+    size_t len = backing ? strlen(backing) : 0;
+    unsigned long long capacity = TEST_CAPACITY;
+    int fd;
+    int i;
+    int ret = -1;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "QFI\xfb", 4);
+    buf[7] = 2; /* version */
+    if (backing) {
+        buf[15] = TEST_BACKING_OFFSET;
+        buf[16] = (len >> 24) & 0xff;
+        buf[17] = (len >> 16) & 0xff;
+        buf[18] = (len >> 8) & 0xff;
+        buf[19] = len & 0xff;
+        memcpy(buf + TEST_BACKING_OFFSET, backing, len);
+    }
+    for (i = 0 ; i < 8 ; i++)
+        buf[24 + i] = (capacity >> (56 - i * 8)) & 0xff;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        return -1;
+    if (safewrite(fd, buf, sizeof(buf)) != sizeof(buf))
+        goto cleanup;
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    return ret;
+}
+
+/* Files changed within the current second are not cached */
+static void
+testWaitNextSecond(void)
+{
+    time_t start = time(NULL);
+
+    while (time(NULL) <= start)
+        usleep(100 * 1000);
+}
+
+/* Get the metadata of the image open at @fd, telling by whether the
+ * descriptor was read from if it came from the cache */
+static int
+testProbe(const char *path,
+          int fd,
+          virStorageFileMetadata *meta,
+          bool *cached)
+{
+    if (lseek(fd, 1, SEEK_SET) != 1)
+        return -1;
+
+    if (virStorageFileGetMetadataFromFD(path, fd,
+                                        VIR_STORAGE_FILE_QCOW2, meta) < 0)
+        return -1;
+
+    *cached = lseek(fd, 0, SEEK_CUR) == 1;
+    return 0;
+}
+
+struct testBackingData {
+    const char *backing;
+    const char *expect; /* relative to testDir if a file */
+    bool isFile;
+};
+
+/*
+ * The backing store of an image must come out the same whether its
+ * header was read or found in the cache, and a new header written
+ * over it must show up
+ */
+static int
+testBacking(const void *opaque)
+{
+    const struct testBackingData *data = opaque;
+    virStorageFileMetadata meta;
+    char *path = NULL;
+    char *expect = NULL;
+    bool cached;
+    int fd = -1;
+    int i;
+    int ret = -1;
+
+    memset(&meta, 0, sizeof(meta));
+
+    if (virAsprintf(&path, "%s/overlay.qcow2", testDir) < 0)
+        goto cleanup;
+    if (data->isFile) {
+        if (virAsprintf(&expect, "%s/%s", testDir, data->expect) < 0)
+            goto cleanup;
+    } else if (!(expect = strdup(data->expect))) {
+        goto cleanup;
+    }
+
+    if (testWriteImage(path, "stale") < 0 ||
+        (fd = open(path, O_RDONLY)) < 0)
+        goto cleanup;
+    testWaitNextSecond();
+    if (testProbe(path, fd, &meta, &cached) < 0)
+        goto cleanup;
+    VIR_FREE(meta.backingStore);
+
+    /* Replacing the header must not leave the old one in use */
+    if (testWriteImage(path, data->backing) < 0)
+        goto cleanup;
+    testWaitNextSecond();
+
+    for (i = 0 ; i < 2 ; i++) {
+        if (testProbe(path, fd, &meta, &cached) < 0)
+            goto cleanup;
+
+        if (cached != (i == 1)) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nProbe %d %s the cache\n",
+                        i, cached ? "used" : "did not use");
+            goto cleanup;
+        }
+
+        if (STRNEQ_NULLABLE(meta.backingStore, expect) ||
+            meta.backingStoreIsFile != data->isFile ||
+            meta.capacity != TEST_CAPACITY) {
+            if (virTestGetDebug())
+                fprintf(stderr,
+                        "\nProbe %d found backing store '%s' (file %d), "
+                        "capacity %llu\n",
+                        i, NULLSTR(meta.backingStore),
+                        meta.backingStoreIsFile, meta.capacity);
+            goto cleanup;
+        }
+        VIR_FREE(meta.backingStore);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(meta.backingStore);
+    VIR_FREE(expect);
+    VIR_FREE(path);
+    return ret;
+}
+
+/*
+ * A full cache must drop the entry that was used longest ago, not
+ * the ones in use.  Entries are keyed on the path too, so one file
+ * probed under many names fills the cache.
+ */
+static int
+testEviction(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virStorageFileMetadata meta;
+    char *path = NULL;
+    char *name = NULL;
+    bool cached;
+    int fd = -1;
+    int i;
+    int ret = -1;
+
+    memset(&meta, 0, sizeof(meta));
+
+    if (virAsprintf(&path, "%s/lru.qcow2", testDir) < 0 ||
+        testWriteImage(path, NULL) < 0 ||
+        (fd = open(path, O_RDONLY)) < 0)
+        goto cleanup;
+    testWaitNextSecond();
+
+    for (i = 0 ; i <= TEST_CACHE_MAX ; i++) {
+        VIR_FREE(name);
+        if (virAsprintf(&name, "%s/%d/lru.qcow2", testDir, i) < 0 ||
+            testProbe(name, fd, &meta, &cached) < 0)
+            goto cleanup;
+
+        /* Keep the first entry in use while the cache fills up */
+        if (i == TEST_CACHE_MAX - 1) {
+            char *first;
+            if (virAsprintf(&first, "%s/0/lru.qcow2", testDir) < 0)
+                goto cleanup;
+            if (testProbe(first, fd, &meta, &cached) < 0 || !cached) {
+                VIR_FREE(first);
+                if (virTestGetDebug())
+                    fprintf(stderr, "\nFirst entry was not cached\n");
+                goto cleanup;
+            }
+            VIR_FREE(first);
+        }
+    }
+
+    VIR_FREE(name);
+    if (virAsprintf(&name, "%s/0/lru.qcow2", testDir) < 0 ||
+        testProbe(name, fd, &meta, &cached) < 0)
+        goto cleanup;
+    if (!cached) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nEntry in use was evicted\n");
+        goto cleanup;
+    }
+
+    VIR_FREE(name);
+    if (virAsprintf(&name, "%s/1/lru.qcow2", testDir) < 0 ||
+        testProbe(name, fd, &meta, &cached) < 0)
+        goto cleanup;
+    if (cached) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nLeast recently used entry was kept\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(name);
+    VIR_FREE(path);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    if (!(testDir = mkdtemp(template)))
+        return EXIT_FAILURE;
+
+#define DO_TEST_BACKING(backing, expect, isFile)                        \
+    do {                                                                \
+        struct testBackingData data = { backing, expect, isFile };      \
+        if (virtTestRun("Backing store " backing, 1,                    \
+                        testBacking, &data) < 0)                        \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_BACKING("base.img", "base.img", true);
+    DO_TEST_BACKING("nbd:localhost:10809", "nbd:localhost:10809", false);
+
+    if (virtTestRun("Cache eviction", 1, testEviction, NULL) < 0)
+        ret = -1;
+
+    rmdir(testDir);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
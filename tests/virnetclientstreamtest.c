@@ -0,0 +1,234 @@
+/*
+ * virnetclientstreamtest.c: Test the client side of RPC streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+
+#include "rpc/virnetclientstream.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#define TEST_PROGRAM 0x11223344
+#define TEST_PROC 0x666
+#define TEST_SERIAL 0x99
+
+/*
+ * Build a message as it comes off the wire, with the header
+ * decoded and the payload left to read
+ */
+static virNetMessagePtr
+testStreamMessage(int type, const char *data, long long hole)
+{
+    virNetMessagePtr msg;
+    virNetStreamHole payload = { hole, 0 };
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = TEST_PROGRAM;
+    msg->header.vers = 1;
+    msg->header.proc = TEST_PROC;
+    msg->header.type = type;
+    msg->header.serial = TEST_SERIAL;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto error;
+
+    if (type == VIR_NET_STREAM_HOLE) {
+        if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                       &payload) < 0)
+            goto error;
+    } else if (virNetMessageEncodePayloadRaw(msg, data,
+                                             data ? strlen(data) : 0) < 0) {
+        goto error;
+    }
+
+    msg->bufferOffset = 0;
+    msg->bufferLength = VIR_NET_MESSAGE_LEN_MAX;
+    if (virNetMessageDecodeLength(msg) < 0 ||
+        virNetMessageDecodeHeader(msg) < 0)
+        goto error;
+
+    return msg;
+
+error:
+    virNetMessageFree(msg);
+    return NULL;
+}
+
+/* Queue data, two holes in a row, more data, then the end */
+static virNetClientStreamPtr
+testStreamNew(virNetClientProgramPtr prog)
+{
+    virNetClientStreamPtr st;
+    virNetMessagePtr msg = NULL;
+
+    if (!(st = virNetClientStreamNew(prog, TEST_PROC, TEST_SERIAL)))
+        return NULL;
+
+    if (!(msg = testStreamMessage(VIR_NET_STREAM, "abc", 0)) ||
+        virNetClientStreamQueuePacket(st, msg) < 0)
+        goto error;
+    virNetMessageFree(msg);
+
+    if (!(msg = testStreamMessage(VIR_NET_STREAM_HOLE, NULL, 10)) ||
+        virNetClientStreamQueueHole(st, msg) < 0)
+        goto error;
+    virNetMessageFree(msg);
+
+    if (!(msg = testStreamMessage(VIR_NET_STREAM_HOLE, NULL, 5)) ||
+        virNetClientStreamQueueHole(st, msg) < 0)
+        goto error;
+    virNetMessageFree(msg);
+
+    if (!(msg = testStreamMessage(VIR_NET_STREAM, "defg", 0)) ||
+        virNetClientStreamQueuePacket(st, msg) < 0)
+        goto error;
+    virNetMessageFree(msg);
+
+    if (!(msg = testStreamMessage(VIR_NET_STREAM, NULL, 0)) ||
+        virNetClientStreamQueuePacket(st, msg) < 0)
+        goto error;
+    virNetMessageFree(msg);
+
+    return st;
+
+error:
+    virNetMessageFree(msg);
+    virNetClientStreamFree(st);
+    return NULL;
+}
+
+static int
+testStreamRecv(virNetClientStreamPtr st, unsigned int flags,
+               int expect, const char *data)
+{
+    char buf[100];
+    int got;
+
+    memset(buf, 'x', sizeof(buf));
+    got = virNetClientStreamRecvPacket(st, NULL, buf, sizeof(buf),
+                                       true, flags);
+    if (got != expect) {
+        VIR_DEBUG("Expect to receive %d got %d", expect, got);
+        return -1;
+    }
+    if (data && memcmp(buf, data, expect) != 0) {
+        VIR_DEBUG("Received data does not match '%s'", data);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * A reader that stops at holes must get the data up to a hole, then
+ * the holes with nothing between them as one, then the data after
+ */
+static int testStreamHoleStop(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetClientProgramPtr prog;
+    virNetClientStreamPtr st = NULL;
+    long long len;
+    int ret = -1;
+
+    if (!(prog = virNetClientProgramNew(TEST_PROGRAM, 1, NULL, 0, NULL)))
+        return -1;
+    if (!(st = testStreamNew(prog)))
+        goto cleanup;
+
+    if (testStreamRecv(st, VIR_STREAM_RECV_STOP_AT_HOLE, 3, "abc") < 0 ||
+        testStreamRecv(st, VIR_STREAM_RECV_STOP_AT_HOLE, -3, NULL) < 0)
+        goto cleanup;
+
+    if (virNetClientStreamRecvHole(st, &len, 0) < 0)
+        goto cleanup;
+    if (len != 15) {
+        VIR_DEBUG("Expect hole length 15 got %lld", len);
+        goto cleanup;
+    }
+
+    if (testStreamRecv(st, VIR_STREAM_RECV_STOP_AT_HOLE, 4, "defg") < 0 ||
+        testStreamRecv(st, VIR_STREAM_RECV_STOP_AT_HOLE, 0, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (st)
+        virNetClientStreamFree(st);
+    virNetClientProgramFree(prog);
+    return ret;
+}
+
+/*
+ * A reader that does not ask for holes must get them as zeros
+ */
+static int testStreamHoleZeros(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virNetClientProgramPtr prog;
+    virNetClientStreamPtr st = NULL;
+    char zeros[15] = { 0 };
+    int ret = -1;
+
+    if (!(prog = virNetClientProgramNew(TEST_PROGRAM, 1, NULL, 0, NULL)))
+        return -1;
+    if (!(st = testStreamNew(prog)))
+        goto cleanup;
+
+    if (testStreamRecv(st, 0, 3, "abc") < 0 ||
+        testStreamRecv(st, 0, sizeof(zeros), zeros) < 0 ||
+        testStreamRecv(st, 0, 4, "defg") < 0 ||
+        testStreamRecv(st, 0, 0, NULL) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (st)
+        virNetClientStreamFree(st);
+    virNetClientProgramFree(prog);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (virtTestRun("Stream hole stop", 1, testStreamHoleStop, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Stream hole zeros", 1, testStreamHoleZeros, NULL) < 0)
+        ret = -1;
+
+    return (ret==0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+VIRT_TEST_MAIN(mymain)
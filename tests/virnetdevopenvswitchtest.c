@@ -0,0 +1,143 @@
+/*
+ * virnetdevopenvswitchtest.c: Test parsing of Open vSwitch statistics
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "internal.h"
+#include "virterror_internal.h"
+#include "virnetdevopenvswitch.h"
+
+/* ovs-vsctl --columns=name,statistics list Interface */
+static const char *testOutput =
+    "name                : br0\n"
+    "statistics          : {collisions=0, rx_bytes=0, rx_crc_err=0, "
+    "rx_dropped=0, rx_errors=0, rx_frame_err=0, rx_over_err=0, "
+    "rx_packets=0, tx_bytes=0, tx_dropped=0, tx_errors=0, tx_packets=0}\n"
+    "\n"
+    "name                : vnet0\n"
+    "statistics          : {collisions=0, rx_bytes=5000000000, "
+    "rx_crc_err=0, rx_dropped=3, rx_errors=1, rx_frame_err=0, "
+    "rx_over_err=0, rx_packets=10, tx_bytes=6000000000, tx_dropped=4, "
+    "tx_errors=2, tx_packets=20}\n"
+    "\n"
+    "name                : \"vnet-1.0\"\n"
+    "statistics          : {rx_bytes=500, rx_packets=5, tx_bytes=600, "
+    "tx_packets=6}\n"
+    "\n"
+    "name                : vnet2\n"
+    "statistics          : {}\n";
+
+struct testInfo {
+    const char *ifname;
+    bool fail;
+    /* counters from the domain's point of view */
+    long long rx_bytes, rx_packets, rx_errs, rx_drop;
+    long long tx_bytes, tx_packets, tx_errs, tx_drop;
+};
+
+static void testQuietError(void *userData ATTRIBUTE_UNUSED,
+                           virErrorPtr error ATTRIBUTE_UNUSED)
+{
+    /* nada */
+}
+
+static int
+testParse(const void *data)
+{
+    const struct testInfo *info = data;
+    struct _virDomainInterfaceStats stats;
+    int rc;
+
+    memset(&stats, 0, sizeof(stats));
+
+    rc = virNetDevOpenvswitchParseStats(testOutput, info->ifname, &stats);
+    virResetLastError();
+
+    if (info->fail) {
+        if (rc == 0) {
+            if (virTestGetDebug())
+                fprintf(stderr, "\nParsing should have failed\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (rc < 0)
+        return -1;
+
+    if (stats.rx_bytes != info->rx_bytes ||
+        stats.rx_packets != info->rx_packets ||
+        stats.rx_errs != info->rx_errs ||
+        stats.rx_drop != info->rx_drop ||
+        stats.tx_bytes != info->tx_bytes ||
+        stats.tx_packets != info->tx_packets ||
+        stats.tx_errs != info->tx_errs ||
+        stats.tx_drop != info->tx_drop) {
+        if (virTestGetDebug())
+            fprintf(stderr,
+                    "\nExpected rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld,"
+                    " got rx %lld/%lld/%lld/%lld tx %lld/%lld/%lld/%lld\n",
+                    info->rx_bytes, info->rx_packets,
+                    info->rx_errs, info->rx_drop,
+                    info->tx_bytes, info->tx_packets,
+                    info->tx_errs, info->tx_drop,
+                    stats.rx_bytes, stats.rx_packets,
+                    stats.rx_errs, stats.rx_drop,
+                    stats.tx_bytes, stats.tx_packets,
+                    stats.tx_errs, stats.tx_drop);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+#define DO_TEST(name, ifname, fail, ...)                                \
+    do {                                                                \
+        static struct testInfo info = { ifname, fail, __VA_ARGS__ };    \
+        if (virtTestRun("OVS stats " name, 1, testParse, &info) < 0)    \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* the host's TX is the domain's RX and vice versa */
+    DO_TEST("all counters", "vnet0", false,
+            6000000000LL, 20, 2, 4, 5000000000LL, 10, 1, 3);
+    DO_TEST("quoted name", "vnet-1.0", false,
+            600, 6, -1, -1, 500, 5, -1, -1);
+    DO_TEST("no counters", "vnet2", true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    DO_TEST("unknown port", "vnet3", true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+    DO_TEST("name prefix", "vnet", true,
+            0, 0, 0, 0, 0, 0, 0, 0);
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
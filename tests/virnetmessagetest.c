@@ -483,6 +483,86 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
     return 0;
 }
 
+/*
+ * A hole in a stream is sent as a VIR_NET_STREAM_HOLE message
+ * whose payload gives its length, and must come back out intact
+ */
+static int testMessagePayloadStreamHole(const void *args ATTRIBUTE_UNUSED)
+{
+    static virNetMessage msg;
+    virNetStreamHole hole = { 0x100002000LL, 0 };
+    static const char expect[] = {
+        0x00, 0x00, 0x00, 0x28,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x06,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x02,  /* Status */
+
+        0x00, 0x00, 0x00, 0x01,  /* Hole length */
+        0x00, 0x00, 0x20, 0x00,
+        0x00, 0x00, 0x00, 0x00,  /* Hole flags */
+    };
+    memset(&msg, 0, sizeof(msg));
+
+    msg.header.prog = 0x11223344;
+    msg.header.vers = 0x01;
+    msg.header.proc = 0x666;
+    msg.header.type = VIR_NET_STREAM_HOLE;
+    msg.header.serial = 0x99;
+    msg.header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(&msg) < 0)
+        return -1;
+
+    if (virNetMessageEncodePayload(&msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &hole) < 0)
+        return -1;
+
+    if (ARRAY_CARDINALITY(expect) != msg.bufferLength) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  sizeof(expect), msg.bufferLength);
+        return -1;
+    }
+
+    if (memcmp(expect, msg.buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg.buffer, sizeof(expect));
+        return -1;
+    }
+
+    memset(&hole, 0, sizeof(hole));
+    memset(&msg.header, 0, sizeof(msg.header));
+    msg.bufferOffset = 0;
+    msg.bufferLength = 0x4;
+
+    if (virNetMessageDecodeLength(&msg) < 0 ||
+        virNetMessageDecodeHeader(&msg) < 0) {
+        VIR_DEBUG("Failed to decode message header");
+        return -1;
+    }
+
+    if (msg.header.type != VIR_NET_STREAM_HOLE) {
+        VIR_DEBUG("Expect message type %d got %d",
+                  VIR_NET_STREAM_HOLE, msg.header.type);
+        return -1;
+    }
+
+    if (virNetMessageDecodePayload(&msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &hole) < 0) {
+        VIR_DEBUG("Failed to decode message payload");
+        return -1;
+    }
+
+    if (hole.length != 0x100002000LL || hole.flags != 0) {
+        VIR_DEBUG("Expect hole length %lld got %lld flags %u",
+                  0x100002000LL, (long long)hole.length, hole.flags);
+        return -1;
+    }
+
+    return 0;
+}
+
 
 static int
 mymain(void)
@@ -506,6 +586,9 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Payload Stream Hole", 1, testMessagePayloadStreamHole, NULL) < 0)
+        ret = -1;
+
     return (ret==0 ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
@@ -0,0 +1,434 @@
+/*
+ * virnetserverclienttest.c: Test the server side of RPC connections
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <signal.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "virterror_internal.h"
+#include "memory.h"
+#include "logging.h"
+#include "virfile.h"
+
+#include "rpc/virnetsocket.h"
+#include "rpc/virnetserverclient.h"
+#include "rpc/virnetserverservice.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+#ifndef WIN32
+struct testClientData {
+    char *tmpdir;
+    char *path;
+    virNetSocketPtr lsock; /* Listen socket */
+    virNetSocketPtr csock; /* Client socket */
+    virNetServerClientPtr client;
+};
+
+
+static void
+testClientDataFree(struct testClientData *data)
+{
+    if (data->client) {
+        virNetServerClientClose(data->client);
+        virNetServerClientFree(data->client);
+    }
+    virNetSocketFree(data->lsock);
+    virNetSocketFree(data->csock);
+    if (data->path)
+        unlink(data->path);
+    VIR_FREE(data->path);
+    if (data->tmpdir)
+        rmdir(data->tmpdir);
+    VIR_FREE(data->tmpdir);
+}
+
+
+/*
+ * Connect a socket over UNIX to a server side client object,
+ * which is not registered with the event loop, so anything it
+ * queues for transmission stays queued
+ */
+static int
+testClientDataNew(struct testClientData *data)
+{
+    char template[] = "/tmp/libvirt_XXXXXX";
+    virNetSocketPtr ssock = NULL; /* Server socket */
+
+    memset(data, 0, sizeof(*data));
+
+    if (!mkdtemp(template)) {
+        VIR_WARN("Failed to create temporary directory");
+        goto error;
+    }
+    if (!(data->tmpdir = strdup(template))) {
+        rmdir(template);
+        virReportOOMError();
+        goto error;
+    }
+    if (virAsprintf(&data->path, "%s/test.sock", data->tmpdir) < 0)
+        goto error;
+
+    if (virNetSocketNewListenUNIX(data->path, 0700, -1, getgid(),
+                                  &data->lsock) < 0)
+        goto error;
+
+    if (virNetSocketListen(data->lsock, 0) < 0)
+        goto error;
+
+    if (virNetSocketNewConnectUNIX(data->path, false, NULL, &data->csock) < 0)
+        goto error;
+
+    if (virNetSocketAccept(data->lsock, &ssock) < 0 || !ssock)
+        goto error;
+
+    if (!(data->client = virNetServerClientNew(ssock,
+                                               VIR_NET_SERVER_SERVICE_AUTH_NONE,
+                                               false, 1, NULL))) {
+        virNetSocketFree(ssock);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    testClientDataFree(data);
+    return -1;
+}
+
+
+# define TEST_EVENT_PROC_LOST 0x777
+# define TEST_EVENT_LEN (VIR_NET_MESSAGE_LEN_MAX + VIR_NET_MESSAGE_HEADER_MAX)
+
+static unsigned long long testEventsLost;
+
+static virNetMessagePtr
+testClientEventNew(int proc)
+{
+    virNetMessagePtr msg;
+
+    if (!(msg = virNetMessageNew(false)))
+        return NULL;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = proc;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 1;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayloadEmpty(msg) < 0) {
+        virNetMessageFree(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
+static virNetMessagePtr
+testClientEventsLost(virNetServerClientPtr client ATTRIBUTE_UNUSED,
+                     unsigned long long count)
+{
+    testEventsLost += count;
+    return testClientEventNew(TEST_EVENT_PROC_LOST);
+}
+
+static void
+testClientTimer(int timer ATTRIBUTE_UNUSED, void *opaque ATTRIBUTE_UNUSED)
+{
+}
+
+/*
+ * Run the event loop until @len bytes sent by the server side
+ * client have been read into @buf
+ */
+static int
+testClientReceive(struct testClientData *data, char *buf, size_t len)
+{
+    size_t got = 0;
+    int loops = 0;
+    int timer;
+    int ret = -1;
+
+    /* Wake up now and then in case the client never writes */
+    if ((timer = virEventAddTimeout(10, testClientTimer, NULL, NULL)) < 0)
+        return -1;
+
+    while (got < len) {
+        ssize_t rv = 0;
+
+        if (++loops > 1000) {
+            VIR_DEBUG("Message not sent, %zu of %zu bytes received",
+                      got, len);
+            goto cleanup;
+        }
+        if (virEventRunDefaultImpl() < 0)
+            goto cleanup;
+
+        while (got < len &&
+               (rv = virNetSocketRead(data->csock, buf + got,
+                                      len - got)) > 0)
+            got += rv;
+        if (got < len && rv < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virEventRemoveTimeout(timer);
+    return ret;
+}
+
+/* The procedure of the @n'th message of TEST_EVENT_LEN bytes in @buf,
+ * which follows the length, program and version in the header */
+static int
+testClientEventProc(const char *buf, int n)
+{
+    const unsigned char *proc = (const unsigned char *)buf +
+        n * TEST_EVENT_LEN + VIR_NET_MESSAGE_LEN_MAX + 8;
+
+    return (proc[0] << 24) | (proc[1] << 16) | (proc[2] << 8) | proc[3];
+}
+
+/*
+ * A client that never reads its events must not make the
+ * daemon queue them without bound, nor lose them silently:
+ * once its event queue is full, further events are dropped,
+ * and the client is told how many once it catches up
+ */
+static int testClientEventQueueLimit(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testClientData data;
+    virNetMessagePtr msg = NULL;
+    char received[TEST_EVENT_LEN * 5];
+    int ret = -1;
+    int i;
+
+    if (testClientDataNew(&data) < 0)
+        return -1;
+
+    testEventsLost = 0;
+    virNetServerClientSetMaxEvents(data.client, 3);
+    virNetServerClientSetEventsLostHook(data.client, testClientEventsLost);
+
+    for (i = 0 ; i < 3 ; i++) {
+        if (!(msg = testClientEventNew(i)))
+            goto cleanup;
+        if (virNetServerClientSendEvent(data.client, msg) < 0) {
+            VIR_DEBUG("Event %d was refused below the limit", i);
+            goto cleanup;
+        }
+        msg = NULL;
+    }
+
+    for (i = 3 ; i < 5 ; i++) {
+        if (!(msg = testClientEventNew(i)))
+            goto cleanup;
+        if (virNetServerClientSendEvent(data.client, msg) == 0) {
+            msg = NULL;
+            VIR_DEBUG("Event %d was queued beyond the limit", i);
+            goto cleanup;
+        }
+        virNetMessageFree(msg);
+        msg = NULL;
+    }
+
+    if (virNetServerClientWantClose(data.client)) {
+        VIR_DEBUG("Client was closed when its event queue overflowed");
+        goto cleanup;
+    }
+    if (testEventsLost != 0) {
+        VIR_DEBUG("Client was told of lost events before catching up");
+        goto cleanup;
+    }
+
+    /* Once the client reads its events, the notice follows them */
+    if (virNetServerClientInit(data.client) < 0 ||
+        testClientReceive(&data, received, TEST_EVENT_LEN * 4) < 0)
+        goto cleanup;
+
+    for (i = 0 ; i < 4 ; i++) {
+        int proc = testClientEventProc(received, i);
+        int want = i < 3 ? i : TEST_EVENT_PROC_LOST;
+
+        if (proc != want) {
+            VIR_DEBUG("Message %d has procedure %x, expected %x",
+                      i, proc, want);
+            goto cleanup;
+        }
+    }
+    if (testEventsLost != 2) {
+        VIR_DEBUG("Client was told of %llu lost events, expected 2",
+                  testEventsLost);
+        goto cleanup;
+    }
+
+    /* With room in the queue again, events flow without a notice */
+    if (!(msg = testClientEventNew(5)))
+        goto cleanup;
+    if (virNetServerClientSendEvent(data.client, msg) < 0)
+        goto cleanup;
+    msg = NULL;
+
+    if (testClientReceive(&data, received, TEST_EVENT_LEN) < 0)
+        goto cleanup;
+    if (testClientEventProc(received, 0) != 5 ||
+        testEventsLost != 2) {
+        VIR_DEBUG("Unexpected message after the queue drained");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetMessageFree(msg);
+    testClientDataFree(&data);
+    return ret;
+}
+
+
+# ifdef __linux__
+/* Small enough to sit in a pipe without blocking the writer */
+#  define TEST_SPLICE_LEN (48 * 1024)
+
+/*
+ * Stream data left in a pipe must reach the client socket right
+ * after the message header, as if it had been in the buffer
+ */
+static int testClientStreamSplice(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testClientData data;
+    virNetMessagePtr msg = NULL;
+    int pipefd[2] = { -1, -1 };
+    char *payload = NULL;
+    char *received = NULL;
+    size_t headerLen;
+    size_t want;
+    unsigned int length;
+    int ret = -1;
+    int i;
+
+    if (testClientDataNew(&data) < 0)
+        return -1;
+
+    if (!virNetServerClientCanSplice(data.client)) {
+        VIR_DEBUG("Plain UNIX socket client cannot splice");
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(payload, TEST_SPLICE_LEN) < 0 ||
+        VIR_ALLOC_N(received, VIR_NET_MESSAGE_LEN_MAX +
+                    VIR_NET_MESSAGE_HEADER_MAX + TEST_SPLICE_LEN) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    for (i = 0 ; i < TEST_SPLICE_LEN ; i++)
+        payload[i] = i % 251;
+
+    if (pipe(pipefd) < 0 ||
+        safewrite(pipefd[1], payload, TEST_SPLICE_LEN) != TEST_SPLICE_LEN)
+        goto cleanup;
+
+    if (!(msg = virNetMessageNew(false)))
+        goto cleanup;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+    headerLen = msg->bufferOffset;
+    want = headerLen + TEST_SPLICE_LEN;
+
+    if (virNetMessageEncodePayloadSplice(msg, pipefd[0],
+                                         TEST_SPLICE_LEN) < 0)
+        goto cleanup;
+    pipefd[0] = -1;
+
+    if (virNetServerClientSendMessage(data.client, msg) < 0)
+        goto cleanup;
+    msg = NULL;
+
+    /* Let the event loop write the message out */
+    if (virNetServerClientInit(data.client) < 0 ||
+        testClientReceive(&data, received, want) < 0)
+        goto cleanup;
+
+    length = ((unsigned char) received[0] << 24) |
+        ((unsigned char) received[1] << 16) |
+        ((unsigned char) received[2] << 8) |
+        (unsigned char) received[3];
+    if (length != want) {
+        VIR_DEBUG("Expect message length %zu got %u", want, length);
+        goto cleanup;
+    }
+
+    if (memcmp(received + headerLen, payload, TEST_SPLICE_LEN) != 0) {
+        VIR_DEBUG("Spliced payload does not match");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FREE(payload);
+    VIR_FREE(received);
+    virNetMessageFree(msg);
+    testClientDataFree(&data);
+    return ret;
+}
+# endif
+#endif
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (virEventRegisterDefaultImpl() < 0)
+        return EXIT_FAILURE;
+
+#ifndef WIN32
+    if (virtTestRun("Client event queue limit", 1,
+                    testClientEventQueueLimit, NULL) < 0)
+        ret = -1;
+# ifdef __linux__
+    if (virtTestRun("Client stream splice", 1,
+                    testClientStreamSplice, NULL) < 0)
+        ret = -1;
+# endif
+#endif
+
+    return (ret==0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+VIRT_TEST_MAIN(mymain)
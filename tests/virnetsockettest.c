@@ -446,6 +446,149 @@ cleanup:
 #endif
 
 
+#ifdef __linux__
+# define STREAM_CHUNK (16 * 1024)
+# define STREAM_TOTAL (256 * 1024)
+
+/* Byte @offset of the test stream */
+# define STREAM_BYTE(offset) ((char) ((offset) % 251))
+
+/* Pull whatever has arrived off the receiving socket, checking
+ * that it is what was sent */
+static int
+testSocketStreamDrain(virNetSocketPtr sock, char *buf, size_t *received)
+{
+    ssize_t got;
+    ssize_t i;
+
+    while ((got = virNetSocketRead(sock, buf, STREAM_CHUNK)) > 0) {
+        for (i = 0 ; i < got ; i++) {
+            if (buf[i] != STREAM_BYTE(*received + i)) {
+                VIR_DEBUG("Wrong byte received at offset %zu",
+                          *received + i);
+                return -1;
+            }
+        }
+        *received += got;
+    }
+
+    return got < 0 ? -1 : 0;
+}
+
+/*
+ * Push stream data from a pipe into a UNIX socket the way the
+ * daemon does, either copied through a buffer or spliced, and
+ * check that it all comes out the other end unchanged
+ */
+static int testSocketStream(const void *opaque)
+{
+    const bool *splice = opaque;
+    virNetSocketPtr lsock = NULL; /* Listen socket */
+    virNetSocketPtr ssock = NULL; /* Server socket */
+    virNetSocketPtr csock = NULL; /* Client socket */
+    int pipefd[2] = { -1, -1 };
+    char *src = NULL;
+    char *copy = NULL;
+    char *sink = NULL;
+    size_t sent = 0;
+    size_t received = 0;
+    int ret = -1;
+
+    char *path = NULL;
+    char *tmpdir;
+    char template[] = "/tmp/libvirt_XXXXXX";
+
+    tmpdir = mkdtemp(template);
+    if (tmpdir == NULL) {
+        VIR_WARN("Failed to create temporary directory");
+        goto cleanup;
+    }
+    if (virAsprintf(&path, "%s/test.sock", tmpdir) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewListenUNIX(path, 0700, -1, getgid(), &lsock) < 0)
+        goto cleanup;
+
+    if (virNetSocketListen(lsock, 0) < 0)
+        goto cleanup;
+
+    if (virNetSocketNewConnectUNIX(path, false, NULL, &csock) < 0)
+        goto cleanup;
+
+    if (virNetSocketAccept(lsock, &ssock) < 0 || !ssock)
+        goto cleanup;
+
+    if (pipe(pipefd) < 0)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(src, STREAM_CHUNK) < 0 ||
+        VIR_ALLOC_N(copy, STREAM_CHUNK) < 0 ||
+        VIR_ALLOC_N(sink, STREAM_CHUNK) < 0)
+        goto cleanup;
+
+    while (sent < STREAM_TOTAL) {
+        size_t done = 0;
+        size_t i;
+
+        for (i = 0 ; i < STREAM_CHUNK ; i++)
+            src[i] = STREAM_BYTE(sent + i);
+
+        if (safewrite(pipefd[1], src, STREAM_CHUNK) != STREAM_CHUNK)
+            goto cleanup;
+        if (!*splice &&
+            saferead(pipefd[0], copy, STREAM_CHUNK) != STREAM_CHUNK)
+            goto cleanup;
+
+        while (done < STREAM_CHUNK) {
+            ssize_t got;
+
+            if (*splice)
+                got = virNetSocketSpliceFrom(ssock, pipefd[0],
+                                             STREAM_CHUNK - done);
+            else
+                got = virNetSocketWrite(ssock, copy + done,
+                                        STREAM_CHUNK - done);
+            if (got < 0)
+                goto cleanup;
+            done += got;
+
+            if (testSocketStreamDrain(csock, sink, &received) < 0)
+                goto cleanup;
+        }
+        sent += done;
+    }
+
+    while (received < sent) {
+        if (testSocketStreamDrain(csock, sink, &received) < 0)
+            goto cleanup;
+    }
+
+    if (received != STREAM_TOTAL) {
+        VIR_DEBUG("Expected %d bytes, got %zu", STREAM_TOTAL, received);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FREE(src);
+    VIR_FREE(copy);
+    VIR_FREE(sink);
+    virNetSocketFree(lsock);
+    virNetSocketFree(ssock);
+    virNetSocketFree(csock);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    if (tmpdir)
+        rmdir(tmpdir);
+    return ret;
+}
+#endif
+
+
 static int
 mymain(void)
 {
@@ -496,6 +639,17 @@ mymain(void)
     if (virtTestRun("Socket External Command /dev/does-not-exist", 1, testSocketCommandFail, NULL) < 0)
         ret = -1;
 
+# ifdef __linux__
+    bool spliceStream = false;
+    if (virtTestRun("Socket stream copied", 1,
+                    testSocketStream, &spliceStream) < 0)
+        ret = -1;
+    spliceStream = true;
+    if (virtTestRun("Socket stream spliced", 1,
+                    testSocketStream, &spliceStream) < 0)
+        ret = -1;
+# endif
+
     struct testSSHData sshData1 = {
         .nodename = "somehost",
         .path = "/tmp/socket",
@@ -735,6 +735,149 @@ cleanup:
 }
 
 
+static int testTLSSessionHandshake(virNetTLSSessionPtr serverSess,
+                                   virNetTLSSessionPtr clientSess)
+{
+    bool clientShake = false;
+    bool serverShake = false;
+
+    while (!clientShake || !serverShake) {
+        int rv;
+        if (!serverShake) {
+            rv = virNetTLSSessionHandshake(serverSess);
+            if (rv < 0)
+                return -1;
+            if (rv == VIR_NET_TLS_HANDSHAKE_COMPLETE)
+                serverShake = true;
+        }
+        if (!clientShake) {
+            rv = virNetTLSSessionHandshake(clientSess);
+            if (rv < 0)
+                return -1;
+            if (rv == VIR_NET_TLS_HANDSHAKE_COMPLETE)
+                clientShake = true;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * This tests that a client reconnecting to the same server
+ * resumes the session it had, and that a session is only
+ * resumed once both sides accepted each other: if the server
+ * rejects the client, the client offering its session again
+ * must get a full handshake and be rejected again
+ */
+static int testTLSSessionResume(const void *opaque)
+{
+    struct testTLSSessionData *data = (struct testTLSSessionData *)opaque;
+    virNetTLSContextPtr clientCtxt = NULL;
+    virNetTLSContextPtr serverCtxt = NULL;
+    virNetTLSSessionPtr clientSess = NULL;
+    virNetTLSSessionPtr serverSess = NULL;
+    int channel[2] = { -1, -1 };
+    bool resume;
+    int ret = -1;
+    int i;
+
+    testTLSGenerateCert(&data->careq);
+    data->serverreq.cacrt = data->careq.crt;
+    testTLSGenerateCert(&data->serverreq);
+    data->clientreq.cacrt = data->careq.crt;
+    testTLSGenerateCert(&data->clientreq);
+
+    serverCtxt = virNetTLSContextNewServer(data->careq.filename,
+                                           NULL,
+                                           data->serverreq.filename,
+                                           keyfile,
+                                           data->wildcards,
+                                           false,
+                                           true);
+    clientCtxt = virNetTLSContextNewClient(data->careq.filename,
+                                           NULL,
+                                           data->clientreq.filename,
+                                           keyfile,
+                                           false,
+                                           true);
+    if (!serverCtxt || !clientCtxt) {
+        VIR_WARN("Unexpected failure loading %s", data->careq.filename);
+        goto cleanup;
+    }
+
+    /* The first connection does a full handshake, the second resumes */
+    for (i = 0; i < 2; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, channel) < 0)
+            abort();
+        ignore_value(virSetNonBlock(channel[0]));
+        ignore_value(virSetNonBlock(channel[1]));
+
+        if (!(serverSess = virNetTLSSessionNew(serverCtxt, NULL)) ||
+            !(clientSess = virNetTLSSessionNew(clientCtxt, data->hostname))) {
+            VIR_WARN("Unexpected failure creating sessions");
+            goto cleanup;
+        }
+
+        virNetTLSSessionSetIOCallbacks(serverSess, testWrite, testRead, &channel[0]);
+        virNetTLSSessionSetIOCallbacks(clientSess, testWrite, testRead, &channel[1]);
+
+        if (testTLSSessionHandshake(serverSess, clientSess) < 0) {
+            VIR_WARN("Unexpected handshake failure on connection %d", i);
+            goto cleanup;
+        }
+
+        resume = i == 1 && !data->expectServerFail;
+        if (virNetTLSSessionIsResumed(serverSess) != resume ||
+            virNetTLSSessionIsResumed(clientSess) != resume) {
+            VIR_WARN("Connection %d was %sexpected to resume", i,
+                     resume ? "" : "not ");
+            goto cleanup;
+        }
+
+        if ((virNetTLSContextCheckCertificate(serverCtxt, serverSess) < 0) !=
+            data->expectServerFail) {
+            VIR_WARN("Server cert check %s on connection %d",
+                     data->expectServerFail ? "passed" : "failed", i);
+            goto cleanup;
+        }
+        virResetLastError();
+
+        if (virNetTLSContextCheckCertificate(clientCtxt, clientSess) < 0) {
+            VIR_WARN("Unexpected client cert check fail on connection %d", i);
+            goto cleanup;
+        }
+
+        virNetTLSSessionSaveResumeData(clientSess);
+
+        virNetTLSSessionFree(serverSess);
+        virNetTLSSessionFree(clientSess);
+        serverSess = clientSess = NULL;
+        VIR_FORCE_CLOSE(channel[0]);
+        VIR_FORCE_CLOSE(channel[1]);
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetTLSSessionFree(serverSess);
+    virNetTLSSessionFree(clientSess);
+    virNetTLSContextFree(serverCtxt);
+    virNetTLSContextFree(clientCtxt);
+    gnutls_x509_crt_deinit(data->careq.crt);
+    gnutls_x509_crt_deinit(data->clientreq.crt);
+    gnutls_x509_crt_deinit(data->serverreq.crt);
+    data->careq.crt = data->clientreq.crt = data->serverreq.crt = NULL;
+
+    if (getenv("VIRT_TEST_DEBUG_CERTS") == NULL) {
+        unlink(data->careq.filename);
+        unlink(data->clientreq.filename);
+        unlink(data->serverreq.filename);
+    }
+    VIR_FORCE_CLOSE(channel[0]);
+    VIR_FORCE_CLOSE(channel[1]);
+    return ret;
+}
+
 static int
 mymain(void)
 {
@@ -1180,6 +1323,18 @@ mymain(void)
     DO_SESS_TEST(cacertreq, servercertreq, clientcertreq, false, false, "libvirt.org", NULL);
     DO_SESS_TEST_EXT(cacertreq, cacert1req, servercertreq, clientcertreq, true, true, "libvirt.org", NULL);
 
+# define DO_RESUME_TEST(caReq, serverReq, clientReq, expectServerFail, hostname, wildcards) \
+    do {                                                                \
+        struct testTLSSessionData data = {                              \
+            caReq, { 0 }, serverReq, clientReq,                         \
+            expectServerFail, false, hostname, wildcards                \
+        };                                                              \
+        if (virtTestRun("TLS Session resume", 1, testTLSSessionResume, &data) < 0) \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_RESUME_TEST(cacertreq, servercertreq, clientcertreq, false, "libvirt.org", NULL);
+
     /* When an altname is set, the CN is ignored, so it must be duplicated
      * as an altname for it to match */
     static struct testTLSCertReq servercertalt1req = {
@@ -1241,6 +1396,8 @@ mymain(void)
     DO_SESS_TEST(cacertreq, servercertreq, clientcertreq, false, false, "libvirt.org", wildcards5);
     DO_SESS_TEST(cacertreq, servercertreq, clientcertreq, false, false, "libvirt.org", wildcards6);
 
+    DO_RESUME_TEST(cacertreq, servercertreq, clientcertreq, true, "libvirt.org", wildcards1);
+
     unlink(keyfile);
 
     asn1_delete_structure(&pkix_asn1);
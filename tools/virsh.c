@@ -11193,6 +11193,7 @@ static const vshCmdOptDef opts_vol_upload[] = {
     {"pool", VSH_OT_STRING, 0, N_("pool name or uuid")},
     {"offset", VSH_OT_INT, 0, N_("volume offset to upload to") },
     {"length", VSH_OT_INT, 0, N_("amount of data to upload") },
+    {"sparse", VSH_OT_BOOL, 0, N_("preserve sparseness of volume") },
     {NULL, 0, 0, NULL}
 };
 
@@ -11205,6 +11206,74 @@ cmdVolUploadSource(virStreamPtr st ATTRIBUTE_UNUSED,
     return saferead(*fd, bytes, nbytes);
 }
 
+/*
+ * Send the file behind @fd, skipping the holes in it with
+ * virStreamSendHole rather than sending their zeros.
+ */
+static int
+cmdVolUploadSparse(virStreamPtr st, int fd)
+{
+    char *bytes = NULL;
+    size_t want = 64 * 1024;
+    struct stat sb;
+    off_t cur = 0;
+    int ret = -1;
+
+    if (fstat(fd, &sb) < 0 ||
+        VIR_ALLOC_N(bytes, want) < 0)
+        goto cleanup;
+
+    while (cur < sb.st_size) {
+        off_t data = cur;
+        off_t hole = sb.st_size;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        if ((data = lseek(fd, cur, SEEK_DATA)) < 0) {
+            if (errno == ENXIO)
+                data = sb.st_size;
+            else if (errno == EINVAL)
+                data = cur;
+            else
+                goto cleanup;
+        }
+        if (data > cur &&
+            virStreamSendHole(st, data - cur, 0) < 0)
+            goto cleanup;
+        if (data < sb.st_size &&
+            (hole = lseek(fd, data, SEEK_HOLE)) < 0)
+            hole = sb.st_size;
+#endif
+        cur = data;
+        if (cur < hole &&
+            lseek(fd, cur, SEEK_SET) < 0)
+            goto cleanup;
+
+        while (cur < hole) {
+            size_t len = hole - cur < want ? hole - cur : want;
+            size_t off = 0;
+            ssize_t got;
+
+            if ((got = saferead(fd, bytes, len)) <= 0)
+                goto cleanup;
+            while (off < got) {
+                int done;
+                if ((done = virStreamSend(st, bytes + off, got - off)) < 0)
+                    goto cleanup;
+                off += done;
+            }
+            cur += got;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(bytes);
+    if (ret < 0)
+        virStreamAbort(st);
+    return ret;
+}
+
 static bool
 cmdVolUpload (vshControl *ctl, const vshCmd *cmd)
 {
@@ -11215,6 +11284,8 @@ cmdVolUpload (vshControl *ctl, const vshCmd *cmd)
     virStreamPtr st = NULL;
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
+    unsigned int flags = 0;
 
     if (!vshConnectionUsability(ctl, ctl->conn))
         goto cleanup;
@@ -11243,13 +11314,21 @@ cmdVolUpload (vshControl *ctl, const vshCmd *cmd)
         goto cleanup;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_UPLOAD_SPARSE_STREAM;
+
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolUpload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolUpload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot upload to volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
+    if (sparse) {
+        if (cmdVolUploadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot send data to volume %s"), name);
+            goto cleanup;
+        }
+    } else if (virStreamSendAll(st, cmdVolUploadSource, &fd) < 0) {
         vshError(ctl, _("cannot send data to volume %s"), name);
         goto cleanup;
     }
@@ -11293,9 +11372,58 @@ static const vshCmdOptDef opts_vol_download[] = {
     {"pool", VSH_OT_STRING, 0, N_("pool name or uuid")},
     {"offset", VSH_OT_INT, 0, N_("volume offset to download from") },
     {"length", VSH_OT_INT, 0, N_("amount of data to download") },
+    {"sparse", VSH_OT_BOOL, 0, N_("preserve sparseness of volume") },
     {NULL, 0, 0, NULL}
 };
 
+/*
+ * Receive the stream into @fd, turning the holes it reports
+ * into holes in the file rather than writing out zeros.
+ */
+static int
+cmdVolDownloadSparse(virStreamPtr st, int fd)
+{
+    char *bytes = NULL;
+    size_t want = 64 * 1024;
+    off_t cur;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(bytes, want) < 0)
+        goto cleanup;
+
+    for (;;) {
+        int got = virStreamRecvFlags(st, bytes, want,
+                                     VIR_STREAM_RECV_STOP_AT_HOLE);
+        if (got == -3) {
+            long long len;
+
+            if (virStreamRecvHole(st, &len, 0) < 0 ||
+                lseek(fd, len, SEEK_CUR) < 0)
+                goto cleanup;
+            continue;
+        }
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+        if (safewrite(fd, bytes, got) < 0)
+            goto cleanup;
+    }
+
+    /* A trailing hole only shows up in the file size */
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0 ||
+        ftruncate(fd, cur) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(bytes);
+    if (ret < 0)
+        virStreamAbort(st);
+    return ret;
+}
+
 static bool
 cmdVolDownload (vshControl *ctl, const vshCmd *cmd)
 {
@@ -11307,6 +11435,8 @@ cmdVolDownload (vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     bool created = false;
+    bool sparse = vshCommandOptBool(cmd, "sparse");
+    unsigned int flags = 0;
 
     if (!vshConnectionUsability(ctl, ctl->conn))
         return false;
@@ -11339,13 +11469,21 @@ cmdVolDownload (vshControl *ctl, const vshCmd *cmd)
         created = true;
     }
 
+    if (sparse)
+        flags |= VIR_STORAGE_VOL_DOWNLOAD_SPARSE_STREAM;
+
     st = virStreamNew(ctl->conn, 0);
-    if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
+    if (virStorageVolDownload(vol, st, offset, length, flags) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
+    if (sparse) {
+        if (cmdVolDownloadSparse(st, fd) < 0) {
+            vshError(ctl, _("cannot receive data from volume %s"), name);
+            goto cleanup;
+        }
+    } else if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
         vshError(ctl, _("cannot receive data from volume %s"), name);
         goto cleanup;
     }